@@ -14,7 +14,22 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "Leap.h"
 #include "LeapUtilGL.h"
+#include "StrokeStore.h"
+#include "StrokeRenderer.h"
+#include "StrokePalette.h"
+#include "PointableMarkers.h"
+#include "SampleRing.h"
+#include "PaintLog.h"
+#include "FrameRecording.h"
+#include "PaintPipeline.h"
+#include "GestureCommands.h"
+#include "CanvasFile.h"
+#include "StrokeExport.h"
+#include "JobSystem.h"
+#include "CanvasMirror.h"
 #include <cctype>
+#include <memory>
+#include <thread>
 #include <vector>
 
 using namespace Leap;
@@ -45,23 +60,130 @@ struct GLColor
 };
 
 
-class SampleListener : public Listener {
+static_assert( LeapPaint::GestureData::kType_Swipe == Gesture::TYPE_SWIPE && LeapPaint::GestureData::kType_Circle == Gesture::TYPE_CIRCLE &&
+               LeapPaint::GestureData::kType_ScreenTap == Gesture::TYPE_SCREEN_TAP && LeapPaint::GestureData::kType_KeyTap == Gesture::TYPE_KEY_TAP,
+               "GestureData types must match Leap::Gesture::Type" );
+static_assert( LeapPaint::GestureData::kState_Start == Gesture::STATE_START && LeapPaint::GestureData::kState_Update == Gesture::STATE_UPDATE &&
+               LeapPaint::GestureData::kState_Stop == Gesture::STATE_STOP,
+               "GestureData states must match Leap::Gesture::State" );
+
+// snapshot the parts of a Leap::Frame the app uses so live and replayed
+// frames take the same path.
+static void toFrameData( const Frame& frame, LeapPaint::FrameData& data )
+{
+    data.iId        = frame.id();
+    data.iTimestamp = frame.timestamp();
+
+    const HandList hands = frame.hands();
+    data.uiNumHands = LeapUtil::Min( static_cast<uint32_t>(hands.count()), static_cast<uint32_t>(LeapPaint::FrameData::kMaxHands) );
+
+    for ( uint32_t i = 0; i < data.uiNumHands; i++ )
+    {
+        const Hand              hand = hands[i];
+        LeapPaint::HandData&    out  = data.aHands[i];
+
+        out.iId             = hand.id();
+        out.fSphereRadius   = hand.sphereRadius();
+        out.vPalmPosition   = hand.palmPosition();
+        out.vPalmNormal     = hand.palmNormal();
+        out.vDirection      = hand.direction();
+    }
+
+    const PointableList pointables = frame.pointables();
+    data.uiNumPointables = LeapUtil::Min( static_cast<uint32_t>(pointables.count()), static_cast<uint32_t>(LeapPaint::FrameData::kMaxPointables) );
+
+    for ( uint32_t i = 0; i < data.uiNumPointables; i++ )
+    {
+        const Pointable             pointable = pointables[i];
+        LeapPaint::PointableData&   out       = data.aPointables[i];
+
+        out.iId             = pointable.id();
+        out.iHandId         = pointable.hand().isValid() ? pointable.hand().id() : -1;
+        out.uiIsTool        = pointable.isTool() ? 1 : 0;
+        out.vTipPosition    = pointable.tipPosition();
+        out.vDirection      = pointable.direction();
+    }
+
+    const GestureList gestures = frame.gestures();
+    data.uiNumGestures = LeapUtil::Min( static_cast<uint32_t>(gestures.count()), static_cast<uint32_t>(LeapPaint::FrameData::kMaxGestures) );
+
+    for ( uint32_t i = 0; i < data.uiNumGestures; i++ )
+    {
+        const Gesture               gesture = gestures[i];
+        LeapPaint::GestureData&     out     = data.aGestures[i];
+        const PointableList         gesturePointables = gesture.pointables();
+
+        out.iId             = gesture.id();
+        out.iType           = gesture.type();
+        out.iState          = gesture.state();
+        out.iPointableId    = gesturePointables.isEmpty() ? -1 : gesturePointables[0].id();
+        out.vPosition       = Vector::zero();
+        out.vDirection      = Vector::zero();
+        out.vNormal         = Vector::zero();
+        out.fProgress       = 0;
+        out.fRadius         = 0;
+        out.fSpeed          = 0;
+
+        switch ( gesture.type() )
+        {
+        case Gesture::TYPE_CIRCLE:
+          {
+            CircleGesture circle = gesture;
+            out.vPosition   = circle.center();
+            out.vNormal     = circle.normal();
+            out.fProgress   = circle.progress();
+            out.fRadius     = circle.radius();
+            out.iPointableId= circle.pointable().id();
+          }
+          break;
+        case Gesture::TYPE_SWIPE:
+          {
+            SwipeGesture swipe = gesture;
+            out.vPosition   = swipe.position();
+            out.vDirection  = swipe.direction();
+            out.fSpeed      = swipe.speed();
+          }
+          break;
+        case Gesture::TYPE_KEY_TAP:
+          {
+            KeyTapGesture tap = gesture;
+            out.vPosition   = tap.position();
+            out.vDirection  = tap.direction();
+          }
+          break;
+        case Gesture::TYPE_SCREEN_TAP:
+          {
+            ScreenTapGesture screentap = gesture;
+            out.vPosition   = screentap.position();
+            out.vDirection  = screentap.direction();
+          }
+          break;
+        default:
+          break;
+        }
+    }
+}
+
+class SampleListener : public Listener, public LeapPaint::FrameSink {
 public:
     virtual void onInit(const Controller&);
     virtual void onConnect(const Controller&);
     virtual void onDisconnect(const Controller&);
     virtual void onExit(const Controller&);
-    virtual void onFrame(const Controller&);
     virtual void onFocusGained(const Controller&);
     virtual void onFocusLost(const Controller&);
+    virtual void onFrameData(const LeapPaint::FrameData&);
+
+private:
+    LeapPaint::FrameData m_prevFrame;
 };
 
 void SampleListener::onInit(const Controller& controller) {
-    std::cout << "Initialized" << std::endl;
+    PAINT_LOG( LeapPaint::kLog_Info, 0, "Initialized" );
 }
 
 void SampleListener::onConnect(const Controller& controller) {
-    std::cout << "Connected" << std::endl;
+    PAINT_LOG( LeapPaint::kLog_Info, 0, "Connected" );
     controller.enableGesture(Gesture::TYPE_CIRCLE);
     controller.enableGesture(Gesture::TYPE_KEY_TAP);
     controller.enableGesture(Gesture::TYPE_SCREEN_TAP);
@@ -71,153 +193,283 @@ void SampleListener::onConnect(const Controller& controller) {
 
 void SampleListener::onDisconnect(const Controller& controller) {
     //Note: not dispatched when running in a debugger.
-    std::cout << "Disconnected" << std::endl;
+    PAINT_LOG( LeapPaint::kLog_Info, 0, "Disconnected" );
 }
 
 void SampleListener::onExit(const Controller& controller) {
-    std::cout << "Exited" << std::endl;
+    PAINT_LOG( LeapPaint::kLog_Info, 0, "Exited" );
 }
 
-void SampleListener::onFrame(const Controller& controller) {
-    // Get the most recent frame and report some basic information
-    const Frame frame = controller.frame();
-    std::cout << "Frame id: " << frame.id()
-    << ", timestamp: " << frame.timestamp()
-    << ", hands: " << frame.hands().count()
-    << ", fingers: " << frame.fingers().count()
-    << ", tools: " << frame.tools().count()
-    << ", gestures: " << frame.gestures().count() << std::endl;
+void SampleListener::onFrameData(const LeapPaint::FrameData& frame) {
+    // Frame diagnostics are debug level; skip them entirely unless someone is listening.
+    if ( !LeapPaint::Logger::instance().isEnabled( LeapPaint::kLog_Debug ) ) {
+        return;
+    }
+
+    // Report some basic information about the frame
+    PAINT_LOG( LeapPaint::kLog_Debug, 10, "Frame id: {}, timestamp: {}, hands: {}, pointables: {}, gestures: {}",
+               frame.iId, frame.iTimestamp, frame.uiNumHands, frame.uiNumPointables, frame.uiNumGestures );
     
-    if (!frame.hands().isEmpty()) {
+    if (frame.uiNumHands > 0) {
         // Get the first hand
-        const Hand hand = frame.hands()[0];
+        const LeapPaint::HandData& hand = frame.aHands[0];
         
-        // Check if the hand has any fingers
-        const FingerList fingers = hand.fingers();
-        if (!fingers.isEmpty()) {
-            // Calculate the hand's average finger tip position
-            Vector avgPos;
-            for (int i = 0; i < fingers.count(); ++i) {
-                avgPos += fingers[i].tipPosition();
+        // Calculate the hand's average finger tip position
+        Vector avgPos;
+        uint32_t numFingers = 0;
+        for (uint32_t i = 0; i < frame.uiNumPointables; ++i) {
+            if (frame.aPointables[i].iHandId == hand.iId && !frame.aPointables[i].uiIsTool) {
+                avgPos += frame.aPointables[i].vTipPosition;
+                numFingers++;
             }
-            avgPos /= (float)fingers.count();
-            std::cout << "Hand has " << fingers.count()
-            << " fingers, average finger tip position" << avgPos << std::endl;
+        }
+        if (numFingers > 0) {
+            avgPos /= (float)numFingers;
+            PAINT_LOG( LeapPaint::kLog_Debug, 10, "Hand has {} fingers, average finger tip position{}", numFingers, avgPos );
         }
         
         // Get the hand's sphere radius and palm position
-        std::cout << "Hand sphere radius: " << hand.sphereRadius()
-        << " mm, palm position: " << hand.palmPosition() << std::endl;
-        
-        // Get the hand's normal vector and direction
-        const Vector normal = hand.palmNormal();
-        const Vector direction = hand.direction();
+        PAINT_LOG( LeapPaint::kLog_Debug, 10, "Hand sphere radius: {} mm, palm position: {}", hand.fSphereRadius, hand.vPalmPosition );
         
         // Calculate the hand's pitch, roll, and yaw angles
-        std::cout << "Hand pitch: " << direction.pitch() * RAD_TO_DEG << " degrees, "
-        << "roll: " << normal.roll() * RAD_TO_DEG << " degrees, "
-        << "yaw: " << direction.yaw() * RAD_TO_DEG << " degrees" << std::endl;
+        PAINT_LOG( LeapPaint::kLog_Debug, 10, "Hand pitch: {} degrees, roll: {} degrees, yaw: {} degrees",
+                   hand.vDirection.pitch() * RAD_TO_DEG, hand.vPalmNormal.roll() * RAD_TO_DEG, hand.vDirection.yaw() * RAD_TO_DEG );
     }
     
     // Get gestures
-    const GestureList gestures = frame.gestures();
-    for (int g = 0; g < gestures.count(); ++g) {
-        Gesture gesture = gestures[g];
+    for (uint32_t g = 0; g < frame.uiNumGestures; ++g) {
+        const LeapPaint::GestureData& gesture = frame.aGestures[g];
         
-        switch (gesture.type()) {
+        switch (gesture.iType) {
             case Gesture::TYPE_CIRCLE:
             {
-                CircleGesture circle = gesture;
-                std::string clockwiseness;
+                const char* clockwiseness = "counterclockwise";
                 
-                if (circle.pointable().direction().angleTo(circle.normal()) <= PI/4) {
-                    clockwiseness = "clockwise";
-                } else {
-                    clockwiseness = "counterclockwise";
+                for (uint32_t i = 0; i < frame.uiNumPointables; ++i) {
+                    if (frame.aPointables[i].iId == gesture.iPointableId &&
+                        frame.aPointables[i].vDirection.angleTo(gesture.vNormal) <= PI/4) {
+                        clockwiseness = "clockwise";
+                    }
                 }
                 
                 // Calculate angle swept since last frame
                 float sweptAngle = 0;
-                if (circle.state() != Gesture::STATE_START) {
-                    CircleGesture previousUpdate = CircleGesture(controller.frame(1).gesture(circle.id()));
-                    sweptAngle = (circle.progress() - previousUpdate.progress()) * 2 * PI;
+                const LeapPaint::GestureData* previousUpdate = m_prevFrame.findGesture(gesture.iId);
+                if (gesture.iState != Gesture::STATE_START && previousUpdate != nullptr) {
+                    sweptAngle = (gesture.fProgress - previousUpdate->fProgress) * 2 * PI;
                 }
-                std::cout << "Circle id: " << gesture.id()
-                << ", state: " << gesture.state()
-                << ", progress: " << circle.progress()
-                << ", radius: " << circle.radius()
-                << ", angle " << sweptAngle * RAD_TO_DEG
-                <<  ", " << clockwiseness << std::endl;
+                PAINT_LOG( LeapPaint::kLog_Debug, 10, "Circle id: {}, state: {}, progress: {}, radius: {}, angle {}, {}",
+                           gesture.iId, gesture.iState, gesture.fProgress, gesture.fRadius, sweptAngle * RAD_TO_DEG, clockwiseness );
                 break;
             }
             case Gesture::TYPE_SWIPE:
             {
-                SwipeGesture swipe = gesture;
-                std::cout << "Swipe id: " << gesture.id()
-                << ", state: " << gesture.state()
-                << ", direction: " << swipe.direction()
-                << ", speed: " << swipe.speed() << std::endl;
+                PAINT_LOG( LeapPaint::kLog_Debug, 10, "Swipe id: {}, state: {}, direction: {}, speed: {}",
+                           gesture.iId, gesture.iState, gesture.vDirection, gesture.fSpeed );
                 break;
             }
             case Gesture::TYPE_KEY_TAP:
             {
-                KeyTapGesture tap = gesture;
-                std::cout << "Key Tap id: " << gesture.id()
-                << ", state: " << gesture.state()
-                << ", position: " << tap.position()
-                << ", direction: " << tap.direction()<< std::endl;
+                PAINT_LOG( LeapPaint::kLog_Debug, 10, "Key Tap id: {}, state: {}, position: {}, direction: {}",
+                           gesture.iId, gesture.iState, gesture.vPosition, gesture.vDirection );
                 break;
             }
             case Gesture::TYPE_SCREEN_TAP:
             {
-                ScreenTapGesture screentap = gesture;
-                std::cout << "Screen Tap id: " << gesture.id()
-                << ", state: " << gesture.state()
-                << ", position: " << screentap.position()
-                << ", direction: " << screentap.direction()<< std::endl;
+                PAINT_LOG( LeapPaint::kLog_Debug, 10, "Screen Tap id: {}, state: {}, position: {}, direction: {}",
+                           gesture.iId, gesture.iState, gesture.vPosition, gesture.vDirection );
                 break;
             }
             default:
-                std::cout << "Unknown gesture type." << std::endl;
+                PAINT_LOG( LeapPaint::kLog_Warning, 1, "Unknown gesture type." );
                 break;
         }
     }
-    
-    if (!frame.hands().isEmpty() || !gestures.isEmpty()) {
-        std::cout << std::endl;
-    }
+
+    m_prevFrame = frame;
 }
 
 void SampleListener::onFocusGained(const Controller& controller) {
-    std::cout << "Focus Gained" << std::endl;
+    PAINT_LOG( LeapPaint::kLog_Info, 0, "Focus Gained" );
 }
 
 void SampleListener::onFocusLost(const Controller& controller) {
-    std::cout << "Focus Lost" << std::endl;
+    PAINT_LOG( LeapPaint::kLog_Info, 0, "Focus Lost" );
 }
+
+//==============================================================================
+// Single place tracking frames enter the app.  Live frames from the controller
+// and replayed frames from a recording are both fanned out to the registered
+// sinks on the thread that delivers them, and optionally recorded.
+class FrameHub : public Leap::Listener,
+                 public LeapPaint::FrameSink
+{
+public:
+    void addSink( LeapPaint::FrameSink* pSink )
+    {
+        ScopedLock sinkLock(m_sinkMutex);
+        m_sinks.addIfNotAlreadyThere( pSink );
+    }
+
+    void removeSink( LeapPaint::FrameSink* pSink )
+    {
+        ScopedLock sinkLock(m_sinkMutex);
+        m_sinks.removeFirstMatchingValue( pSink );
+    }
+
+    bool startRecording( const String& strPath )
+    {
+        ScopedLock sinkLock(m_sinkMutex);
+        return m_recorder.open( strPath.toRawUTF8() );
+    }
+
+    void stopRecording()
+    {
+        ScopedLock sinkLock(m_sinkMutex);
+        m_recorder.close();
+    }
+
+    virtual void onFrame( const Leap::Controller& controller )
+    {
+        toFrameData( controller.frame(), m_frame );
+        onFrameData( m_frame );
+    }
+
+    virtual void onFrameData( const LeapPaint::FrameData& frame )
+    {
+        ScopedLock sinkLock(m_sinkMutex);
+
+        if ( m_recorder.isOpen() )
+        {
+            m_recorder.write( frame );
+
+            // bound what a crash can lose to about a second of tracking.
+            if ( (m_recorder.frameCount() & 127) == 0 )
+            {
+                m_recorder.flush();
+            }
+        }
+
+        for ( int i = 0; i < m_sinks.size(); i++ )
+        {
+            m_sinks.getUnchecked(i)->onFrameData( frame );
+        }
+    }
+
+private:
+    CriticalSection                 m_sinkMutex;
+    Array<LeapPaint::FrameSink*>    m_sinks;
+    LeapPaint::FrameWriter          m_recorder;
+    LeapPaint::FrameData            m_frame;
+};
+
+//==============================================================================
+// A block of overlay text, rasterised into a texture only when its text or
+// layout changes and drawn as a single textured quad every frame in between.
+// Render thread only, with the GL context current.
+class OverlayText
+{
+public:
+    OverlayText() : m_iWidth(0), m_iHeight(0), m_fScale(0), m_fTexS(0), m_fTexT(0) {}
+
+    void release()
+    {
+        m_texture.release();
+        m_strKey    = String();
+        m_iWidth    = 0;
+        m_iHeight   = 0;
+    }
+
+    // strKey is everything the text depends on.  paint() draws into an
+    // iWidth x iHeight area in component coordinates, fScale pixels to the
+    // unit.  returns whether the texture was redrawn.
+    template<typename Painter>
+    bool update( const String& strKey, int iWidth, int iHeight, float fScale, Painter paint )
+    {
+        if ( strKey == m_strKey && iWidth == m_iWidth && iHeight == m_iHeight && fScale == m_fScale )
+        {
+            return false;
+        }
+
+        m_strKey    = strKey;
+        m_iWidth    = iWidth;
+        m_iHeight   = iHeight;
+        m_fScale    = fScale;
+
+        if ( iWidth <= 0 || iHeight <= 0 )
+        {
+            return true;
+        }
+
+        // power of two sizes so no GL has to pad them.
+        const int iPixelsWide = nextPowerOfTwo( roundToInt( iWidth * fScale ) );
+        const int iPixelsHigh = nextPowerOfTwo( roundToInt( iHeight * fScale ) );
+
+        Image image( Image::ARGB, iPixelsWide, iPixelsHigh, true );
+
+        {
+            Graphics g( image );
+            g.addTransform( AffineTransform::scale( fScale ) );
+            paint( g );
+        }
+
+        m_texture.loadImage( image );
+
+        m_fTexS = iWidth * fScale / iPixelsWide;
+        m_fTexT = iHeight * fScale / iPixelsHigh;
+
+        return true;
+    }
+
+    // one quad with its top left at iX, iY in component coordinates.  expects
+    // a y down projection in those units and premultiplied alpha blending.
+    void draw( int iX, int iY ) const
+    {
+        if ( m_iWidth <= 0 || m_iHeight <= 0 || m_texture.getTextureID() == 0 )
+        {
+            return;
+        }
+
+        const float fLeft   = static_cast<float>(iX);
+        const float fTop    = static_cast<float>(iY);
+        const float fRight  = static_cast<float>(iX + m_iWidth);
+        const float fBottom = static_cast<float>(iY + m_iHeight);
+
+        m_texture.bind();
+
+        // JUCE uploads images bottom row first, so the top of the text is t = 1.
+        glBegin( GL_QUADS );
+        glTexCoord2f( 0,       1 );             glVertex2f( fLeft,  fTop );
+        glTexCoord2f( 0,       1 - m_fTexT );   glVertex2f( fLeft,  fBottom );
+        glTexCoord2f( m_fTexS, 1 - m_fTexT );   glVertex2f( fRight, fBottom );
+        glTexCoord2f( m_fTexS, 1 );             glVertex2f( fRight, fTop );
+        glEnd();
+    }
+
+private:
+    OpenGLTexture   m_texture;
+    String          m_strKey;
+    int             m_iWidth;
+    int             m_iHeight;
+    float           m_fScale;
+    float           m_fTexS;        ///< texture coordinates of the text's far corner
+    float           m_fTexT;
+};
+
 //==============================================================================
 class FingerVisualizerApplication  : public JUCEApplication
 {
 public:
     //==============================================================================
     
-    // Create a sample listener and controller
+    // Create a sample listener
     SampleListener listener;
-    Controller controller;
-    
-//    // Allocate point array.
-//    size_t size = 100000;
-////    std::vector<std::vector<int>> points;
-////    for(int i = 0; i < size; i++)
-////    {
-////        vector<int> row;
-////        points.push_back(row);
-////    }
     
     FingerVisualizerApplication()
     {
         // Have the sample listener receive events from the controller
-        controller.addListener(listener);
+        getController().addListener(listener);
+        getFrameHub().addSink(&listener);
     }
 
     ~FingerVisualizerApplication()
@@ -231,7 +483,23 @@ public:
     {
         // Do your application's shutdown code here..
         // Remove the sample listener when done
-        controller.removeListener(listener);
+        m_replayer.stop();
+        getController().removeListener(getFrameHub());
+        getFrameHub().stopRecording();
+        getFrameHub().removeSink(&listener);
+        getController().removeListener(listener);
+
+        // the canvas saves itself as it goes, and may log doing so, so the
+        // window goes before the logger.
+        m_pMainWindow = nullptr;
+
+        LeapPaint::Logger::instance().stop();
+
+        if ( m_pLogFile != nullptr )
+        {
+            fclose( m_pLogFile );
+            m_pLogFile = nullptr;
+        }
     }
 
     //==============================================================================
@@ -268,19 +536,122 @@ public:
         return  s_controller;
     }
 
+    static FrameHub& getFrameHub()
+    {
+        static FrameHub s_frameHub;
+
+        return  s_frameHub;
+    }
+
+    static LeapPaint::SimplifierSettings& getSimplifierSettings()
+    {
+        static LeapPaint::SimplifierSettings s_simplifierSettings;
+
+        return  s_simplifierSettings;
+    }
+
+    static LeapPaint::TipFilterSettings& getTipFilterSettings()
+    {
+        static LeapPaint::TipFilterSettings s_tipFilterSettings;
+
+        return  s_tipFilterSettings;
+    }
+
+    static LeapPaint::PenSettings& getPenSettings()
+    {
+        static LeapPaint::PenSettings s_penSettings;
+
+        return  s_penSettings;
+    }
+
+    static LeapPaint::GestureSettings& getGestureSettings()
+    {
+        static LeapPaint::GestureSettings s_gestureSettings;
+
+        return  s_gestureSettings;
+    }
+
+    /// null when --jobs 0 keeps all derived work on the render thread.
+    static std::unique_ptr<LeapPaint::JobSystem>& getJobSystem()
+    {
+        static std::unique_ptr<LeapPaint::JobSystem> s_pJobSystem;
+
+        return  s_pJobSystem;
+    }
+
+    static float& getLodPixelError()
+    {
+        static float s_fLodPixelError = 1.0f;
+
+        return  s_fLodPixelError;
+    }
+
+    static String& getCanvasPath()
+    {
+        static String s_strCanvasPath;
+
+        return  s_strCanvasPath;
+    }
+
+    static String& getExportPath()
+    {
+        static String s_strExportPath;
+
+        return  s_strExportPath;
+    }
+
+    static String& getLatencyPath()
+    {
+        static String s_strLatencyPath;
+
+        return  s_strLatencyPath;
+    }
+
+    /// where the painting is served to other processes, empty for nowhere.
+    static String& getMirrorAddress()
+    {
+        static String s_strMirrorAddress;
+
+        return  s_strMirrorAddress;
+    }
+
+    /// set when this instance only shows what another one serves.
+    static String& getMirrorFromAddress()
+    {
+        static String s_strMirrorFromAddress;
+
+        return  s_strMirrorFromAddress;
+    }
+
 private:
     ScopedPointer<FingerVisualizerWindow>  m_pMainWindow; 
+    FILE*                                  m_pLogFile = nullptr;
+    LeapPaint::FrameReplayer               m_replayer;
 };
 
 //==============================================================================
 class OpenGLCanvas  : public Component,
                       public OpenGLRenderer,
-                      Leap::Listener
+                      public LeapPaint::FrameSink
 {
 public:
     OpenGLCanvas()
-      : Component( "OpenGLCanvas" )
+      : Component( "OpenGLCanvas" ),
+        m_tipCapture( m_samples, FingerVisualizerApplication::getTipFilterSettings(), FingerVisualizerApplication::getPenSettings() ),
+        m_strokeBuilder( m_strokes, kNumColors, FingerVisualizerApplication::getSimplifierSettings() ),
+        m_gestureCommands( m_commands, FingerVisualizerApplication::getGestureSettings() )
     {
+        m_bViewing = FingerVisualizerApplication::getMirrorFromAddress().isNotEmpty();
+
+        if ( !m_bViewing )
+        {
+            openCanvas();
+        }
+
+        startMirroring();
+
+        m_tipCapture.setLatencyMonitor( &m_latency );
+
         m_openGLContext.setRenderer (this);
         m_openGLContext.setComponentPaintingEnabled (true);
         m_openGLContext.attachTo (*this);
@@ -288,8 +659,10 @@ public:
 
         m_fLastUpdateTimeSeconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
         m_fLastRenderTimeSeconds = m_fLastUpdateTimeSeconds;
+        m_fLastDirtySeconds      = m_fLastUpdateTimeSeconds;
+        m_fLastStatsSeconds      = 0;
 
-        FingerVisualizerApplication::getController().addListener( *this );
+        FingerVisualizerApplication::getFrameHub().addSink( this );
 
         initColors();
 
@@ -304,14 +677,25 @@ public:
         m_fPointableRadius = 0.05f;
 
         m_bShowHelp = false;
+        m_strokeStyle.set( StrokeRenderer::kStyle_Tubes );
 
         m_strHelp = "ESC - quit\n"
                     "h - Toggle help and frame rate display\n"
                     "p - Toggle pause\n"
+                    "t - Toggle tubes and lines\n"
+                    "e - Export strokes\n"
+                    "l - Save latency histograms\n"
+                    "z / y - Undo / redo\n"
+                    "x - Erase the stroke at the fingertip\n"
+                    "r - Recolor the stroke at the fingertip\n"
                     "Mouse Drag  - Rotate camera\n"
                     "Mouse Wheel - Zoom camera\n"
                     "Arrow Keys  - Rotate camera\n"
-                    "Space       - Reset camera";
+                    "Space       - Reset camera\n"
+                    "Key tap     - Lift / lower the pen\n"
+                    "Screen tap  - Next color\n"
+                    "Circle      - Brush size, clockwise bigger\n"
+                    "Swipe       - Left undo, right redo, down clear";
 
         //m_strPrompt = "Press 'h' for help";
         m_strPrompt = "";
@@ -320,12 +704,88 @@ public:
 
     ~OpenGLCanvas()
     {
-        FingerVisualizerApplication::getController().removeListener( *this );
+        FingerVisualizerApplication::getFrameHub().removeSink( this );
+        m_mirrorView.disconnect();
         m_openGLContext.detach();
+        m_mirror.stop();
+
+        if ( m_exportThread.joinable() )
+        {
+            m_exporter.cancel();
+            m_exportThread.join();
+        }
+
+        // the render thread is gone, so the strokes can be saved from here.
+        // a viewer's strokes belong to the instance it mirrors.
+        m_strokeBuilder.liftPen();
+
+        if ( !m_bViewing && !m_canvas.save( m_strokes ) )
+        {
+            PAINT_LOG( LeapPaint::kLog_Error, 0, "could not save the canvas, its journal is kept" );
+        }
+    }
+
+    // --mirror serves the painting to other processes as it is drawn, and
+    // --mirror-from shows what another instance serves instead of painting.
+    void startMirroring()
+    {
+        const String& strFrom   = FingerVisualizerApplication::getMirrorFromAddress();
+        const String& strTo     = FingerVisualizerApplication::getMirrorAddress();
+
+        if ( m_bViewing )
+        {
+            if ( !m_mirrorView.connect( strFrom.toStdString(), [this]() { requestRepaint(); } ) )
+            {
+                PAINT_LOG( LeapPaint::kLog_Error, 0, "could not connect to the mirror at {}", strFrom.toRawUTF8() );
+            }
+        }
+        else if ( strTo.isNotEmpty() )
+        {
+            if ( m_mirror.start( strTo.toStdString() ) )
+            {
+                // the journal feeds the mirror, whether or not it is saved.
+                m_strokeBuilder.setJournal( &m_canvas.journal() );
+                PAINT_LOG( LeapPaint::kLog_Info, 0, "mirroring the canvas at {}", strTo.toRawUTF8() );
+            }
+            else
+            {
+                PAINT_LOG( LeapPaint::kLog_Error, 0, "could not serve the mirror at {}", strTo.toRawUTF8() );
+            }
+        }
+    }
+
+    // loads the painting left by the previous session, including whatever its
+    // journal recorded after the last save.
+    void openCanvas()
+    {
+        const String& strPath = FingerVisualizerApplication::getCanvasPath();
+
+        if ( strPath.isEmpty() )
+        {
+            return;
+        }
+
+        const double fStartSeconds = Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() );
+
+        if ( m_canvas.open( strPath.toStdString(), m_strokes ) )
+        {
+            m_strokeBuilder.setJournal( &m_canvas.journal() );
+        }
+        else
+        {
+            PAINT_LOG( LeapPaint::kLog_Error, 0, "could not open the canvas journal, painting won't be saved" );
+        }
+
+        const double fMs = (Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() ) - fStartSeconds) * 1000.0;
+
+        PAINT_LOG( LeapPaint::kLog_Info, 0, "canvas {} points, {} strokes, opened in {} ms", m_strokes.pointCount(), m_strokes.strokeCount(), fMs );
     }
 
     void newOpenGLContextCreated()
     {
+        // paces frames to the display, see requestRepaint().
+        m_openGLContext.setSwapInterval( 1 );
+
         glEnable(GL_BLEND);
         glEnable(GL_TEXTURE_2D);
         glEnable(GL_CULL_FACE);
@@ -346,12 +806,24 @@ public:
         glShadeModel(GL_SMOOTH);
 
         glEnable(GL_LIGHTING);
+        // tube normals go through the scaled leap-to-world transform.
+        glEnable(GL_NORMALIZE);
 
         m_fixedFont = Font("Courier New", 24, Font::plain );
+
+        m_pStrokeRenderer = new StrokeRenderer( m_openGLContext.extensions );
+        m_pStrokeRenderer->setJobSystem( FingerVisualizerApplication::getJobSystem().get() );
+        m_pStrokeRenderer->setColors( m_avColors, kNumColors );
+        m_pPointableMarkers = new PointableMarkers( m_openGLContext.extensions, LeapPaint::FrameData::kMaxPointables );
     }
 
     void openGLContextClosing()
     {
+        m_statsText.release();
+        m_helpText.release();
+        m_promptText.release();
+        m_pStrokeRenderer = nullptr;
+        m_pPointableMarkers = nullptr;
     }
 
     bool keyPressed( const KeyPress& keyPress )
@@ -367,24 +839,28 @@ public:
       if ( iKeyCode == KeyPress::upKey )
       {
         m_camera.RotateOrbit( 0, 0, LeapUtil::kfHalfPi * -0.05f );
+        requestRepaint();
         return true;
       }
 
       if ( iKeyCode == KeyPress::downKey )
       {
         m_camera.RotateOrbit( 0, 0, LeapUtil::kfHalfPi * 0.05f );
+        requestRepaint();
         return true;
       }
 
       if ( iKeyCode == KeyPress::leftKey )
       {
         m_camera.RotateOrbit( 0, LeapUtil::kfHalfPi * -0.05f, 0 );
+        requestRepaint();
         return true;
       }
 
       if ( iKeyCode == KeyPress::rightKey )
       {
         m_camera.RotateOrbit( 0, LeapUtil::kfHalfPi * 0.05f, 0 );
+        requestRepaint();
         return true;
       }
 
@@ -392,19 +868,46 @@ public:
       {
       case ' ':
         resetCamera();
+        requestRepaint();
         break;
-      case 'C': // clear canvas
-        for(int i = 0; i < count; i++)
-        {
-            std::cout << "clear" << std::endl;
-        }
-        count = 0;
+      case 'C': // clear canvas, carried out by the render thread which owns the strokes.
+        m_clearRequested.set( 1 );
+        requestRepaint();
+        break;
+      case 'E': // started by the render thread, written in the background.
+        m_exportRequested.set( 1 );
+        requestRepaint();
+        break;
+      case 'Z': // edits are carried out by the render thread too.
+        m_undoSteps += 1;
+        requestRepaint();
+        break;
+      case 'Y':
+        m_undoSteps -= 1;
+        requestRepaint();
+        break;
+      case 'X':
+        m_pickEdit.set( kPickEdit_Erase );
+        requestRepaint();
+        break;
+      case 'R':
+        m_pickEdit.set( kPickEdit_Recolor );
+        requestRepaint();
+        break;
+      case 'L': // the histograms are lock free, so they're written from here.
+        saveLatency();
         break;
       case 'H':
         m_bShowHelp = !m_bShowHelp;
+        requestRepaint();
         break;
       case 'P':
         m_bPaused = !m_bPaused;
+        requestRepaint();
+        break;
+      case 'T': // picked up by the render thread on its next frame.
+        m_strokeStyle.set( m_strokeStyle.get() == StrokeRenderer::kStyle_Tubes ? StrokeRenderer::kStyle_Lines : StrokeRenderer::kStyle_Tubes );
+        requestRepaint();
         break;
       default:
         return false;
@@ -421,7 +924,7 @@ public:
     void mouseDrag (const MouseEvent& e)
     {
         m_camera.OnMouseMoveOrbit( LeapUtil::FromVector2( e.getPosition() ) );
-        m_openGLContext.triggerRepaint();
+        requestRepaint();
     }
 
     void mouseWheelMove ( const MouseEvent& e,
@@ -429,7 +932,7 @@ public:
     {
       (void)e;
       m_camera.OnMouseWheel( wheel.deltaY );
-      m_openGLContext.triggerRepaint();
+      requestRepaint();
     }
 
     void resized()
@@ -440,131 +943,138 @@ public:
     {
     }
 
-    
-    // BAD: Initialize points here.
-    int count = 0;
-    Leap::Vector points[1000000];
-    
-    
-    void renderOpenGL2D()
+    // the overlay is three cached text textures.  the frame rates and
+    // latencies change every frame, so they're redrawn a few times a second
+    // at most (the rate onFrameData refreshes the overlay at), the help and
+    // prompt only when they or the window change.
+    void renderOpenGL2D( const String& strUpdateFPS )
     {
-        //count += 1;
-        LeapUtilGL::GLAttribScope attribScope( GL_ENABLE_BIT );
+        const double kfStatsSeconds = 0.25;
+
+        const int   iWidth      = getWidth();
+        const int   iHeight     = getHeight();
+        const int   iMargin     = 10;
+        const int   iFontSize   = static_cast<int>(m_fixedFont.getHeight());
+        const int   iLineStep   = iFontSize + (iFontSize >> 2);
+        const int   iBaseLine   = 20;
+        const int   iStatsLines = 4 + LeapPaint::LatencyMonitor::kNumStages;
+        const int   iHelpTop    = iBaseLine + iLineStep * iStatsLines;
+        const int   iPromptTop  = iHeight - (iFontSize + iFontSize + iLineStep) - iLineStep;
+
+        if ( iWidth <= 0 || iHeight <= 0 )
+        {
+            return;
+        }
 
-        // when enabled text draws poorly.
-        glDisable(GL_CULL_FACE);
+        // text is rasterised at the viewport's resolution, which may be finer
+        // than the component's.
+        GLint aiViewport[4];
+        glGetIntegerv( GL_VIEWPORT, aiViewport );
 
-        ScopedPointer<LowLevelGraphicsContext> glRenderer (createOpenGLGraphicsContext (m_openGLContext, getWidth(), getHeight()));
+        const float fScale = aiViewport[2] / static_cast<float>(iWidth);
 
-        if (glRenderer != nullptr)
+        if ( m_bShowHelp )
         {
-            Graphics g(*glRenderer.get());
+            const double fNowSeconds = m_fLastRenderTimeSeconds;
 
-            int iMargin   = 10;
-            int iFontSize = static_cast<int>(m_fixedFont.getHeight());
-            int iLineStep = iFontSize + (iFontSize >> 2);
-            int iBaseLine = 20;
-            Font origFont = g.getCurrentFont();
-
-            const Rectangle<int>& rectBounds = getBounds();
-
-            if ( m_bShowHelp )
+            if ( fNowSeconds - m_fLastStatsSeconds >= kfStatsSeconds )
             {
-                g.setColour( Colours::seagreen );
-                g.setFont( static_cast<float>(iFontSize) );
+                m_fLastStatsSeconds = fNowSeconds;
 
-                if ( !m_bPaused )
+                // milliseconds per stage, newest sample of each frame.
+                StringArray lines;
+                lines.add( m_bPaused ? String() : strUpdateFPS );
+                lines.add( m_strRenderFPS );
+                lines.add( String() );
+                lines.add( "latency    p50    p99    max" );
+
+                for ( int i = 0; i < LeapPaint::LatencyMonitor::kNumStages; i++ )
                 {
-                  g.drawSingleLineText( m_strUpdateFPS, iMargin, iBaseLine );
+                    const LeapPaint::LatencyMonitor::Stage  eStage      = static_cast<LeapPaint::LatencyMonitor::Stage>(i);
+                    const LeapPaint::LatencyHistogram&      histogram   = m_latency.histogram( eStage );
+
+                    lines.add( String::formatted( "%-8s %6.2f %6.2f %6.2f", LeapPaint::LatencyMonitor::stageName( eStage ),
+                                                  histogram.percentile( 0.5 ) * 1.0e-6, histogram.percentile( 0.99 ) * 1.0e-6, histogram.max() * 1.0e-6 ) );
                 }
 
-                g.drawSingleLineText( m_strRenderFPS, iMargin, iBaseLine + iLineStep );
+                m_statsText.update( lines.joinIntoString( "\n" ), iWidth, iHelpTop, fScale, [&]( Graphics& g )
+                {
+                    g.setColour( Colours::seagreen );
+                    g.setFont( static_cast<float>(iFontSize) );
 
-                g.setFont( m_fixedFont );
-                g.setColour( Colours::slateblue );
+                    for ( int i = 0; i < lines.size(); i++ )
+                    {
+                        if ( i == 3 )
+                        {
+                            g.setFont( m_fixedFont );
+                        }
 
-                g.drawMultiLineText(  m_strHelp,
-                                      iMargin,
-                                      iBaseLine + iLineStep * 3,
-                                      rectBounds.getWidth() - iMargin*2 );
+                        g.drawSingleLineText( lines[i], iMargin, iBaseLine + iLineStep * i );
+                    }
+                } );
             }
 
-            g.setFont( origFont );
-            g.setFont( static_cast<float>(iFontSize) );
+            m_helpText.update( m_strHelp, iWidth, iHeight - iHelpTop, fScale, [&]( Graphics& g )
+            {
+                g.setColour( Colours::slateblue );
+                g.setFont( m_fixedFont );
+                g.drawMultiLineText( m_strHelp, iMargin, iLineStep, iWidth - iMargin*2 );
+            } );
+        }
 
+        m_promptText.update( m_strPrompt, iWidth / 4 + iMargin*2, iHeight - iPromptTop, fScale, [&]( Graphics& g )
+        {
             g.setColour( Colours::salmon );
-            g.drawMultiLineText(  m_strPrompt,
-                                  iMargin,
-                                  rectBounds.getBottom() - (iFontSize + iFontSize + iLineStep),
-                                  rectBounds.getWidth()/4 );
-            
-            // Ben modification
-            //g.drawLine(5, 5, 500, 500);
-            // Get the most recent frame and report some basic information
-            const Frame frame = FingerVisualizerApplication::getController().frame();
-            std::cout << "Frame id: " << frame.id()
-            << ", timestamp: " << frame.timestamp()
-            << ", hands: " << frame.hands().count()
-            << ", fingers: " << frame.fingers().count()
-            << ", tools: " << frame.tools().count()
-            << ", gestures: " << frame.gestures().count() << std::endl;
-            
-            if (!frame.hands().isEmpty()) {
-                // Get the first hand
-                const Hand hand = frame.hands()[0];
-                
-                // Check if the hand has any fingers
-                const FingerList fingers = hand.fingers();
-                if (!fingers.isEmpty()) {
-                    // Calculate the hand's average finger tip position
-                    Vector avgPos;
-                    for (int i = 0; i < fingers.count(); ++i) {
-                        avgPos += fingers[i].tipPosition();
-                    }
-                    avgPos /= (float)fingers.count();
-                    std::cout << "Hand has " << fingers.count()
-                    << " fingers, average finger tip position" << avgPos << std::endl;
-                }
-                
-                // Get the hand's sphere radius and palm position
-                std::cout << "Hand sphere radius: " << hand.sphereRadius()
-                << " mm, palm position: " << hand.palmPosition() << std::endl;
-                
-                // Get the hand's normal vector and direction
-                const Vector normal = hand.palmNormal();
-                const Vector direction = hand.direction();
-                
-                // Calculate the hand's pitch, roll, and yaw angles
-                std::cout << "Hand pitch: " << direction.pitch() * RAD_TO_DEG << " degrees, "
-                << "roll: " << normal.roll() * RAD_TO_DEG << " degrees, "
-                << "yaw: " << direction.yaw() * RAD_TO_DEG << " degrees" << std::endl;
-                
-                
-                // 3DPaint: If one finger is detected, record those points.
-                if(1 == fingers.count())
-                {
-                    points[count] = fingers.leftmost().tipPosition(); //bad
-                    count += 1;
-                }
-//                else if(2 == fingers.count())//needed in order to 'lift pen'
-//                {
-//                    points[count-1].x = -1; // bad.
-//                }
-                
-                
-            }
-            
+            g.setFont( static_cast<float>(iFontSize) );
+            g.drawMultiLineText( m_strPrompt, iMargin, iLineStep, iWidth/4 );
+        } );
 
+        if ( !m_bShowHelp && m_strPrompt.isEmpty() )
+        {
+            return;
+        }
+
+        LeapUtilGL::GLAttribScope attribScope( GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT | GL_TEXTURE_BIT );
+
+        glDisable(GL_LIGHTING);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_TEXTURE_2D);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+        // component coordinates, y down.
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho( 0, iWidth, iHeight, 0, -1, 1 );
+
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+
+        if ( m_bShowHelp )
+        {
+            m_statsText.draw( 0, 0 );
+            m_helpText.draw( 0, iHelpTop );
         }
+
+        m_promptText.draw( 0, iPromptTop );
+
+        glPopMatrix();
+
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+
+        glMatrixMode(GL_MODELVIEW);
     }
 
     //
     // calculations that should only be done once per leap data frame but may be drawn many times should go here.
     //   
-    void update( Leap::Frame frame )
+    bool update( const LeapPaint::FrameData& frame )
     {
-        ScopedLock sceneLock(m_renderMutex);
-
         double curSysTimeSeconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
 
         float deltaTimeSeconds = static_cast<float>(curSysTimeSeconds - m_fLastUpdateTimeSeconds);
@@ -572,7 +1082,183 @@ public:
         m_fLastUpdateTimeSeconds = curSysTimeSeconds;
         float fUpdateDT = m_avgUpdateDeltaTime.AddSample( deltaTimeSeconds );
         float fUpdateFPS = (fUpdateDT > 0) ? 1.0f/fUpdateDT : 0.0f;
-        m_strUpdateFPS = String::formatted( "UpdateFPS: %4.2f", fUpdateFPS );
+
+        {
+            ScopedLock sceneLock(m_renderMutex);
+            m_strUpdateFPS = String::formatted( "UpdateFPS: %4.2f", fUpdateFPS );
+        }
+
+        // queue gesture commands and fingertip samples for the render thread.
+        const bool bCommands = m_gestureCommands.onFrame( frame );
+
+        return m_tipCapture.onFrame( frame ) || bCommands;
+    }
+
+    // any thread.  the render thread is woken at most once per frame it
+    // draws, and with the swap interval at 1 it draws at most once per
+    // display refresh, however fast requests come in.
+    void requestRepaint()
+    {
+        if ( m_repaintPending.compareAndSetBool( 1, 0 ) )
+        {
+            m_openGLContext.triggerRepaint();
+        }
+    }
+
+    // render thread.  moves queued samples into the stroke store.
+    void ingestSamples()
+    {
+        if ( m_exportRequested.exchange( 0 ) != 0 )
+        {
+            startExport();
+        }
+
+        // a viewer only shows what the instance it mirrors paints.
+        if ( m_bViewing )
+        {
+            m_samples.drain( []( const LeapPaint::TipSample& ) {} );
+            m_commands.drain( []( const LeapPaint::PaintCommand& ) {} );
+            m_clearRequested.exchange( 0 );
+            m_mirrorView.poll( m_strokes );
+            return;
+        }
+
+        if ( m_clearRequested.exchange( 0 ) != 0 )
+        {
+            PAINT_LOG( LeapPaint::kLog_Info, 0, "clear {} strokes", m_strokes.strokeCount() - m_strokes.clearMark() );
+            m_strokeBuilder.clear();
+        }
+
+        if ( m_strokeBuilder.drain( m_samples ) > 0 )
+        {
+            m_latency.ingested( m_strokeBuilder.lastReceived(), LeapPaint::LatencyMonitor::now() );
+        }
+
+        // after the samples queued with them, so a pen lift ends strokes
+        // where the gesture was made.
+        m_strokeBuilder.drain( m_commands );
+    }
+
+    // render thread, after the frame's samples and edits.  a crash loses at
+    // most this frame's strokes and edits.  mirrors get them first.
+    void commitChanges()
+    {
+        if ( m_mirror.isRunning() )
+        {
+            // a snapshot has to agree with the journal, which has no predicted tips.
+            m_strokeBuilder.withRealTips( [this]() { m_mirror.publish( m_canvas.journal().pending(), m_strokes ); } );
+        }
+
+        m_canvas.journal().flush();
+    }
+
+    // render thread.  undo / redo, and erase or recolor whatever stroke is
+    // closest to the first fingertip.  only strokes hide and show, so none of
+    // this uploads geometry.
+    void applyEdits( const LeapPaint::FrameData& frame )
+    {
+        LeapPaint::StrokeHistory& history = m_strokeBuilder.history();
+
+        for ( int iSteps = m_undoSteps.exchange( 0 ); iSteps != 0; iSteps += (iSteps > 0) ? -1 : 1 )
+        {
+            if ( !(iSteps > 0 ? history.undo( m_strokes ) : history.redo( m_strokes )) )
+            {
+                break;
+            }
+        }
+
+        const int iPickEdit = m_pickEdit.exchange( kPickEdit_None );
+
+        if ( iPickEdit == kPickEdit_None || m_pStrokeRenderer == nullptr || frame.uiNumPointables == 0 )
+        {
+            return;
+        }
+
+        const float             kfPickDistance  = 20.0f;
+        LeapPaint::SegmentHit   hit;
+
+        if ( m_pStrokeRenderer->index().nearest( m_strokes, frame.aPointables[0].vTipPosition, kfPickDistance, hit ) )
+        {
+            if ( iPickEdit == kPickEdit_Erase )
+            {
+                history.erase( m_strokes, hit.uiStroke );
+            }
+            else
+            {
+                history.recolor( m_strokes, hit.uiStroke, (m_strokes.stroke( hit.uiStroke ).uiColorIndex + 1) % kNumColors );
+            }
+        }
+    }
+
+    // render thread.  notes where the finished strokes are and writes them
+    // out on a thread of their own, painting carries on meanwhile.
+    void startExport()
+    {
+        if ( m_exporting.get() != 0 )
+        {
+            PAINT_LOG( LeapPaint::kLog_Warning, 0, "export already in progress, {} done", m_exporter.progress() );
+            return;
+        }
+
+        if ( m_exportThread.joinable() )
+        {
+            m_exportThread.join();
+        }
+
+        const String& strPath = FingerVisualizerApplication::getExportPath();
+
+        m_exportSettings.eGeometry      = (m_strokeStyle.get() == StrokeRenderer::kStyle_Tubes) ? LeapPaint::StrokeExporter::kGeometry_Tubes
+                                                                                                : LeapPaint::StrokeExporter::kGeometry_Lines;
+        m_exportSettings.pColors        = m_avColors;
+        m_exportSettings.uiNumColors    = kNumColors;
+        m_exportSettings.pJobs          = FingerVisualizerApplication::getJobSystem().get();
+
+        if ( !LeapPaint::StrokeExporter::formatFromPath( strPath.toStdString(), m_exportSettings.eFormat ) )
+        {
+            PAINT_LOG( LeapPaint::kLog_Error, 0, "export file must end in .ply, .obj or .glb" );
+            return;
+        }
+
+        m_exporter.capture( m_strokes );
+        m_exporting.set( 1 );
+
+        m_exportThread = std::thread( [this, strPath]()
+        {
+            const double fStartSeconds = Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() );
+
+            if ( m_exporter.write( strPath.toStdString(), m_exportSettings ) )
+            {
+                const double fMs = (Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() ) - fStartSeconds) * 1000.0;
+
+                PAINT_LOG( LeapPaint::kLog_Info, 0, "exported {} points in {} ms", m_exporter.pointCount(), fMs );
+            }
+            else
+            {
+                PAINT_LOG( LeapPaint::kLog_Error, 0, "could not export strokes" );
+            }
+
+            m_exporting.set( 0 );
+        } );
+    }
+
+    // message thread.  everything recorded since startup.
+    void saveLatency()
+    {
+        FILE* pFile = fopen( FingerVisualizerApplication::getLatencyPath().toRawUTF8(), "wb" );
+
+        if ( pFile == nullptr || !m_latency.writeJson( pFile ) )
+        {
+            PAINT_LOG( LeapPaint::kLog_Error, 0, "could not save latency histograms" );
+        }
+        else
+        {
+            PAINT_LOG( LeapPaint::kLog_Info, 0, "saved latency histograms, {} frames drawn", m_latency.histogram( LeapPaint::LatencyMonitor::kStage_Total ).count() );
+        }
+
+        if ( pFile != nullptr )
+        {
+            fclose( pFile );
+        }
     }
 
     /// affects model view matrix.  needs to be inside a glPush/glPop matrix block!
@@ -627,13 +1313,27 @@ public:
     // should be handled in update and cached in members.
     void renderOpenGL()
     {
+        // the previous frame has been swapped by now.
+        m_latency.beginFrame( LeapPaint::LatencyMonitor::now() );
+
+        // whatever changes from here on needs another frame.
+        m_repaintPending.set( 0 );
+
 		    {
 			      MessageManagerLock mm (Thread::getCurrentThread());
 			      if (! mm.lockWasGained())
 				      return;
 		    }
 
-        Leap::Frame frame = m_lastFrame;
+        LeapPaint::FrameData frame;
+        String               strUpdateFPS;
+
+        // only held long enough to copy what the listener thread publishes.
+        {
+            ScopedLock frameLock(m_renderMutex);
+            frame        = m_lastFrame;
+            strUpdateFPS = m_strUpdateFPS;
+        }
 
         double  curSysTimeSeconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks());
         float   fRenderDT = static_cast<float>(curSysTimeSeconds - m_fLastRenderTimeSeconds);
@@ -649,27 +1349,47 @@ public:
         setupScene();
         
         
-        // Draw the points.
-        Leap::Vector vStartPos = m_mtxFrameTransform.transformPoint(points[0] * m_fFrameScale);
-        Leap::Vector vEndPos;
-        for(int i = 1; i < count; i++)
+        // Draw the points.  only newly recorded points are uploaded, the rest
+        // already sit in vertex buffers.
+        ingestSamples();
+
+        if ( !m_bViewing )
         {
-            vEndPos = m_mtxFrameTransform.transformPoint( points[i] * m_fFrameScale);
-            
-            //glTranslatef( vStartPos.x, vStartPos.y, vStartPos.z );
-            
+            applyEdits( frame );
+            commitChanges();
+        }
 
-            glBegin(GL_LINES);
-            
-            glVertex3f( vStartPos.x, vStartPos.y, vStartPos.z);
-            glVertex3f( vEndPos.x, vEndPos.y, vEndPos.z );
-            
-            glEnd();
-            
-            
-            
-            std::cout << "Number of points being rendered: " << count << std::endl;
-            vStartPos = vEndPos;
+        if ( m_pStrokeRenderer != nullptr )
+        {
+            m_pStrokeRenderer->setStyle( static_cast<StrokeRenderer::Style>( m_strokeStyle.get() ) );
+            m_pStrokeRenderer->update( m_strokes );
+
+            LeapUtilGL::GLMatrixScope strokeMatrixScope;
+
+            // same mapping as m_mtxFrameTransform.transformPoint( p * m_fFrameScale )
+            const GLfloat afLeapToWorld[16] =
+            {
+                m_mtxFrameTransform.xBasis.x * m_fFrameScale, m_mtxFrameTransform.xBasis.y * m_fFrameScale, m_mtxFrameTransform.xBasis.z * m_fFrameScale, 0,
+                m_mtxFrameTransform.yBasis.x * m_fFrameScale, m_mtxFrameTransform.yBasis.y * m_fFrameScale, m_mtxFrameTransform.yBasis.z * m_fFrameScale, 0,
+                m_mtxFrameTransform.zBasis.x * m_fFrameScale, m_mtxFrameTransform.zBasis.y * m_fFrameScale, m_mtxFrameTransform.zBasis.z * m_fFrameScale, 0,
+                m_mtxFrameTransform.origin.x,                 m_mtxFrameTransform.origin.y,                 m_mtxFrameTransform.origin.z,                 1
+            };
+
+            glMultMatrixf( afLeapToWorld );
+
+            // cull and pick detail levels in leap space against whatever the
+            // orbit camera sees.
+            GLfloat afProjection[16], afModelView[16];
+            GLint   aiViewport[4];
+            glGetFloatv( GL_PROJECTION_MATRIX, afProjection );
+            glGetFloatv( GL_MODELVIEW_MATRIX, afModelView );
+            glGetIntegerv( GL_VIEWPORT, aiViewport );
+
+            const LeapPaint::StrokeView view = LeapPaint::StrokeView::fromGL( afProjection, afModelView,
+                                                                              static_cast<float>(aiViewport[3]),
+                                                                              FingerVisualizerApplication::getLodPixelError() );
+
+            m_pStrokeRenderer->draw( m_strokes, &view );
         }
         
 //        // draw the grid background
@@ -706,72 +1426,80 @@ public:
         // draw fingers/tools as lines with sphere at the tip.
         drawPointables( frame );
 
-        {
-          ScopedLock renderLock(m_renderMutex);
+        // draw the text overlay
+        renderOpenGL2D( strUpdateFPS );
 
-          // draw the text overlay
-          renderOpenGL2D();
-        }
+        m_latency.submitted( LeapPaint::LatencyMonitor::now() );
     }
 
-    void drawPointables( Leap::Frame frame )
+    // every pointable in two draw calls, whatever their number.
+    void drawPointables( const LeapPaint::FrameData& frame )
     {
-        LeapUtilGL::GLAttribScope colorScope( GL_CURRENT_BIT | GL_LINE_BIT );
-
-        const Leap::PointableList& pointables = frame.pointables();
+        if ( m_pPointableMarkers == nullptr )
+        {
+            return;
+        }
 
-        const float fScale = m_fPointableRadius;
+        LeapUtilGL::GLAttribScope colorScope( GL_CURRENT_BIT );
 
-        glLineWidth( 3.0f );
+        PointableMarkers::Marker aMarkers[LeapPaint::FrameData::kMaxPointables];
 
-        for ( size_t i = 0, e = pointables.count(); i < e; i++ )
+        for ( uint32_t i = 0, e = frame.uiNumPointables; i < e; i++ )
         {
-            const Leap::Pointable&  pointable   = pointables[i];
-            Leap::Vector            vStartPos   = m_mtxFrameTransform.transformPoint( pointable.tipPosition() * m_fFrameScale );
-            Leap::Vector            vEndPos     = m_mtxFrameTransform.transformDirection( pointable.direction() ) * -0.25f;
-            const uint32_t          colorIndex  = static_cast<uint32_t>(pointable.id()) % kNumColors;
+            const LeapPaint::PointableData& pointable = frame.aPointables[i];
 
-            glColor3fv( m_avColors[colorIndex].toFloatPointer() );
-
-            {
-                LeapUtilGL::GLMatrixScope matrixScope;
+            aMarkers[i].vTip            = m_mtxFrameTransform.transformPoint( pointable.vTipPosition * m_fFrameScale );
+            aMarkers[i].vLine           = m_mtxFrameTransform.transformDirection( pointable.vDirection ) * -0.25f;
+            aMarkers[i].uiColorIndex    = m_strokeBuilder.colorIndex( pointable.iId );
+        }
 
-                glTranslatef( vStartPos.x, vStartPos.y, vStartPos.z );
+        // LeapUtilGL::drawSphere, which these replace, is of unit diameter.
+        m_pPointableMarkers->draw( aMarkers, frame.uiNumPointables, m_fPointableRadius * 0.5f, m_avColors );
+    }
 
-                glBegin(GL_LINES);
+    // called on the leap listener thread, or the replay thread.
+    // only frames that change what is drawn are published and repainted, so
+    // an idle canvas doesn't render at all.
+    virtual void onFrameData(const LeapPaint::FrameData& frame)
+    {
+        // how far the drawn fingertips may lag the tracking before a redraw,
+        // in leap millimetres and unit direction change (about a pixel either
+        // way at the default camera distance).
+        const float  kfRedrawDistance   = 0.5f;
+        const float  kfRedrawDirection  = 0.02f;
+        const double kfOverlaySeconds   = 0.25;
 
-                glVertex3f( 0, 0, 0 );
-                glVertex3fv( vEndPos.toFloatPointer() );
+        if ( !m_bPaused )
+        {
+          bool bDirty = update( frame );
 
-                glEnd();
+          // fingertips are drawn where they are expected to be by the time
+          // the frame is on screen.
+          m_predictedFrame = frame;
+          m_tipCapture.filter().predictTips( m_predictedFrame );
 
-                glScalef( fScale, fScale, fScale );
+          // the overlay's figures change all the time, refresh them a few
+          // times a second.
+          const double fNowSeconds = m_fLastUpdateTimeSeconds;
 
-                LeapUtilGL::drawSphere( LeapUtilGL::kStyle_Solid );
-            }
-        }
-    }
+          if ( m_bShowHelp && fNowSeconds - m_fLastDirtySeconds > kfOverlaySeconds )
+          {
+              bDirty = true;
+          }
 
-    virtual void onInit(const Leap::Controller&) 
-    {
-    }
+          {
+              ScopedLock frameLock(m_renderMutex);
 
-    virtual void onConnect(const Leap::Controller&) 
-    {
-    }
+              if ( !bDirty && m_lastFrame.samePointables( m_predictedFrame, kfRedrawDistance, kfRedrawDirection ) )
+              {
+                  return;
+              }
 
-    virtual void onDisconnect(const Leap::Controller&) 
-    {
-    }
+              m_lastFrame = m_predictedFrame;
+          }
 
-    virtual void onFrame(const Leap::Controller& controller)
-    {
-        if ( !m_bPaused )
-        {
-          Leap::Frame frame = controller.frame();
-          update( frame );
-          m_lastFrame = frame;
-          m_openGLContext.triggerRepaint();
+          m_fLastDirtySeconds = fNowSeconds;
+          requestRepaint();
         }
     }
 
@@ -783,47 +1511,16 @@ public:
 
     void initColors()
     {
-      float fMin      = 0.0f;
-      float fMax      = 1.0f;
-      float fNumSteps = static_cast<float>(pow( kNumColors, 1.0/3.0 ));
-      float fStepSize = (fMax - fMin)/fNumSteps;
-      float fR = fMin, fG = fMin, fB = fMin;
-
-      for ( uint32_t i = 0; i < kNumColors; i++ )
-      {
-        m_avColors[i] = Leap::Vector( fR, fG, LeapUtil::Min(fB, fMax) );
-
-        fR += fStepSize;
-
-        if ( fR > fMax )
-        {
-          fR = fMin;
-          fG += fStepSize;
-
-          if ( fG > fMax )
-          {
-            fG = fMin;
-            fB += fStepSize;
-          }
-        }
-      }
-
-      Random rng(0x13491349);
-
-      for ( uint32_t i = 0; i < kNumColors; i++ )
-      {
-        uint32_t      uiRandIdx    = i + (rng.nextInt() % (kNumColors - i));
-        Leap::Vector  vSwapTemp    = m_avColors[i];
-
-        m_avColors[i]          = m_avColors[uiRandIdx];
-        m_avColors[uiRandIdx]  = vSwapTemp;
-      }
+        LeapPaint::makePalette( m_avColors );
     }
 
 private:
+    typedef LeapPaint::StrokeRenderer<OpenGLExtensionFunctions> StrokeRenderer;
+    typedef LeapPaint::PointableMarkers<OpenGLExtensionFunctions> PointableMarkers;
+
     OpenGLContext               m_openGLContext;
     LeapUtilGL::CameraGL        m_camera;
-    Leap::Frame                 m_lastFrame;
+    LeapPaint::FrameData        m_lastFrame;
     double                      m_fLastUpdateTimeSeconds;
     double                      m_fLastRenderTimeSeconds;
     Leap::Matrix                m_mtxFrameTransform;
@@ -839,8 +1536,38 @@ private:
     CriticalSection             m_renderMutex;
     bool                        m_bShowHelp;
     bool                        m_bPaused;
-
-    enum  { kNumColors = 256 };
+    LeapPaint::StrokeStore      m_strokes;
+    Atomic<int>                 m_clearRequested;
+    Atomic<int>                 m_strokeStyle;
+    LeapPaint::SampleQueue      m_samples;
+    LeapPaint::TipCapture       m_tipCapture;
+    LeapPaint::StrokeBuilder    m_strokeBuilder;
+    LeapPaint::CommandQueue     m_commands;
+    LeapPaint::GestureCommands  m_gestureCommands;
+    LeapPaint::CanvasDocument   m_canvas;
+    LeapPaint::MirrorServer     m_mirror;
+    LeapPaint::MirrorClient     m_mirrorView;
+    bool                        m_bViewing;         ///< --mirror-from: shows another instance's painting
+    LeapPaint::StrokeExporter   m_exporter;
+    LeapPaint::StrokeExporter::Settings m_exportSettings;
+    Atomic<int>                 m_exportRequested;
+    Atomic<int>                 m_exporting;
+    std::thread                 m_exportThread;
+    Atomic<int>                 m_undoSteps;        ///< undos queued, negative for redos
+    Atomic<int>                 m_pickEdit;
+    LeapPaint::LatencyMonitor   m_latency;
+    Atomic<int>                 m_repaintPending;
+    LeapPaint::FrameData        m_predictedFrame;   ///< listener thread scratch
+    double                      m_fLastDirtySeconds;
+    double                      m_fLastStatsSeconds;
+    OverlayText                 m_statsText;
+    OverlayText                 m_helpText;
+    OverlayText                 m_promptText;
+    ScopedPointer<StrokeRenderer> m_pStrokeRenderer;
+    ScopedPointer<PointableMarkers> m_pPointableMarkers;
+
+    enum  { kNumColors = LeapPaint::kPaletteSize };
+    enum  { kPickEdit_None, kPickEdit_Erase, kPickEdit_Recolor };
     Leap::Vector            m_avColors[kNumColors];
 };
 
@@ -886,9 +1613,189 @@ public:
 
 void FingerVisualizerApplication::initialise (const String& commandLine)
 {
-    (void) commandLine;
+    // Logging: --verbose enables per frame diagnostics, --log-binary <file>
+    // writes the compact binary log instead of text on stdout.
+    StringArray args;
+    args.addTokens( commandLine, true );
+
+    if ( args.contains( "--verbose" ) )
+    {
+        LeapPaint::Logger::instance().setLevel( LeapPaint::kLog_Debug );
+    }
+
+    const int iBinaryLogArg = args.indexOf( "--log-binary" );
+
+    if ( iBinaryLogArg >= 0 && iBinaryLogArg + 1 < args.size() )
+    {
+        m_pLogFile = fopen( args[iBinaryLogArg + 1].toRawUTF8(), "wb" );
+    }
+
+    if ( m_pLogFile != nullptr )
+    {
+        LeapPaint::Logger::instance().start( m_pLogFile, LeapPaint::kLogMode_Binary );
+    }
+    else
+    {
+        LeapPaint::Logger::instance().start( stdout, LeapPaint::kLogMode_Text );
+    }
+
+    // Strokes: --tolerance <mm> sets how far simplified strokes may deviate
+    // from the raw samples, 0 keeps every sample.
+    const int iToleranceArg = args.indexOf( "--tolerance" );
+
+    if ( iToleranceArg >= 0 && iToleranceArg + 1 < args.size() )
+    {
+        getSimplifierSettings().fTolerance = jmax( 0.0f, args[iToleranceArg + 1].getFloatValue() );
+    }
+
+    // Fingertips: --filter one-euro|kalman|none picks the smoothing, and
+    // --predict-ms <ms> how far ahead the drawn tip is extrapolated, 0 for
+    // the smoothed position.
+    const int iFilterArg = args.indexOf( "--filter" );
+
+    if ( iFilterArg >= 0 && iFilterArg + 1 < args.size() )
+    {
+        const String strFilter = args[iFilterArg + 1];
+
+        if ( strFilter == "none" )
+        {
+            getTipFilterSettings().eSmoothing = LeapPaint::TipFilterSettings::kSmoothing_None;
+        }
+        else if ( strFilter == "kalman" )
+        {
+            getTipFilterSettings().eSmoothing = LeapPaint::TipFilterSettings::kSmoothing_Kalman;
+        }
+        else
+        {
+            getTipFilterSettings().eSmoothing = LeapPaint::TipFilterSettings::kSmoothing_OneEuro;
+        }
+    }
+
+    const int iPredictArg = args.indexOf( "--predict-ms" );
+
+    if ( iPredictArg >= 0 && iPredictArg + 1 < args.size() )
+    {
+        getTipFilterSettings().fLeadSeconds = jmax( 0.0f, args[iPredictArg + 1].getFloatValue() ) * 0.001f;
+    }
+
+    // Pens: --pen one-finger paints with every hand showing a single finger,
+    // --pen touch with every finger or tool pushed through the touch plane.
+    const int iPenArg = args.indexOf( "--pen" );
+
+    if ( iPenArg >= 0 && iPenArg + 1 < args.size() )
+    {
+        getPenSettings().eMode = (args[iPenArg + 1] == "touch") ? LeapPaint::PenSettings::kPen_Touch : LeapPaint::PenSettings::kPen_OneFinger;
+    }
+
+    // --no-gestures leaves circles, taps and swipes alone.
+    getGestureSettings().bEnabled = !args.contains( "--no-gestures" );
+
+    // Jobs: --jobs <n> is how many worker threads mesh, build detail levels
+    // and encode exports, 0 keeps all of it on the render thread.  by default
+    // one per core besides the render thread.
+    const int iJobsArg = args.indexOf( "--jobs" );
+    const int iNumJobs = (iJobsArg >= 0 && iJobsArg + 1 < args.size()) ? jmax( 0, args[iJobsArg + 1].getIntValue() ) : -1;
+
+    if ( iNumJobs != 0 )
+    {
+        getJobSystem().reset( new LeapPaint::JobSystem( static_cast<uint32_t>( jmax( 0, iNumJobs ) ) ) );
+    }
+
+    // --lod-pixels <px> is how far, on screen, distant strokes may be drawn
+    // from their full detail shape, 0 always draws full detail.
+    const int iLodArg = args.indexOf( "--lod-pixels" );
+
+    if ( iLodArg >= 0 && iLodArg + 1 < args.size() )
+    {
+        getLodPixelError() = jmax( 0.0f, args[iLodArg + 1].getFloatValue() );
+    }
+
+    // Canvas: --canvas <file> is where the painting is kept between sessions,
+    // by default in the user's application data folder.
+    const int iCanvasArg = args.indexOf( "--canvas" );
+
+    if ( iCanvasArg >= 0 && iCanvasArg + 1 < args.size() )
+    {
+        getCanvasPath() = File::getCurrentWorkingDirectory().getChildFile( args[iCanvasArg + 1].unquoted() ).getFullPathName();
+    }
+    else
+    {
+        const File canvasDir = File::getSpecialLocation( File::userApplicationDataDirectory ).getChildFile( "LeapPaint3D" );
+        canvasDir.createDirectory();
+        getCanvasPath() = canvasDir.getChildFile( "canvas.lpcv" ).getFullPathName();
+    }
+
+    // Export: --export <file> is where 'e' writes the strokes, as .ply, .obj
+    // or .glb by its extension, by default a glTF file in the user's documents.
+    const int iExportArg = args.indexOf( "--export" );
+
+    if ( iExportArg >= 0 && iExportArg + 1 < args.size() )
+    {
+        getExportPath() = File::getCurrentWorkingDirectory().getChildFile( args[iExportArg + 1].unquoted() ).getFullPathName();
+    }
+    else
+    {
+        getExportPath() = File::getSpecialLocation( File::userDocumentsDirectory ).getChildFile( "LeapPaint3D.glb" ).getFullPathName();
+    }
+
+    // Mirror: --mirror <address> serves the painting to viewers as it is
+    // drawn, --mirror-from <address> is such a viewer.  an address is a TCP
+    // port on 127.0.0.1 or the path of a Unix domain socket.
+    const int iMirrorArg     = args.indexOf( "--mirror" );
+    const int iMirrorFromArg = args.indexOf( "--mirror-from" );
+
+    if ( iMirrorArg >= 0 && iMirrorArg + 1 < args.size() )
+    {
+        getMirrorAddress() = args[iMirrorArg + 1].unquoted();
+    }
+
+    if ( iMirrorFromArg >= 0 && iMirrorFromArg + 1 < args.size() )
+    {
+        getMirrorFromAddress() = args[iMirrorFromArg + 1].unquoted();
+    }
+
+    // --latency <file> is where 'l' saves the latency histograms, as JSON.
+    const int iLatencyArg = args.indexOf( "--latency" );
+
+    if ( iLatencyArg >= 0 && iLatencyArg + 1 < args.size() )
+    {
+        getLatencyPath() = File::getCurrentWorkingDirectory().getChildFile( args[iLatencyArg + 1].unquoted() ).getFullPathName();
+    }
+    else
+    {
+        getLatencyPath() = File::getSpecialLocation( File::userDocumentsDirectory ).getChildFile( "LeapPaint3D-latency.json" ).getFullPathName();
+    }
+
     // Do your application's initialisation code here..
     m_pMainWindow = new FingerVisualizerWindow();
+
+    // Frames: --record <file> saves every tracking frame, --replay <file>
+    // plays a recording instead of using the device (--replay-fast: no pacing).
+    const int iRecordArg = args.indexOf( "--record" );
+
+    if ( iRecordArg >= 0 && iRecordArg + 1 < args.size() )
+    {
+        if ( !getFrameHub().startRecording( args[iRecordArg + 1] ) )
+        {
+            PAINT_LOG( LeapPaint::kLog_Error, 0, "could not open recording for writing" );
+        }
+    }
+
+    const int iReplayArg = args.indexOf( "--replay" );
+
+    if ( iReplayArg >= 0 && iReplayArg + 1 < args.size() )
+    {
+        const float fSpeed = args.contains( "--replay-fast" ) ? 0.0f : 1.0f;
+
+        if ( !m_replayer.start( args[iReplayArg + 1].toRawUTF8(), getFrameHub(), fSpeed ) )
+        {
+            PAINT_LOG( LeapPaint::kLog_Error, 0, "could not open recording for replay" );
+        }
+    }
+    else
+    {
+        getController().addListener( getFrameHub() );
+    }
 }
 
 //==============================================================================
@@ -0,0 +1,1004 @@
+/******************************************************************************\
+* LeapPaint3D canvas files.
+*
+* A canvas is saved as a snapshot whose point chunks are laid out exactly like
+* StrokeStore::Chunk, so loading maps the file copy-on-write and hands the
+* chunks to the store in place.  Only the small stroke and run tables are
+* copied; strokes painted afterwards dirty just the pages they write to.
+*
+* Every change made after a snapshot is appended to a journal as it happens
+* and pushed to the OS once per frame, so a crash loses at most the frame
+* being painted.  Opening a canvas replays the journal on top of the
+* snapshot.  Snapshots alternate between two files so the one in use is never
+* overwritten, and the journal names the snapshot it continues.
+*
+* Snapshot layout (little endian):
+*   Header, StrokeRecord[strokes], RunRecord[runs],
+*   page aligned StrokeStore::Chunk[chunks]
+* Journal layout:
+*   "LPJN" u32 version, u64 snapshot serial, then records of a u8 op and its
+*   fields (see CanvasJournal).  A truncated trailing record is ignored.
+\******************************************************************************/
+
+#if !defined(__CanvasFile_h__)
+#define __CanvasFile_h__
+
+#include "StrokeStore.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace LeapPaint {
+
+/// a whole file mapped copy-on-write: writes through the mapping stay private
+/// to the process and never reach the file.
+class MappedFile
+{
+public:
+    MappedFile() : m_pData(nullptr), m_uiSize(0)
+#if defined(_WIN32)
+      , m_hMapping(nullptr)
+#endif
+    {}
+
+    ~MappedFile() { close(); }
+
+    bool open( const char* szPath )
+    {
+        close();
+
+#if defined(_WIN32)
+        HANDLE hFile = CreateFileA( szPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+
+        if ( hFile == INVALID_HANDLE_VALUE )
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+
+        if ( GetFileSizeEx( hFile, &size ) && size.QuadPart > 0 )
+        {
+            m_hMapping = CreateFileMappingA( hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr );
+
+            if ( m_hMapping )
+            {
+                m_pData = static_cast<uint8_t*>( MapViewOfFile( m_hMapping, FILE_MAP_COPY, 0, 0, 0 ) );
+                m_uiSize = m_pData ? static_cast<size_t>(size.QuadPart) : 0;
+            }
+        }
+
+        CloseHandle( hFile );
+#else
+        const int iFile = ::open( szPath, O_RDONLY );
+
+        if ( iFile < 0 )
+        {
+            return false;
+        }
+
+        struct stat info;
+
+        if ( fstat( iFile, &info ) == 0 && info.st_size > 0 )
+        {
+            void* pData = mmap( nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, iFile, 0 );
+
+            if ( pData != MAP_FAILED )
+            {
+                m_pData     = static_cast<uint8_t*>(pData);
+                m_uiSize    = static_cast<size_t>(info.st_size);
+            }
+        }
+
+        ::close( iFile );
+#endif
+
+        if ( !m_pData )
+        {
+            close();
+        }
+
+        return m_pData != nullptr;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if ( m_pData )
+        {
+            UnmapViewOfFile( m_pData );
+        }
+
+        if ( m_hMapping )
+        {
+            CloseHandle( m_hMapping );
+            m_hMapping = nullptr;
+        }
+#else
+        if ( m_pData )
+        {
+            munmap( m_pData, m_uiSize );
+        }
+#endif
+
+        m_pData     = nullptr;
+        m_uiSize    = 0;
+    }
+
+    uint8_t*    data() const { return m_pData; }
+    size_t      size() const { return m_uiSize; }
+
+private:
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+
+private:
+    uint8_t*    m_pData;
+    size_t      m_uiSize;
+#if defined(_WIN32)
+    HANDLE      m_hMapping;
+#endif
+};
+
+/// snapshots of a whole StrokeStore.
+class CanvasFile
+{
+public:
+    enum { kVersion = 1, kChunkAlignment = 4096 };
+
+    struct Header
+    {
+        char        acMagic[4];         ///< "LPCV", written last
+        uint32_t    uiVersion;
+        uint64_t    uiSerial;           ///< bumped by every save
+        uint32_t    uiChunkPoints;
+        uint32_t    uiNumChunks;
+        uint32_t    uiNumStrokes;
+        uint32_t    uiNumRuns;
+        uint64_t    uiStrokesOffset;
+        uint64_t    uiRunsOffset;
+        uint64_t    uiChunksOffset;
+        uint64_t    uiFileSize;
+    };
+
+    /// per stroke attributes.
+    struct StrokeRecord
+    {
+        uint32_t    uiColorIndex;
+        float       fWidth;
+        int64_t     iStartTimestamp;
+        int64_t     iEndTimestamp;
+        uint32_t    uiNumPoints;
+        uint32_t    uiFirstRun;
+        uint32_t    uiLastRun;
+        float       afMin[3];
+        float       afMax[3];
+        uint32_t    uiFlags;            ///< reserved, 0
+    };
+
+    struct RunRecord
+    {
+        uint32_t    uiStroke;
+        uint32_t    uiChunk;
+        uint32_t    uiFirst;
+        uint32_t    uiCount;
+        uint32_t    uiNext;
+        uint32_t    uiFlags;            ///< kRunFlag_*
+    };
+
+    enum { kRunFlag_Joint = 1 };
+
+    static_assert( sizeof(Header) == 64 && sizeof(StrokeRecord) == 64 && sizeof(RunRecord) == 24, "canvas records must not be padded" );
+    static_assert( sizeof(StrokeStore::Chunk) == 4 + StrokeStore::kChunkPoints * 12, "chunks are mapped as they are stored" );
+
+    /// writes a complete snapshot.  the header goes in last, so a file cut
+    /// short by a crash never reads as valid.
+    static bool save( const StrokeStore& store, const char* szPath, uint64_t uiSerial )
+    {
+        FILE* pFile = fopen( szPath, "wb" );
+
+        if ( !pFile )
+        {
+            return false;
+        }
+
+        setvbuf( pFile, nullptr, _IOFBF, 1 << 16 );
+
+        // chunks emptied by a clear are left out.
+        std::vector<uint32_t> chunkMap( store.chunkCount(), static_cast<uint32_t>(StrokeStore::kInvalid) );
+        uint32_t              uiNumChunks = 0;
+
+        for ( uint32_t i = 0; i < store.chunkCount(); i++ )
+        {
+            if ( store.chunk( i ).uiCount > 0 )
+            {
+                chunkMap[i] = uiNumChunks++;
+            }
+        }
+
+        Header header;
+        memset( &header, 0, sizeof(header) );
+
+        header.uiVersion        = kVersion;
+        header.uiSerial         = uiSerial;
+        header.uiChunkPoints    = StrokeStore::kChunkPoints;
+        header.uiNumChunks      = uiNumChunks;
+        header.uiNumStrokes     = store.strokeCount();
+        header.uiNumRuns        = store.runCount();
+        header.uiStrokesOffset  = sizeof(Header);
+        header.uiRunsOffset     = header.uiStrokesOffset + uint64_t(header.uiNumStrokes) * sizeof(StrokeRecord);
+        header.uiChunksOffset   = alignUp( header.uiRunsOffset + uint64_t(header.uiNumRuns) * sizeof(RunRecord) );
+        header.uiFileSize       = header.uiChunksOffset + uint64_t(uiNumChunks) * sizeof(StrokeStore::Chunk);
+
+        bool bOk = fwrite( &header, sizeof(header), 1, pFile ) == 1;
+
+        for ( uint32_t i = 0; i < store.strokeCount() && bOk; i++ )
+        {
+            const StrokeStore::Stroke&  stroke = store.stroke( i );
+            StrokeRecord                record;
+
+            record.uiColorIndex     = stroke.uiColorIndex;
+            record.fWidth           = stroke.fWidth;
+            record.iStartTimestamp  = stroke.iStartTimestamp;
+            record.iEndTimestamp    = stroke.iEndTimestamp;
+            record.uiNumPoints      = stroke.uiNumPoints;
+            record.uiFirstRun       = stroke.uiFirstRun;
+            record.uiLastRun        = stroke.uiLastRun;
+            record.afMin[0]         = stroke.vMin.x;
+            record.afMin[1]         = stroke.vMin.y;
+            record.afMin[2]         = stroke.vMin.z;
+            record.afMax[0]         = stroke.vMax.x;
+            record.afMax[1]         = stroke.vMax.y;
+            record.afMax[2]         = stroke.vMax.z;
+            record.uiFlags          = 0;
+
+            bOk = fwrite( &record, sizeof(record), 1, pFile ) == 1;
+        }
+
+        for ( uint32_t i = 0; i < store.runCount() && bOk; i++ )
+        {
+            const StrokeStore::Run& run = store.run( i );
+            RunRecord               record;
+
+            record.uiStroke     = run.uiStroke;
+            record.uiChunk      = chunkMap[run.uiChunk];
+            record.uiFirst      = run.uiFirst;
+            record.uiCount      = run.uiCount;
+            record.uiNext       = run.uiNext;
+            record.uiFlags      = run.bJoint ? kRunFlag_Joint : 0;
+
+            bOk = fwrite( &record, sizeof(record), 1, pFile ) == 1;
+        }
+
+        const std::vector<uint8_t> padding( static_cast<size_t>(header.uiChunksOffset - (header.uiRunsOffset + uint64_t(header.uiNumRuns) * sizeof(RunRecord))), 0 );
+
+        if ( bOk && !padding.empty() )
+        {
+            bOk = fwrite( &padding[0], 1, padding.size(), pFile ) == padding.size();
+        }
+
+        for ( uint32_t i = 0; i < store.chunkCount() && bOk; i++ )
+        {
+            if ( chunkMap[i] != StrokeStore::kInvalid )
+            {
+                bOk = fwrite( &store.chunk( i ), sizeof(StrokeStore::Chunk), 1, pFile ) == 1;
+            }
+        }
+
+        if ( bOk )
+        {
+            memcpy( header.acMagic, "LPCV", 4 );
+
+            bOk = fflush( pFile ) == 0 && fseek( pFile, 0, SEEK_SET ) == 0 && fwrite( &header, sizeof(header), 1, pFile ) == 1;
+        }
+
+        bOk = (fclose( pFile ) == 0) && bOk;
+
+        return bOk;
+    }
+
+    /// the serial of a complete snapshot at szPath, or false.
+    static bool peekSerial( const char* szPath, uint64_t& uiSerial )
+    {
+        FILE* pFile = fopen( szPath, "rb" );
+
+        if ( !pFile )
+        {
+            return false;
+        }
+
+        Header header;
+        bool   bOk = fread( &header, sizeof(header), 1, pFile ) == 1 && isValid( header ) &&
+                     fseek( pFile, 0, SEEK_END ) == 0 && static_cast<uint64_t>(ftell( pFile )) == header.uiFileSize;
+
+        fclose( pFile );
+
+        uiSerial = bOk ? header.uiSerial : 0;
+
+        return bOk;
+    }
+
+    /// maps the snapshot at szPath and replaces the store's contents with it.
+    /// the store is left untouched when the file is missing or damaged.
+    static bool load( const char* szPath, StrokeStore& store, uint64_t& uiSerial )
+    {
+        std::shared_ptr<MappedFile> pFile( new MappedFile );
+
+        if ( !pFile->open( szPath ) || pFile->size() < sizeof(Header) )
+        {
+            return false;
+        }
+
+        Header header;
+        memcpy( &header, pFile->data(), sizeof(header) );
+
+        if ( !isValid( header ) || header.uiFileSize != pFile->size() ||
+             header.uiStrokesOffset + uint64_t(header.uiNumStrokes) * sizeof(StrokeRecord) > header.uiRunsOffset ||
+             header.uiRunsOffset + uint64_t(header.uiNumRuns) * sizeof(RunRecord) > header.uiChunksOffset ||
+             header.uiChunksOffset % kChunkAlignment != 0 ||
+             header.uiChunksOffset + uint64_t(header.uiNumChunks) * sizeof(StrokeStore::Chunk) > header.uiFileSize )
+        {
+            return false;
+        }
+
+        std::vector<StrokeStore::Stroke>    strokes( header.uiNumStrokes );
+        std::vector<StrokeStore::Run>       runs( header.uiNumRuns );
+        std::vector<StrokeStore::Chunk*>    chunks( header.uiNumChunks );
+        std::vector<uint32_t>               chunkEnds( header.uiNumChunks, 0 );
+
+        const StrokeRecord* pStrokes = reinterpret_cast<const StrokeRecord*>( pFile->data() + header.uiStrokesOffset );
+
+        for ( uint32_t i = 0; i < header.uiNumStrokes; i++ )
+        {
+            StrokeRecord record;
+            memcpy( &record, pStrokes + i, sizeof(record) );
+
+            if ( !isRunOrNone( record.uiFirstRun, header ) || !isRunOrNone( record.uiLastRun, header ) )
+            {
+                return false;
+            }
+
+            StrokeStore::Stroke& stroke = strokes[i];
+
+            stroke.uiColorIndex     = record.uiColorIndex;
+            stroke.fWidth           = record.fWidth;
+            stroke.iStartTimestamp  = record.iStartTimestamp;
+            stroke.iEndTimestamp    = record.iEndTimestamp;
+            stroke.uiNumPoints      = record.uiNumPoints;
+            stroke.uiFirstRun       = record.uiFirstRun;
+            stroke.uiLastRun        = record.uiLastRun;
+            stroke.vMin             = Leap::Vector( record.afMin[0], record.afMin[1], record.afMin[2] );
+            stroke.vMax             = Leap::Vector( record.afMax[0], record.afMax[1], record.afMax[2] );
+            stroke.bOpen            = false;
+            stroke.bErased          = false;
+        }
+
+        const RunRecord* pRuns = reinterpret_cast<const RunRecord*>( pFile->data() + header.uiRunsOffset );
+
+        for ( uint32_t i = 0; i < header.uiNumRuns; i++ )
+        {
+            RunRecord record;
+            memcpy( &record, pRuns + i, sizeof(record) );
+
+            if ( record.uiStroke >= header.uiNumStrokes || record.uiChunk >= header.uiNumChunks ||
+                 record.uiCount > StrokeStore::kChunkPoints || record.uiFirst > StrokeStore::kChunkPoints - record.uiCount ||
+                 !isRunOrNone( record.uiNext, header ) )
+            {
+                return false;
+            }
+
+            StrokeStore::Run& run = runs[i];
+
+            run.uiStroke    = record.uiStroke;
+            run.uiChunk     = record.uiChunk;
+            run.uiFirst     = record.uiFirst;
+            run.uiCount     = record.uiCount;
+            run.uiNext      = record.uiNext;
+            run.bJoint      = (record.uiFlags & kRunFlag_Joint) != 0;
+
+            chunkEnds[run.uiChunk] = std::max( chunkEnds[run.uiChunk], run.uiFirst + run.uiCount );
+        }
+
+        for ( uint32_t i = 0; i < header.uiNumChunks; i++ )
+        {
+            chunks[i] = reinterpret_cast<StrokeStore::Chunk*>( pFile->data() + header.uiChunksOffset + uint64_t(i) * sizeof(StrokeStore::Chunk) );
+
+            // a chunk's count must cover its runs and fit in it, or drawing
+            // and appending would run past its points.
+            uint32_t uiCount;
+            memcpy( &uiCount, &chunks[i]->uiCount, sizeof(uiCount) );
+
+            if ( uiCount > StrokeStore::kChunkPoints || uiCount < chunkEnds[i] )
+            {
+                return false;
+            }
+        }
+
+        store.adopt( strokes, runs, chunks, pFile );
+        uiSerial = header.uiSerial;
+
+        return true;
+    }
+
+private:
+    static uint64_t alignUp( uint64_t uiOffset )
+    {
+        return (uiOffset + kChunkAlignment - 1) / kChunkAlignment * kChunkAlignment;
+    }
+
+    static bool isValid( const Header& header )
+    {
+        return memcmp( header.acMagic, "LPCV", 4 ) == 0 && header.uiVersion == kVersion && header.uiChunkPoints == StrokeStore::kChunkPoints;
+    }
+
+    static bool isRunOrNone( uint32_t uiRun, const Header& header )
+    {
+        return uiRun == StrokeStore::kInvalid || uiRun < header.uiNumRuns;
+    }
+};
+
+/// append-only log of StrokeStore changes.  records are buffered and only
+/// written by flush().  not thread safe; call from the thread painting strokes.
+class CanvasJournal
+{
+public:
+    enum { kVersion = 1 };
+
+    /// record ops and their fields after the u8 op.
+    enum Op
+    {
+        kOp_BeginStroke = 1,    ///< u32 stroke, u32 color, f32 width, i64 timestamp
+        kOp_AppendPoint,        ///< u32 stroke, f32 x y z, i64 timestamp
+        kOp_MoveLastPoint,      ///< u32 stroke, f32 x y z, i64 timestamp
+        kOp_EndStroke,          ///< u32 stroke
+        kOp_Clear,
+        kOp_SetErased,          ///< u32 stroke, u8 erased
+        kOp_SetClearMark,       ///< u32 mark
+        kOp_SetColor            ///< u32 stroke, u32 color
+    };
+
+    /// one record, read back.  fields its op doesn't have are left alone.
+    struct Record
+    {
+        Op              eOp;
+        uint32_t        uiStroke;
+        uint32_t        uiColorIndex;
+        uint32_t        uiMark;
+        float           fWidth;
+        Leap::Vector    vPoint;
+        int64_t         iTimestamp;
+        bool            bErased;
+    };
+
+    CanvasJournal() : m_pFile(nullptr) {}
+    ~CanvasJournal() { close(); }
+
+    /// replays the records following snapshot uiSerial into store and keeps
+    /// appending to them.  a journal written after another snapshot is
+    /// already part of the store and is started over.  returns false when the
+    /// journal can't be written.
+    bool open( const char* szPath, uint64_t uiSerial, StrokeStore& store )
+    {
+        close();
+
+        std::vector<uint8_t> records;
+        readRecords( szPath, uiSerial, records );
+
+        const size_t uiValid = replay( records, store );
+        records.resize( uiValid );
+
+        // a stroke interrupted by a crash ends where its journal did.
+        for ( uint32_t i = 0; i < store.strokeCount(); i++ )
+        {
+            if ( store.stroke( i ).bOpen )
+            {
+                store.endStroke( i );
+                putOp( records, kOp_EndStroke );
+                put( records, i );
+            }
+        }
+
+        // rewritten so a torn trailing record never sits between old and new ones.
+        if ( !start( szPath, uiSerial ) )
+        {
+            return false;
+        }
+
+        m_buffer.swap( records );
+        flush();
+
+        return true;
+    }
+
+    /// starts an empty journal following snapshot uiSerial.
+    bool restart( uint64_t uiSerial )
+    {
+        const std::string strPath = m_strPath;
+        close();
+        return start( strPath.c_str(), uiSerial );
+    }
+
+    void close()
+    {
+        if ( m_pFile )
+        {
+            flush();
+            fclose( m_pFile );
+            m_pFile = nullptr;
+        }
+
+        m_buffer.clear();
+    }
+
+    bool isOpen() const { return m_pFile != nullptr; }
+
+    void beginStroke( StrokeStore::StrokeId id, uint32_t uiColorIndex, float fWidth, int64_t iTimestamp )
+    {
+        putOp( m_buffer, kOp_BeginStroke );
+        put( m_buffer, id );
+        put( m_buffer, uiColorIndex );
+        put( m_buffer, fWidth );
+        put( m_buffer, iTimestamp );
+    }
+
+    void appendPoint( StrokeStore::StrokeId id, const Leap::Vector& vPoint, int64_t iTimestamp )
+    {
+        putPoint( kOp_AppendPoint, id, vPoint, iTimestamp );
+    }
+
+    void moveLastPoint( StrokeStore::StrokeId id, const Leap::Vector& vPoint, int64_t iTimestamp )
+    {
+        putPoint( kOp_MoveLastPoint, id, vPoint, iTimestamp );
+    }
+
+    void endStroke( StrokeStore::StrokeId id )
+    {
+        putOp( m_buffer, kOp_EndStroke );
+        put( m_buffer, id );
+    }
+
+    void clear()
+    {
+        putOp( m_buffer, kOp_Clear );
+    }
+
+    void setErased( StrokeStore::StrokeId id, bool bErased )
+    {
+        putOp( m_buffer, kOp_SetErased );
+        put( m_buffer, id );
+        put( m_buffer, static_cast<uint8_t>( bErased ? 1 : 0 ) );
+    }
+
+    void setClearMark( uint32_t uiMark )
+    {
+        putOp( m_buffer, kOp_SetClearMark );
+        put( m_buffer, uiMark );
+    }
+
+    void setColor( StrokeStore::StrokeId id, uint32_t uiColorIndex )
+    {
+        putOp( m_buffer, kOp_SetColor );
+        put( m_buffer, id );
+        put( m_buffer, uiColorIndex );
+    }
+
+    /// records buffered since the last flush().
+    const std::vector<uint8_t>& pending() const { return m_buffer; }
+
+    /// hands buffered records to the OS, which keeps them across a crash of
+    /// the app.  cheap enough to call every frame.
+    void flush()
+    {
+        if ( m_pFile && !m_buffer.empty() )
+        {
+            fwrite( &m_buffer[0], 1, m_buffer.size(), m_pFile );
+            fflush( m_pFile );
+        }
+
+        m_buffer.clear();
+    }
+
+    /// applies journal records to store.  stops at the first truncated or
+    /// inconsistent record and returns the number of bytes applied.
+    static size_t replay( const std::vector<uint8_t>& records, StrokeStore& store )
+    {
+        size_t uiPos = 0;
+        Record record;
+
+        while ( uiPos < records.size() )
+        {
+            size_t uiNext = uiPos;
+
+            if ( !read( &records[0], records.size(), uiNext, record ) || !apply( record, store ) )
+            {
+                return uiPos;
+            }
+
+            uiPos = uiNext;
+        }
+
+        return uiPos;
+    }
+
+    /// reads the record at uiNext and moves past it.  false if it is cut
+    /// short or its op is unknown.
+    static bool read( const uint8_t* pData, size_t uiSize, size_t& uiNext, Record& record )
+    {
+        if ( uiNext >= uiSize )
+        {
+            return false;
+        }
+
+        record.eOp = static_cast<Op>( pData[uiNext++] );
+
+        switch ( record.eOp )
+        {
+        case kOp_BeginStroke:
+            return get( pData, uiSize, uiNext, record.uiStroke ) && get( pData, uiSize, uiNext, record.uiColorIndex ) &&
+                   get( pData, uiSize, uiNext, record.fWidth ) && get( pData, uiSize, uiNext, record.iTimestamp );
+
+        case kOp_AppendPoint:
+        case kOp_MoveLastPoint:
+            return get( pData, uiSize, uiNext, record.uiStroke ) && get( pData, uiSize, uiNext, record.vPoint.x ) &&
+                   get( pData, uiSize, uiNext, record.vPoint.y ) && get( pData, uiSize, uiNext, record.vPoint.z ) &&
+                   get( pData, uiSize, uiNext, record.iTimestamp );
+
+        case kOp_EndStroke:
+            return get( pData, uiSize, uiNext, record.uiStroke );
+
+        case kOp_Clear:
+            return true;
+
+        case kOp_SetErased:
+            {
+                uint8_t uiErased = 0;
+
+                if ( !get( pData, uiSize, uiNext, record.uiStroke ) || !get( pData, uiSize, uiNext, uiErased ) )
+                {
+                    return false;
+                }
+
+                record.bErased = (uiErased != 0);
+            }
+            return true;
+
+        case kOp_SetClearMark:
+            return get( pData, uiSize, uiNext, record.uiMark );
+
+        case kOp_SetColor:
+            return get( pData, uiSize, uiNext, record.uiStroke ) && get( pData, uiSize, uiNext, record.uiColorIndex );
+
+        default:
+            return false;
+        }
+    }
+
+    /// makes the change record describes to store.  false, with store left
+    /// alone, if it doesn't fit what store holds.
+    static bool apply( const Record& record, StrokeStore& store )
+    {
+        switch ( record.eOp )
+        {
+        case kOp_BeginStroke:
+            if ( record.uiStroke != store.strokeCount() )
+            {
+                return false;
+            }
+
+            store.beginStroke( record.uiColorIndex, record.fWidth, record.iTimestamp );
+            return true;
+
+        case kOp_AppendPoint:
+        case kOp_MoveLastPoint:
+            if ( record.uiStroke >= store.strokeCount() || !store.stroke( record.uiStroke ).bOpen )
+            {
+                return false;
+            }
+
+            if ( record.eOp == kOp_AppendPoint )
+            {
+                store.appendPoint( record.uiStroke, record.vPoint, record.iTimestamp );
+            }
+            else if ( store.stroke( record.uiStroke ).uiNumPoints > 0 )
+            {
+                store.moveLastPoint( record.uiStroke, record.vPoint, record.iTimestamp );
+            }
+            else
+            {
+                return false;
+            }
+            return true;
+
+        case kOp_EndStroke:
+            if ( record.uiStroke >= store.strokeCount() )
+            {
+                return false;
+            }
+
+            store.endStroke( record.uiStroke );
+            return true;
+
+        case kOp_Clear:
+            store.clear();
+            return true;
+
+        case kOp_SetErased:
+            if ( record.uiStroke >= store.strokeCount() )
+            {
+                return false;
+            }
+
+            store.setErased( record.uiStroke, record.bErased );
+            return true;
+
+        case kOp_SetClearMark:
+            if ( record.uiMark > store.strokeCount() )
+            {
+                return false;
+            }
+
+            store.setClearMark( record.uiMark );
+            return true;
+
+        case kOp_SetColor:
+            if ( record.uiStroke >= store.strokeCount() )
+            {
+                return false;
+            }
+
+            store.setColor( record.uiStroke, record.uiColorIndex );
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    /// the records of the journal at szPath if it follows snapshot uiSerial.
+    static void readRecords( const char* szPath, uint64_t uiSerial, std::vector<uint8_t>& records )
+    {
+        FILE* pFile = fopen( szPath, "rb" );
+
+        if ( !pFile )
+        {
+            return;
+        }
+
+        char        acMagic[4];
+        uint32_t    uiVersion       = 0;
+        uint64_t    uiFileSerial    = 0;
+
+        if ( fread( acMagic, 1, 4, pFile ) == 4 && memcmp( acMagic, "LPJN", 4 ) == 0 &&
+             fread( &uiVersion, sizeof(uiVersion), 1, pFile ) == 1 && uiVersion == kVersion &&
+             fread( &uiFileSerial, sizeof(uiFileSerial), 1, pFile ) == 1 && uiFileSerial == uiSerial )
+        {
+            uint8_t acBlock[1 << 16];
+            size_t  uiRead;
+
+            while ( (uiRead = fread( acBlock, 1, sizeof(acBlock), pFile )) > 0 )
+            {
+                records.insert( records.end(), acBlock, acBlock + uiRead );
+            }
+        }
+
+        fclose( pFile );
+    }
+
+private:
+    CanvasJournal( const CanvasJournal& );
+    CanvasJournal& operator=( const CanvasJournal& );
+
+    bool start( const char* szPath, uint64_t uiSerial )
+    {
+        m_strPath   = szPath;
+        m_pFile     = fopen( szPath, "wb" );
+
+        if ( !m_pFile )
+        {
+            return false;
+        }
+
+        const uint32_t uiVersion = kVersion;
+        fwrite( "LPJN", 1, 4, m_pFile );
+        fwrite( &uiVersion, sizeof(uiVersion), 1, m_pFile );
+        fwrite( &uiSerial, sizeof(uiSerial), 1, m_pFile );
+        fflush( m_pFile );
+
+        return true;
+    }
+
+    static void putOp( std::vector<uint8_t>& buffer, Op op )
+    {
+        buffer.push_back( static_cast<uint8_t>(op) );
+    }
+
+    void putPoint( Op op, StrokeStore::StrokeId id, const Leap::Vector& vPoint, int64_t iTimestamp )
+    {
+        putOp( m_buffer, op );
+        put( m_buffer, id );
+        put( m_buffer, vPoint.x );
+        put( m_buffer, vPoint.y );
+        put( m_buffer, vPoint.z );
+        put( m_buffer, iTimestamp );
+    }
+
+    template<typename T>
+    static void put( std::vector<uint8_t>& buffer, const T& value )
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(&value);
+        buffer.insert( buffer.end(), pBytes, pBytes + sizeof(T) );
+    }
+
+    template<typename T>
+    static bool get( const uint8_t* pData, size_t uiSize, size_t& uiPos, T& value )
+    {
+        if ( uiPos + sizeof(T) > uiSize )
+        {
+            return false;
+        }
+
+        memcpy( &value, pData + uiPos, sizeof(T) );
+        uiPos += sizeof(T);
+
+        return true;
+    }
+
+private:
+    FILE*                   m_pFile;
+    std::string             m_strPath;
+    std::vector<uint8_t>    m_buffer;
+};
+
+/// a canvas on disk: two alternating snapshot slots, <path> and <path>.1,
+/// plus the journal <path>.journal.
+class CanvasDocument
+{
+public:
+    CanvasDocument() : m_uiSerial(0), m_iSlot(-1) {}
+
+    /// loads the newest snapshot, replays the journal and starts journaling.
+    /// a missing canvas starts out empty.  false when the journal can't be
+    /// written, in which case nothing is persisted.
+    bool open( const std::string& strPath, StrokeStore& store )
+    {
+        m_strPath   = strPath;
+        m_uiSerial  = loadNewest( strPath, store, m_iSlot );
+
+        return m_journal.open( journalPath( strPath ).c_str(), m_uiSerial, store );
+    }
+
+    /// loads a canvas the way open() does but leaves its files alone, e.g. to
+    /// export it from another process.  false when there is nothing to load.
+    static bool read( const std::string& strPath, StrokeStore& store )
+    {
+        int                     iSlot       = -1;
+        const uint64_t          uiSerial    = loadNewest( strPath, store, iSlot );
+        std::vector<uint8_t>    records;
+
+        CanvasJournal::readRecords( journalPath( strPath ).c_str(), uiSerial, records );
+        CanvasJournal::replay( records, store );
+
+        for ( uint32_t i = 0; i < store.strokeCount(); i++ )
+        {
+            store.endStroke( i );
+        }
+
+        return iSlot >= 0 || !records.empty();
+    }
+
+    /// everything painting into the store reports its changes here.
+    CanvasJournal& journal() { return m_journal; }
+
+    /// writes a snapshot into the slot not in use and switches the store over
+    /// to it, then starts the journal over.  until the new snapshot is
+    /// complete the old one and the journal stay authoritative.  no stroke may
+    /// be open, i.e. lift the pen first.  hidden strokes are left out, which
+    /// renumbers the ones after them.
+    bool save( StrokeStore& store )
+    {
+        if ( m_strPath.empty() || store.openStrokeCount() > 0 )
+        {
+            return false;
+        }
+
+        m_journal.flush();
+
+        const int       iSlot       = (m_iSlot == 0) ? 1 : 0;
+        const uint64_t  uiSerial    = m_uiSerial + 1;
+
+        StrokeStore visible;
+
+        if ( store.hasHiddenStrokes() )
+        {
+            visible.copyVisible( store );
+        }
+
+        if ( !CanvasFile::save( store.hasHiddenStrokes() ? visible : store, slotPath( m_strPath, iSlot ).c_str(), uiSerial ) )
+        {
+            return false;
+        }
+
+        // the store must not keep using the slot the next save will overwrite.
+        uint64_t uiLoaded = 0;
+
+        if ( CanvasFile::load( slotPath( m_strPath, iSlot ).c_str(), store, uiLoaded ) )
+        {
+            m_iSlot = iSlot;
+        }
+        else if ( store.hasHiddenStrokes() )
+        {
+            // the journal will follow the snapshot's numbering.
+            store = std::move( visible );
+        }
+
+        m_uiSerial = uiSerial;
+
+        return m_journal.restart( uiSerial );
+    }
+
+    uint64_t serial() const { return m_uiSerial; }
+
+private:
+    static std::string slotPath( const std::string& strPath, int iSlot )   { return iSlot == 0 ? strPath : strPath + ".1"; }
+    static std::string journalPath( const std::string& strPath )           { return strPath + ".journal"; }
+
+    /// maps the newest complete snapshot, or the other one if that fails.
+    /// returns its serial, 0 with iSlot -1 when there is none.
+    static uint64_t loadNewest( const std::string& strPath, StrokeStore& store, int& iSlot )
+    {
+        uint64_t auiSerials[2];
+        bool     abValid[2];
+
+        for ( int i = 0; i < 2; i++ )
+        {
+            abValid[i] = CanvasFile::peekSerial( slotPath( strPath, i ).c_str(), auiSerials[i] );
+        }
+
+        // newest first, the other one if that doesn't map.
+        const int iNewest = (abValid[1] && (!abValid[0] || auiSerials[1] > auiSerials[0])) ? 1 : 0;
+
+        uint64_t uiSerial = 0;
+        iSlot = -1;
+
+        for ( int i = 0; i < 2 && iSlot < 0; i++ )
+        {
+            const int iCandidate = (i == 0) ? iNewest : 1 - iNewest;
+
+            if ( abValid[iCandidate] && CanvasFile::load( slotPath( strPath, iCandidate ).c_str(), store, uiSerial ) )
+            {
+                iSlot = iCandidate;
+            }
+        }
+
+        return uiSerial;
+    }
+
+private:
+    std::string     m_strPath;
+    CanvasJournal   m_journal;
+    uint64_t        m_uiSerial;
+    int             m_iSlot;
+};
+
+} // namespace LeapPaint
+
+#endif // __CanvasFile_h__
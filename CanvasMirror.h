@@ -0,0 +1,1273 @@
+/******************************************************************************\
+* LeapPaint3D live canvas mirroring.
+*
+* MirrorServer streams the painting to other processes while it is drawn, over
+* a TCP port on the loopback interface or a Unix domain socket.  Once a frame
+* the render thread hands it what CanvasJournal buffered for that frame, and
+* those records go out as one message, re-encoded by MirrorCodec:
+*
+*   stroke      varint, counted back from the newest stroke
+*   position    zigzag varint micrometre deltas to the stroke's last point
+*   time        zigzag varint delta to the stroke's last timestamp
+*
+* A painted point takes about 11 bytes instead of the journal's 25.  A client
+* connecting later first gets a snapshot of the whole painting, then the same
+* deltas as everyone else.  Sockets are only touched by the server's own
+* thread; the render thread encodes and queues, and the thread capturing
+* tracking frames isn't involved at all.
+*
+* MirrorClient is the other end.  It reads on a thread of its own and applies
+* what arrived to a StrokeStore whenever it is polled, with the same checks
+* journal replay makes.
+\******************************************************************************/
+
+#if !defined(__CanvasMirror_h__)
+#define __CanvasMirror_h__
+
+#include "CanvasFile.h"
+#include "StrokeStore.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace LeapPaint {
+
+/// the few socket calls mirroring makes, over BSD sockets or Winsock.  an
+/// address made only of digits is a TCP port on 127.0.0.1, anything else the
+/// path of a Unix domain socket.
+class MirrorSocket
+{
+public:
+#if defined(_WIN32)
+    typedef SOCKET Handle;
+#else
+    typedef int Handle;
+#endif
+
+    static Handle invalid()
+    {
+#if defined(_WIN32)
+        return INVALID_SOCKET;
+#else
+        return -1;
+#endif
+    }
+
+    /// a non-blocking listening socket, or invalid().  a Unix socket left
+    /// behind by a previous run is replaced.
+    static Handle listen( const std::string& strAddress )
+    {
+        if ( !startup() )
+        {
+            return invalid();
+        }
+
+        Handle h = invalid();
+
+        if ( isPort( strAddress ) )
+        {
+            const sockaddr_in addr = loopback( strAddress );
+            const int         iOn  = 1;
+
+            h = socket( AF_INET, SOCK_STREAM, 0 );
+
+            if ( h != invalid() )
+            {
+                setsockopt( h, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&iOn), sizeof(iOn) );
+            }
+
+            if ( h != invalid() && ::bind( h, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr) ) != 0 )
+            {
+                close( h );
+            }
+        }
+#if !defined(_WIN32)
+        else
+        {
+            sockaddr_un addr;
+
+            if ( !unixAddress( strAddress, addr ) )
+            {
+                return invalid();
+            }
+
+            removeSocketFile( strAddress );
+
+            h = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+            if ( h != invalid() && ::bind( h, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr) ) != 0 )
+            {
+                close( h );
+            }
+        }
+#endif
+
+        if ( h != invalid() && (::listen( h, 4 ) != 0 || !setNonBlocking( h )) )
+        {
+            close( h );
+        }
+
+        return h;
+    }
+
+    /// closes a socket from listen() and removes its file, if it has one.
+    static void stopListening( Handle& h, const std::string& strAddress )
+    {
+        close( h );
+
+#if !defined(_WIN32)
+        if ( !isPort( strAddress ) )
+        {
+            removeSocketFile( strAddress );
+        }
+#else
+        (void)strAddress;
+#endif
+    }
+
+    /// a blocking connection to a listening socket, or invalid().
+    static Handle connect( const std::string& strAddress )
+    {
+        if ( !startup() )
+        {
+            return invalid();
+        }
+
+        Handle h = invalid();
+
+        if ( isPort( strAddress ) )
+        {
+            const sockaddr_in addr = loopback( strAddress );
+
+            h = socket( AF_INET, SOCK_STREAM, 0 );
+
+            if ( h != invalid() && ::connect( h, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr) ) != 0 )
+            {
+                close( h );
+            }
+        }
+#if !defined(_WIN32)
+        else
+        {
+            sockaddr_un addr;
+
+            if ( !unixAddress( strAddress, addr ) )
+            {
+                return invalid();
+            }
+
+            h = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+            if ( h != invalid() && ::connect( h, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr) ) != 0 )
+            {
+                close( h );
+            }
+        }
+#endif
+
+        return h;
+    }
+
+    /// the next connection waiting on a listening socket, non-blocking and
+    /// without Nagle's delay, or invalid() if there is none.
+    static Handle accept( Handle hListener )
+    {
+        Handle h = ::accept( hListener, nullptr, nullptr );
+
+        if ( h == invalid() )
+        {
+            return h;
+        }
+
+        const int iOn = 1;
+        setsockopt( h, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&iOn), sizeof(iOn) );
+
+#if defined(SO_NOSIGPIPE)
+        setsockopt( h, SOL_SOCKET, SO_NOSIGPIPE, &iOn, sizeof(iOn) );
+#endif
+
+        if ( !setNonBlocking( h ) )
+        {
+            close( h );
+        }
+
+        return h;
+    }
+
+    /// bytes written, 0 if the socket can't take any right now, -1 once the
+    /// connection is gone.
+    static long send( Handle h, const uint8_t* pData, size_t uiSize )
+    {
+#if defined(_WIN32)
+        const int iSent = ::send( h, reinterpret_cast<const char*>(pData), static_cast<int>( std::min<size_t>( uiSize, 1 << 30 ) ), 0 );
+
+        return (iSent >= 0) ? iSent : (WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1);
+#else
+#if defined(MSG_NOSIGNAL)
+        const int iFlags = MSG_NOSIGNAL;
+#else
+        const int iFlags = 0;
+#endif
+        const ssize_t iSent = ::send( h, pData, uiSize, iFlags );
+
+        return (iSent >= 0) ? static_cast<long>(iSent) : ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1);
+#endif
+    }
+
+    /// blocks until something arrives.  bytes read, 0 or less once the
+    /// connection is gone or shut down.
+    static long receive( Handle h, uint8_t* pData, size_t uiSize )
+    {
+#if defined(_WIN32)
+        return ::recv( h, reinterpret_cast<char*>(pData), static_cast<int>(uiSize), 0 );
+#else
+        ssize_t iRead;
+
+        do
+        {
+            iRead = ::recv( h, pData, uiSize, 0 );
+        }
+        while ( iRead < 0 && errno == EINTR );
+
+        return static_cast<long>(iRead);
+#endif
+    }
+
+    /// waits up to uiMs for any of the sockets to take more bytes.
+    static void waitWritable( const std::vector<Handle>& handles, uint32_t uiMs )
+    {
+        fd_set  writable;
+        Handle  hMax = 0;
+
+        FD_ZERO( &writable );
+
+        for ( size_t i = 0; i < handles.size(); i++ )
+        {
+            FD_SET( handles[i], &writable );
+            hMax = std::max( hMax, handles[i] );
+        }
+
+        timeval timeout;
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = static_cast<long>(uiMs) * 1000;
+
+        select( static_cast<int>(hMax) + 1, nullptr, &writable, nullptr, &timeout );
+    }
+
+    /// wakes a thread blocked in receive() on h.
+    static void shutdown( Handle h )
+    {
+        if ( h != invalid() )
+        {
+#if defined(_WIN32)
+            ::shutdown( h, SD_BOTH );
+#else
+            ::shutdown( h, SHUT_RDWR );
+#endif
+        }
+    }
+
+    static void close( Handle& h )
+    {
+        if ( h != invalid() )
+        {
+#if defined(_WIN32)
+            closesocket( h );
+#else
+            ::close( h );
+#endif
+            h = invalid();
+        }
+    }
+
+private:
+    static bool startup()
+    {
+#if defined(_WIN32)
+        static const bool s_bStarted = []()
+        {
+            WSADATA data;
+            return WSAStartup( MAKEWORD(2, 2), &data ) == 0;
+        }();
+
+        return s_bStarted;
+#else
+        return true;
+#endif
+    }
+
+    static bool isPort( const std::string& strAddress )
+    {
+        return !strAddress.empty() && strAddress.size() <= 5 && strAddress.find_first_not_of( "0123456789" ) == std::string::npos;
+    }
+
+    static sockaddr_in loopback( const std::string& strPort )
+    {
+        sockaddr_in addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons( static_cast<uint16_t>( atoi( strPort.c_str() ) ) );
+        addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+        return addr;
+    }
+
+    static bool setNonBlocking( Handle h )
+    {
+#if defined(_WIN32)
+        u_long uiOn = 1;
+        return ioctlsocket( h, FIONBIO, &uiOn ) == 0;
+#else
+        const int iFlags = fcntl( h, F_GETFL, 0 );
+        return iFlags >= 0 && fcntl( h, F_SETFL, iFlags | O_NONBLOCK ) == 0;
+#endif
+    }
+
+#if !defined(_WIN32)
+    static bool unixAddress( const std::string& strPath, sockaddr_un& addr )
+    {
+        memset( &addr, 0, sizeof(addr) );
+        addr.sun_family = AF_UNIX;
+
+        if ( strPath.size() >= sizeof(addr.sun_path) )
+        {
+            return false;
+        }
+
+        memcpy( addr.sun_path, strPath.c_str(), strPath.size() );
+
+        return true;
+    }
+
+    /// only ever a socket, never a file that happens to be there.
+    static void removeSocketFile( const std::string& strPath )
+    {
+        struct stat info;
+
+        if ( lstat( strPath.c_str(), &info ) == 0 && S_ISSOCK( info.st_mode ) )
+        {
+            unlink( strPath.c_str() );
+        }
+    }
+#endif
+};
+
+/// the compact form of CanvasJournal records.  each end of a mirror keeps
+/// one and feeds it the same records in the same order, so both agree on
+/// what the deltas are taken against.  positions are rounded to whole
+/// micrometres.
+class MirrorCodec
+{
+public:
+    enum { kStepsPerMm = 1000 };
+
+    void reset() { m_strokes.clear(); }
+
+    uint32_t strokeCount() const { return static_cast<uint32_t>(m_strokes.size()); }
+
+    /// appends the journal records, re-encoded, to out.  false at the first
+    /// one that can't be read or doesn't fit the strokes seen so far.
+    bool encode( const uint8_t* pRecords, size_t uiSize, std::vector<uint8_t>& out )
+    {
+        CanvasJournal::Record record;
+
+        for ( size_t uiNext = 0; uiNext < uiSize; )
+        {
+            if ( !CanvasJournal::read( pRecords, uiSize, uiNext, record ) || !encode( record, out ) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool encode( const CanvasJournal::Record& record, std::vector<uint8_t>& out )
+    {
+        const bool bHasStroke = record.eOp == CanvasJournal::kOp_AppendPoint || record.eOp == CanvasJournal::kOp_MoveLastPoint ||
+                                record.eOp == CanvasJournal::kOp_EndStroke || record.eOp == CanvasJournal::kOp_SetErased ||
+                                record.eOp == CanvasJournal::kOp_SetColor;
+
+        if ( bHasStroke && record.uiStroke >= strokeCount() )
+        {
+            return false;
+        }
+
+        out.push_back( static_cast<uint8_t>(record.eOp) );
+
+        switch ( record.eOp )
+        {
+        case CanvasJournal::kOp_BeginStroke:
+            {
+                if ( record.uiStroke != strokeCount() )
+                {
+                    out.pop_back();
+                    return false;
+                }
+
+                putVarint( out, record.uiColorIndex );
+                putFloat( out, record.fWidth );
+                putVarint( out, record.iTimestamp );
+
+                StrokeState state;
+                state.aiPoint[0] = state.aiPoint[1] = state.aiPoint[2] = 0;
+                state.iTimestamp = record.iTimestamp;
+                m_strokes.push_back( state );
+            }
+            break;
+
+        case CanvasJournal::kOp_AppendPoint:
+        case CanvasJournal::kOp_MoveLastPoint:
+            {
+                StrokeState&    state       = m_strokes[record.uiStroke];
+                const int32_t   aiPoint[3]  = { toSteps( record.vPoint.x ), toSteps( record.vPoint.y ), toSteps( record.vPoint.z ) };
+
+                putVarint( out, strokeCount() - 1 - record.uiStroke );
+
+                for ( int a = 0; a < 3; a++ )
+                {
+                    putVarint( out, static_cast<int64_t>(aiPoint[a]) - state.aiPoint[a] );
+                    state.aiPoint[a] = aiPoint[a];
+                }
+
+                putVarint( out, record.iTimestamp - state.iTimestamp );
+                state.iTimestamp = record.iTimestamp;
+            }
+            break;
+
+        case CanvasJournal::kOp_EndStroke:
+            putVarint( out, strokeCount() - 1 - record.uiStroke );
+            break;
+
+        case CanvasJournal::kOp_Clear:
+            m_strokes.clear();
+            break;
+
+        case CanvasJournal::kOp_SetErased:
+            putVarint( out, strokeCount() - 1 - record.uiStroke );
+            out.push_back( record.bErased ? 1 : 0 );
+            break;
+
+        case CanvasJournal::kOp_SetClearMark:
+            putVarint( out, record.uiMark );
+            break;
+
+        case CanvasJournal::kOp_SetColor:
+            putVarint( out, strokeCount() - 1 - record.uiStroke );
+            putVarint( out, record.uiColorIndex );
+            break;
+
+        default:
+            out.pop_back();
+            return false;
+        }
+
+        return true;
+    }
+
+    /// reads the record at uiNext back into journal form and moves past it.
+    /// false if it is cut short or names a stroke there isn't.
+    bool decode( const uint8_t* pData, size_t uiSize, size_t& uiNext, CanvasJournal::Record& record )
+    {
+        if ( uiNext >= uiSize )
+        {
+            return false;
+        }
+
+        record.eOp = static_cast<CanvasJournal::Op>( pData[uiNext++] );
+
+        int64_t iValue = 0;
+
+        switch ( record.eOp )
+        {
+        case CanvasJournal::kOp_BeginStroke:
+            {
+                if ( !getVarint( pData, uiSize, uiNext, iValue ) || !getFloat( pData, uiSize, uiNext, record.fWidth ) ||
+                     !getVarint( pData, uiSize, uiNext, record.iTimestamp ) )
+                {
+                    return false;
+                }
+
+                record.uiStroke     = strokeCount();
+                record.uiColorIndex = static_cast<uint32_t>(iValue);
+
+                StrokeState state;
+                state.aiPoint[0] = state.aiPoint[1] = state.aiPoint[2] = 0;
+                state.iTimestamp = record.iTimestamp;
+                m_strokes.push_back( state );
+            }
+            return true;
+
+        case CanvasJournal::kOp_AppendPoint:
+        case CanvasJournal::kOp_MoveLastPoint:
+            {
+                if ( !getStroke( pData, uiSize, uiNext, record.uiStroke ) )
+                {
+                    return false;
+                }
+
+                StrokeState&    state = m_strokes[record.uiStroke];
+                int64_t         aiDelta[4];
+
+                for ( int a = 0; a < 4; a++ )
+                {
+                    if ( !getVarint( pData, uiSize, uiNext, aiDelta[a] ) )
+                    {
+                        return false;
+                    }
+                }
+
+                for ( int a = 0; a < 3; a++ )
+                {
+                    state.aiPoint[a] = static_cast<int32_t>( state.aiPoint[a] + aiDelta[a] );
+                }
+
+                state.iTimestamp += aiDelta[3];
+
+                record.vPoint       = Leap::Vector( fromSteps( state.aiPoint[0] ), fromSteps( state.aiPoint[1] ), fromSteps( state.aiPoint[2] ) );
+                record.iTimestamp   = state.iTimestamp;
+            }
+            return true;
+
+        case CanvasJournal::kOp_EndStroke:
+            return getStroke( pData, uiSize, uiNext, record.uiStroke );
+
+        case CanvasJournal::kOp_Clear:
+            m_strokes.clear();
+            return true;
+
+        case CanvasJournal::kOp_SetErased:
+            if ( !getStroke( pData, uiSize, uiNext, record.uiStroke ) || uiNext >= uiSize )
+            {
+                return false;
+            }
+
+            record.bErased = (pData[uiNext++] != 0);
+            return true;
+
+        case CanvasJournal::kOp_SetClearMark:
+            if ( !getVarint( pData, uiSize, uiNext, iValue ) )
+            {
+                return false;
+            }
+
+            record.uiMark = static_cast<uint32_t>(iValue);
+            return true;
+
+        case CanvasJournal::kOp_SetColor:
+            if ( !getStroke( pData, uiSize, uiNext, record.uiStroke ) || !getVarint( pData, uiSize, uiNext, iValue ) )
+            {
+                return false;
+            }
+
+            record.uiColorIndex = static_cast<uint32_t>(iValue);
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    /// encodes all of store, starting over from no strokes.  the store keeps
+    /// no per point times, so every point carries its stroke's end time.
+    void snapshot( const StrokeStore& store, std::vector<uint8_t>& out )
+    {
+        reset();
+
+        CanvasJournal::Record record;
+
+        for ( uint32_t s = 0; s < store.strokeCount(); s++ )
+        {
+            const StrokeStore::Stroke& stroke = store.stroke( s );
+
+            record.eOp          = CanvasJournal::kOp_BeginStroke;
+            record.uiStroke     = s;
+            record.uiColorIndex = stroke.uiColorIndex;
+            record.fWidth       = stroke.fWidth;
+            record.iTimestamp   = stroke.iStartTimestamp;
+            encode( record, out );
+
+            record.eOp          = CanvasJournal::kOp_AppendPoint;
+            record.iTimestamp   = stroke.iEndTimestamp;
+
+            store.forEachPoint( s, [&]( const Leap::Vector& vPoint )
+            {
+                record.vPoint = vPoint;
+                encode( record, out );
+            } );
+
+            if ( !stroke.bOpen )
+            {
+                record.eOp = CanvasJournal::kOp_EndStroke;
+                encode( record, out );
+            }
+
+            if ( stroke.bErased )
+            {
+                record.eOp      = CanvasJournal::kOp_SetErased;
+                record.bErased  = true;
+                encode( record, out );
+            }
+        }
+
+        if ( store.clearMark() > 0 )
+        {
+            record.eOp      = CanvasJournal::kOp_SetClearMark;
+            record.uiMark   = store.clearMark();
+            encode( record, out );
+        }
+    }
+
+private:
+    /// what the next delta of a stroke is taken against.
+    struct StrokeState
+    {
+        int32_t aiPoint[3];
+        int64_t iTimestamp;
+    };
+
+    static int32_t toSteps( float f )        { return static_cast<int32_t>( std::floor( static_cast<double>(f) * kStepsPerMm + 0.5 ) ); }
+    static float   fromSteps( int32_t iSteps ) { return static_cast<float>( static_cast<double>(iSteps) / kStepsPerMm ); }
+
+    /// zigzag varints: small magnitudes of either sign take few bytes.
+    static void putVarint( std::vector<uint8_t>& out, int64_t iValue )
+    {
+        uint64_t uiValue = (static_cast<uint64_t>(iValue) << 1) ^ static_cast<uint64_t>(iValue >> 63);
+
+        while ( uiValue >= 0x80 )
+        {
+            out.push_back( static_cast<uint8_t>(uiValue | 0x80) );
+            uiValue >>= 7;
+        }
+
+        out.push_back( static_cast<uint8_t>(uiValue) );
+    }
+
+    /// reads one varint at uiNext, false if the data ends first.
+    static bool getVarint( const uint8_t* pData, size_t uiSize, size_t& uiNext, int64_t& iValue )
+    {
+        uint64_t uiValue = 0;
+
+        for ( uint32_t uiShift = 0; uiShift < 64 && uiNext < uiSize; uiShift += 7 )
+        {
+            const uint8_t uiByte = pData[uiNext++];
+            uiValue |= static_cast<uint64_t>(uiByte & 0x7F) << uiShift;
+
+            if ( !(uiByte & 0x80) )
+            {
+                iValue = static_cast<int64_t>(uiValue >> 1) ^ -static_cast<int64_t>(uiValue & 1);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void putFloat( std::vector<uint8_t>& out, float f )
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(&f);
+        out.insert( out.end(), pBytes, pBytes + sizeof(f) );
+    }
+
+    static bool getFloat( const uint8_t* pData, size_t uiSize, size_t& uiNext, float& f )
+    {
+        if ( uiNext + sizeof(f) > uiSize )
+        {
+            return false;
+        }
+
+        memcpy( &f, pData + uiNext, sizeof(f) );
+        uiNext += sizeof(f);
+
+        return true;
+    }
+
+    bool getStroke( const uint8_t* pData, size_t uiSize, size_t& uiNext, uint32_t& uiStroke ) const
+    {
+        int64_t iBack = 0;
+
+        if ( !getVarint( pData, uiSize, uiNext, iBack ) || iBack < 0 || iBack >= static_cast<int64_t>(m_strokes.size()) )
+        {
+            return false;
+        }
+
+        uiStroke = strokeCount() - 1 - static_cast<uint32_t>(iBack);
+
+        return true;
+    }
+
+private:
+    std::vector<StrokeState> m_strokes;
+};
+
+/// what both ends of a mirror agree on.  the stream starts with "LPMR" and a
+/// u32 version, then messages: u8 kMessage_*, u32 payload bytes, and the
+/// payload, MirrorCodec records.
+struct MirrorProtocol
+{
+    enum { kVersion = 1, kStreamHeaderBytes = 8, kMessageHeaderBytes = 5 };
+
+    enum Message
+    {
+        kMessage_Delta = 1,     ///< applies on top of what the client has
+        kMessage_Snapshot       ///< replaces what the client has
+    };
+
+    static void putStreamHeader( std::vector<uint8_t>& out )
+    {
+        const uint32_t uiVersion = kVersion;
+        out.insert( out.end(), "LPMR", "LPMR" + 4 );
+        out.insert( out.end(), reinterpret_cast<const uint8_t*>(&uiVersion), reinterpret_cast<const uint8_t*>(&uiVersion) + 4 );
+    }
+
+    static bool isStreamHeader( const uint8_t* pData )
+    {
+        uint32_t uiVersion = 0;
+        memcpy( &uiVersion, pData + 4, 4 );
+
+        return memcmp( pData, "LPMR", 4 ) == 0 && uiVersion == kVersion;
+    }
+
+    /// starts a message at the end of out, finishMessage() fills in its size.
+    static size_t startMessage( std::vector<uint8_t>& out, Message eMessage )
+    {
+        const size_t uiStart = out.size();
+        out.push_back( static_cast<uint8_t>(eMessage) );
+        out.resize( out.size() + 4 );
+
+        return uiStart;
+    }
+
+    static void finishMessage( std::vector<uint8_t>& out, size_t uiStart )
+    {
+        const uint32_t uiBytes = static_cast<uint32_t>( out.size() - uiStart - kMessageHeaderBytes );
+        memcpy( &out[uiStart + 1], &uiBytes, 4 );
+    }
+};
+
+/// serves the painting of one StrokeStore to any number of clients.
+class MirrorServer
+{
+public:
+    MirrorServer()
+      : m_bCodecValid(false),
+        m_hListener(MirrorSocket::invalid()),
+        m_bStop(false),
+        m_uiSnapshotRequests(0),
+        m_uiNumClients(0),
+        m_uiNumDropped(0),
+        m_uiBytesSent(0)
+    {
+    }
+
+    ~MirrorServer() { stop(); }
+
+    /// starts listening at strAddress, see MirrorSocket.
+    bool start( const std::string& strAddress )
+    {
+        stop();
+
+        m_hListener = MirrorSocket::listen( strAddress );
+
+        if ( m_hListener == MirrorSocket::invalid() )
+        {
+            return false;
+        }
+
+        m_strAddress    = strAddress;
+        m_bStop         = false;
+        m_bCodecValid   = false;
+        m_thread        = std::thread( [this]() { serve(); } );
+
+        return true;
+    }
+
+    /// disconnects every client.
+    void stop()
+    {
+        if ( !m_thread.joinable() )
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_bStop = true;
+        }
+
+        m_wake.notify_one();
+        m_thread.join();
+
+        for ( size_t i = 0; i < m_clients.size(); i++ )
+        {
+            MirrorSocket::close( m_clients[i].hSocket );
+        }
+
+        m_clients.clear();
+        m_queue.clear();
+        m_uiNumClients = 0;
+
+        MirrorSocket::stopListening( m_hListener, m_strAddress );
+    }
+
+    bool isRunning() const { return m_thread.joinable(); }
+
+    /// render thread, once a frame: the journal records of the frame, already
+    /// applied to store.  clients that connected since the last call get a
+    /// snapshot of store instead.  nothing is encoded before the first
+    /// client connects.
+    void publish( const std::vector<uint8_t>& records, const StrokeStore& store )
+    {
+        if ( !isRunning() )
+        {
+            return;
+        }
+
+        bool bResync = false;
+
+        if ( m_bCodecValid && !records.empty() )
+        {
+            Message message;
+            message.eTarget = kTarget_Synced;
+
+            const size_t uiStart = MirrorProtocol::startMessage( message.bytes, MirrorProtocol::kMessage_Delta );
+
+            // can't happen with records from a CanvasJournal, but if it does
+            // everyone starts over from a snapshot.
+            bResync = !m_codec.encode( &records[0], records.size(), message.bytes );
+
+            if ( !bResync )
+            {
+                MirrorProtocol::finishMessage( message.bytes, uiStart );
+                queue( message );
+            }
+        }
+
+        if ( m_uiSnapshotRequests.exchange( 0 ) > 0 || bResync )
+        {
+            Message message;
+            message.eTarget = bResync ? kTarget_All : kTarget_Waiting;
+
+            const size_t uiStart = MirrorProtocol::startMessage( message.bytes, MirrorProtocol::kMessage_Snapshot );
+            m_codec.snapshot( store, message.bytes );
+            MirrorProtocol::finishMessage( message.bytes, uiStart );
+
+            m_bCodecValid = true;
+            queue( message );
+        }
+    }
+
+    uint32_t clientCount() const    { return m_uiNumClients.load( std::memory_order_relaxed ); }
+    /// clients disconnected for falling too far behind.
+    uint32_t droppedCount() const   { return m_uiNumDropped.load( std::memory_order_relaxed ); }
+    uint64_t bytesSent() const      { return m_uiBytesSent.load( std::memory_order_relaxed ); }
+
+private:
+    MirrorServer( const MirrorServer& );
+    MirrorServer& operator=( const MirrorServer& );
+
+    enum
+    {
+        kPollMs         = 10,           ///< how late a new connection may be noticed
+        kMaxBacklog     = 32 << 20      ///< bytes a client may fall behind before it is dropped
+    };
+
+    enum Target
+    {
+        kTarget_Synced,     ///< clients that have had a snapshot
+        kTarget_Waiting,    ///< clients that haven't, which then have
+        kTarget_All
+    };
+
+    struct Message
+    {
+        std::vector<uint8_t>    bytes;
+        Target                  eTarget;
+    };
+
+    struct Client
+    {
+        MirrorSocket::Handle    hSocket;
+        std::vector<uint8_t>    out;
+        size_t                  uiSent;
+        bool                    bSynced;
+    };
+
+    void queue( Message& message )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_queue.push_back( std::move( message ) );
+        }
+
+        m_wake.notify_one();
+    }
+
+    /// server thread from here on.
+    void serve()
+    {
+        std::vector<Message> messages;
+
+        for ( ;; )
+        {
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+
+                if ( m_queue.empty() && !m_bStop && !hasBacklog() )
+                {
+                    m_wake.wait_for( lock, std::chrono::milliseconds( kPollMs ) );
+                }
+
+                if ( m_bStop )
+                {
+                    return;
+                }
+
+                messages.swap( m_queue );
+            }
+
+            for ( size_t i = 0; i < messages.size(); i++ )
+            {
+                deliver( messages[i] );
+            }
+
+            messages.clear();
+
+            acceptClients();
+            writeClients();
+        }
+    }
+
+    void deliver( const Message& message )
+    {
+        for ( size_t i = 0; i < m_clients.size(); i++ )
+        {
+            Client& client = m_clients[i];
+
+            if ( message.eTarget == kTarget_All || (message.eTarget == kTarget_Synced) == client.bSynced )
+            {
+                client.out.insert( client.out.end(), message.bytes.begin(), message.bytes.end() );
+                client.bSynced = true;
+            }
+        }
+    }
+
+    void acceptClients()
+    {
+        MirrorSocket::Handle hSocket;
+
+        while ( (hSocket = MirrorSocket::accept( m_hListener )) != MirrorSocket::invalid() )
+        {
+            Client client;
+            client.hSocket  = hSocket;
+            client.uiSent   = 0;
+            client.bSynced  = false;
+            MirrorProtocol::putStreamHeader( client.out );
+
+            m_clients.push_back( std::move( client ) );
+            m_uiSnapshotRequests.fetch_add( 1 );
+        }
+
+        m_uiNumClients = static_cast<uint32_t>(m_clients.size());
+    }
+
+    /// sends whatever each client can take without blocking, and waits a
+    /// little for the ones that can't take it all.
+    void writeClients()
+    {
+        std::vector<MirrorSocket::Handle> blocked;
+
+        for ( size_t i = 0; i < m_clients.size(); )
+        {
+            Client& client  = m_clients[i];
+            long    iSent   = 0;
+
+            while ( client.uiSent < client.out.size() &&
+                    (iSent = MirrorSocket::send( client.hSocket, &client.out[client.uiSent], client.out.size() - client.uiSent )) > 0 )
+            {
+                client.uiSent += static_cast<size_t>(iSent);
+                m_uiBytesSent.fetch_add( static_cast<uint64_t>(iSent), std::memory_order_relaxed );
+            }
+
+            if ( iSent < 0 || client.out.size() - client.uiSent > kMaxBacklog )
+            {
+                if ( iSent >= 0 )
+                {
+                    m_uiNumDropped.fetch_add( 1, std::memory_order_relaxed );
+                }
+
+                MirrorSocket::close( client.hSocket );
+                m_clients.erase( m_clients.begin() + i );
+                continue;
+            }
+
+            if ( client.uiSent == client.out.size() )
+            {
+                client.out.clear();
+                client.uiSent = 0;
+            }
+            else
+            {
+                blocked.push_back( client.hSocket );
+            }
+
+            i++;
+        }
+
+        m_uiNumClients = static_cast<uint32_t>(m_clients.size());
+
+        if ( !blocked.empty() )
+        {
+            MirrorSocket::waitWritable( blocked, kPollMs );
+        }
+    }
+
+    bool hasBacklog() const
+    {
+        for ( size_t i = 0; i < m_clients.size(); i++ )
+        {
+            if ( m_clients[i].uiSent < m_clients[i].out.size() )
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    // render thread
+    MirrorCodec                 m_codec;
+    bool                        m_bCodecValid;
+
+    // server thread
+    MirrorSocket::Handle        m_hListener;
+    std::string                 m_strAddress;
+    std::vector<Client>         m_clients;
+    std::thread                 m_thread;
+
+    // shared
+    std::mutex                  m_mutex;
+    std::condition_variable     m_wake;
+    std::vector<Message>        m_queue;
+    bool                        m_bStop;
+    std::atomic<uint32_t>       m_uiSnapshotRequests;
+    std::atomic<uint32_t>       m_uiNumClients;
+    std::atomic<uint32_t>       m_uiNumDropped;
+    std::atomic<uint64_t>       m_uiBytesSent;
+};
+
+/// shows the painting a MirrorServer serves.
+class MirrorClient
+{
+public:
+    MirrorClient()
+      : m_hSocket(MirrorSocket::invalid()),
+        m_bConnected(false),
+        m_bStarted(false),
+        m_bFailed(false),
+        m_uiNumMessages(0),
+        m_uiBytesReceived(0)
+    {
+    }
+
+    ~MirrorClient() { disconnect(); }
+
+    /// onData, if set, is called on the reading thread whenever something
+    /// arrives or the connection goes away, e.g. to request a repaint.
+    bool connect( const std::string& strAddress, const std::function<void()>& onData = std::function<void()>() )
+    {
+        disconnect();
+
+        m_hSocket = MirrorSocket::connect( strAddress );
+
+        if ( m_hSocket == MirrorSocket::invalid() )
+        {
+            return false;
+        }
+
+        m_pending.clear();
+        m_received.clear();
+        m_codec.reset();
+        m_bStarted      = false;
+        m_bFailed       = false;
+        m_bConnected    = true;
+        m_thread        = std::thread( [this, onData]() { receive( onData ); } );
+
+        return true;
+    }
+
+    void disconnect()
+    {
+        if ( m_thread.joinable() )
+        {
+            MirrorSocket::shutdown( m_hSocket );
+            m_thread.join();
+        }
+
+        MirrorSocket::close( m_hSocket );
+        m_bConnected = false;
+    }
+
+    /// false once the server went away or sent something that doesn't apply.
+    bool isConnected() const { return m_bConnected.load() && !m_bFailed; }
+
+    /// applies every complete message received so far to store.  a snapshot
+    /// replaces whatever store held.  returns the number of messages.
+    uint32_t poll( StrokeStore& store )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_pending.insert( m_pending.end(), m_received.begin(), m_received.end() );
+            m_received.clear();
+        }
+
+        size_t uiPos = 0;
+
+        if ( !m_bStarted && !m_bFailed && m_pending.size() >= MirrorProtocol::kStreamHeaderBytes )
+        {
+            m_bStarted  = MirrorProtocol::isStreamHeader( &m_pending[0] );
+            m_bFailed   = !m_bStarted;
+            uiPos       = MirrorProtocol::kStreamHeaderBytes;
+        }
+
+        uint32_t uiNumApplied = 0;
+
+        while ( m_bStarted && !m_bFailed && uiPos + MirrorProtocol::kMessageHeaderBytes <= m_pending.size() )
+        {
+            uint32_t uiBytes = 0;
+            memcpy( &uiBytes, &m_pending[uiPos + 1], 4 );
+
+            const size_t uiPayload = uiPos + MirrorProtocol::kMessageHeaderBytes;
+
+            if ( uiPayload + uiBytes > m_pending.size() )
+            {
+                break;
+            }
+
+            m_bFailed = !apply( m_pending[uiPos], uiBytes > 0 ? &m_pending[uiPayload] : nullptr, uiBytes, store );
+            uiPos     = uiPayload + uiBytes;
+            uiNumApplied++;
+        }
+
+        m_pending.erase( m_pending.begin(), m_pending.begin() + uiPos );
+        m_uiNumMessages += uiNumApplied;
+
+        return uiNumApplied;
+    }
+
+    uint64_t messageCount() const   { return m_uiNumMessages; }
+    uint64_t bytesReceived() const  { return m_uiBytesReceived.load( std::memory_order_relaxed ); }
+
+private:
+    MirrorClient( const MirrorClient& );
+    MirrorClient& operator=( const MirrorClient& );
+
+    bool apply( uint8_t uiMessage, const uint8_t* pData, size_t uiSize, StrokeStore& store )
+    {
+        if ( uiMessage == MirrorProtocol::kMessage_Snapshot )
+        {
+            store.clear();
+            m_codec.reset();
+        }
+        else if ( uiMessage != MirrorProtocol::kMessage_Delta )
+        {
+            return false;
+        }
+
+        CanvasJournal::Record record;
+
+        for ( size_t uiNext = 0; uiNext < uiSize; )
+        {
+            if ( !m_codec.decode( pData, uiSize, uiNext, record ) || !CanvasJournal::apply( record, store ) )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /// reading thread.
+    void receive( std::function<void()> onData )
+    {
+        uint8_t acBlock[1 << 14];
+        long    iRead;
+
+        while ( (iRead = MirrorSocket::receive( m_hSocket, acBlock, sizeof(acBlock) )) > 0 )
+        {
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_received.insert( m_received.end(), acBlock, acBlock + iRead );
+            }
+
+            m_uiBytesReceived.fetch_add( static_cast<uint64_t>(iRead), std::memory_order_relaxed );
+
+            if ( onData )
+            {
+                onData();
+            }
+        }
+
+        m_bConnected = false;
+
+        if ( onData )
+        {
+            onData();
+        }
+    }
+
+private:
+    MirrorSocket::Handle    m_hSocket;
+    std::thread             m_thread;
+    std::atomic<bool>       m_bConnected;
+
+    // polling thread
+    MirrorCodec             m_codec;
+    std::vector<uint8_t>    m_pending;
+    bool                    m_bStarted;
+    bool                    m_bFailed;
+    uint64_t                m_uiNumMessages;
+
+    // shared
+    std::mutex              m_mutex;
+    std::vector<uint8_t>    m_received;
+    std::atomic<uint64_t>   m_uiBytesReceived;
+};
+
+} // namespace LeapPaint
+
+#endif // __CanvasMirror_h__
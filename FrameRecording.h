@@ -0,0 +1,495 @@
+/******************************************************************************\
+* LeapPaint3D frame recording and replay.
+*
+* FrameData is a plain snapshot of the parts of a Leap::Frame the app uses.  It
+* has fixed capacity so it can be copied around without allocating.  Frames
+* can be appended to a compact binary file and later replayed into the same
+* FrameSinks the live controller feeds, so a session can be reproduced
+* without the device.
+*
+* File layout (little endian):
+*   "LPRC" u32 version
+*   per frame: u32 payload size, then
+*     i64 id, i64 timestamp(us), u8 hands, u8 pointables, u8 gestures,
+*     hands[], pointables[], gestures[] as written by FrameWriter.
+* A truncated trailing frame (e.g. after a crash) is ignored on read.
+\******************************************************************************/
+
+#if !defined(__FrameRecording_h__)
+#define __FrameRecording_h__
+
+#include "LeapMath.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace LeapPaint {
+
+struct HandData
+{
+    int32_t         iId;
+    float           fSphereRadius;
+    Leap::Vector    vPalmPosition;
+    Leap::Vector    vPalmNormal;
+    Leap::Vector    vDirection;
+};
+
+struct PointableData
+{
+    int32_t         iId;
+    int32_t         iHandId;        ///< -1 when not attached to a hand
+    uint32_t        uiIsTool;
+    Leap::Vector    vTipPosition;
+    Leap::Vector    vDirection;
+};
+
+/// type and state carry the Leap::Gesture enum values unchanged.
+struct GestureData
+{
+    // the Leap::Gesture values, for code that doesn't see the Leap headers.
+    enum { kType_Swipe = 1, kType_Circle = 4, kType_ScreenTap = 5, kType_KeyTap = 6 };
+    enum { kState_Start = 1, kState_Update = 2, kState_Stop = 3 };
+
+    int32_t         iId;
+    int32_t         iType;
+    int32_t         iState;
+    int32_t         iPointableId;
+    Leap::Vector    vPosition;
+    Leap::Vector    vDirection;
+    Leap::Vector    vNormal;
+    float           fProgress;
+    float           fRadius;
+    float           fSpeed;
+};
+
+struct FrameData
+{
+    enum { kMaxHands = 4, kMaxPointables = 20, kMaxGestures = 8 };
+
+    int64_t         iId;
+    int64_t         iTimestamp;     ///< device time in microseconds
+    uint32_t        uiNumHands;
+    uint32_t        uiNumPointables;
+    uint32_t        uiNumGestures;
+    HandData        aHands[kMaxHands];
+    PointableData   aPointables[kMaxPointables];
+    GestureData     aGestures[kMaxGestures];
+
+    FrameData() : iId(0), iTimestamp(0), uiNumHands(0), uiNumPointables(0), uiNumGestures(0) {}
+
+    uint32_t fingerCount( int32_t iHandId ) const
+    {
+        uint32_t uiCount = 0;
+
+        for ( uint32_t i = 0; i < uiNumPointables; i++ )
+        {
+            uiCount += (aPointables[i].iHandId == iHandId && !aPointables[i].uiIsTool) ? 1 : 0;
+        }
+
+        return uiCount;
+    }
+
+    /// whether drawing this frame's pointables would look the same as drawing
+    /// other's: same pointables, no tip moved by more than fDistance and no
+    /// direction turned by more than fDirection (difference of unit vectors).
+    bool samePointables( const FrameData& other, float fDistance, float fDirection ) const
+    {
+        if ( uiNumPointables != other.uiNumPointables )
+        {
+            return false;
+        }
+
+        for ( uint32_t i = 0; i < uiNumPointables; i++ )
+        {
+            const PointableData& a = aPointables[i];
+            const PointableData& b = other.aPointables[i];
+
+            if ( a.iId != b.iId ||
+                 a.vTipPosition.distanceTo( b.vTipPosition ) > fDistance ||
+                 a.vDirection.distanceTo( b.vDirection ) > fDirection )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    const GestureData* findGesture( int32_t iGestureId ) const
+    {
+        for ( uint32_t i = 0; i < uiNumGestures; i++ )
+        {
+            if ( aGestures[i].iId == iGestureId )
+            {
+                return &aGestures[i];
+            }
+        }
+
+        return nullptr;
+    }
+};
+
+/// anything consuming tracking frames, live or replayed.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+    virtual void onFrameData( const FrameData& frame ) = 0;
+};
+
+/// appends frames to a recording.  not thread safe; call from one thread.
+class FrameWriter
+{
+public:
+    enum { kVersion = 1 };
+
+    FrameWriter() : m_pFile(nullptr), m_uiNumFrames(0) {}
+    ~FrameWriter() { close(); }
+
+    bool open( const char* szPath )
+    {
+        close();
+
+        m_pFile = fopen( szPath, "wb" );
+
+        if ( !m_pFile )
+        {
+            return false;
+        }
+
+        setvbuf( m_pFile, nullptr, _IOFBF, 1 << 16 );
+
+        const uint32_t uiVersion = kVersion;
+        fwrite( "LPRC", 1, 4, m_pFile );
+        fwrite( &uiVersion, sizeof(uiVersion), 1, m_pFile );
+
+        return true;
+    }
+
+    void close()
+    {
+        if ( m_pFile )
+        {
+            fclose( m_pFile );
+            m_pFile = nullptr;
+        }
+    }
+
+    bool isOpen() const { return m_pFile != nullptr; }
+
+    void write( const FrameData& frame )
+    {
+        if ( !m_pFile )
+        {
+            return;
+        }
+
+        m_buffer.clear();
+
+        put( frame.iId );
+        put( frame.iTimestamp );
+        put( static_cast<uint8_t>(frame.uiNumHands) );
+        put( static_cast<uint8_t>(frame.uiNumPointables) );
+        put( static_cast<uint8_t>(frame.uiNumGestures) );
+
+        for ( uint32_t i = 0; i < frame.uiNumHands; i++ )
+        {
+            const HandData& hand = frame.aHands[i];
+            put( hand.iId );
+            put( hand.fSphereRadius );
+            put( hand.vPalmPosition );
+            put( hand.vPalmNormal );
+            put( hand.vDirection );
+        }
+
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            const PointableData& pointable = frame.aPointables[i];
+            put( pointable.iId );
+            put( pointable.iHandId );
+            put( static_cast<uint8_t>(pointable.uiIsTool) );
+            put( pointable.vTipPosition );
+            put( pointable.vDirection );
+        }
+
+        for ( uint32_t i = 0; i < frame.uiNumGestures; i++ )
+        {
+            const GestureData& gesture = frame.aGestures[i];
+            put( gesture.iId );
+            put( static_cast<uint8_t>(gesture.iType) );
+            put( static_cast<uint8_t>(gesture.iState) );
+            put( gesture.iPointableId );
+            put( gesture.vPosition );
+            put( gesture.vDirection );
+            put( gesture.vNormal );
+            put( gesture.fProgress );
+            put( gesture.fRadius );
+            put( gesture.fSpeed );
+        }
+
+        const uint32_t uiSize = static_cast<uint32_t>(m_buffer.size());
+
+        fwrite( &uiSize, sizeof(uiSize), 1, m_pFile );
+        fwrite( &m_buffer[0], 1, uiSize, m_pFile );
+
+        m_uiNumFrames++;
+    }
+
+    /// pushes buffered frames to the OS.
+    void flush() { if ( m_pFile ) { fflush( m_pFile ); } }
+
+    uint64_t frameCount() const { return m_uiNumFrames; }
+
+private:
+    template<typename T>
+    void put( const T& value )
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(&value);
+        m_buffer.insert( m_buffer.end(), pBytes, pBytes + sizeof(T) );
+    }
+
+    void put( const Leap::Vector& v )
+    {
+        put( v.x );
+        put( v.y );
+        put( v.z );
+    }
+
+private:
+    FILE*                   m_pFile;
+    std::vector<uint8_t>    m_buffer;
+    uint64_t                m_uiNumFrames;
+};
+
+/// sequential reader for files written by FrameWriter.
+class FrameReader
+{
+public:
+    FrameReader() : m_pFile(nullptr), m_uiDataStart(0), m_uiPos(0) {}
+    ~FrameReader() { close(); }
+
+    bool open( const char* szPath )
+    {
+        close();
+
+        m_pFile = fopen( szPath, "rb" );
+
+        if ( !m_pFile )
+        {
+            return false;
+        }
+
+        char        acMagic[4];
+        uint32_t    uiVersion = 0;
+
+        if ( fread( acMagic, 1, 4, m_pFile ) != 4 || memcmp( acMagic, "LPRC", 4 ) != 0 ||
+             fread( &uiVersion, sizeof(uiVersion), 1, m_pFile ) != 1 || uiVersion != FrameWriter::kVersion )
+        {
+            close();
+            return false;
+        }
+
+        m_uiDataStart = ftell( m_pFile );
+
+        return true;
+    }
+
+    void close()
+    {
+        if ( m_pFile )
+        {
+            fclose( m_pFile );
+            m_pFile = nullptr;
+        }
+    }
+
+    void rewind() { if ( m_pFile ) { fseek( m_pFile, m_uiDataStart, SEEK_SET ); } }
+
+    /// false at the end of the recording or on a truncated/corrupt frame.
+    bool next( FrameData& frame )
+    {
+        uint32_t uiSize = 0;
+
+        if ( !m_pFile || fread( &uiSize, sizeof(uiSize), 1, m_pFile ) != 1 || uiSize > (1u << 20) )
+        {
+            return false;
+        }
+
+        m_buffer.resize( uiSize );
+
+        if ( uiSize == 0 || fread( &m_buffer[0], 1, uiSize, m_pFile ) != uiSize )
+        {
+            return false;
+        }
+
+        m_uiPos = 0;
+
+        uint8_t uiNumHands = 0, uiNumPointables = 0, uiNumGestures = 0;
+
+        if ( !get( frame.iId ) || !get( frame.iTimestamp ) ||
+             !get( uiNumHands ) || !get( uiNumPointables ) || !get( uiNumGestures ) ||
+             uiNumHands > FrameData::kMaxHands || uiNumPointables > FrameData::kMaxPointables || uiNumGestures > FrameData::kMaxGestures )
+        {
+            return false;
+        }
+
+        frame.uiNumHands        = uiNumHands;
+        frame.uiNumPointables   = uiNumPointables;
+        frame.uiNumGestures     = uiNumGestures;
+
+        bool bOk = true;
+
+        for ( uint32_t i = 0; i < frame.uiNumHands; i++ )
+        {
+            HandData& hand = frame.aHands[i];
+            bOk = bOk && get( hand.iId ) && get( hand.fSphereRadius ) && get( hand.vPalmPosition ) && get( hand.vPalmNormal ) && get( hand.vDirection );
+        }
+
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            PointableData&  pointable   = frame.aPointables[i];
+            uint8_t         uiIsTool    = 0;
+            bOk = bOk && get( pointable.iId ) && get( pointable.iHandId ) && get( uiIsTool ) && get( pointable.vTipPosition ) && get( pointable.vDirection );
+            pointable.uiIsTool = uiIsTool;
+        }
+
+        for ( uint32_t i = 0; i < frame.uiNumGestures; i++ )
+        {
+            GestureData&    gesture = frame.aGestures[i];
+            uint8_t         uiType  = 0;
+            uint8_t         uiState = 0;
+            bOk = bOk && get( gesture.iId ) && get( uiType ) && get( uiState ) && get( gesture.iPointableId ) &&
+                  get( gesture.vPosition ) && get( gesture.vDirection ) && get( gesture.vNormal ) &&
+                  get( gesture.fProgress ) && get( gesture.fRadius ) && get( gesture.fSpeed );
+            gesture.iType  = uiType;
+            gesture.iState = uiState;
+        }
+
+        return bOk;
+    }
+
+private:
+    template<typename T>
+    bool get( T& value )
+    {
+        if ( m_uiPos + sizeof(T) > m_buffer.size() )
+        {
+            return false;
+        }
+
+        memcpy( &value, &m_buffer[m_uiPos], sizeof(T) );
+        m_uiPos += sizeof(T);
+
+        return true;
+    }
+
+    bool get( Leap::Vector& v )
+    {
+        return get( v.x ) && get( v.y ) && get( v.z );
+    }
+
+private:
+    FILE*                   m_pFile;
+    long                    m_uiDataStart;
+    std::vector<uint8_t>    m_buffer;
+    size_t                  m_uiPos;
+};
+
+/// plays a recording into a sink on its own thread, standing in for the
+/// Leap::Controller listener thread.
+class FrameReplayer
+{
+public:
+    FrameReplayer() : m_pSink(nullptr), m_fSpeed(1.0f), m_bLoop(false), m_bStop(false), m_bFinished(false) {}
+    ~FrameReplayer() { stop(); }
+
+    /// fSpeed 1 replays at recorded speed, 0 as fast as the sink accepts frames.
+    bool start( const char* szPath, FrameSink& sink, float fSpeed = 1.0f, bool bLoop = false )
+    {
+        stop();
+
+        if ( !m_reader.open( szPath ) )
+        {
+            return false;
+        }
+
+        m_pSink     = &sink;
+        m_fSpeed    = fSpeed;
+        m_bLoop     = bLoop;
+        m_bStop     = false;
+        m_bFinished = false;
+        m_thread    = std::thread( [this]() { run(); } );
+
+        return true;
+    }
+
+    void stop()
+    {
+        m_bStop = true;
+
+        if ( m_thread.joinable() )
+        {
+            m_thread.join();
+        }
+
+        m_reader.close();
+    }
+
+    bool isFinished() const { return m_bFinished; }
+
+private:
+    void run()
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        FrameData frame;
+
+        while ( !m_bStop )
+        {
+            const Clock::time_point startTime       = Clock::now();
+            int64_t                 iFirstTimestamp = -1;
+
+            while ( !m_bStop && m_reader.next( frame ) )
+            {
+                if ( iFirstTimestamp < 0 )
+                {
+                    iFirstTimestamp = frame.iTimestamp;
+                }
+
+                if ( m_fSpeed > 0 )
+                {
+                    const int64_t iDueUs = static_cast<int64_t>((frame.iTimestamp - iFirstTimestamp) / m_fSpeed);
+                    std::this_thread::sleep_until( startTime + std::chrono::microseconds( iDueUs ) );
+                }
+
+                m_pSink->onFrameData( frame );
+            }
+
+            if ( !m_bLoop )
+            {
+                break;
+            }
+
+            m_reader.rewind();
+        }
+
+        m_bFinished = true;
+    }
+
+private:
+    FrameReader         m_reader;
+    FrameSink*          m_pSink;
+    float               m_fSpeed;
+    bool                m_bLoop;
+    std::atomic<bool>   m_bStop;
+    std::atomic<bool>   m_bFinished;
+    std::thread         m_thread;
+};
+
+} // namespace LeapPaint
+
+#endif // __FrameRecording_h__
@@ -0,0 +1,278 @@
+/******************************************************************************\
+* LeapPaint3D gesture commands.
+*
+* The controller recognises circles, key taps, screen taps and swipes.  Each
+* gesture keeps its id from the frame it is first recognised in until it is
+* over, and is reported again in every frame in between.  GestureCommands
+* follows every gesture id through those frames and turns it into paint
+* commands:
+*
+*   key tap         lift the pen, or put it back down
+*   screen tap      next colour
+*   circle          brush size, one step per half turn after the first turn,
+*                   clockwise bigger, anticlockwise smaller
+*   swipe left      undo
+*   swipe right     redo
+*   swipe down      clear
+*
+* Swipes act once they stop, or drop out of the frames, so their direction is
+* the whole movement's.  Everything runs on the thread delivering tracking
+* frames, in fixed size tables, so a frame costs at most a few hundred compares
+* whatever it holds.  Commands go to the render thread on a lock free ring; a
+* full ring drops them, it never blocks either side.
+\******************************************************************************/
+
+#if !defined(__GestureCommands_h__)
+#define __GestureCommands_h__
+
+#include "FrameRecording.h"
+#include "PaintLog.h"
+#include "SampleRing.h"
+#include <cmath>
+#include <cstdint>
+
+namespace LeapPaint {
+
+/// one edit for whoever owns the strokes.
+struct PaintCommand
+{
+    enum Type
+    {
+        kCommand_LiftPen,       ///< iAmount 1 stops painting, 0 starts again
+        kCommand_BrushSize,     ///< iAmount steps bigger, negative for smaller
+        kCommand_Color,         ///< iAmount colours on
+        kCommand_Undo,          ///< iAmount undos, negative for redos
+        kCommand_Clear
+    };
+
+    int64_t     iTimestamp;     ///< device time of the frame that finished the gesture
+    int32_t     iAmount;
+    uint32_t    uiType;
+};
+
+typedef SpscRing<PaintCommand, 64> CommandQueue;
+
+struct GestureSettings
+{
+    GestureSettings() : bEnabled(true), fTurnsPerStep(0.5f), fMinTurns(1.0f) {}
+
+    bool    bEnabled;
+    float   fTurnsPerStep;      ///< circle turns per brush size step
+    float   fMinTurns;          ///< circle turns before the brush size changes
+};
+
+/// producer side of the command ring.  used by one thread.
+class GestureCommands
+{
+public:
+    explicit GestureCommands( CommandQueue& queue, const GestureSettings& settings = GestureSettings() )
+      : m_queue(queue),
+        m_settings(settings),
+        m_uiNumTracked(0),
+        m_bPenLifted(false)
+    {}
+
+    /// true if a command was queued.
+    bool onFrame( const FrameData& frame )
+    {
+        if ( !m_settings.bEnabled )
+        {
+            return false;
+        }
+
+        bool bQueued = false;
+
+        for ( uint32_t t = 0; t < m_uiNumTracked; t++ )
+        {
+            m_aTracked[t].bSeen = false;
+        }
+
+        for ( uint32_t g = 0; g < frame.uiNumGestures; g++ )
+        {
+            const GestureData&  gesture     = frame.aGestures[g];
+            Tracked*            pTracked    = track( gesture.iId );
+
+            if ( !pTracked )
+            {
+                continue;
+            }
+
+            pTracked->bSeen     = true;
+            pTracked->gesture   = gesture;
+
+            if ( pTracked->bDone )
+            {
+                continue;
+            }
+
+            switch ( gesture.iType )
+            {
+            case GestureData::kType_KeyTap:
+                // pen state flips only if the ring took the command, so the
+                // two sides never disagree.
+                if ( post( frame.iTimestamp, PaintCommand::kCommand_LiftPen, m_bPenLifted ? 0 : 1 ) )
+                {
+                    m_bPenLifted = !m_bPenLifted;
+                    bQueued = true;
+                }
+
+                pTracked->bDone = true;
+                break;
+
+            case GestureData::kType_ScreenTap:
+                bQueued |= post( frame.iTimestamp, PaintCommand::kCommand_Color, 1 );
+                pTracked->bDone = true;
+                break;
+
+            case GestureData::kType_Circle:
+                bQueued |= stepCircle( frame, *pTracked );
+                pTracked->bDone = (gesture.iState == GestureData::kState_Stop);
+                break;
+
+            case GestureData::kType_Swipe:
+                if ( gesture.iState == GestureData::kState_Stop )
+                {
+                    bQueued |= finishSwipe( frame.iTimestamp, gesture );
+                    pTracked->bDone = true;
+                }
+                break;
+
+            default:
+                pTracked->bDone = true;
+                break;
+            }
+        }
+
+        // gestures that are gone.  a swipe whose stop was never seen still
+        // counts.
+        for ( uint32_t t = 0; t < m_uiNumTracked; )
+        {
+            Tracked& tracked = m_aTracked[t];
+
+            if ( tracked.bSeen )
+            {
+                t++;
+                continue;
+            }
+
+            if ( !tracked.bDone && tracked.gesture.iType == GestureData::kType_Swipe )
+            {
+                bQueued |= finishSwipe( frame.iTimestamp, tracked.gesture );
+            }
+
+            tracked = m_aTracked[--m_uiNumTracked];
+        }
+
+        return bQueued;
+    }
+
+private:
+    /// every gesture of the last frame fits, plus as many again ending.
+    enum { kMaxTracked = 2 * FrameData::kMaxGestures };
+
+    struct Tracked
+    {
+        GestureData gesture;        ///< as last seen
+        int32_t     iSteps;         ///< circle: brush size steps posted
+        bool        bSeen;
+        bool        bDone;          ///< acted on, ignored until it is gone
+    };
+
+    Tracked* track( int32_t iId )
+    {
+        for ( uint32_t t = 0; t < m_uiNumTracked; t++ )
+        {
+            if ( m_aTracked[t].gesture.iId == iId )
+            {
+                return &m_aTracked[t];
+            }
+        }
+
+        // can't happen with well formed frames, at most kMaxGestures of them
+        // are left from the last one.
+        if ( m_uiNumTracked == kMaxTracked )
+        {
+            return nullptr;
+        }
+
+        Tracked& tracked = m_aTracked[m_uiNumTracked++];
+        tracked.iSteps  = 0;
+        tracked.bDone   = false;
+
+        return &tracked;
+    }
+
+    bool stepCircle( const FrameData& frame, Tracked& tracked )
+    {
+        const GestureData& circle = tracked.gesture;
+
+        if ( circle.fProgress < m_settings.fMinTurns )
+        {
+            return false;
+        }
+
+        // the circle is clockwise seen from the finger when it points along
+        // the normal.
+        bool bClockwise = false;
+
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            if ( frame.aPointables[i].iId == circle.iPointableId )
+            {
+                bClockwise = frame.aPointables[i].vDirection.angleTo( circle.vNormal ) <= Leap::PI / 4;
+            }
+        }
+
+        const int32_t iDue = 1 + static_cast<int32_t>( std::floor( (circle.fProgress - m_settings.fMinTurns) / m_settings.fTurnsPerStep ) );
+
+        if ( iDue <= tracked.iSteps || !post( frame.iTimestamp, PaintCommand::kCommand_BrushSize, bClockwise ? iDue - tracked.iSteps : tracked.iSteps - iDue ) )
+        {
+            return false;
+        }
+
+        tracked.iSteps = iDue;
+
+        return true;
+    }
+
+    bool finishSwipe( int64_t iTimestamp, const GestureData& swipe )
+    {
+        const Leap::Vector& v = swipe.vDirection;
+
+        if ( std::fabs( v.x ) >= std::fabs( v.y ) )
+        {
+            return post( iTimestamp, PaintCommand::kCommand_Undo, (v.x < 0.0f) ? 1 : -1 );
+        }
+
+        return (v.y < 0.0f) && post( iTimestamp, PaintCommand::kCommand_Clear, 0 );
+    }
+
+    bool post( int64_t iTimestamp, PaintCommand::Type eType, int32_t iAmount )
+    {
+        PaintCommand command;
+        command.iTimestamp  = iTimestamp;
+        command.iAmount     = iAmount;
+        command.uiType      = eType;
+
+        if ( !m_queue.push( command ) )
+        {
+            PAINT_LOG( kLog_Warning, 1, "command ring full, {} commands dropped so far", m_queue.droppedCount() );
+            return false;
+        }
+
+        PAINT_LOG( kLog_Debug, 0, "gesture command {} amount {}", static_cast<uint32_t>(eType), iAmount );
+
+        return true;
+    }
+
+private:
+    CommandQueue&       m_queue;
+    GestureSettings     m_settings;
+    Tracked             m_aTracked[kMaxTracked];
+    uint32_t            m_uiNumTracked;
+    bool                m_bPenLifted;
+};
+
+} // namespace LeapPaint
+
+#endif // __GestureCommands_h__
@@ -0,0 +1,533 @@
+/******************************************************************************\
+* LeapPaint3D job system.
+*
+* A pool of worker threads, by default one per core besides the render thread,
+* runs graphs of jobs.  A job is queued once every job it depends on has
+* finished, by whichever thread finished the last of them, so a frame's work
+* is described once as a JobGraph and started in one go.
+*
+* Every worker owns a Chase-Lev deque per priority: it pushes and pops jobs at
+* the bottom, so the jobs it just made ready run while their inputs are still
+* in its cache, and idle workers steal from the top of the others'.  Threads
+* outside the pool queue on a shared list instead.  A thread waiting for a
+* graph runs jobs meanwhile rather than block.
+*
+* Frame jobs go before background ones everywhere, and a thread waiting on a
+* frame graph only helps with frame jobs, so the render thread never finds
+* itself encoding an export batch.
+*
+* A graph may also be started and polled: once isDone() returns true,
+* everything its jobs wrote is visible to the polling thread.  That is how
+* results computed in the background are handed to the renderer without locks.
+\******************************************************************************/
+
+#if !defined(__JobSystem_h__)
+#define __JobSystem_h__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LeapPaint {
+
+enum JobPriority
+{
+    kJobPriority_Frame,
+    kJobPriority_Background,
+    kNumJobPriorities
+};
+
+/// jobs and the order between them.  must not change between being started
+/// and being done, and must not contain cycles.  clear() keeps the storage, so
+/// a graph rebuilt every frame stops allocating once warm.
+class JobGraph
+{
+public:
+    typedef uint32_t JobId;
+
+    explicit JobGraph( JobPriority ePriority = kJobPriority_Frame )
+      : m_ePriority(ePriority),
+        m_uiNumJobs(0),
+        m_uiRemaining(0)
+    {}
+
+    void clear() { m_uiNumJobs = 0; }
+
+    JobId add( std::function<void()> fn )
+    {
+        if ( m_uiNumJobs == m_jobs.size() )
+        {
+            m_jobs.emplace_back();
+        }
+
+        Job& job = m_jobs[m_uiNumJobs];
+        job.fn                  = std::move( fn );
+        job.uiNumDependencies   = 0;
+        job.pGraph              = this;
+        job.successors.clear();
+
+        return m_uiNumJobs++;
+    }
+
+    /// uiThen doesn't start before uiFirst has finished.
+    void precede( JobId uiFirst, JobId uiThen )
+    {
+        m_jobs[uiFirst].successors.push_back( uiThen );
+        m_jobs[uiThen].uiNumDependencies++;
+    }
+
+    uint32_t    size() const        { return m_uiNumJobs; }
+    JobPriority priority() const    { return m_ePriority; }
+
+    /// true once every job of the last start has finished, or nothing was started.
+    bool        isDone() const      { return m_uiRemaining.load( std::memory_order_acquire ) == 0; }
+
+private:
+    friend class JobSystem;
+
+    struct Job
+    {
+        Job() : uiNumDependencies(0), uiPending(0), pGraph(nullptr) {}
+
+        std::function<void()>   fn;
+        std::vector<JobId>      successors;
+        uint32_t                uiNumDependencies;
+        std::atomic<uint32_t>   uiPending;          ///< dependencies yet to finish
+        JobGraph*               pGraph;
+    };
+
+    JobPriority             m_ePriority;
+    std::deque<Job>         m_jobs;                 ///< only grows, so jobs never move
+    uint32_t                m_uiNumJobs;
+    std::atomic<uint32_t>   m_uiRemaining;
+};
+
+/// Chase-Lev deque of a fixed capacity, memory orders as in Le et al.,
+/// "Correct and Efficient Work-Stealing for Weak Memory Models".  the owning
+/// thread pushes and pops at the bottom, any thread steals from the top.
+template<typename T, uint32_t kCapacity>
+class WorkStealingDeque
+{
+    static_assert( (kCapacity & (kCapacity - 1)) == 0, "WorkStealingDeque capacity must be a power of two" );
+
+public:
+    WorkStealingDeque() : m_iTop(0), m_iBottom(0)
+    {
+        for ( uint32_t i = 0; i < kCapacity; i++ )
+        {
+            m_apItems[i].store( nullptr, std::memory_order_relaxed );
+        }
+    }
+
+    /// owner side.  false when full.
+    bool push( T* pItem )
+    {
+        const int64_t iBottom   = m_iBottom.load( std::memory_order_relaxed );
+        const int64_t iTop      = m_iTop.load( std::memory_order_acquire );
+
+        if ( iBottom - iTop >= kCapacity )
+        {
+            return false;
+        }
+
+        m_apItems[iBottom & (kCapacity - 1)].store( pItem, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        m_iBottom.store( iBottom + 1, std::memory_order_relaxed );
+
+        return true;
+    }
+
+    /// owner side, newest first.
+    T* pop()
+    {
+        const int64_t iBottom = m_iBottom.load( std::memory_order_relaxed ) - 1;
+
+        m_iBottom.store( iBottom, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        int64_t iTop = m_iTop.load( std::memory_order_relaxed );
+
+        if ( iTop > iBottom )
+        {
+            m_iBottom.store( iBottom + 1, std::memory_order_relaxed );
+            return nullptr;
+        }
+
+        T* pItem = m_apItems[iBottom & (kCapacity - 1)].load( std::memory_order_relaxed );
+
+        if ( iTop == iBottom )
+        {
+            // the last item, a thief may be taking it too.
+            if ( !m_iTop.compare_exchange_strong( iTop, iTop + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+            {
+                pItem = nullptr;
+            }
+
+            m_iBottom.store( iBottom + 1, std::memory_order_relaxed );
+        }
+
+        return pItem;
+    }
+
+    /// any thread, oldest first.  null when empty or another thief won.
+    T* steal()
+    {
+        int64_t iTop = m_iTop.load( std::memory_order_acquire );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        const int64_t iBottom = m_iBottom.load( std::memory_order_acquire );
+
+        if ( iTop >= iBottom )
+        {
+            return nullptr;
+        }
+
+        T* pItem = m_apItems[iTop & (kCapacity - 1)].load( std::memory_order_relaxed );
+
+        if ( !m_iTop.compare_exchange_strong( iTop, iTop + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+        {
+            return nullptr;
+        }
+
+        return pItem;
+    }
+
+private:
+    std::atomic<int64_t>    m_iTop;
+    char                    m_acPad[64];        ///< thieves and the owner write different lines
+    std::atomic<int64_t>    m_iBottom;
+    std::atomic<T*>         m_apItems[kCapacity];
+};
+
+class JobSystem
+{
+public:
+    enum
+    {
+        kDequeCapacity  = 1024,     ///< per worker and priority, more spills to the shared list
+        kIdleSpins      = 64        ///< looks for work this often before sleeping
+    };
+
+    /// uiNumWorkers 0 for one per core besides the calling thread.  there is
+    /// always at least one, so started graphs finish without anyone waiting.
+    explicit JobSystem( uint32_t uiNumWorkers = 0 )
+      : m_uiEpoch(0),
+        m_uiNumSleeping(0),
+        m_bQuit(false)
+    {
+        if ( uiNumWorkers == 0 )
+        {
+            uiNumWorkers = std::max( 2u, std::thread::hardware_concurrency() ) - 1;
+        }
+
+        for ( uint32_t p = 0; p < kNumJobPriorities; p++ )
+        {
+            m_auiNumShared[p].store( 0, std::memory_order_relaxed );
+        }
+
+        for ( uint32_t i = 0; i < uiNumWorkers; i++ )
+        {
+            m_workers.push_back( std::unique_ptr<Worker>( new Worker( this, i ) ) );
+        }
+
+        // every worker exists before any of them looks for work to steal.
+        for ( uint32_t i = 0; i < uiNumWorkers; i++ )
+        {
+            Worker* pWorker = m_workers[i].get();
+            pWorker->thread = std::thread( [this, pWorker]() { workerLoop( *pWorker ); } );
+        }
+    }
+
+    /// graphs still running are abandoned, finish them first.
+    ~JobSystem()
+    {
+        m_bQuit.store( true );
+        wake();
+
+        for ( size_t i = 0; i < m_workers.size(); i++ )
+        {
+            m_workers[i]->thread.join();
+        }
+    }
+
+    uint32_t workerCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+    /// threads that run a graph's jobs while someone waits for it.
+    uint32_t concurrency() const { return workerCount() + 1; }
+
+    /// queues the jobs without dependencies and returns.
+    void start( JobGraph& graph )
+    {
+        const uint32_t uiNumJobs = graph.m_uiNumJobs;
+
+        graph.m_uiRemaining.store( uiNumJobs, std::memory_order_relaxed );
+
+        for ( uint32_t i = 0; i < uiNumJobs; i++ )
+        {
+            graph.m_jobs[i].uiPending.store( graph.m_jobs[i].uiNumDependencies, std::memory_order_relaxed );
+        }
+
+        // queueing publishes the counts above to whoever runs the jobs.
+        for ( uint32_t i = 0; i < uiNumJobs; i++ )
+        {
+            if ( graph.m_jobs[i].uiNumDependencies == 0 )
+            {
+                queue( graph.m_jobs[i] );
+            }
+        }
+    }
+
+    /// returns once the graph is done, running jobs of its priority or more
+    /// urgent meanwhile.
+    void wait( JobGraph& graph )
+    {
+        Worker* pSelf = currentWorker();
+
+        if ( pSelf && pSelf->pSystem != this )
+        {
+            pSelf = nullptr;
+        }
+
+        while ( !graph.isDone() )
+        {
+            const uint32_t uiEpoch = m_uiEpoch.load( std::memory_order_acquire );
+
+            if ( JobGraph::Job* pJob = find( pSelf, graph.m_ePriority ) )
+            {
+                execute( *pJob );
+            }
+            else if ( !graph.isDone() )
+            {
+                idle( uiEpoch );
+            }
+        }
+    }
+
+    void run( JobGraph& graph )
+    {
+        start( graph );
+        wait( graph );
+    }
+
+    /// fn( uiBegin, uiEnd ) over pieces of 0 .. uiCount - 1 no smaller than
+    /// uiGrain, a few per thread so uneven pieces even out.  without a job
+    /// system the whole range runs here.
+    template<typename Fn>
+    static void parallelFor( JobSystem* pJobs, uint32_t uiCount, uint32_t uiGrain, Fn fn, JobPriority ePriority = kJobPriority_Frame )
+    {
+        uiGrain = std::max( 1u, uiGrain );
+
+        if ( !pJobs || uiCount <= uiGrain )
+        {
+            if ( uiCount > 0 )
+            {
+                fn( 0u, uiCount );
+            }
+
+            return;
+        }
+
+        const uint32_t  uiNumPieces = std::min( (uiCount + uiGrain - 1) / uiGrain, 4 * pJobs->concurrency() );
+        JobGraph        graph( ePriority );
+
+        for ( uint32_t p = 0; p < uiNumPieces; p++ )
+        {
+            const uint32_t uiBegin  = static_cast<uint32_t>( uint64_t(uiCount) * p / uiNumPieces );
+            const uint32_t uiEnd    = static_cast<uint32_t>( uint64_t(uiCount) * (p + 1) / uiNumPieces );
+
+            graph.add( [&fn, uiBegin, uiEnd]() { fn( uiBegin, uiEnd ); } );
+        }
+
+        pJobs->run( graph );
+    }
+
+private:
+    typedef WorkStealingDeque<JobGraph::Job, kDequeCapacity> Deque;
+
+    struct Worker
+    {
+        Worker( JobSystem* pOwner, uint32_t uiOwnIndex ) : pSystem(pOwner), uiIndex(uiOwnIndex) {}
+
+        JobSystem*      pSystem;
+        uint32_t        uiIndex;
+        Deque           aDeques[kNumJobPriorities];
+        std::thread     thread;
+    };
+
+    static Worker*& currentWorker()
+    {
+        static thread_local Worker* s_pWorker = nullptr;
+        return s_pWorker;
+    }
+
+    void workerLoop( Worker& self )
+    {
+        currentWorker() = &self;
+
+        while ( !m_bQuit.load( std::memory_order_acquire ) )
+        {
+            const uint32_t uiEpoch = m_uiEpoch.load( std::memory_order_acquire );
+
+            if ( JobGraph::Job* pJob = find( &self, kJobPriority_Background ) )
+            {
+                execute( *pJob );
+            }
+            else
+            {
+                idle( uiEpoch );
+            }
+        }
+    }
+
+    /// on the worker's own deque if it is one of ours with room, else shared.
+    void queue( JobGraph::Job& job )
+    {
+        const JobPriority   ePriority   = job.pGraph->m_ePriority;
+        Worker*             pSelf       = currentWorker();
+
+        if ( !pSelf || pSelf->pSystem != this || !pSelf->aDeques[ePriority].push( &job ) )
+        {
+            std::lock_guard<std::mutex> lock( m_sharedMutex );
+            m_aShared[ePriority].push_back( &job );
+            m_auiNumShared[ePriority].fetch_add( 1, std::memory_order_release );
+        }
+
+        wake();
+    }
+
+    /// the most urgent job up to eMaxPriority: own deque, then the shared
+    /// list, then the other workers' deques.
+    JobGraph::Job* find( Worker* pSelf, JobPriority eMaxPriority )
+    {
+        const uint32_t uiNumWorkers = static_cast<uint32_t>(m_workers.size());
+
+        for ( uint32_t p = 0; p <= static_cast<uint32_t>(eMaxPriority); p++ )
+        {
+            if ( pSelf )
+            {
+                if ( JobGraph::Job* pJob = pSelf->aDeques[p].pop() )
+                {
+                    return pJob;
+                }
+            }
+
+            if ( m_auiNumShared[p].load( std::memory_order_acquire ) > 0 )
+            {
+                std::lock_guard<std::mutex> lock( m_sharedMutex );
+
+                if ( !m_aShared[p].empty() )
+                {
+                    JobGraph::Job* pJob = m_aShared[p].front();
+
+                    m_aShared[p].pop_front();
+                    m_auiNumShared[p].fetch_sub( 1, std::memory_order_relaxed );
+
+                    return pJob;
+                }
+            }
+
+            // victims from the next worker on, so thieves spread out.
+            const uint32_t uiFirst = pSelf ? pSelf->uiIndex + 1 : 0;
+
+            for ( uint32_t i = 0; i < uiNumWorkers; i++ )
+            {
+                Worker& victim = *m_workers[(uiFirst + i) % uiNumWorkers];
+
+                if ( &victim == pSelf )
+                {
+                    continue;
+                }
+
+                if ( JobGraph::Job* pJob = victim.aDeques[p].steal() )
+                {
+                    return pJob;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    void execute( JobGraph::Job& job )
+    {
+        job.fn();
+
+        JobGraph& graph = *job.pGraph;
+
+        for ( size_t i = 0; i < job.successors.size(); i++ )
+        {
+            JobGraph::Job& next = graph.m_jobs[job.successors[i]];
+
+            if ( next.uiPending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            {
+                queue( next );
+            }
+        }
+
+        // the graph may be gone as soon as this reaches 0.
+        if ( graph.m_uiRemaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        {
+            wake();
+        }
+    }
+
+    /// new jobs and finished graphs both move the epoch on.
+    void wake()
+    {
+        m_uiEpoch.fetch_add( 1, std::memory_order_seq_cst );
+
+        if ( m_uiNumSleeping.load( std::memory_order_seq_cst ) > 0 )
+        {
+            std::lock_guard<std::mutex> lock( m_sleepMutex );
+            m_wakeup.notify_all();
+        }
+    }
+
+    /// returns once the epoch moved past uiEpoch, or the pool is closing.
+    void idle( uint32_t uiEpoch )
+    {
+        for ( uint32_t i = 0; i < kIdleSpins; i++ )
+        {
+            if ( m_uiEpoch.load( std::memory_order_acquire ) != uiEpoch || m_bQuit.load( std::memory_order_relaxed ) )
+            {
+                return;
+            }
+
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock( m_sleepMutex );
+
+        // counted before the epoch is checked again, so wake() either sees a
+        // sleeper or this sees its epoch.
+        m_uiNumSleeping.fetch_add( 1, std::memory_order_seq_cst );
+
+        while ( m_uiEpoch.load( std::memory_order_seq_cst ) == uiEpoch && !m_bQuit.load( std::memory_order_relaxed ) )
+        {
+            m_wakeup.wait( lock );
+        }
+
+        m_uiNumSleeping.fetch_sub( 1, std::memory_order_relaxed );
+    }
+
+private:
+    std::vector< std::unique_ptr<Worker> >  m_workers;
+    std::mutex                              m_sharedMutex;
+    std::deque<JobGraph::Job*>              m_aShared[kNumJobPriorities];      ///< queued by threads outside the pool
+    std::atomic<uint32_t>                   m_auiNumShared[kNumJobPriorities];
+    std::atomic<uint32_t>                   m_uiEpoch;
+    std::atomic<uint32_t>                   m_uiNumSleeping;
+    std::atomic<bool>                       m_bQuit;
+    std::mutex                              m_sleepMutex;
+    std::condition_variable                 m_wakeup;
+};
+
+} // namespace LeapPaint
+
+#endif // __JobSystem_h__
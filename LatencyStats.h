@@ -0,0 +1,310 @@
+/******************************************************************************\
+* LeapPaint3D latency statistics.
+*
+* The newest fingertip sample of each render frame is followed from the device
+* to the screen:
+*
+*   tracking    device timestamp to the listener receiving the frame
+*   queue       receipt to the render thread ingesting the sample
+*   render      ingest to the last GL call of the frame being issued
+*   present     last GL call to the buffer swap returning
+*   total       receipt to the buffer swap returning
+*
+* The device clock has no known offset to the host clock, so tracking is
+* measured above the fastest delivery seen: it shows jitter and stalls in the
+* tracking service, not its fixed latency.  The swap is not observable from
+* the renderer either; it is taken as the start of the next frame, when that
+* comes soon enough to be the render loop going round again.
+*
+* Every stage keeps a log-linear histogram, HdrHistogram style, of atomic
+* counters, so any thread records into it and reads it without locks.
+\******************************************************************************/
+
+#if !defined(__LatencyStats_h__)
+#define __LatencyStats_h__
+
+#include "PaintLog.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+namespace LeapPaint {
+
+/// nanosecond durations.  values below 2^kSubBits are exact, every power of
+/// two range above splits into 2^kSubBits buckets, so any value is known to
+/// within about 3%.  values past 2^kMaxBits ns (18 minutes) are clamped.
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        kSubBits    = 5,
+        kSubBuckets = 1 << kSubBits,
+        kMaxBits    = 40,
+        kNumBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets
+    };
+
+    LatencyHistogram() { reset(); }
+
+    void record( int64_t iNanos )
+    {
+        const uint64_t uiNanos = static_cast<uint64_t>( std::max<int64_t>( 0, iNanos ) );
+
+        m_auiCounts[bucket( uiNanos )].fetch_add( 1, std::memory_order_relaxed );
+        m_uiCount.fetch_add( 1, std::memory_order_relaxed );
+
+        uint64_t uiMax = m_uiMax.load( std::memory_order_relaxed );
+
+        while ( uiNanos > uiMax && !m_uiMax.compare_exchange_weak( uiMax, uiNanos, std::memory_order_relaxed ) )
+        {
+        }
+    }
+
+    /// not atomic as a whole: values recorded meanwhile may be kept or not.
+    void reset()
+    {
+        for ( uint32_t i = 0; i < kNumBuckets; i++ )
+        {
+            m_auiCounts[i].store( 0, std::memory_order_relaxed );
+        }
+
+        m_uiCount.store( 0, std::memory_order_relaxed );
+        m_uiMax.store( 0, std::memory_order_relaxed );
+    }
+
+    uint64_t count() const  { return m_uiCount.load( std::memory_order_relaxed ); }
+    uint64_t max() const    { return m_uiMax.load( std::memory_order_relaxed ); }
+
+    /// upper bound of the bucket holding the given fraction of the values,
+    /// 0 while empty.
+    uint64_t percentile( double fFraction ) const
+    {
+        const uint64_t uiCount = count();
+
+        if ( uiCount == 0 )
+        {
+            return 0;
+        }
+
+        const uint64_t uiRank = static_cast<uint64_t>( fFraction * static_cast<double>(uiCount - 1) ) + 1;
+        uint64_t       uiSeen = 0;
+
+        for ( uint32_t i = 0; i < kNumBuckets; i++ )
+        {
+            uiSeen += m_auiCounts[i].load( std::memory_order_relaxed );
+
+            if ( uiSeen >= uiRank )
+            {
+                return std::min( upperBound( i ), max() );
+            }
+        }
+
+        return max();
+    }
+
+    uint64_t bucketCount( uint32_t uiBucket ) const { return m_auiCounts[uiBucket].load( std::memory_order_relaxed ); }
+
+    /// largest value that lands in a bucket.
+    static uint64_t upperBound( uint32_t uiBucket )
+    {
+        if ( uiBucket < 2 * kSubBuckets )
+        {
+            return uiBucket;
+        }
+
+        const uint32_t uiShift = uiBucket / kSubBuckets - 1;
+        return ((static_cast<uint64_t>(uiBucket % kSubBuckets + kSubBuckets) + 1) << uiShift) - 1;
+    }
+
+    static uint32_t bucket( uint64_t uiNanos )
+    {
+        if ( uiNanos < 2 * kSubBuckets )
+        {
+            return static_cast<uint32_t>(uiNanos);
+        }
+
+        uiNanos = std::min<uint64_t>( uiNanos, (uint64_t(1) << kMaxBits) - 1 );
+
+        // highest set bit, at least kSubBits + 1 here.
+        uint32_t uiBit = 0;
+
+        for ( uint32_t uiStep = 32; uiStep > 0; uiStep >>= 1 )
+        {
+            if ( uiNanos >> (uiBit + uiStep) )
+            {
+                uiBit += uiStep;
+            }
+        }
+
+        const uint32_t uiShift = uiBit - kSubBits;
+        return (uiShift + 1) * kSubBuckets + static_cast<uint32_t>(uiNanos >> uiShift) - kSubBuckets;
+    }
+
+private:
+    std::atomic<uint64_t>   m_auiCounts[kNumBuckets];
+    std::atomic<uint64_t>   m_uiCount;
+    std::atomic<uint64_t>   m_uiMax;
+};
+
+/// the histograms of every stage, and the bookkeeping that feeds them.
+/// received() belongs to the thread delivering tracking frames, the frame
+/// methods to the render thread.  anything may read or reset.
+class LatencyMonitor
+{
+public:
+    enum Stage
+    {
+        kStage_Tracking,
+        kStage_Queue,
+        kStage_Render,
+        kStage_Present,
+        kStage_Total,
+        kNumStages
+    };
+
+    /// a frame starting later than this after the last one was submitted
+    /// means the renderer sat idle, so the swap time is unknown.
+    enum { kMaxPresentNanos = 50000000 };
+
+    LatencyMonitor()
+      : m_iDeviceOffset(0),
+        m_bHaveOffset(false),
+        m_iReceived(0),
+        m_iIngested(0),
+        m_iSubmitted(0)
+    {}
+
+    static int64_t now() { return static_cast<int64_t>( logTicksNs() ); }
+
+    static const char* stageName( Stage eStage )
+    {
+        static const char* s_aszNames[kNumStages] = { "tracking", "queue", "render", "present", "total" };
+        return s_aszNames[eStage];
+    }
+
+    const LatencyHistogram& histogram( Stage eStage ) const { return m_aHistograms[eStage]; }
+
+    void reset()
+    {
+        for ( uint32_t i = 0; i < kNumStages; i++ )
+        {
+            m_aHistograms[i].reset();
+        }
+    }
+
+    /// a tracking frame stamped iDeviceMicros by the device arrived at iNow.
+    void received( int64_t iDeviceMicros, int64_t iNow )
+    {
+        const int64_t iOffset = iNow - iDeviceMicros * 1000;
+
+        // the fastest delivery so far, let go of slowly so the two clocks
+        // drifting apart doesn't count as latency.
+        if ( !m_bHaveOffset || iOffset < m_iDeviceOffset )
+        {
+            m_iDeviceOffset = iOffset;
+            m_bHaveOffset   = true;
+        }
+        else
+        {
+            m_iDeviceOffset += 100;
+        }
+
+        m_aHistograms[kStage_Tracking].record( iOffset - m_iDeviceOffset );
+    }
+
+    /// a render frame starts: the previous one has been swapped.
+    void beginFrame( int64_t iNow )
+    {
+        if ( m_iSubmitted != 0 && iNow - m_iSubmitted < kMaxPresentNanos )
+        {
+            m_aHistograms[kStage_Present].record( iNow - m_iSubmitted );
+
+            if ( m_iReceived != 0 )
+            {
+                m_aHistograms[kStage_Total].record( iNow - m_iReceived );
+            }
+        }
+
+        m_iReceived     = 0;
+        m_iIngested     = 0;
+        m_iSubmitted    = 0;
+    }
+
+    /// the newest sample of this frame, received at iReceived, was ingested.
+    void ingested( int64_t iReceived, int64_t iNow )
+    {
+        m_aHistograms[kStage_Queue].record( iNow - iReceived );
+
+        m_iReceived = iReceived;
+        m_iIngested = iNow;
+    }
+
+    /// the frame's GL calls are all issued.
+    void submitted( int64_t iNow )
+    {
+        if ( m_iIngested != 0 )
+        {
+            m_aHistograms[kStage_Render].record( iNow - m_iIngested );
+        }
+
+        m_iSubmitted = iNow;
+    }
+
+    /// every stage with its percentiles and non-empty buckets, as one JSON
+    /// object.
+    bool writeJson( FILE* pFile ) const
+    {
+        fprintf( pFile, "{\"unit\":\"ns\",\"stages\":{" );
+
+        for ( uint32_t s = 0; s < kNumStages; s++ )
+        {
+            const LatencyHistogram& h = m_aHistograms[s];
+
+            fprintf( pFile, "%s\"%s\":{\"count\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu,\"buckets\":[",
+                     s ? "," : "", stageName( static_cast<Stage>(s) ),
+                     static_cast<unsigned long long>(h.count()),
+                     static_cast<unsigned long long>(h.percentile( 0.5 )),
+                     static_cast<unsigned long long>(h.percentile( 0.9 )),
+                     static_cast<unsigned long long>(h.percentile( 0.99 )),
+                     static_cast<unsigned long long>(h.percentile( 0.999 )),
+                     static_cast<unsigned long long>(h.max()) );
+
+            // [upper bound, count] pairs.
+            bool bFirst = true;
+
+            for ( uint32_t i = 0; i < LatencyHistogram::kNumBuckets; i++ )
+            {
+                if ( const uint64_t uiCount = h.bucketCount( i ) )
+                {
+                    fprintf( pFile, "%s[%llu,%llu]", bFirst ? "" : ",",
+                             static_cast<unsigned long long>(LatencyHistogram::upperBound( i )),
+                             static_cast<unsigned long long>(uiCount) );
+                    bFirst = false;
+                }
+            }
+
+            fprintf( pFile, "]}" );
+        }
+
+        fprintf( pFile, "}}\n" );
+
+        return !ferror( pFile );
+    }
+
+private:
+    LatencyHistogram    m_aHistograms[kNumStages];
+
+    // tracking frames.
+    int64_t             m_iDeviceOffset;    ///< host minus device time of the fastest delivery, ns
+    bool                m_bHaveOffset;
+
+    // the render frame in progress, or the last one until the next begins.
+    int64_t             m_iReceived;
+    int64_t             m_iIngested;
+    int64_t             m_iSubmitted;
+};
+
+} // namespace LeapPaint
+
+#endif // __LatencyStats_h__
@@ -0,0 +1,542 @@
+/******************************************************************************\
+* LeapPaint3D asynchronous logging.
+*
+* PAINT_LOG() only copies its arguments into a lock-free ring owned by the
+* calling thread.  A background thread drains every ring and does the actual
+* formatting and I/O, either as text or as a compact binary stream that can be
+* decoded later.  Each call site can be rate limited to N messages per second;
+* suppressed messages are counted and reported with the next one let through.
+*
+*   PAINT_LOG( LeapPaint::kLog_Debug, 10, "frame {} hands {}", frame.id(), n );
+*
+* Format strings and string arguments must be literals (or otherwise outlive
+* the logger) since only the pointer is queued.
+\******************************************************************************/
+
+#if !defined(__PaintLog_h__)
+#define __PaintLog_h__
+
+#include "LeapMath.h"
+#include "SampleRing.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace LeapPaint {
+
+enum LogLevel
+{
+    kLog_Trace,
+    kLog_Debug,
+    kLog_Info,
+    kLog_Warning,
+    kLog_Error,
+    kLog_NumLevels
+};
+
+enum LogMode
+{
+    kLogMode_Text,
+    kLogMode_Binary
+};
+
+inline uint64_t logTicksNs()
+{
+    return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+/// one queued argument.
+struct LogArg
+{
+    enum Type { kType_Int, kType_Float, kType_String, kType_Vector };
+
+    uint32_t uiType;
+    union
+    {
+        int64_t     iValue;
+        double      fValue;
+        const char* szValue;
+        float       afVector[3];
+    };
+
+    LogArg() : uiType(kType_Int), iValue(0) {}
+    LogArg( int v )                 : uiType(kType_Int), iValue(v) {}
+    LogArg( unsigned v )            : uiType(kType_Int), iValue(v) {}
+    LogArg( long v )                : uiType(kType_Int), iValue(v) {}
+    LogArg( unsigned long v )       : uiType(kType_Int), iValue(static_cast<int64_t>(v)) {}
+    LogArg( long long v )           : uiType(kType_Int), iValue(v) {}
+    LogArg( unsigned long long v )  : uiType(kType_Int), iValue(static_cast<int64_t>(v)) {}
+    LogArg( bool v )                : uiType(kType_Int), iValue(v ? 1 : 0) {}
+    LogArg( float v )               : uiType(kType_Float), fValue(v) {}
+    LogArg( double v )              : uiType(kType_Float), fValue(v) {}
+    LogArg( const char* v )         : uiType(kType_String), szValue(v) {}
+    LogArg( const Leap::Vector& v ) : uiType(kType_Vector) { afVector[0] = v.x; afVector[1] = v.y; afVector[2] = v.z; }
+};
+
+/// static per call site data, created by the PAINT_LOG macro.
+class LogSite
+{
+public:
+    LogSite( LogLevel level, uint32_t uiMaxPerSecond, const char* szFormat, const char* szFile, int iLine )
+      : m_level(level),
+        m_uiMaxPerSecond(uiMaxPerSecond),
+        m_szFormat(szFormat),
+        m_szFile(szFile),
+        m_iLine(iLine),
+        m_uiId(nextId()),
+        m_uiWindowStart(0),
+        m_uiWindowCount(0),
+        m_uiSuppressed(0)
+    {}
+
+    /// false when the site already used up its budget for the current second.
+    bool admit( uint64_t uiNowNs )
+    {
+        if ( m_uiMaxPerSecond == 0 )
+        {
+            return true;
+        }
+
+        uint64_t uiStart = m_uiWindowStart.load( std::memory_order_relaxed );
+
+        if ( uiNowNs - uiStart >= 1000000000ull &&
+             m_uiWindowStart.compare_exchange_strong( uiStart, uiNowNs, std::memory_order_relaxed ) )
+        {
+            m_uiWindowCount.store( 0, std::memory_order_relaxed );
+        }
+
+        if ( m_uiWindowCount.fetch_add( 1, std::memory_order_relaxed ) >= m_uiMaxPerSecond )
+        {
+            m_uiSuppressed.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+
+        return true;
+    }
+
+    uint32_t takeSuppressed() { return m_uiSuppressed.exchange( 0, std::memory_order_relaxed ); }
+
+    LogLevel        level() const   { return m_level; }
+    const char*     format() const  { return m_szFormat; }
+    const char*     file() const    { return m_szFile; }
+    int             line() const    { return m_iLine; }
+    uint32_t        id() const      { return m_uiId; }
+
+private:
+    static uint32_t nextId()
+    {
+        static std::atomic<uint32_t> s_uiNextId( 0 );
+        return s_uiNextId.fetch_add( 1 );
+    }
+
+    const LogLevel          m_level;
+    const uint32_t          m_uiMaxPerSecond;
+    const char* const       m_szFormat;
+    const char* const       m_szFile;
+    const int               m_iLine;
+    const uint32_t          m_uiId;
+    std::atomic<uint64_t>   m_uiWindowStart;
+    std::atomic<uint32_t>   m_uiWindowCount;
+    std::atomic<uint32_t>   m_uiSuppressed;
+};
+
+class Logger
+{
+public:
+    enum { kMaxArgs = 6, kRingSize = 2048 };
+
+    struct Record
+    {
+        LogSite*    pSite;
+        uint64_t    uiTimestampNs;
+        uint32_t    uiSuppressed;
+        uint32_t    uiNumArgs;
+        LogArg      aArgs[kMaxArgs];
+    };
+
+    static Logger& instance()
+    {
+        static Logger s_logger;
+        return s_logger;
+    }
+
+    ~Logger() { stop(); }
+
+    void setLevel( LogLevel level )     { m_level.store( level, std::memory_order_relaxed ); }
+    bool isEnabled( LogLevel level ) const { return level >= m_level.load( std::memory_order_relaxed ); }
+
+    /// starts the writer thread.  pFile is not closed by the logger.
+    void start( FILE* pFile, LogMode mode = kLogMode_Text )
+    {
+        stop();
+
+        m_pFile = pFile;
+        m_mode  = mode;
+        m_sitesWritten.clear();
+        m_bRunning.store( true );
+
+        if ( m_mode == kLogMode_Binary )
+        {
+            const uint32_t uiVersion = 1;
+            fwrite( "LPLG", 1, 4, m_pFile );
+            fwrite( &uiVersion, sizeof(uiVersion), 1, m_pFile );
+        }
+
+        m_writer = std::thread( [this]() { writerLoop(); } );
+    }
+
+    /// drains whatever is still queued and joins the writer.
+    void stop()
+    {
+        if ( m_writer.joinable() )
+        {
+            m_bRunning.store( false );
+            m_writer.join();
+        }
+    }
+
+    template<typename... Args>
+    void post( LogSite& site, const Args&... args )
+    {
+        const uint64_t uiNow = logTicksNs();
+
+        if ( !site.admit( uiNow ) )
+        {
+            return;
+        }
+
+        static_assert( sizeof...(Args) <= kMaxArgs, "too many PAINT_LOG arguments" );
+
+        Record record;
+        const LogArg aArgs[] = { LogArg(), LogArg(args)... };
+
+        record.pSite            = &site;
+        record.uiTimestampNs    = uiNow;
+        record.uiSuppressed     = site.takeSuppressed();
+        record.uiNumArgs        = sizeof...(Args);
+
+        for ( uint32_t i = 0; i < record.uiNumArgs; i++ )
+        {
+            record.aArgs[i] = aArgs[i + 1];
+        }
+
+        threadRing().push( record );
+    }
+
+    /// records lost because a thread's ring was full.
+    uint32_t droppedCount()
+    {
+        std::lock_guard<std::mutex> lock( m_ringsMutex );
+
+        uint32_t uiDropped = m_uiRetiredDropped;
+
+        for ( size_t i = 0; i < m_rings.size(); i++ )
+        {
+            uiDropped += m_rings[i]->ring.droppedCount();
+        }
+
+        return uiDropped;
+    }
+
+private:
+    typedef SpscRing<Record, kRingSize> Ring;
+
+    struct ThreadRing
+    {
+        ThreadRing() : bRetired(false) {}
+
+        Ring                ring;
+        std::atomic<bool>   bRetired;   ///< its thread has exited
+    };
+
+    /// retires the ring when its thread exits; shared so that this stays safe
+    /// for threads outliving the logger.
+    struct RingOwner
+    {
+        ~RingOwner()
+        {
+            if ( pRing )
+            {
+                pRing->bRetired.store( true, std::memory_order_release );
+            }
+        }
+
+        std::shared_ptr<ThreadRing> pRing;
+    };
+
+    Logger() : m_level(kLog_Info), m_pFile(nullptr), m_mode(kLogMode_Text), m_bRunning(false), m_uiBaseNs(logTicksNs()), m_uiRetiredDropped(0) {}
+
+    /// the ring is created and registered the first time a thread logs, which
+    /// is the only time the logging path takes a lock.  the writer frees it
+    /// once the thread has exited and the ring is drained.
+    Ring& threadRing()
+    {
+        static thread_local Ring* s_pRing = nullptr;
+
+        if ( !s_pRing )
+        {
+            static thread_local RingOwner s_owner;
+
+            s_owner.pRing = std::make_shared<ThreadRing>();
+            s_pRing = &s_owner.pRing->ring;
+
+            std::lock_guard<std::mutex> lock( m_ringsMutex );
+            m_rings.push_back( s_owner.pRing );
+        }
+
+        return *s_pRing;
+    }
+
+    void writerLoop()
+    {
+        for ( ;; )
+        {
+            const bool bRunning = m_bRunning.load();
+
+            if ( drainAll() == 0 )
+            {
+                if ( !bRunning )
+                {
+                    break;
+                }
+
+                std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+            }
+        }
+
+        fflush( m_pFile );
+    }
+
+    uint32_t drainAll()
+    {
+        std::vector<ThreadRing*> rings;
+
+        {
+            std::lock_guard<std::mutex> lock( m_ringsMutex );
+
+            for ( size_t i = 0; i < m_rings.size(); i++ )
+            {
+                rings.push_back( m_rings[i].get() );
+            }
+        }
+
+        uint32_t            uiNumWritten = 0;
+        uint32_t            uiNumRetired = 0;
+        std::vector<bool>   vbFree( rings.size(), false );
+
+        for ( size_t i = 0; i < rings.size(); i++ )
+        {
+            // retired before the drain means nothing more is coming.
+            vbFree[i] = rings[i]->bRetired.load( std::memory_order_acquire );
+            uiNumRetired += vbFree[i] ? 1 : 0;
+
+            uiNumWritten += rings[i]->ring.drain( [this]( const Record& record )
+            {
+                if ( m_mode == kLogMode_Binary )
+                {
+                    writeBinary( record );
+                }
+                else
+                {
+                    writeText( record );
+                }
+            } );
+        }
+
+        if ( uiNumWritten )
+        {
+            fflush( m_pFile );
+        }
+
+        if ( uiNumRetired )
+        {
+            freeRetired( rings, vbFree );
+        }
+
+        return uiNumWritten;
+    }
+
+    void freeRetired( const std::vector<ThreadRing*>& rings, const std::vector<bool>& vbFree )
+    {
+        std::lock_guard<std::mutex> lock( m_ringsMutex );
+
+        for ( size_t i = 0; i < rings.size(); i++ )
+        {
+            if ( !vbFree[i] )
+            {
+                continue;
+            }
+
+            for ( size_t j = 0; j < m_rings.size(); j++ )
+            {
+                if ( m_rings[j].get() == rings[i] )
+                {
+                    m_uiRetiredDropped += rings[i]->ring.droppedCount();
+                    m_rings[j] = m_rings.back();
+                    m_rings.pop_back();
+                    break;
+                }
+            }
+        }
+    }
+
+    void writeText( const Record& record )
+    {
+        static const char* const s_aszLevels[kLog_NumLevels] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+        const LogSite& site = *record.pSite;
+
+        std::string strLine;
+        char        szBuf[96];
+
+        snprintf( szBuf, sizeof(szBuf), "[%10.4f] %s ", (record.uiTimestampNs - m_uiBaseNs) * 1e-9, s_aszLevels[site.level()] );
+        strLine += szBuf;
+
+        uint32_t uiArg = 0;
+
+        for ( const char* p = site.format(); *p; p++ )
+        {
+            if ( p[0] == '{' && p[1] == '}' && uiArg < record.uiNumArgs )
+            {
+                formatArg( record.aArgs[uiArg++], strLine );
+                p++;
+            }
+            else
+            {
+                strLine += *p;
+            }
+        }
+
+        if ( record.uiSuppressed )
+        {
+            snprintf( szBuf, sizeof(szBuf), " (%u similar suppressed)", record.uiSuppressed );
+            strLine += szBuf;
+        }
+
+        strLine += '\n';
+
+        fwrite( strLine.data(), 1, strLine.size(), m_pFile );
+    }
+
+    static void formatArg( const LogArg& arg, std::string& strOut )
+    {
+        char szBuf[96];
+
+        switch ( arg.uiType )
+        {
+        case LogArg::kType_Int:
+            snprintf( szBuf, sizeof(szBuf), "%lld", static_cast<long long>(arg.iValue) );
+            break;
+        case LogArg::kType_Float:
+            snprintf( szBuf, sizeof(szBuf), "%g", arg.fValue );
+            break;
+        case LogArg::kType_String:
+            strOut += arg.szValue ? arg.szValue : "(null)";
+            return;
+        case LogArg::kType_Vector:
+            snprintf( szBuf, sizeof(szBuf), "(%g, %g, %g)", arg.afVector[0], arg.afVector[1], arg.afVector[2] );
+            break;
+        default:
+            return;
+        }
+
+        strOut += szBuf;
+    }
+
+    /// binary stream: 'S' site definitions the first time a site shows up,
+    /// then 'E' events carrying only the site id and raw argument payloads.
+    void writeBinary( const Record& record )
+    {
+        const LogSite& site = *record.pSite;
+
+        if ( m_sitesWritten.size() <= site.id() )
+        {
+            m_sitesWritten.resize( site.id() + 1, false );
+        }
+
+        if ( !m_sitesWritten[site.id()] )
+        {
+            m_sitesWritten[site.id()] = true;
+
+            const uint8_t   uiTag   = 'S';
+            const uint32_t  uiId    = site.id();
+            const uint8_t   uiLevel = static_cast<uint8_t>(site.level());
+            const int32_t   iLine   = site.line();
+
+            fwrite( &uiTag, 1, 1, m_pFile );
+            fwrite( &uiId, sizeof(uiId), 1, m_pFile );
+            fwrite( &uiLevel, 1, 1, m_pFile );
+            fwrite( &iLine, sizeof(iLine), 1, m_pFile );
+            writeBinaryString( site.file() );
+            writeBinaryString( site.format() );
+        }
+
+        const uint8_t   uiTag       = 'E';
+        const uint32_t  uiId        = site.id();
+        const uint8_t   uiNumArgs   = static_cast<uint8_t>(record.uiNumArgs);
+
+        fwrite( &uiTag, 1, 1, m_pFile );
+        fwrite( &uiId, sizeof(uiId), 1, m_pFile );
+        fwrite( &record.uiTimestampNs, sizeof(record.uiTimestampNs), 1, m_pFile );
+        fwrite( &record.uiSuppressed, sizeof(record.uiSuppressed), 1, m_pFile );
+        fwrite( &uiNumArgs, 1, 1, m_pFile );
+
+        for ( uint32_t i = 0; i < record.uiNumArgs; i++ )
+        {
+            const LogArg&   arg     = record.aArgs[i];
+            const uint8_t   uiType  = static_cast<uint8_t>(arg.uiType);
+
+            fwrite( &uiType, 1, 1, m_pFile );
+
+            switch ( arg.uiType )
+            {
+            case LogArg::kType_Int:     fwrite( &arg.iValue, sizeof(arg.iValue), 1, m_pFile );      break;
+            case LogArg::kType_Float:   fwrite( &arg.fValue, sizeof(arg.fValue), 1, m_pFile );      break;
+            case LogArg::kType_String:  writeBinaryString( arg.szValue );                           break;
+            case LogArg::kType_Vector:  fwrite( arg.afVector, sizeof(arg.afVector), 1, m_pFile );   break;
+            }
+        }
+    }
+
+    void writeBinaryString( const char* sz )
+    {
+        const uint16_t uiLength = sz ? static_cast<uint16_t>(strlen( sz )) : 0;
+
+        fwrite( &uiLength, sizeof(uiLength), 1, m_pFile );
+        fwrite( sz, 1, uiLength, m_pFile );
+    }
+
+private:
+    std::atomic<int>                    m_level;
+    FILE*                               m_pFile;
+    LogMode                             m_mode;
+    std::atomic<bool>                   m_bRunning;
+    const uint64_t                      m_uiBaseNs;
+    std::thread                         m_writer;
+    std::mutex                          m_ringsMutex;
+    std::vector< std::shared_ptr<ThreadRing> > m_rings;
+    uint32_t                            m_uiRetiredDropped;     ///< by rings since freed
+    std::vector<bool>                   m_sitesWritten;
+};
+
+} // namespace LeapPaint
+
+/// level check first so disabled levels cost a single relaxed load.
+#define PAINT_LOG( level, maxPerSecond, format, ... )                                                       \
+    do                                                                                                      \
+    {                                                                                                       \
+        if ( LeapPaint::Logger::instance().isEnabled( level ) )                                             \
+        {                                                                                                   \
+            static LeapPaint::LogSite s_logSite( level, maxPerSecond, format, __FILE__, __LINE__ );         \
+            LeapPaint::Logger::instance().post( s_logSite, ##__VA_ARGS__ );                                 \
+        }                                                                                                   \
+    } while ( 0 )
+
+#endif // __PaintLog_h__
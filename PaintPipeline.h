@@ -0,0 +1,498 @@
+/******************************************************************************\
+* LeapPaint3D capture pipeline.
+*
+* TipCapture runs on the thread delivering tracking frames, filters the tips
+* and turns them into TipSamples on a ring.  StrokeBuilder runs on the render
+* thread and turns the queued samples into strokes.  Neither depends on JUCE
+* or GL, so the benchmarks drive exactly the code the app runs.
+\******************************************************************************/
+
+#if !defined(__PaintPipeline_h__)
+#define __PaintPipeline_h__
+
+#include "CanvasFile.h"
+#include "FrameRecording.h"
+#include "GestureCommands.h"
+#include "LatencyStats.h"
+#include "PaintLog.h"
+#include "SampleRing.h"
+#include "StrokeHistory.h"
+#include "StrokeSimplifier.h"
+#include "StrokeStore.h"
+#include "TipFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace LeapPaint {
+
+typedef SpscRing<TipSample, 16384> SampleQueue;
+
+/// when a pointable paints.  distances are in leap millimetres.
+struct PenSettings
+{
+    enum Mode
+    {
+        kPen_OneFinger,     ///< the finger of every hand showing exactly one finger
+        kPen_Touch          ///< every finger or tool pushed through the touch plane
+    };
+
+    PenSettings() : eMode(kPen_OneFinger), fTouchZ(0.0f), fHysteresis(5.0f) {}
+
+    Mode    eMode;
+    float   fTouchZ;        ///< tips in front of this plane (smaller z) paint
+    float   fHysteresis;    ///< how far back past the plane a tip has to go to lift
+};
+
+/// producer side: every pointable has its own pen, going down and up by the
+/// PenSettings rule.  each pen's samples carry its pointable id.
+class TipCapture
+{
+public:
+    explicit TipCapture( SampleQueue& queue, const TipFilterSettings& settings = TipFilterSettings(), const PenSettings& pen = PenSettings() )
+      : m_queue(queue),
+        m_pen(pen),
+        m_pLatency(nullptr),
+        m_uiNumPensDown(0)
+    {
+        m_filter.configure( settings );
+    }
+
+    /// filtered tips of the last frame.
+    const TipFilter& filter() const { return m_filter; }
+
+    /// frame arrivals are recorded here, if set.
+    void setLatencyMonitor( LatencyMonitor* pLatency ) { m_pLatency = pLatency; }
+
+    uint32_t penDownCount() const { return m_uiNumPensDown; }
+
+    /// true if a sample was queued, which is bound to change the painting.
+    bool onFrame( const FrameData& frame )
+    {
+        const int64_t iReceived = LatencyMonitor::now();
+
+        if ( m_pLatency )
+        {
+            m_pLatency->received( frame.iTimestamp, iReceived );
+        }
+
+        m_filter.update( frame );
+
+        bool abDown[FrameData::kMaxPointables];
+
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            abDown[i] = isPenDown( frame, i );
+        }
+
+        bool bQueued = false;
+
+        // pens that went up or out of sight lift first, so a pointable id
+        // never has two strokes open.
+        for ( uint32_t p = 0; p < m_uiNumPensDown; )
+        {
+            const int32_t   iId     = m_aiPensDown[p];
+            bool            bDown   = false;
+
+            for ( uint32_t i = 0; i < frame.uiNumPointables && !bDown; i++ )
+            {
+                bDown = abDown[i] && frame.aPointables[i].iId == iId;
+            }
+
+            if ( bDown )
+            {
+                p++;
+                continue;
+            }
+
+            TipSample sample;
+            sample.iTimestamp   = frame.iTimestamp;
+            sample.iReceived    = iReceived;
+            sample.iPointableId = iId;
+            sample.uiType       = TipSample::kType_Lift;
+
+            // retried on the next frame if the ring is full.
+            if ( m_queue.push( sample ) )
+            {
+                m_aiPensDown[p] = m_aiPensDown[--m_uiNumPensDown];
+                bQueued = true;
+            }
+            else
+            {
+                p++;
+            }
+        }
+
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            const PointableData& pointable = frame.aPointables[i];
+
+            if ( !abDown[i] || (!wasPenDown( pointable.iId ) && m_uiNumPensDown == FrameData::kMaxPointables) )
+            {
+                continue;
+            }
+
+            const TipFilter::Tip* pFiltered = m_filter.find( pointable.iId );
+
+            TipSample sample;
+            sample.vPosition    = pFiltered->vSmoothed;
+            sample.vPredicted   = pFiltered->vPredicted;
+            sample.iTimestamp   = frame.iTimestamp;
+            sample.iReceived    = iReceived;
+            sample.iPointableId = pointable.iId;
+            sample.uiType       = TipSample::kType_Move;
+
+            if ( !m_queue.push( sample ) )
+            {
+                PAINT_LOG( kLog_Warning, 1, "sample ring full, {} samples dropped so far", m_queue.droppedCount() );
+            }
+
+            if ( !wasPenDown( pointable.iId ) )
+            {
+                m_aiPensDown[m_uiNumPensDown++] = pointable.iId;
+            }
+
+            bQueued = true;
+        }
+
+        return bQueued;
+    }
+
+private:
+    bool wasPenDown( int32_t iId ) const
+    {
+        for ( uint32_t p = 0; p < m_uiNumPensDown; p++ )
+        {
+            if ( m_aiPensDown[p] == iId )
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool isPenDown( const FrameData& frame, uint32_t uiPointable ) const
+    {
+        const PointableData& pointable = frame.aPointables[uiPointable];
+
+        if ( m_pen.eMode == PenSettings::kPen_Touch )
+        {
+            // the smoothed tip, so jitter at the plane doesn't break the stroke.
+            const float fZ = m_filter.find( pointable.iId )->vSmoothed.z;
+
+            return fZ < m_pen.fTouchZ || (fZ < m_pen.fTouchZ + m_pen.fHysteresis && wasPenDown( pointable.iId ));
+        }
+
+        return !pointable.uiIsTool && pointable.iHandId >= 0 && frame.fingerCount( pointable.iHandId ) == 1;
+    }
+
+private:
+    SampleQueue&    m_queue;
+    TipFilter       m_filter;
+    PenSettings     m_pen;
+    LatencyMonitor* m_pLatency;
+    int32_t         m_aiPensDown[FrameData::kMaxPointables];
+    uint32_t        m_uiNumPensDown;
+};
+
+/// consumer side: owns the strokes being painted, one per pointable whose pen
+/// is down, and simplifies each as its samples come in.  the last point of
+/// each is drawn at the predicted tip while painting, never journaled, and put
+/// back before anything is kept.  every pen writes into chunks of its own (see
+/// StrokeStore::appendPoint), so concurrent strokes stay contiguous, and
+/// finding a sample's pen is a scan of the pens down.  it also carries out
+/// PaintCommands, which apply to the strokes begun after them.
+class StrokeBuilder
+{
+public:
+    StrokeBuilder( StrokeStore& store, uint32_t uiNumColors, const SimplifierSettings& settings = SimplifierSettings() )
+      : m_store(store),
+        m_uiNumColors(uiNumColors),
+        m_settings(settings),
+        m_iLastReceived(0),
+        m_pJournal(nullptr),
+        m_fWidth(1.0f),
+        m_uiColorOffset(0),
+        m_bPenLifted(false)
+    {
+        m_pens.reserve( FrameData::kMaxPointables );
+    }
+
+    /// every change made to the store is also recorded here, if set.
+    void setJournal( CanvasJournal* pJournal )
+    {
+        m_pJournal = pJournal;
+        m_history.setJournal( pJournal );
+    }
+
+    /// finished strokes and clears, plus whatever else is edited through it.
+    StrokeHistory& history() { return m_history; }
+
+    /// when the newest sample added arrived from the device.
+    int64_t lastReceived() const { return m_iLastReceived; }
+
+    /// strokes being painted.
+    uint32_t openStrokeCount() const { return static_cast<uint32_t>(m_pens.size()); }
+
+    /// colour of the strokes a pointable paints from now on.
+    uint32_t colorIndex( int32_t iPointableId ) const { return (static_cast<uint32_t>(iPointableId) + m_uiColorOffset) % m_uiNumColors; }
+
+    float width() const         { return m_fWidth; }
+    bool  isPenLifted() const   { return m_bPenLifted; }
+
+    void apply( const PaintCommand& command )
+    {
+        // brush size steps scale the width, within a range that still meshes
+        // and draws sensibly.
+        const float kfWidthStep = 1.25f;
+        const float kfMinWidth  = 0.25f;
+        const float kfMaxWidth  = 8.0f;
+
+        switch ( command.uiType )
+        {
+        case PaintCommand::kCommand_LiftPen:
+            m_bPenLifted = (command.iAmount != 0);
+
+            if ( m_bPenLifted )
+            {
+                liftPen();
+            }
+            break;
+
+        case PaintCommand::kCommand_BrushSize:
+            m_fWidth *= std::pow( kfWidthStep, static_cast<float>(command.iAmount) );
+            m_fWidth  = std::min( std::max( m_fWidth, kfMinWidth ), kfMaxWidth );
+            break;
+
+        case PaintCommand::kCommand_Color:
+            m_uiColorOffset = (m_uiColorOffset + static_cast<uint32_t>(command.iAmount)) % m_uiNumColors;
+            break;
+
+        case PaintCommand::kCommand_Undo:
+            for ( int32_t iSteps = command.iAmount; iSteps != 0; iSteps += (iSteps > 0) ? -1 : 1 )
+            {
+                if ( !(iSteps > 0 ? m_history.undo( m_store ) : m_history.redo( m_store )) )
+                {
+                    break;
+                }
+            }
+            break;
+
+        case PaintCommand::kCommand_Clear:
+            clear();
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void add( const TipSample& sample )
+    {
+        m_iLastReceived = sample.iReceived;
+
+        if ( sample.uiType == TipSample::kType_Lift )
+        {
+            for ( size_t i = 0; i < m_pens.size(); i++ )
+            {
+                if ( m_pens[i].iPointableId == sample.iPointableId )
+                {
+                    endStroke( m_pens[i] );
+
+                    m_pens[i] = m_pens.back();
+                    m_pens.pop_back();
+                    break;
+                }
+            }
+
+            return;
+        }
+
+        if ( m_bPenLifted )
+        {
+            return;
+        }
+
+        Pen* pPen = nullptr;
+
+        for ( size_t i = 0; i < m_pens.size() && !pPen; i++ )
+        {
+            pPen = (m_pens[i].iPointableId == sample.iPointableId) ? &m_pens[i] : nullptr;
+        }
+
+        if ( !pPen )
+        {
+            const uint32_t uiColorIndex = colorIndex( sample.iPointableId );
+
+            m_pens.push_back( Pen() );
+            pPen = &m_pens.back();
+            pPen->iPointableId  = sample.iPointableId;
+            pPen->stroke        = m_store.beginStroke( uiColorIndex, m_fWidth, sample.iTimestamp );
+            pPen->iTipTimestamp = sample.iTimestamp;
+            pPen->bTipPredicted = false;
+            pPen->simplifier.configure( m_settings );
+
+            if ( m_pJournal )
+            {
+                m_pJournal->beginStroke( pPen->stroke, uiColorIndex, m_fWidth, sample.iTimestamp );
+            }
+        }
+
+        Pen& pen = *pPen;
+
+        switch ( pen.simplifier.add( sample.vPosition ) )
+        {
+        case StrokeSimplifier::kStep_Append:
+            // the last point becomes final, so it has to be the real one.
+            restoreTip( pen );
+
+            m_store.appendPoint( pen.stroke, sample.vPosition, sample.iTimestamp );
+
+            if ( m_pJournal )
+            {
+                m_pJournal->appendPoint( pen.stroke, sample.vPosition, sample.iTimestamp );
+            }
+
+            pen.vTip            = sample.vPosition;
+            pen.iTipTimestamp   = sample.iTimestamp;
+            break;
+
+        case StrokeSimplifier::kStep_MoveTip:
+            moveTip( pen, sample.vPosition, sample.iTimestamp );
+
+            pen.vTip            = sample.vPosition;
+            pen.iTipTimestamp   = sample.iTimestamp;
+            pen.bTipPredicted   = false;
+            break;
+
+        default:
+            break;
+        }
+
+        if ( sample.vPredicted != pen.vTip )
+        {
+            // drawn only, the journal keeps the real tip.
+            m_store.moveLastPoint( pen.stroke, sample.vPredicted, pen.iTipTimestamp );
+            pen.vPredicted      = sample.vPredicted;
+            pen.bTipPredicted   = true;
+        }
+    }
+
+    /// moves everything queued into the store.  returns the number of samples.
+    uint32_t drain( SampleQueue& queue )
+    {
+        return queue.drain( [this]( const TipSample& sample ) { add( sample ); } );
+    }
+
+    /// carries out every queued command.  returns the number of commands.
+    uint32_t drain( CommandQueue& queue )
+    {
+        return queue.drain( [this]( const PaintCommand& command ) { apply( command ); } );
+    }
+
+    // end every stroke being painted.
+    void liftPen()
+    {
+        for ( size_t i = 0; i < m_pens.size(); i++ )
+        {
+            endStroke( m_pens[i] );
+        }
+
+        m_pens.clear();
+    }
+
+    /// ends the strokes being painted and hides every stroke, undoably.
+    void clear()
+    {
+        liftPen();
+        m_history.clear( m_store );
+    }
+
+    /// calls fn with the store as journaled, every predicted tip put back,
+    /// e.g. to take a mirror snapshot that agrees with the journal.
+    template<typename Fn>
+    void withRealTips( Fn fn )
+    {
+        for ( size_t i = 0; i < m_pens.size(); i++ )
+        {
+            if ( m_pens[i].bTipPredicted )
+            {
+                m_store.moveLastPoint( m_pens[i].stroke, m_pens[i].vTip, m_pens[i].iTipTimestamp );
+            }
+        }
+
+        fn();
+
+        for ( size_t i = 0; i < m_pens.size(); i++ )
+        {
+            if ( m_pens[i].bTipPredicted )
+            {
+                m_store.moveLastPoint( m_pens[i].stroke, m_pens[i].vPredicted, m_pens[i].iTipTimestamp );
+            }
+        }
+    }
+
+private:
+    /// the stroke of one pointable whose pen is down.
+    struct Pen
+    {
+        int32_t                 iPointableId;
+        StrokeStore::StrokeId   stroke;
+        Leap::Vector            vTip;           ///< the last point as kept and journaled, whatever is drawn
+        Leap::Vector            vPredicted;     ///< where it is drawn while bTipPredicted
+        int64_t                 iTipTimestamp;
+        bool                    bTipPredicted;
+        StrokeSimplifier        simplifier;
+    };
+
+    void endStroke( Pen& pen )
+    {
+        restoreTip( pen );
+        m_store.endStroke( pen.stroke );
+
+        if ( m_pJournal )
+        {
+            m_pJournal->endStroke( pen.stroke );
+        }
+
+        m_history.painted( m_store, pen.stroke );
+    }
+
+    void moveTip( Pen& pen, const Leap::Vector& vPosition, int64_t iTimestamp )
+    {
+        m_store.moveLastPoint( pen.stroke, vPosition, iTimestamp );
+
+        if ( m_pJournal )
+        {
+            m_pJournal->moveLastPoint( pen.stroke, vPosition, iTimestamp );
+        }
+    }
+
+    /// puts the last point back from the predicted tip to the last sample.
+    /// the journal never saw the prediction, so only the store moves.
+    void restoreTip( Pen& pen )
+    {
+        if ( pen.bTipPredicted )
+        {
+            m_store.moveLastPoint( pen.stroke, pen.vTip, pen.iTipTimestamp );
+            pen.bTipPredicted = false;
+        }
+    }
+
+private:
+    StrokeStore&            m_store;
+    const uint32_t          m_uiNumColors;
+    const SimplifierSettings m_settings;
+    std::vector<Pen>        m_pens;
+    StrokeHistory           m_history;
+    int64_t                 m_iLastReceived;
+    CanvasJournal*          m_pJournal;
+    float                   m_fWidth;
+    uint32_t                m_uiColorOffset;
+    bool                    m_bPenLifted;
+};
+
+} // namespace LeapPaint
+
+#endif // __PaintPipeline_h__
@@ -0,0 +1,228 @@
+/******************************************************************************\
+* LeapPaint3D pointable markers.
+*
+* Every pointable is shown as a sphere at its tip and a line back along its
+* direction.  The unit sphere is tessellated once and its indices, repeated
+* for as many markers as a frame can hold, go into a static index buffer.
+* Each frame the markers are expanded from the unit sphere into one streamed
+* vertex buffer with a colour per vertex, and drawn with a single
+* glDrawElements for all spheres and a single glDrawArrays for all lines, so
+* the number of GL calls doesn't grow with the number of pointables.
+*
+* That is instancing done on the CPU: instanced draws need GL 3.1 and shaders,
+* and like StrokeRenderer this keeps to OpenGL 1.5 buffer objects and client
+* vertex arrays.  GL headers must be included before this file.
+\******************************************************************************/
+
+#if !defined(__PointableMarkers_h__)
+#define __PointableMarkers_h__
+
+#include "LeapMath.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace LeapPaint {
+
+/// GLFunctions as for StrokeRenderer.
+template<typename GLFunctions>
+class PointableMarkers
+{
+public:
+    /// one marker, in world space.
+    struct Marker
+    {
+        Leap::Vector    vTip;
+        Leap::Vector    vLine;          ///< from the tip to the far end of the line
+        uint32_t        uiColorIndex;
+    };
+
+    PointableMarkers( GLFunctions& gl, uint32_t uiMaxMarkers, uint32_t uiSlices = 16, uint32_t uiStacks = 8 )
+      : m_gl(gl),
+        m_uiMaxMarkers(uiMaxMarkers),
+        m_uiVertices(0),
+        m_uiIndices(0)
+    {
+        tessellate( uiSlices, uiStacks );
+
+        const size_t uiMaxVertices = uiMaxMarkers * (m_unitSphere.size() + 2);
+        m_positions.reserve( uiMaxVertices );
+        m_normals.reserve( uiMaxVertices );
+        m_colors.reserve( uiMaxVertices );
+    }
+
+    ~PointableMarkers() { release(); }
+
+    /// spheres of fRadius, colours from pColors.  markers past the maximum
+    /// are left out.
+    void draw( const Marker* pMarkers, uint32_t uiCount, float fRadius, const Leap::Vector* pColors )
+    {
+        uiCount = std::min( uiCount, m_uiMaxMarkers );
+
+        if ( uiCount == 0 )
+        {
+            return;
+        }
+
+        createBuffers();
+
+        // every sphere first, then the lines, two vertices each.
+        const uint32_t uiSphereVertices = static_cast<uint32_t>(m_unitSphere.size());
+
+        m_positions.clear();
+        m_normals.clear();
+        m_colors.clear();
+
+        for ( uint32_t m = 0; m < uiCount; m++ )
+        {
+            const Marker&       marker  = pMarkers[m];
+            const Leap::Vector& vColor  = pColors[marker.uiColorIndex];
+
+            for ( uint32_t v = 0; v < uiSphereVertices; v++ )
+            {
+                m_positions.push_back( marker.vTip + m_unitSphere[v] * fRadius );
+                m_normals.push_back( m_unitSphere[v] );
+                m_colors.push_back( vColor );
+            }
+        }
+
+        for ( uint32_t m = 0; m < uiCount; m++ )
+        {
+            const Marker&       marker  = pMarkers[m];
+            const Leap::Vector& vColor  = pColors[marker.uiColorIndex];
+
+            m_positions.push_back( marker.vTip );
+            m_positions.push_back( marker.vTip + marker.vLine );
+            m_normals.push_back( Leap::Vector::zAxis() );
+            m_normals.push_back( Leap::Vector::zAxis() );
+            m_colors.push_back( vColor );
+            m_colors.push_back( vColor );
+        }
+
+        const size_t uiBytes = m_positions.size() * sizeof(Leap::Vector);
+
+        m_gl.glBindBuffer( GL_ARRAY_BUFFER, m_uiVertices );
+
+        // a fresh store each frame, so the driver needn't wait for the
+        // previous frame's draw to finish reading it.
+        m_gl.glBufferData( GL_ARRAY_BUFFER, 3 * uiBytes, nullptr, GL_STREAM_DRAW );
+        m_gl.glBufferSubData( GL_ARRAY_BUFFER, 0, uiBytes, &m_positions[0] );
+        m_gl.glBufferSubData( GL_ARRAY_BUFFER, uiBytes, uiBytes, &m_normals[0] );
+        m_gl.glBufferSubData( GL_ARRAY_BUFFER, 2 * uiBytes, uiBytes, &m_colors[0] );
+
+        glEnableClientState( GL_VERTEX_ARRAY );
+        glEnableClientState( GL_NORMAL_ARRAY );
+        glEnableClientState( GL_COLOR_ARRAY );
+
+        glVertexPointer( 3, GL_FLOAT, sizeof(Leap::Vector), 0 );
+        glNormalPointer( GL_FLOAT, sizeof(Leap::Vector), reinterpret_cast<const GLvoid*>( uiBytes ) );
+        glColorPointer( 3, GL_FLOAT, sizeof(Leap::Vector), reinterpret_cast<const GLvoid*>( 2 * uiBytes ) );
+
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m_uiIndices );
+        glDrawElements( GL_TRIANGLES, static_cast<GLsizei>(uiCount * m_uiSphereIndices), GL_UNSIGNED_SHORT, 0 );
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+        // lines are flat coloured, a lit line has no sensible normal.
+        glPushAttrib( GL_ENABLE_BIT | GL_LINE_BIT );
+        glDisable( GL_LIGHTING );
+        glLineWidth( 3.0f );
+        glDrawArrays( GL_LINES, static_cast<GLint>(uiCount * uiSphereVertices), static_cast<GLsizei>(uiCount * 2) );
+        glPopAttrib();
+
+        glDisableClientState( GL_COLOR_ARRAY );
+        glDisableClientState( GL_NORMAL_ARRAY );
+        glDisableClientState( GL_VERTEX_ARRAY );
+
+        m_gl.glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    }
+
+    /// needs the GL context the buffers were made in to be current.
+    void release()
+    {
+        if ( m_uiVertices != 0 )
+        {
+            m_gl.glDeleteBuffers( 1, &m_uiVertices );
+            m_gl.glDeleteBuffers( 1, &m_uiIndices );
+            m_uiVertices    = 0;
+            m_uiIndices     = 0;
+        }
+    }
+
+private:
+    /// unit sphere as uiStacks rings of uiSlices quads from pole to pole,
+    /// counter clockwise seen from outside.  the seam and the poles repeat
+    /// vertices so every quad is four plain indices.
+    void tessellate( uint32_t uiSlices, uint32_t uiStacks )
+    {
+        for ( uint32_t i = 0; i <= uiStacks; i++ )
+        {
+            const float fPhi = Leap::PI * static_cast<float>(i) / static_cast<float>(uiStacks);
+
+            for ( uint32_t j = 0; j <= uiSlices; j++ )
+            {
+                const float fTheta = 2.0f * Leap::PI * static_cast<float>(j) / static_cast<float>(uiSlices);
+
+                m_unitSphere.push_back( Leap::Vector( std::sin( fPhi ) * std::sin( fTheta ), std::cos( fPhi ), std::sin( fPhi ) * std::cos( fTheta ) ) );
+            }
+        }
+
+        for ( uint32_t i = 0; i < uiStacks; i++ )
+        {
+            for ( uint32_t j = 0; j < uiSlices; j++ )
+            {
+                const uint16_t a = static_cast<uint16_t>(i * (uiSlices + 1) + j);
+                const uint16_t b = static_cast<uint16_t>(a + uiSlices + 1);
+
+                const uint16_t auiQuad[6] = { a, b, static_cast<uint16_t>(b + 1), a, static_cast<uint16_t>(b + 1), static_cast<uint16_t>(a + 1) };
+                m_sphereIndices.insert( m_sphereIndices.end(), auiQuad, auiQuad + 6 );
+            }
+        }
+
+        m_uiSphereIndices = static_cast<uint32_t>(m_sphereIndices.size());
+    }
+
+    void createBuffers()
+    {
+        if ( m_uiVertices != 0 )
+        {
+            return;
+        }
+
+        // the sphere's indices once per marker, offset to its vertices.
+        const uint32_t          uiSphereVertices = static_cast<uint32_t>(m_unitSphere.size());
+        std::vector<uint16_t>   indices;
+        indices.reserve( m_uiMaxMarkers * m_uiSphereIndices );
+
+        for ( uint32_t m = 0; m < m_uiMaxMarkers; m++ )
+        {
+            for ( uint32_t i = 0; i < m_uiSphereIndices; i++ )
+            {
+                indices.push_back( static_cast<uint16_t>(m * uiSphereVertices + m_sphereIndices[i]) );
+            }
+        }
+
+        m_gl.glGenBuffers( 1, &m_uiVertices );
+        m_gl.glGenBuffers( 1, &m_uiIndices );
+
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m_uiIndices );
+        m_gl.glBufferData( GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), &indices[0], GL_STATIC_DRAW );
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+    }
+
+private:
+    GLFunctions&                m_gl;
+    const uint32_t              m_uiMaxMarkers;
+    std::vector<Leap::Vector>   m_unitSphere;
+    std::vector<uint16_t>       m_sphereIndices;
+    uint32_t                    m_uiSphereIndices;
+    GLuint                      m_uiVertices;
+    GLuint                      m_uiIndices;
+    std::vector<Leap::Vector>   m_positions;        ///< this frame's vertices, reused
+    std::vector<Leap::Vector>   m_normals;
+    std::vector<Leap::Vector>   m_colors;
+};
+
+} // namespace LeapPaint
+
+#endif // __PointableMarkers_h__
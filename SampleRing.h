@@ -0,0 +1,115 @@
+/******************************************************************************\
+* LeapPaint3D single producer / single consumer ring buffer.
+*
+* Used to hand fingertip samples from the Leap listener thread to the render
+* thread without either side ever taking a lock.
+\******************************************************************************/
+
+#if !defined(__SampleRing_h__)
+#define __SampleRing_h__
+
+#include "LeapMath.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace LeapPaint {
+
+/// kCapacity must be a power of two.  exactly one thread may push and exactly
+/// one (possibly different) thread may pop.
+template<typename T, uint32_t kCapacity>
+class SpscRing
+{
+    static_assert( (kCapacity & (kCapacity - 1)) == 0, "SpscRing capacity must be a power of two" );
+
+public:
+    SpscRing() : m_uiHead(0), m_uiTail(0), m_uiNumDropped(0) {}
+
+    /// producer side.  returns false and counts a drop when the ring is full.
+    bool push( const T& item )
+    {
+        const uint32_t uiTail = m_uiTail.load( std::memory_order_relaxed );
+
+        if ( uiTail - m_uiHead.load( std::memory_order_acquire ) == kCapacity )
+        {
+            m_uiNumDropped.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+
+        m_aItems[uiTail & (kCapacity - 1)] = item;
+        m_uiTail.store( uiTail + 1, std::memory_order_release );
+
+        return true;
+    }
+
+    /// consumer side.
+    bool pop( T& item )
+    {
+        const uint32_t uiHead = m_uiHead.load( std::memory_order_relaxed );
+
+        if ( uiHead == m_uiTail.load( std::memory_order_acquire ) )
+        {
+            return false;
+        }
+
+        item = m_aItems[uiHead & (kCapacity - 1)];
+        m_uiHead.store( uiHead + 1, std::memory_order_release );
+
+        return true;
+    }
+
+    /// consumer side.  hands every queued item to consume() and releases the
+    /// slots in one go.  returns the number of items consumed.
+    template<typename Consumer>
+    uint32_t drain( Consumer consume )
+    {
+        const uint32_t uiHead = m_uiHead.load( std::memory_order_relaxed );
+        const uint32_t uiTail = m_uiTail.load( std::memory_order_acquire );
+
+        for ( uint32_t i = uiHead; i != uiTail; i++ )
+        {
+            consume( m_aItems[i & (kCapacity - 1)] );
+        }
+
+        m_uiHead.store( uiTail, std::memory_order_release );
+
+        return uiTail - uiHead;
+    }
+
+    uint32_t size() const           { return m_uiTail.load( std::memory_order_acquire ) - m_uiHead.load( std::memory_order_acquire ); }
+    uint32_t droppedCount() const   { return m_uiNumDropped.load( std::memory_order_relaxed ); }
+
+private:
+    enum { kCacheLine = 64 };
+
+    // head and tail padded onto separate cache lines so the two threads don't
+    // false share.  padding rather than alignas keeps heap allocation legal
+    // without C++17 aligned new.
+    std::atomic<uint32_t>   m_uiHead;
+    char                    m_aPad0[kCacheLine - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t>   m_uiTail;
+    std::atomic<uint32_t>   m_uiNumDropped;
+    char                    m_aPad1[kCacheLine - 2 * sizeof(std::atomic<uint32_t>)];
+    T                       m_aItems[kCapacity];
+};
+
+/// one fingertip observation as captured on the listener thread.
+struct TipSample
+{
+    enum Type
+    {
+        kType_Move,     ///< pen is down at vPosition
+        kType_Lift      ///< pen went up, vPosition unused
+    };
+
+    Leap::Vector    vPosition;      ///< filtered, what the stroke keeps
+    Leap::Vector    vPredicted;     ///< where the tip will be when drawn, vPosition without prediction
+    int64_t         iTimestamp;
+    int64_t         iReceived;      ///< host time the frame arrived, see LatencyMonitor::now()
+    int32_t         iPointableId;
+    uint32_t        uiType;
+};
+
+} // namespace LeapPaint
+
+#endif // __SampleRing_h__
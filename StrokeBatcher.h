@@ -0,0 +1,208 @@
+/******************************************************************************\
+* LeapPaint3D stroke geometry batching.
+*
+* Tracks which vertices and segment indices of each StrokeStore chunk are new
+* since the last sync.  StrokeRenderer uploads exactly that; the benchmarks
+* drive it without a GL context.  New segments are also fed to a StrokeIndex
+* for culling and picking.
+\******************************************************************************/
+
+#if !defined(__StrokeBatcher_h__)
+#define __StrokeBatcher_h__
+
+#include "StrokeIndex.h"
+#include "StrokeStore.h"
+#include <algorithm>
+#include <vector>
+
+namespace LeapPaint {
+
+/// CPU side of the renderer: works out which vertices and segment indices are
+/// new since the last sync.  kept free of GL so it can be driven headless.
+/// the last point of an open stroke may be moved in place, so it is uploaded
+/// again whenever it changed.
+class StrokeBatcher
+{
+public:
+    struct ChunkGeometry
+    {
+        uint32_t                uiNumVertices;
+        uint32_t                uiNumVerticesUploaded;
+        uint32_t                uiNumIndicesUploaded;
+        std::vector<uint16_t>   indices;
+    };
+
+    /// points of a run that were added or moved by the last sync.
+    struct ChangedRun
+    {
+        uint32_t uiRun;
+        uint32_t uiFirstChanged;    ///< relative to the run
+
+        bool operator<( const ChangedRun& other ) const { return uiRun < other.uiRun; }
+    };
+
+    StrokeBatcher() : m_uiGeneration(0), m_uiNumRunsSeen(0), m_bReset(false) {}
+
+    /// picks up everything appended to the store since the previous call.
+    /// returns true when the store was cleared and all geometry starts over.
+    bool sync( const StrokeStore& store )
+    {
+        m_dirtyChunks.clear();
+        m_changedRuns.clear();
+
+        const bool bReset = m_bReset || (store.generation() != m_uiGeneration);
+
+        if ( bReset )
+        {
+            for ( size_t i = 0; i < m_chunks.size(); i++ )
+            {
+                m_chunks[i].uiNumVertices           = 0;
+                m_chunks[i].uiNumVerticesUploaded   = 0;
+                m_chunks[i].uiNumIndicesUploaded    = 0;
+                m_chunks[i].indices.clear();
+            }
+
+            m_liveRuns.clear();
+            m_index.clear();
+            m_uiNumRunsSeen = 0;
+            m_uiGeneration  = store.generation();
+            m_bReset        = false;
+        }
+
+        for ( ; m_uiNumRunsSeen < store.runCount(); m_uiNumRunsSeen++ )
+        {
+            LiveRun live = { m_uiNumRunsSeen, 0, Leap::Vector() };
+            m_liveRuns.push_back( live );
+        }
+
+        for ( size_t i = 0; i < m_liveRuns.size(); )
+        {
+            LiveRun&                    live    = m_liveRuns[i];
+            const StrokeStore::Run&     run     = store.run( live.uiRun );
+
+            const Leap::Vector* pPoints = store.runPoints( run );
+            const ChangedRun    changed = { live.uiRun, live.uiNumSynced };
+
+            if ( live.uiNumSynced > 0 && pPoints[live.uiNumSynced - 1] != live.vLastSynced )
+            {
+                // the tip moved after the last sync, possibly before more points followed it.
+                ChunkGeometry& geometry = chunkGeometry( run.uiChunk );
+
+                geometry.uiNumVerticesUploaded = std::min( geometry.uiNumVerticesUploaded, run.uiFirst + live.uiNumSynced - 1 );
+                markDirty( run.uiChunk );
+
+                m_index.moveVertex( run.uiChunk, run.uiFirst + live.uiNumSynced - 1, pPoints[live.uiNumSynced - 1] );
+
+                m_changedRuns.push_back( changed );
+                m_changedRuns.back().uiFirstChanged--;
+            }
+
+            if ( live.uiNumSynced < run.uiCount )
+            {
+                ChunkGeometry& geometry = chunkGeometry( run.uiChunk );
+
+                for ( uint32_t p = (live.uiNumSynced ? live.uiNumSynced : 1); p < run.uiCount; p++ )
+                {
+                    m_index.addSegment( run.uiStroke, run.uiChunk, run.uiFirst + p - 1, static_cast<uint32_t>(geometry.indices.size()),
+                                        pPoints[p - 1], pPoints[p] );
+
+                    geometry.indices.push_back( static_cast<uint16_t>(run.uiFirst + p - 1) );
+                    geometry.indices.push_back( static_cast<uint16_t>(run.uiFirst + p) );
+                }
+
+                live.uiNumSynced = run.uiCount;
+                markDirty( run.uiChunk );
+
+                if ( m_changedRuns.empty() || m_changedRuns.back().uiRun != live.uiRun )
+                {
+                    m_changedRuns.push_back( changed );
+                }
+            }
+
+            live.vLastSynced = pPoints[run.uiCount - 1];
+
+            const StrokeStore::Stroke& stroke = store.stroke( run.uiStroke );
+
+            if ( !stroke.bOpen || stroke.uiLastRun != live.uiRun )
+            {
+                // the run can not grow any more.
+                m_index.completeBrick( run.uiChunk, run.uiStroke );
+
+                m_liveRuns[i] = m_liveRuns.back();
+                m_liveRuns.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+
+        for ( size_t i = 0; i < m_dirtyChunks.size(); i++ )
+        {
+            const uint32_t uiChunk = m_dirtyChunks[i];
+            m_chunks[uiChunk].uiNumVertices = store.chunk( uiChunk ).uiCount;
+        }
+
+        m_index.commit( store );
+
+        return bReset;
+    }
+
+    /// forces the next sync to rebuild everything, e.g. after the GL context was lost.
+    void invalidate() { m_bReset = true; }
+
+    /// where the index builds detail levels, see StrokeIndex::setJobSystem.
+    void setJobSystem( JobSystem* pJobs ) { m_index.setJobSystem( pJobs ); }
+
+    uint32_t                    chunkCount() const                      { return static_cast<uint32_t>(m_chunks.size()); }
+    ChunkGeometry&              chunkGeometry( uint32_t uiChunk )
+    {
+        while ( m_chunks.size() <= uiChunk )
+        {
+            ChunkGeometry geometry = { 0, 0, 0, std::vector<uint16_t>() };
+            geometry.indices.reserve( 64 );
+            m_chunks.push_back( geometry );
+        }
+
+        return m_chunks[uiChunk];
+    }
+
+    /// chunks touched by the last sync.
+    const std::vector<uint32_t>& dirtyChunks() const                    { return m_dirtyChunks; }
+
+    /// runs whose points changed in the last sync, in no particular order.
+    const std::vector<ChangedRun>& changedRuns() const                  { return m_changedRuns; }
+
+    /// every segment synced so far, for culling and picking.
+    const StrokeIndex&          index() const                           { return m_index; }
+
+private:
+    struct LiveRun
+    {
+        uint32_t        uiRun;
+        uint32_t        uiNumSynced;
+        Leap::Vector    vLastSynced;
+    };
+
+    void markDirty( uint32_t uiChunk )
+    {
+        if ( std::find( m_dirtyChunks.begin(), m_dirtyChunks.end(), uiChunk ) == m_dirtyChunks.end() )
+        {
+            m_dirtyChunks.push_back( uiChunk );
+        }
+    }
+
+private:
+    std::vector<ChunkGeometry>  m_chunks;
+    std::vector<LiveRun>        m_liveRuns;
+    std::vector<uint32_t>       m_dirtyChunks;
+    std::vector<ChangedRun>     m_changedRuns;
+    StrokeIndex                 m_index;
+    uint32_t                    m_uiGeneration;
+    uint32_t                    m_uiNumRunsSeen;
+    bool                        m_bReset;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeBatcher_h__
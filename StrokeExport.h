@@ -0,0 +1,709 @@
+/******************************************************************************\
+* LeapPaint3D stroke export.
+*
+* Writes finished strokes as polylines or tube meshes to binary PLY, OBJ or
+* binary glTF (.glb).  Vertex and primitive counts are worked out up front
+* from the run table, so every format is written front to back in batches of
+* runs, each batch encoded into its own small buffer, as many at once as the
+* JobSystem has threads.  Memory stays bounded by that number times
+* kBatchPoints, whatever the painting's size.
+*
+* capture() copies only the run table and must run on the thread owning the
+* StrokeStore; write() reads point chunks in place and may run on any thread,
+* so a long export doesn't stall painting.  The store must not be cleared
+* until write() returns.
+*
+* Coordinates are leap millimetres, except glTF which is in metres as its
+* spec asks.  Colors come from the caller's palette.
+\******************************************************************************/
+
+#if !defined(__StrokeExport_h__)
+#define __StrokeExport_h__
+
+#include "JobSystem.h"
+#include "StrokeStore.h"
+#include "TubeMesh.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace LeapPaint {
+
+class StrokeExporter
+{
+public:
+    enum Format
+    {
+        kFormat_Ply,
+        kFormat_Obj,
+        kFormat_Glb
+    };
+
+    enum Geometry
+    {
+        kGeometry_Lines,
+        kGeometry_Tubes
+    };
+
+    enum { kBatchPoints = 8192 };
+
+    struct Settings
+    {
+        Settings() : eFormat(kFormat_Glb), eGeometry(kGeometry_Tubes), pJobs(nullptr), pColors(nullptr), uiNumColors(0) {}
+
+        Format              eFormat;
+        Geometry            eGeometry;
+        JobSystem*          pJobs;          ///< encodes batches as background jobs, one at a time if null
+        const Leap::Vector* pColors;        ///< rgb in 0..1 by stroke color index, grey if null
+        uint32_t            uiNumColors;
+    };
+
+    StrokeExporter() : m_uiNumPoints(0), m_uiWorkDone(0), m_uiWorkTotal(1), m_bCancel(false) {}
+
+    /// picks the format from the file extension.
+    static bool formatFromPath( const std::string& strPath, Format& eFormat )
+    {
+        const size_t uiDot = strPath.find_last_of( '.' );
+        std::string  strExtension = (uiDot == std::string::npos) ? std::string() : strPath.substr( uiDot + 1 );
+
+        std::transform( strExtension.begin(), strExtension.end(), strExtension.begin(), ::tolower );
+
+        if ( strExtension == "ply" )        { eFormat = kFormat_Ply; return true; }
+        if ( strExtension == "obj" )        { eFormat = kFormat_Obj; return true; }
+        if ( strExtension == "glb" )        { eFormat = kFormat_Glb; return true; }
+
+        return false;
+    }
+
+    /// remembers where the points of every finished stroke are.  strokes
+    /// still being painted or hidden are left out.
+    void capture( const StrokeStore& store )
+    {
+        m_runs.clear();
+        m_uiNumPoints = 0;
+
+        for ( uint32_t s = 0; s < store.strokeCount(); s++ )
+        {
+            const StrokeStore::Stroke& stroke = store.stroke( s );
+
+            if ( stroke.bOpen || !store.isVisible( s ) )
+            {
+                continue;
+            }
+
+            for ( uint32_t r = stroke.uiFirstRun; r != StrokeStore::kInvalid; r = store.run( r ).uiNext )
+            {
+                const StrokeStore::Run& run = store.run( r );
+
+                Run captured;
+                captured.pPoints        = store.runPoints( run );
+                captured.uiCount        = run.uiCount;
+                captured.uiColorIndex   = stroke.uiColorIndex;
+                captured.fWidth         = stroke.fWidth;
+                captured.bJoint         = run.bJoint;
+
+                m_runs.push_back( captured );
+                m_uiNumPoints += run.uiCount;
+            }
+        }
+    }
+
+    /// writes the captured strokes.  a cancelled or failed export leaves no file.
+    bool write( const std::string& strPath, const Settings& settings )
+    {
+        m_bCancel       = false;
+        m_uiWorkDone    = 0;
+
+        FILE* pFile = fopen( strPath.c_str(), "wb" );
+
+        if ( !pFile )
+        {
+            return false;
+        }
+
+        setvbuf( pFile, nullptr, _IOFBF, 1 << 20 );
+
+        const bool bOk = writeFile( pFile, settings );
+
+        if ( fclose( pFile ) != 0 || !bOk )
+        {
+            remove( strPath.c_str() );
+            return false;
+        }
+
+        return true;
+    }
+
+    /// 0..1, may be polled from any thread during write().
+    float progress() const { return static_cast<float>( static_cast<double>(m_uiWorkDone) / m_uiWorkTotal ); }
+
+    void cancel() { m_bCancel = true; }
+
+    uint64_t pointCount() const { return m_uiNumPoints; }
+
+private:
+    struct Run
+    {
+        const Leap::Vector* pPoints;
+        uint32_t            uiCount;
+        uint32_t            uiColorIndex;
+        float               fWidth;
+        bool                bJoint;
+    };
+
+    /// consecutive runs encoded together.
+    struct Batch
+    {
+        uint32_t            uiFirstRun;
+        uint32_t            uiEndRun;
+        uint64_t            uiFirstVertex;
+        uint64_t            uiNumPoints;
+        TubeMesher::Frame   carry;          ///< frame the first run continues from
+    };
+
+    /// per thread scratch, including the position bounds glTF wants.
+    struct Scratch
+    {
+        std::vector<TubeMesher::Frame>  frames;
+        std::vector<Leap::Vector>       positions;
+        std::vector<Leap::Vector>       normals;
+        std::vector<uint8_t>            bytes;
+        float                           afMin[3];
+        float                           afMax[3];
+    };
+
+    enum Pass
+    {
+        kPass_Vertices,
+        kPass_Primitives,
+        kPass_Both              ///< OBJ interleaves them
+    };
+
+    bool writeFile( FILE* pFile, const Settings& settings )
+    {
+        const bool      bTubes          = (settings.eGeometry == kGeometry_Tubes);
+        const uint32_t  uiVertsPerPoint = bTubes ? TubeMesher::kSides : 1;
+        const uint32_t  uiPrimsPerSeg   = bTubes ? TubeMesher::kIndicesPerSegment / 3 : 1;
+
+        // vertex offsets of each batch, and for tubes the frame each batch
+        // starts from, which only a walk along the strokes can tell.
+        m_batches.clear();
+
+        uint64_t            uiNumVertices   = 0;
+        uint64_t            uiNumPrimitives = 0;
+        TubeMesher::Frame   carry;
+        Scratch             scratch;
+
+        for ( uint32_t r = 0; r < m_runs.size(); r++ )
+        {
+            const Run& run = m_runs[r];
+
+            if ( m_batches.empty() || m_batches.back().uiNumPoints + run.uiCount > kBatchPoints )
+            {
+                Batch batch = { r, r, uiNumVertices, 0, carry };
+                m_batches.push_back( batch );
+            }
+
+            m_batches.back().uiEndRun       = r + 1;
+            m_batches.back().uiNumPoints   += run.uiCount;
+
+            uiNumVertices   += uint64_t(run.uiCount) * uiVertsPerPoint;
+            uiNumPrimitives += uint64_t(run.uiCount > 1 ? run.uiCount - 1 : 0) * uiPrimsPerSeg;
+
+            if ( bTubes )
+            {
+                TubeMesher::endFrame( run.pPoints, run.uiCount, run.bJoint, carry, scratch.frames );
+            }
+        }
+
+        // indices are written as 32 bit values.
+        if ( uiNumVertices > 0xFFFFFFFFull )
+        {
+            return false;
+        }
+
+        m_pSettings         = &settings;
+        m_uiNumVertices     = uiNumVertices;
+        m_uiNumPrimitives   = uiNumPrimitives;
+
+        const uint32_t uiBatchesAtOnce = settings.pJobs ? settings.pJobs->concurrency() : 1;
+
+        switch ( settings.eFormat )
+        {
+        case kFormat_Ply:
+            {
+                m_uiWorkTotal = std::max<uint64_t>( 1, 2 * m_batches.size() );
+
+                std::string strHeader = "ply\nformat binary_little_endian 1.0\ncomment LeapPaint3D strokes, leap millimetres\n";
+                strHeader += "element vertex " + std::to_string( uiNumVertices ) + "\n";
+                strHeader += "property float x\nproperty float y\nproperty float z\n";
+                strHeader += bTubes ? "property float nx\nproperty float ny\nproperty float nz\n" : "";
+                strHeader += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+                strHeader += bTubes ? "element face " : "element edge ";
+                strHeader += std::to_string( uiNumPrimitives ) + "\n";
+                strHeader += bTubes ? "property list uchar int vertex_indices\n" : "property int vertex1\nproperty int vertex2\n";
+                strHeader += "end_header\n";
+
+                return fwrite( strHeader.data(), 1, strHeader.size(), pFile ) == strHeader.size() &&
+                       encodeAll( pFile, kPass_Vertices, uiBatchesAtOnce, nullptr ) &&
+                       encodeAll( pFile, kPass_Primitives, uiBatchesAtOnce, nullptr );
+            }
+
+        case kFormat_Obj:
+            {
+                m_uiWorkTotal = std::max<uint64_t>( 1, m_batches.size() );
+
+                std::string strHeader = "# LeapPaint3D strokes, leap millimetres\n# " + std::to_string( uiNumVertices ) + " vertices, " +
+                                        std::to_string( uiNumPrimitives ) + (bTubes ? " triangles\n" : " segments\n");
+
+                return fwrite( strHeader.data(), 1, strHeader.size(), pFile ) == strHeader.size() &&
+                       encodeAll( pFile, kPass_Both, uiBatchesAtOnce, nullptr );
+            }
+
+        case kFormat_Glb:
+            m_uiWorkTotal = std::max<uint64_t>( 1, 2 * m_batches.size() );
+            return writeGlb( pFile, uiBatchesAtOnce );
+        }
+
+        return false;
+    }
+
+    /// binary glTF 2.0: one mesh with interleaved position (, normal) and
+    /// color, then 32 bit indices.  the JSON chunk goes first in the file but
+    /// needs the position bounds, so space is reserved for it and it is
+    /// written once the vertices are done.
+    bool writeGlb( FILE* pFile, uint32_t uiBatchesAtOnce )
+    {
+        const bool      bTubes          = (m_pSettings->eGeometry == kGeometry_Tubes);
+        const uint64_t  uiVertexBytes   = m_uiNumVertices * vertexStride();
+        const uint64_t  uiIndexBytes    = m_uiNumPrimitives * (bTubes ? 3 : 2) * sizeof(uint32_t);
+        const uint64_t  uiBinBytes      = uiVertexBytes + uiIndexBytes;
+
+        const float     afWidest[3]     = { -1.0e-38f, -1.0e-38f, -1.0e-38f };
+        const uint32_t  uiJsonBytes     = (static_cast<uint32_t>( glbJson( afWidest, afWidest ).size() ) + 3) & ~3u;
+        const uint64_t  uiTotalBytes    = 12 + 8 + uiJsonBytes + 8 + uiBinBytes;
+
+        // glb lengths are 32 bit.
+        if ( uiTotalBytes > 0xFFFFFFFFull )
+        {
+            return false;
+        }
+
+        const std::vector<uint8_t> reserved( 12 + 8 + uiJsonBytes, ' ' );
+
+        if ( fwrite( &reserved[0], 1, reserved.size(), pFile ) != reserved.size() )
+        {
+            return false;
+        }
+
+        const uint32_t auiBinHeader[2] = { static_cast<uint32_t>(uiBinBytes), 0x004E4942 };    // "BIN\0"
+
+        float afMin[3] = {  std::numeric_limits<float>::max(),  std::numeric_limits<float>::max(),  std::numeric_limits<float>::max() };
+        float afMax[3] = { -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+
+        if ( fwrite( auiBinHeader, sizeof(auiBinHeader), 1, pFile ) != 1 ||
+             !encodeAll( pFile, kPass_Vertices, uiBatchesAtOnce, afMin, afMax ) ||
+             !encodeAll( pFile, kPass_Primitives, uiBatchesAtOnce, nullptr ) )
+        {
+            return false;
+        }
+
+        if ( m_uiNumVertices == 0 )
+        {
+            std::fill( afMin, afMin + 3, 0.0f );
+            std::fill( afMax, afMax + 3, 0.0f );
+        }
+
+        std::string strJson = glbJson( afMin, afMax );
+        strJson.resize( uiJsonBytes, ' ' );
+
+        const uint32_t auiHeader[5] = { 0x46546C67, 2, static_cast<uint32_t>(uiTotalBytes),    // "glTF"
+                                        uiJsonBytes, 0x4E4F534A };                              // "JSON"
+
+        return fseek( pFile, 0, SEEK_SET ) == 0 &&
+               fwrite( auiHeader, sizeof(auiHeader), 1, pFile ) == 1 &&
+               fwrite( strJson.data(), 1, strJson.size(), pFile ) == strJson.size();
+    }
+
+    std::string glbJson( const float* pMin, const float* pMax ) const
+    {
+        const bool      bTubes          = (m_pSettings->eGeometry == kGeometry_Tubes);
+        const uint64_t  uiVertexBytes   = m_uiNumVertices * vertexStride();
+        const uint64_t  uiNumIndices    = m_uiNumPrimitives * (bTubes ? 3 : 2);
+        const uint32_t  uiColorAccessor = bTubes ? 2 : 1;
+        const auto      number          = []( uint64_t v ) { return std::to_string( v ); };
+
+        char szBounds[160];
+        snprintf( szBounds, sizeof(szBounds), "\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]",
+                  pMin[0], pMin[1], pMin[2], pMax[0], pMax[1], pMax[2] );
+
+        std::string strJson = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"LeapPaint3D\"},"
+                              "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+                              "\"meshes\":[{\"name\":\"strokes\",\"primitives\":[{\"attributes\":{\"POSITION\":0,";
+        strJson += bTubes ? "\"NORMAL\":1," : "";
+        strJson += "\"COLOR_0\":" + number( uiColorAccessor ) + "},\"indices\":" + number( uiColorAccessor + 1 );
+        strJson += bTubes ? ",\"mode\":4}]}]," : ",\"mode\":1}]}],";
+        strJson += "\"buffers\":[{\"byteLength\":" + number( uiVertexBytes + uiNumIndices * 4 ) + "}],";
+        strJson += "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" + number( uiVertexBytes ) +
+                   ",\"byteStride\":" + number( vertexStride() ) + ",\"target\":34962},";
+        strJson += "{\"buffer\":0,\"byteOffset\":" + number( uiVertexBytes ) + ",\"byteLength\":" + number( uiNumIndices * 4 ) + ",\"target\":34963}],";
+        strJson += "\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":" + number( m_uiNumVertices ) +
+                   ",\"type\":\"VEC3\"," + szBounds + "},";
+        strJson += bTubes ? "{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":" + number( m_uiNumVertices ) + ",\"type\":\"VEC3\"}," : "";
+        strJson += "{\"bufferView\":0,\"byteOffset\":" + number( bTubes ? 24 : 12 ) + ",\"componentType\":5121,\"normalized\":true,\"count\":" +
+                   number( m_uiNumVertices ) + ",\"type\":\"VEC4\"},";
+        strJson += "{\"bufferView\":1,\"byteOffset\":0,\"componentType\":5125,\"count\":" + number( uiNumIndices ) + ",\"type\":\"SCALAR\"}]}";
+
+        return strJson;
+    }
+
+    uint32_t vertexStride() const
+    {
+        // position, normal for tubes, rgba8 color.
+        return (m_pSettings->eGeometry == kGeometry_Tubes) ? 28 : 16;
+    }
+
+    /// encodes every batch for one pass, uiBatchesAtOnce batches at a time, and
+    /// writes them out in order.  pMin / pMax collect position bounds.
+    bool encodeAll( FILE* pFile, Pass ePass, uint32_t uiBatchesAtOnce, float* pMin, float* pMax = nullptr )
+    {
+        std::vector<Scratch>    scratch( uiBatchesAtOnce );
+        JobGraph                graph( kJobPriority_Background );
+
+        for ( size_t b = 0; b < m_batches.size(); b += uiBatchesAtOnce )
+        {
+            const uint32_t uiCount = static_cast<uint32_t>( std::min<size_t>( uiBatchesAtOnce, m_batches.size() - b ) );
+
+            for ( uint32_t i = 0; i < uiCount; i++ )
+            {
+                std::fill( scratch[i].afMin, scratch[i].afMin + 3,  std::numeric_limits<float>::max() );
+                std::fill( scratch[i].afMax, scratch[i].afMax + 3, -std::numeric_limits<float>::max() );
+            }
+
+            if ( m_pSettings->pJobs )
+            {
+                graph.clear();
+
+                for ( uint32_t i = 0; i < uiCount; i++ )
+                {
+                    graph.add( [this, &scratch, ePass, b, i]() { encode( ePass, m_batches[b + i], scratch[i] ); } );
+                }
+
+                m_pSettings->pJobs->run( graph );
+            }
+            else
+            {
+                encode( ePass, m_batches[b], scratch[0] );
+            }
+
+            for ( uint32_t i = 0; i < uiCount; i++ )
+            {
+                const std::vector<uint8_t>& bytes = scratch[i].bytes;
+
+                if ( !bytes.empty() && fwrite( &bytes[0], 1, bytes.size(), pFile ) != bytes.size() )
+                {
+                    return false;
+                }
+
+                for ( int k = 0; pMin && k < 3; k++ )
+                {
+                    pMin[k] = std::min( pMin[k], scratch[i].afMin[k] );
+                    pMax[k] = std::max( pMax[k], scratch[i].afMax[k] );
+                }
+            }
+
+            m_uiWorkDone += uiCount;
+
+            if ( m_bCancel )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /// the bytes of one batch for one pass.
+    void encode( Pass ePass, const Batch& batch, Scratch& scratch ) const
+    {
+        const bool          bTubes          = (m_pSettings->eGeometry == kGeometry_Tubes);
+        const uint32_t      uiVertsPerPoint = bTubes ? TubeMesher::kSides : 1;
+        uint64_t            uiFirstVertex   = batch.uiFirstVertex;
+        TubeMesher::Frame   carry           = batch.carry;
+
+        scratch.bytes.clear();
+
+        for ( uint32_t r = batch.uiFirstRun; r < batch.uiEndRun; r++ )
+        {
+            const Run&          run         = m_runs[r];
+            const uint32_t      uiNumVerts  = run.uiCount * uiVertsPerPoint;
+            const Leap::Vector* pPositions  = run.pPoints;
+            const Leap::Vector* pNormals    = nullptr;
+
+            if ( ePass != kPass_Primitives )
+            {
+                if ( bTubes )
+                {
+                    m_mesher.meshRun( run.pPoints, run.uiCount, run.bJoint, run.fWidth, carry, scratch.frames, scratch.positions, scratch.normals );
+                    pPositions  = scratch.positions.empty() ? nullptr : &scratch.positions[0];
+                    pNormals    = scratch.normals.empty() ? nullptr : &scratch.normals[0];
+                }
+
+                uint8_t aColor[4];
+                color( run.uiColorIndex, aColor );
+
+                switch ( m_pSettings->eFormat )
+                {
+                case kFormat_Ply:   plyVertices( pPositions, pNormals, uiNumVerts, aColor, scratch.bytes );             break;
+                case kFormat_Obj:   objVertices( pPositions, pNormals, uiNumVerts, aColor, scratch.bytes );             break;
+                case kFormat_Glb:   glbVertices( pPositions, pNormals, uiNumVerts, aColor, scratch );                   break;
+                }
+            }
+
+            if ( ePass != kPass_Vertices )
+            {
+                for ( uint32_t s = 0; s + 1 < run.uiCount; s++ )
+                {
+                    const uint32_t uiA = static_cast<uint32_t>(uiFirstVertex / uiVertsPerPoint) + s;
+
+                    uint32_t auiIndices[TubeMesher::kIndicesPerSegment];
+                    uint32_t uiNumIndices = 2;
+
+                    if ( bTubes )
+                    {
+                        TubeMesher::segmentIndices( uiA, uiA + 1, auiIndices );
+                        uiNumIndices = TubeMesher::kIndicesPerSegment;
+                    }
+                    else
+                    {
+                        auiIndices[0] = uiA;
+                        auiIndices[1] = uiA + 1;
+                    }
+
+                    switch ( m_pSettings->eFormat )
+                    {
+                    case kFormat_Ply:   plyPrimitives( auiIndices, uiNumIndices, bTubes, scratch.bytes );    break;
+                    case kFormat_Obj:   objPrimitives( auiIndices, uiNumIndices, bTubes, scratch.bytes );    break;
+                    case kFormat_Glb:   put( scratch.bytes, auiIndices, uiNumIndices * sizeof(uint32_t) );   break;
+                    }
+                }
+            }
+
+            uiFirstVertex += uiNumVerts;
+        }
+    }
+
+    void color( uint32_t uiColorIndex, uint8_t* pColor ) const
+    {
+        pColor[0] = pColor[1] = pColor[2] = 200;
+        pColor[3] = 255;
+
+        if ( m_pSettings->pColors && m_pSettings->uiNumColors > 0 )
+        {
+            const Leap::Vector& vColor = m_pSettings->pColors[uiColorIndex % m_pSettings->uiNumColors];
+
+            pColor[0] = toByte( vColor.x );
+            pColor[1] = toByte( vColor.y );
+            pColor[2] = toByte( vColor.z );
+        }
+    }
+
+    static uint8_t toByte( float f ) { return static_cast<uint8_t>( std::min( std::max( f, 0.0f ), 1.0f ) * 255.0f + 0.5f ); }
+
+    static void plyVertices( const Leap::Vector* pPositions, const Leap::Vector* pNormals, uint32_t uiCount, const uint8_t* pColor, std::vector<uint8_t>& out )
+    {
+        for ( uint32_t i = 0; i < uiCount; i++ )
+        {
+            put( out, &pPositions[i], sizeof(Leap::Vector) );
+
+            if ( pNormals )
+            {
+                put( out, &pNormals[i], sizeof(Leap::Vector) );
+            }
+
+            put( out, pColor, 3 );
+        }
+    }
+
+    static void plyPrimitives( const uint32_t* pIndices, uint32_t uiCount, bool bTriangles, std::vector<uint8_t>& out )
+    {
+        if ( !bTriangles )
+        {
+            put( out, pIndices, uiCount * sizeof(uint32_t) );
+            return;
+        }
+
+        for ( uint32_t i = 0; i < uiCount; i += 3 )
+        {
+            out.push_back( 3 );
+            put( out, pIndices + i, 3 * sizeof(uint32_t) );
+        }
+    }
+
+    static void objVertices( const Leap::Vector* pPositions, const Leap::Vector* pNormals, uint32_t uiCount, const uint8_t* pColor, std::vector<uint8_t>& out )
+    {
+        for ( uint32_t i = 0; i < uiCount; i++ )
+        {
+            // "v x y z r g b" is the widely read vertex color extension.
+            putText( out, "v " );
+            putFixed( out, pPositions[i].x, 3 );    out.push_back( ' ' );
+            putFixed( out, pPositions[i].y, 3 );    out.push_back( ' ' );
+            putFixed( out, pPositions[i].z, 3 );    out.push_back( ' ' );
+            putFixed( out, pColor[0] / 255.0f, 3 ); out.push_back( ' ' );
+            putFixed( out, pColor[1] / 255.0f, 3 ); out.push_back( ' ' );
+            putFixed( out, pColor[2] / 255.0f, 3 ); out.push_back( '\n' );
+        }
+
+        for ( uint32_t i = 0; pNormals && i < uiCount; i++ )
+        {
+            putText( out, "vn " );
+            putFixed( out, pNormals[i].x, 4 );      out.push_back( ' ' );
+            putFixed( out, pNormals[i].y, 4 );      out.push_back( ' ' );
+            putFixed( out, pNormals[i].z, 4 );      out.push_back( '\n' );
+        }
+    }
+
+    static void objPrimitives( const uint32_t* pIndices, uint32_t uiCount, bool bTriangles, std::vector<uint8_t>& out )
+    {
+        // obj indices start at 1, normals share the vertex numbering.
+        for ( uint32_t i = 0; i < uiCount; i += (bTriangles ? 3 : 2) )
+        {
+            if ( bTriangles )
+            {
+                putText( out, "f " );
+
+                for ( uint32_t k = 0; k < 3; k++ )
+                {
+                    putUnsigned( out, pIndices[i + k] + 1ull );
+                    putText( out, "//" );
+                    putUnsigned( out, pIndices[i + k] + 1ull );
+                    out.push_back( k < 2 ? ' ' : '\n' );
+                }
+            }
+            else
+            {
+                putText( out, "l " );
+                putUnsigned( out, pIndices[i] + 1ull );
+                out.push_back( ' ' );
+                putUnsigned( out, pIndices[i + 1] + 1ull );
+                out.push_back( '\n' );
+            }
+        }
+    }
+
+    void glbVertices( const Leap::Vector* pPositions, const Leap::Vector* pNormals, uint32_t uiCount, const uint8_t* pColor, Scratch& scratch ) const
+    {
+        const float kfMetresPerMillimetre = 0.001f;
+
+        for ( uint32_t i = 0; i < uiCount; i++ )
+        {
+            const float afPosition[3] = { pPositions[i].x * kfMetresPerMillimetre,
+                                          pPositions[i].y * kfMetresPerMillimetre,
+                                          pPositions[i].z * kfMetresPerMillimetre };
+
+            for ( int k = 0; k < 3; k++ )
+            {
+                scratch.afMin[k] = std::min( scratch.afMin[k], afPosition[k] );
+                scratch.afMax[k] = std::max( scratch.afMax[k], afPosition[k] );
+            }
+
+            put( scratch.bytes, afPosition, sizeof(afPosition) );
+
+            if ( pNormals )
+            {
+                put( scratch.bytes, &pNormals[i], sizeof(Leap::Vector) );
+            }
+
+            put( scratch.bytes, pColor, 4 );
+        }
+    }
+
+    static void put( std::vector<uint8_t>& out, const void* pData, size_t uiBytes )
+    {
+        const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+        out.insert( out.end(), pBytes, pBytes + uiBytes );
+    }
+
+    static void putText( std::vector<uint8_t>& out, const char* szText )
+    {
+        put( out, szText, strlen( szText ) );
+    }
+
+    static void putUnsigned( std::vector<uint8_t>& out, uint64_t uiValue )
+    {
+        char    acDigits[20];
+        int     iNumDigits = 0;
+
+        do
+        {
+            acDigits[iNumDigits++] = static_cast<char>( '0' + uiValue % 10 );
+            uiValue /= 10;
+        }
+        while ( uiValue );
+
+        while ( iNumDigits )
+        {
+            out.push_back( static_cast<uint8_t>( acDigits[--iNumDigits] ) );
+        }
+    }
+
+    /// fixed point text without going through the locale dependent printf,
+    /// which dominates OBJ export otherwise.
+    static void putFixed( std::vector<uint8_t>& out, float fValue, int iDecimals )
+    {
+        static const uint32_t s_auiScale[] = { 1, 10, 100, 1000, 10000 };
+
+        const uint32_t  uiScale = s_auiScale[iDecimals];
+        double          fAbs    = fValue;
+
+        if ( fAbs < 0.0 )
+        {
+            out.push_back( '-' );
+            fAbs = -fAbs;
+        }
+
+        if ( !(fAbs < 1.0e12) )
+        {
+            // nan or absurdly far away.
+            fAbs = 0.0;
+        }
+
+        const uint64_t uiScaled = static_cast<uint64_t>( fAbs * uiScale + 0.5 );
+
+        putUnsigned( out, uiScaled / uiScale );
+
+        if ( iDecimals > 0 )
+        {
+            out.push_back( '.' );
+
+            uint64_t uiFraction = uiScaled % uiScale;
+
+            for ( uint32_t uiDigit = uiScale / 10; uiDigit > 0; uiDigit /= 10 )
+            {
+                out.push_back( static_cast<uint8_t>( '0' + uiFraction / uiDigit ) );
+                uiFraction %= uiDigit;
+            }
+        }
+    }
+
+private:
+    std::vector<Run>        m_runs;
+    std::vector<Batch>      m_batches;
+    TubeMesher              m_mesher;
+    const Settings*         m_pSettings;
+    uint64_t                m_uiNumPoints;
+    uint64_t                m_uiNumVertices;
+    uint64_t                m_uiNumPrimitives;
+    std::atomic<uint64_t>   m_uiWorkDone;
+    uint64_t                m_uiWorkTotal;
+    std::atomic<bool>       m_bCancel;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeExport_h__
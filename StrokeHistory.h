@@ -0,0 +1,218 @@
+/******************************************************************************\
+* LeapPaint3D undo and redo.
+*
+* Every edit is logged as a small command naming the strokes it touched, never
+* their points.  Painting a stroke, erasing it or clearing the canvas only hide
+* or show strokes in the StrokeStore and recoloring swaps a color index, so
+* doing, undoing and redoing any command takes constant time and memory, be it
+* a clear of a million points.  Hidden strokes keep their points until the
+* canvas is saved, see CanvasDocument::save().
+\******************************************************************************/
+
+#if !defined(__StrokeHistory_h__)
+#define __StrokeHistory_h__
+
+#include "CanvasFile.h"
+#include "StrokeStore.h"
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace LeapPaint {
+
+/// undo and redo stacks of edits to a StrokeStore.  lives on the thread
+/// owning the store.  the history forgets everything when the store is
+/// cleared or replaced, since the strokes it names are gone.
+class StrokeHistory
+{
+public:
+    enum { kMaxCommands = 1024 };
+
+    enum Kind
+    {
+        kCommand_Paint,     ///< a finished stroke, undone by hiding it
+        kCommand_Erase,
+        kCommand_Clear,     ///< moves the store's clear mark
+        kCommand_Recolor
+    };
+
+    struct Command
+    {
+        Kind                    eKind;
+        StrokeStore::StrokeId   uiStroke;
+        uint32_t                uiBefore;   ///< clear mark or color before the command
+        uint32_t                uiAfter;    ///< and after it
+    };
+
+    StrokeHistory() : m_uiGeneration(0), m_pJournal(nullptr) {}
+
+    /// the state changes of every command done, undone or redone are also
+    /// recorded here, if set.
+    void setJournal( CanvasJournal* pJournal ) { m_pJournal = pJournal; }
+
+    /// a stroke was finished.  painting anew drops whatever could be redone.
+    void painted( const StrokeStore& store, StrokeStore::StrokeId id )
+    {
+        const Command command = { kCommand_Paint, id, 0, 0 };
+        push( store, command );
+    }
+
+    /// hides every stroke painted so far.  false if there is nothing to clear.
+    bool clear( StrokeStore& store )
+    {
+        if ( store.clearMark() == store.strokeCount() )
+        {
+            return false;
+        }
+
+        const Command command = { kCommand_Clear, StrokeStore::kInvalid, store.clearMark(), store.strokeCount() };
+        apply( store, command, true );
+        push( store, command );
+
+        return true;
+    }
+
+    /// hides one finished stroke.
+    bool erase( StrokeStore& store, StrokeStore::StrokeId id )
+    {
+        if ( id >= store.strokeCount() || !store.isVisible( id ) || store.stroke( id ).bOpen )
+        {
+            return false;
+        }
+
+        const Command command = { kCommand_Erase, id, 0, 0 };
+        apply( store, command, true );
+        push( store, command );
+
+        return true;
+    }
+
+    bool recolor( StrokeStore& store, StrokeStore::StrokeId id, uint32_t uiColorIndex )
+    {
+        if ( id >= store.strokeCount() || !store.isVisible( id ) || store.stroke( id ).uiColorIndex == uiColorIndex )
+        {
+            return false;
+        }
+
+        const Command command = { kCommand_Recolor, id, store.stroke( id ).uiColorIndex, uiColorIndex };
+        apply( store, command, true );
+        push( store, command );
+
+        return true;
+    }
+
+    /// false when there is nothing to undo.
+    bool undo( StrokeStore& store )
+    {
+        forgetIfReplaced( store );
+
+        if ( m_undo.empty() )
+        {
+            return false;
+        }
+
+        apply( store, m_undo.back(), false );
+        m_redo.push_back( m_undo.back() );
+        m_undo.pop_back();
+
+        return true;
+    }
+
+    /// false when there is nothing to redo.
+    bool redo( StrokeStore& store )
+    {
+        forgetIfReplaced( store );
+
+        if ( m_redo.empty() )
+        {
+            return false;
+        }
+
+        apply( store, m_redo.back(), true );
+        m_undo.push_back( m_redo.back() );
+        m_redo.pop_back();
+
+        return true;
+    }
+
+    void reset()
+    {
+        m_undo.clear();
+        m_redo.clear();
+    }
+
+    uint32_t undoCount() const { return static_cast<uint32_t>(m_undo.size()); }
+    uint32_t redoCount() const { return static_cast<uint32_t>(m_redo.size()); }
+
+private:
+    void push( const StrokeStore& store, const Command& command )
+    {
+        forgetIfReplaced( store );
+
+        m_redo.clear();
+        m_undo.push_back( command );
+
+        if ( m_undo.size() > kMaxCommands )
+        {
+            m_undo.pop_front();
+        }
+    }
+
+    void forgetIfReplaced( const StrokeStore& store )
+    {
+        if ( store.generation() != m_uiGeneration )
+        {
+            reset();
+            m_uiGeneration = store.generation();
+        }
+    }
+
+    void apply( StrokeStore& store, const Command& command, bool bForward )
+    {
+        switch ( command.eKind )
+        {
+        case kCommand_Paint:
+        case kCommand_Erase:
+            {
+                // painting forward shows the stroke, erasing forward hides it.
+                const bool bErased = (command.eKind == kCommand_Paint) != bForward;
+
+                store.setErased( command.uiStroke, bErased );
+
+                if ( m_pJournal )
+                {
+                    m_pJournal->setErased( command.uiStroke, bErased );
+                }
+            }
+            break;
+
+        case kCommand_Clear:
+            store.setClearMark( bForward ? command.uiAfter : command.uiBefore );
+
+            if ( m_pJournal )
+            {
+                m_pJournal->setClearMark( store.clearMark() );
+            }
+            break;
+
+        case kCommand_Recolor:
+            store.setColor( command.uiStroke, bForward ? command.uiAfter : command.uiBefore );
+
+            if ( m_pJournal )
+            {
+                m_pJournal->setColor( command.uiStroke, store.stroke( command.uiStroke ).uiColorIndex );
+            }
+            break;
+        }
+    }
+
+private:
+    std::deque<Command>     m_undo;
+    std::vector<Command>    m_redo;
+    uint32_t                m_uiGeneration;
+    CanvasJournal*          m_pJournal;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeHistory_h__
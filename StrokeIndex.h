@@ -0,0 +1,1137 @@
+/******************************************************************************\
+* LeapPaint3D spatial index over painted segments.
+*
+* Segments are grouped into bricks of up to kBrickSegments consecutive
+* segments of one stroke inside one StrokeStore chunk, so a brick is both a
+* contiguous range of that chunk's vertices and of its segment index buffer.
+* Bricks are the leaves of a dynamic bounding volume tree (surface area
+* insertion heuristic, AVL style rotations, leaves padded so a growing brick
+* is only reinserted now and then), which answers frustum, radius and nearest
+* segment queries without touching the rest of the painting.
+*
+* Once a brick is complete it also gets a level of detail pyramid: level L
+* keeps every 2^L-th vertex and records how far the dropped vertices stray
+* from it, so the renderer can draw distant bricks with fewer segments while
+* the error stays under a pixel.  Given a JobSystem the pyramids are built on
+* background jobs and picked up by a later commit; a brick draws at full detail
+* until its pyramid arrives.
+\******************************************************************************/
+
+#if !defined(__StrokeIndex_h__)
+#define __StrokeIndex_h__
+
+#include "JobSystem.h"
+#include "StrokeStore.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <vector>
+
+namespace LeapPaint {
+
+struct Bounds
+{
+    Leap::Vector vMin;
+    Leap::Vector vMax;
+
+    static Bounds empty()
+    {
+        const float kfHuge = std::numeric_limits<float>::max();
+
+        Bounds bounds;
+        bounds.vMin = Leap::Vector(  kfHuge,  kfHuge,  kfHuge );
+        bounds.vMax = Leap::Vector( -kfHuge, -kfHuge, -kfHuge );
+        return bounds;
+    }
+
+    void extend( const Leap::Vector& vPoint )
+    {
+        vMin = Leap::Vector( std::min(vMin.x, vPoint.x), std::min(vMin.y, vPoint.y), std::min(vMin.z, vPoint.z) );
+        vMax = Leap::Vector( std::max(vMax.x, vPoint.x), std::max(vMax.y, vPoint.y), std::max(vMax.z, vPoint.z) );
+    }
+
+    Bounds merged( const Bounds& other ) const
+    {
+        Bounds bounds;
+        bounds.vMin = Leap::Vector( std::min(vMin.x, other.vMin.x), std::min(vMin.y, other.vMin.y), std::min(vMin.z, other.vMin.z) );
+        bounds.vMax = Leap::Vector( std::max(vMax.x, other.vMax.x), std::max(vMax.y, other.vMax.y), std::max(vMax.z, other.vMax.z) );
+        return bounds;
+    }
+
+    Bounds padded( float fMargin ) const
+    {
+        Bounds bounds;
+        bounds.vMin = vMin - Leap::Vector( fMargin, fMargin, fMargin );
+        bounds.vMax = vMax + Leap::Vector( fMargin, fMargin, fMargin );
+        return bounds;
+    }
+
+    bool contains( const Bounds& other ) const
+    {
+        return vMin.x <= other.vMin.x && vMin.y <= other.vMin.y && vMin.z <= other.vMin.z &&
+               vMax.x >= other.vMax.x && vMax.y >= other.vMax.y && vMax.z >= other.vMax.z;
+    }
+
+    float surfaceArea() const
+    {
+        const Leap::Vector vSize = vMax - vMin;
+        return 2.0f * (vSize.x * vSize.y + vSize.y * vSize.z + vSize.z * vSize.x);
+    }
+
+    float distanceSquaredTo( const Leap::Vector& vPoint ) const
+    {
+        const float fX = std::max( std::max( vMin.x - vPoint.x, vPoint.x - vMax.x ), 0.0f );
+        const float fY = std::max( std::max( vMin.y - vPoint.y, vPoint.y - vMax.y ), 0.0f );
+        const float fZ = std::max( std::max( vMin.z - vPoint.z, vPoint.z - vMax.z ), 0.0f );
+        return fX * fX + fY * fY + fZ * fZ;
+    }
+};
+
+/// six clip planes taken from a combined projection * model view matrix, so
+/// the frustum is in whatever space the model view maps from.
+class Frustum
+{
+public:
+    enum Result
+    {
+        kOutside,
+        kIntersects,
+        kInside
+    };
+
+    /// column major matrices as returned by glGetFloatv.
+    static Frustum fromGL( const float afProjection[16], const float afModelView[16] )
+    {
+        float afClip[16];
+
+        for ( int iCol = 0; iCol < 4; iCol++ )
+        {
+            for ( int iRow = 0; iRow < 4; iRow++ )
+            {
+                float fSum = 0.0f;
+
+                for ( int k = 0; k < 4; k++ )
+                {
+                    fSum += afProjection[k * 4 + iRow] * afModelView[iCol * 4 + k];
+                }
+
+                afClip[iCol * 4 + iRow] = fSum;
+            }
+        }
+
+        Frustum frustum;
+
+        for ( int iPlane = 0; iPlane < 6; iPlane++ )
+        {
+            const int   iRow    = iPlane / 2;
+            const float fSign   = (iPlane & 1) ? -1.0f : 1.0f;
+
+            frustum.m_avNormals[iPlane] = Leap::Vector( afClip[3]  + fSign * afClip[iRow],
+                                                        afClip[7]  + fSign * afClip[4 + iRow],
+                                                        afClip[11] + fSign * afClip[8 + iRow] );
+            frustum.m_afOffsets[iPlane] = afClip[15] + fSign * afClip[12 + iRow];
+        }
+
+        return frustum;
+    }
+
+    Result classify( const Bounds& bounds ) const
+    {
+        Result result = kInside;
+
+        for ( int i = 0; i < 6; i++ )
+        {
+            const Leap::Vector& vNormal = m_avNormals[i];
+
+            // corners furthest along and against the plane normal.
+            const Leap::Vector vFar(  vNormal.x >= 0 ? bounds.vMax.x : bounds.vMin.x,
+                                      vNormal.y >= 0 ? bounds.vMax.y : bounds.vMin.y,
+                                      vNormal.z >= 0 ? bounds.vMax.z : bounds.vMin.z );
+            const Leap::Vector vNear( vNormal.x >= 0 ? bounds.vMin.x : bounds.vMax.x,
+                                      vNormal.y >= 0 ? bounds.vMin.y : bounds.vMax.y,
+                                      vNormal.z >= 0 ? bounds.vMin.z : bounds.vMax.z );
+
+            if ( vNormal.dot( vFar ) + m_afOffsets[i] < 0.0f )
+            {
+                return kOutside;
+            }
+
+            if ( vNormal.dot( vNear ) + m_afOffsets[i] < 0.0f )
+            {
+                result = kIntersects;
+            }
+        }
+
+        return result;
+    }
+
+private:
+    Leap::Vector    m_avNormals[6];
+    float           m_afOffsets[6];
+};
+
+/// what the renderer needs to know about the camera, in leap space.
+struct StrokeView
+{
+    Frustum         frustum;
+    Leap::Vector    vEye;
+    float           fPixelScale;        ///< pixels covered by one unit seen from one unit away
+    float           fMaxPixelError;     ///< 0 draws full detail everywhere
+
+    /// column major perspective projection and model view as returned by
+    /// glGetFloatv, viewport height in pixels.
+    static StrokeView fromGL( const float afProjection[16], const float afModelView[16], float fViewportHeight, float fMaxPixelError )
+    {
+        StrokeView view;
+        view.frustum        = Frustum::fromGL( afProjection, afModelView );
+        view.fPixelScale    = afProjection[5] * fViewportHeight * 0.5f;
+        view.fMaxPixelError = fMaxPixelError;
+
+        // the eye sits where the model view maps to the origin, -A^-1 * t.  the
+        // columns of A are the mapped axes, so the rows of A^-1 are the pairwise
+        // cross products of those columns over the determinant.
+        const Leap::Vector  vCol0( afModelView[0], afModelView[1], afModelView[2] );
+        const Leap::Vector  vCol1( afModelView[4], afModelView[5], afModelView[6] );
+        const Leap::Vector  vCol2( afModelView[8], afModelView[9], afModelView[10] );
+        const Leap::Vector  vTranslation( afModelView[12], afModelView[13], afModelView[14] );
+        const float         fDet = vCol0.dot( vCol1.cross( vCol2 ) );
+
+        if ( fDet != 0.0f )
+        {
+            view.vEye = Leap::Vector( vCol1.cross( vCol2 ).dot( vTranslation ),
+                                      vCol2.cross( vCol0 ).dot( vTranslation ),
+                                      vCol0.cross( vCol1 ).dot( vTranslation ) ) * (-1.0f / fDet);
+        }
+        else
+        {
+            view.vEye           = Leap::Vector::zero();
+            view.fMaxPixelError = 0.0f;
+        }
+
+        return view;
+    }
+
+    /// bitwise, so views worked out from the same matrices compare equal.
+    bool sameAs( const StrokeView& other ) const
+    {
+        return memcmp( this, &other, sizeof(StrokeView) ) == 0;
+    }
+};
+
+/// dynamic bounding volume tree.  every leaf carries a caller supplied value.
+class BoundsTree
+{
+public:
+    static const uint32_t kNull = 0xFFFFFFFFu;
+
+    BoundsTree() : m_uiRoot(kNull), m_uiFreeList(kNull), m_uiNumLeaves(0) {}
+
+    void clear()
+    {
+        m_nodes.clear();
+        m_uiRoot        = kNull;
+        m_uiFreeList    = kNull;
+        m_uiNumLeaves   = 0;
+    }
+
+    /// returns the leaf, which stays valid until the tree is cleared.
+    uint32_t insert( const Bounds& bounds, uint32_t uiValue )
+    {
+        const uint32_t uiLeaf = allocateNode();
+
+        m_nodes[uiLeaf].bounds  = bounds;
+        m_nodes[uiLeaf].uiValue = uiValue;
+        m_nodes[uiLeaf].iHeight = 0;
+
+        insertLeaf( uiLeaf );
+        m_uiNumLeaves++;
+
+        return uiLeaf;
+    }
+
+    /// bounds only ever grow: reinserts the leaf when they leave its current box.
+    bool update( uint32_t uiLeaf, const Bounds& bounds, float fMargin )
+    {
+        if ( m_nodes[uiLeaf].bounds.contains( bounds ) )
+        {
+            return false;
+        }
+
+        removeLeaf( uiLeaf );
+        m_nodes[uiLeaf].bounds = bounds.padded( fMargin );
+        insertLeaf( uiLeaf );
+
+        return true;
+    }
+
+    /// visitor( uiValue ) for every leaf not outside the frustum.
+    template<typename Visitor>
+    void query( const Frustum& frustum, Visitor visit ) const
+    {
+        if ( m_uiRoot == kNull )
+        {
+            return;
+        }
+
+        m_stack.clear();
+        m_stack.push_back( m_uiRoot );
+
+        while ( !m_stack.empty() )
+        {
+            const uint32_t          uiNode  = m_stack.back();
+            const Node&             node    = m_nodes[uiNode];
+            const Frustum::Result   result  = frustum.classify( node.bounds );
+
+            m_stack.pop_back();
+
+            if ( result == Frustum::kOutside )
+            {
+                continue;
+            }
+
+            if ( result == Frustum::kInside )
+            {
+                visitSubtree( uiNode, visit );
+            }
+            else if ( node.isLeaf() )
+            {
+                visit( node.uiValue );
+            }
+            else
+            {
+                m_stack.push_back( node.uiChild1 );
+                m_stack.push_back( node.uiChild2 );
+            }
+        }
+    }
+
+    /// visitor( uiValue ) for every leaf whose box is within fRadius of vCenter.
+    template<typename Visitor>
+    void query( const Leap::Vector& vCenter, float fRadius, Visitor visit ) const
+    {
+        if ( m_uiRoot == kNull )
+        {
+            return;
+        }
+
+        const float fRadiusSq = fRadius * fRadius;
+
+        m_stack.clear();
+        m_stack.push_back( m_uiRoot );
+
+        while ( !m_stack.empty() )
+        {
+            const Node& node = m_nodes[m_stack.back()];
+            m_stack.pop_back();
+
+            if ( node.bounds.distanceSquaredTo( vCenter ) > fRadiusSq )
+            {
+                continue;
+            }
+
+            if ( node.isLeaf() )
+            {
+                visit( node.uiValue );
+            }
+            else
+            {
+                m_stack.push_back( node.uiChild1 );
+                m_stack.push_back( node.uiChild2 );
+            }
+        }
+    }
+
+    /// best first search.  distance( uiValue ) returns the exact squared distance
+    /// of a leaf's contents; leaves are visited closest box first and the search
+    /// stops once no box can beat the best distance found.  returns that distance.
+    template<typename Distance>
+    float nearest( const Leap::Vector& vPoint, float fMaxDistanceSq, Distance distance ) const
+    {
+        float fBestSq = fMaxDistanceSq;
+
+        if ( m_uiRoot == kNull )
+        {
+            return fBestSq;
+        }
+
+        typedef std::pair<float, uint32_t> Entry;
+        std::priority_queue< Entry, std::vector<Entry>, std::greater<Entry> > open;
+
+        open.push( Entry( m_nodes[m_uiRoot].bounds.distanceSquaredTo( vPoint ), m_uiRoot ) );
+
+        while ( !open.empty() && open.top().first < fBestSq )
+        {
+            const Node& node = m_nodes[open.top().second];
+            open.pop();
+
+            if ( node.isLeaf() )
+            {
+                fBestSq = std::min( fBestSq, distance( node.uiValue ) );
+                continue;
+            }
+
+            const uint32_t auiChildren[2] = { node.uiChild1, node.uiChild2 };
+
+            for ( int i = 0; i < 2; i++ )
+            {
+                const float fDistanceSq = m_nodes[auiChildren[i]].bounds.distanceSquaredTo( vPoint );
+
+                if ( fDistanceSq < fBestSq )
+                {
+                    open.push( Entry( fDistanceSq, auiChildren[i] ) );
+                }
+            }
+        }
+
+        return fBestSq;
+    }
+
+    uint32_t    leafCount() const                   { return m_uiNumLeaves; }
+    int32_t     height() const                      { return m_uiRoot == kNull ? 0 : m_nodes[m_uiRoot].iHeight; }
+    size_t      memoryUsage() const                 { return m_nodes.capacity() * sizeof(Node); }
+
+private:
+    struct Node
+    {
+        Bounds      bounds;
+        uint32_t    uiParent;       ///< next free node while on the free list
+        uint32_t    uiChild1;
+        uint32_t    uiChild2;
+        uint32_t    uiValue;
+        int32_t     iHeight;        ///< 0 for leaves, -1 while free
+
+        bool isLeaf() const { return uiChild1 == kNull; }
+    };
+
+    template<typename Visitor>
+    void visitSubtree( uint32_t uiNode, Visitor& visit ) const
+    {
+        const size_t uiBase = m_stack.size();
+        m_stack.push_back( uiNode );
+
+        while ( m_stack.size() > uiBase )
+        {
+            const Node& node = m_nodes[m_stack.back()];
+            m_stack.pop_back();
+
+            if ( node.isLeaf() )
+            {
+                visit( node.uiValue );
+            }
+            else
+            {
+                m_stack.push_back( node.uiChild1 );
+                m_stack.push_back( node.uiChild2 );
+            }
+        }
+    }
+
+    uint32_t allocateNode()
+    {
+        uint32_t uiNode = m_uiFreeList;
+
+        if ( uiNode != kNull )
+        {
+            m_uiFreeList = m_nodes[uiNode].uiParent;
+        }
+        else
+        {
+            uiNode = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.push_back( Node() );
+        }
+
+        Node& node = m_nodes[uiNode];
+        node.uiParent   = kNull;
+        node.uiChild1   = kNull;
+        node.uiChild2   = kNull;
+        node.uiValue    = kNull;
+        node.iHeight    = 0;
+
+        return uiNode;
+    }
+
+    void freeNode( uint32_t uiNode )
+    {
+        m_nodes[uiNode].uiParent    = m_uiFreeList;
+        m_nodes[uiNode].iHeight     = -1;
+        m_uiFreeList                = uiNode;
+    }
+
+    void insertLeaf( uint32_t uiLeaf )
+    {
+        if ( m_uiRoot == kNull )
+        {
+            m_uiRoot = uiLeaf;
+            m_nodes[uiLeaf].uiParent = kNull;
+            return;
+        }
+
+        // walk down to the sibling that grows the total surface area the least.
+        const Bounds    leafBounds  = m_nodes[uiLeaf].bounds;
+        uint32_t        uiSibling   = m_uiRoot;
+
+        while ( !m_nodes[uiSibling].isLeaf() )
+        {
+            const Node&     node            = m_nodes[uiSibling];
+            const float     fArea           = node.bounds.surfaceArea();
+            const float     fCombinedArea   = node.bounds.merged( leafBounds ).surfaceArea();
+            const float     fCost           = 2.0f * fCombinedArea;
+            const float     fInheritCost    = 2.0f * (fCombinedArea - fArea);
+            const float     fCost1          = descendCost( node.uiChild1, leafBounds ) + fInheritCost;
+            const float     fCost2          = descendCost( node.uiChild2, leafBounds ) + fInheritCost;
+
+            if ( fCost < fCost1 && fCost < fCost2 )
+            {
+                break;
+            }
+
+            uiSibling = (fCost1 < fCost2) ? node.uiChild1 : node.uiChild2;
+        }
+
+        const uint32_t uiOldParent = m_nodes[uiSibling].uiParent;
+        const uint32_t uiNewParent = allocateNode();
+
+        m_nodes[uiNewParent].uiParent   = uiOldParent;
+        m_nodes[uiNewParent].bounds     = leafBounds.merged( m_nodes[uiSibling].bounds );
+        m_nodes[uiNewParent].iHeight    = m_nodes[uiSibling].iHeight + 1;
+        m_nodes[uiNewParent].uiChild1   = uiSibling;
+        m_nodes[uiNewParent].uiChild2   = uiLeaf;
+
+        if ( uiOldParent != kNull )
+        {
+            replaceChild( uiOldParent, uiSibling, uiNewParent );
+        }
+        else
+        {
+            m_uiRoot = uiNewParent;
+        }
+
+        m_nodes[uiSibling].uiParent = uiNewParent;
+        m_nodes[uiLeaf].uiParent    = uiNewParent;
+
+        refitFrom( m_nodes[uiLeaf].uiParent );
+    }
+
+    void removeLeaf( uint32_t uiLeaf )
+    {
+        if ( uiLeaf == m_uiRoot )
+        {
+            m_uiRoot = kNull;
+            return;
+        }
+
+        const uint32_t uiParent         = m_nodes[uiLeaf].uiParent;
+        const uint32_t uiGrandParent    = m_nodes[uiParent].uiParent;
+        const uint32_t uiSibling        = (m_nodes[uiParent].uiChild1 == uiLeaf) ? m_nodes[uiParent].uiChild2 : m_nodes[uiParent].uiChild1;
+
+        m_nodes[uiSibling].uiParent = uiGrandParent;
+        freeNode( uiParent );
+
+        if ( uiGrandParent != kNull )
+        {
+            replaceChild( uiGrandParent, uiParent, uiSibling );
+            refitFrom( uiGrandParent );
+        }
+        else
+        {
+            m_uiRoot = uiSibling;
+        }
+    }
+
+    float descendCost( uint32_t uiChild, const Bounds& leafBounds ) const
+    {
+        const Bounds& bounds = m_nodes[uiChild].bounds;
+        const float   fArea  = bounds.merged( leafBounds ).surfaceArea();
+
+        return m_nodes[uiChild].isLeaf() ? fArea : fArea - bounds.surfaceArea();
+    }
+
+    void replaceChild( uint32_t uiParent, uint32_t uiOld, uint32_t uiNew )
+    {
+        if ( m_nodes[uiParent].uiChild1 == uiOld )
+        {
+            m_nodes[uiParent].uiChild1 = uiNew;
+        }
+        else
+        {
+            m_nodes[uiParent].uiChild2 = uiNew;
+        }
+    }
+
+    void refitFrom( uint32_t uiNode )
+    {
+        while ( uiNode != kNull )
+        {
+            uiNode = balance( uiNode );
+
+            Node&       node    = m_nodes[uiNode];
+            const Node& child1  = m_nodes[node.uiChild1];
+            const Node& child2  = m_nodes[node.uiChild2];
+
+            node.iHeight    = 1 + std::max( child1.iHeight, child2.iHeight );
+            node.bounds     = child1.bounds.merged( child2.bounds );
+
+            uiNode = node.uiParent;
+        }
+    }
+
+    /// rotates the taller grandchild up when the children of uiA differ in
+    /// height by more than one.  returns the node now at uiA's position.
+    uint32_t balance( uint32_t uiA )
+    {
+        if ( m_nodes[uiA].isLeaf() || m_nodes[uiA].iHeight < 2 )
+        {
+            return uiA;
+        }
+
+        const uint32_t  uiB         = m_nodes[uiA].uiChild1;
+        const uint32_t  uiC         = m_nodes[uiA].uiChild2;
+        const int32_t   iBalance    = m_nodes[uiC].iHeight - m_nodes[uiB].iHeight;
+
+        if ( iBalance > 1 )
+        {
+            return rotateUp( uiA, uiC, uiB, false );
+        }
+
+        if ( iBalance < -1 )
+        {
+            return rotateUp( uiA, uiB, uiC, true );
+        }
+
+        return uiA;
+    }
+
+    /// uiUp is the taller child of uiA, uiOther the shorter one.
+    uint32_t rotateUp( uint32_t uiA, uint32_t uiUp, uint32_t uiOther, bool bUpIsChild1 )
+    {
+        Node&           a       = m_nodes[uiA];
+        Node&           up      = m_nodes[uiUp];
+        const uint32_t  uiF     = up.uiChild1;
+        const uint32_t  uiG     = up.uiChild2;
+
+        up.uiChild1 = uiA;
+        up.uiParent = a.uiParent;
+        a.uiParent  = uiUp;
+
+        if ( up.uiParent != kNull )
+        {
+            replaceChild( up.uiParent, uiA, uiUp );
+        }
+        else
+        {
+            m_uiRoot = uiUp;
+        }
+
+        // the taller grandchild stays with uiUp, the other one takes uiUp's place under uiA.
+        const bool      bKeepF  = m_nodes[uiF].iHeight > m_nodes[uiG].iHeight;
+        const uint32_t  uiKeep  = bKeepF ? uiF : uiG;
+        const uint32_t  uiMove  = bKeepF ? uiG : uiF;
+
+        up.uiChild2 = uiKeep;
+
+        if ( bUpIsChild1 )
+        {
+            a.uiChild1 = uiMove;
+        }
+        else
+        {
+            a.uiChild2 = uiMove;
+        }
+
+        m_nodes[uiMove].uiParent = uiA;
+
+        a.bounds    = m_nodes[uiOther].bounds.merged( m_nodes[uiMove].bounds );
+        a.iHeight   = 1 + std::max( m_nodes[uiOther].iHeight, m_nodes[uiMove].iHeight );
+        up.bounds   = a.bounds.merged( m_nodes[uiKeep].bounds );
+        up.iHeight  = 1 + std::max( a.iHeight, m_nodes[uiKeep].iHeight );
+
+        return uiUp;
+    }
+
+private:
+    std::vector<Node>               m_nodes;
+    mutable std::vector<uint32_t>   m_stack;
+    uint32_t                        m_uiRoot;
+    uint32_t                        m_uiFreeList;
+    uint32_t                        m_uiNumLeaves;
+};
+
+/// result of a picking query.
+struct SegmentHit
+{
+    StrokeStore::StrokeId   uiStroke;
+    uint32_t                uiChunk;
+    uint32_t                uiVertex;       ///< first vertex of the segment within the chunk
+    Leap::Vector            vClosest;
+    float                   fDistance;
+};
+
+/// bricks of segments in a bounding volume tree.  fed by StrokeBatcher as it
+/// emits segment indices; queries read the points back from the store.
+class StrokeIndex
+{
+public:
+    enum { kBrickSegments = 64, kMaxLevels = 6 };
+
+    struct Brick
+    {
+        StrokeStore::StrokeId   uiStroke;
+        uint32_t                uiChunk;
+        uint32_t                uiFirstVertex;
+        uint32_t                uiFirstIndex;
+        uint32_t                uiNumSegments;
+        uint32_t                uiLeaf;
+        Bounds                  bounds;
+        uint32_t                uiLodFirst;                 ///< into lodIndices(), levels 1..uiNumLevels in order
+        uint32_t                uiNumLevels;                ///< 0 until the brick is complete
+        float                   afError[kMaxLevels + 1];    ///< largest deviation per level, in leap units
+    };
+
+    StrokeIndex() : m_fMargin(5.0f), m_pJobs(nullptr), m_uiLevelStamp(0) {}
+
+    ~StrokeIndex() { waitForLevels(); }
+
+    /// builds detail levels on pJobs from now on, or right in commit() if null.
+    /// the job system must outlive the index.
+    void setJobSystem( JobSystem* pJobs )
+    {
+        waitForLevels();
+        collectLevels();
+
+        m_pJobs = pJobs;
+    }
+
+    /// changes whenever a commit added detail levels.
+    uint32_t levelStamp() const { return m_uiLevelStamp; }
+
+    void clear()
+    {
+        // level jobs still read the points of the bricks going away.
+        waitForLevels();
+
+        m_levelBatches.clear();
+        m_tree.clear();
+        m_bricks.clear();
+        m_openBricks.clear();
+        m_touched.clear();
+        m_completed.clear();
+        m_lodIndices.clear();
+    }
+
+    /// segment uiVertex -> uiVertex + 1 of chunk uiChunk, whose index pair starts
+    /// at uiIndex in the chunk's index buffer.
+    void addSegment( StrokeStore::StrokeId uiStroke, uint32_t uiChunk, uint32_t uiVertex, uint32_t uiIndex,
+                     const Leap::Vector& vStart, const Leap::Vector& vEnd )
+    {
+        if ( m_openBricks.size() <= uiChunk )
+        {
+            m_openBricks.resize( uiChunk + 1, static_cast<uint32_t>(kNone) );
+        }
+
+        uint32_t uiBrick = m_openBricks[uiChunk];
+
+        if ( uiBrick == kNone ||
+             m_bricks[uiBrick].uiStroke != uiStroke ||
+             m_bricks[uiBrick].uiNumSegments == kBrickSegments ||
+             m_bricks[uiBrick].uiFirstVertex + m_bricks[uiBrick].uiNumSegments != uiVertex )
+        {
+            if ( uiBrick != kNone )
+            {
+                m_completed.push_back( uiBrick );
+            }
+
+            Brick brick;
+            brick.uiStroke      = uiStroke;
+            brick.uiChunk       = uiChunk;
+            brick.uiFirstVertex = uiVertex;
+            brick.uiFirstIndex  = uiIndex;
+            brick.uiNumSegments = 0;
+            brick.uiLeaf        = kNone;
+            brick.bounds        = Bounds::empty();
+            brick.uiLodFirst    = 0;
+            brick.uiNumLevels   = 0;
+            brick.afError[0]    = 0.0f;
+
+            uiBrick = static_cast<uint32_t>(m_bricks.size());
+            m_bricks.push_back( brick );
+            m_openBricks[uiChunk] = uiBrick;
+        }
+
+        Brick& brick = m_bricks[uiBrick];
+        brick.bounds.extend( vStart );
+        brick.bounds.extend( vEnd );
+        brick.uiNumSegments++;
+
+        touch( uiBrick );
+    }
+
+    /// a vertex that already belongs to a segment was moved in place.
+    void moveVertex( uint32_t uiChunk, uint32_t uiVertex, const Leap::Vector& vPoint )
+    {
+        if ( uiChunk >= m_openBricks.size() || m_openBricks[uiChunk] == kNone )
+        {
+            return;
+        }
+
+        const uint32_t  uiBrick = m_openBricks[uiChunk];
+        Brick&          brick   = m_bricks[uiBrick];
+
+        if ( uiVertex >= brick.uiFirstVertex && uiVertex <= brick.uiFirstVertex + brick.uiNumSegments )
+        {
+            brick.bounds.extend( vPoint );
+            touch( uiBrick );
+        }
+    }
+
+    /// the stroke writing into uiChunk stopped doing so; its brick there is final.
+    void completeBrick( uint32_t uiChunk, StrokeStore::StrokeId uiStroke )
+    {
+        if ( uiChunk < m_openBricks.size() && m_openBricks[uiChunk] != kNone && m_bricks[m_openBricks[uiChunk]].uiStroke == uiStroke )
+        {
+            m_completed.push_back( m_openBricks[uiChunk] );
+            m_openBricks[uiChunk] = kNone;
+        }
+    }
+
+    /// pushes bricks changed since the last commit into the tree and builds the
+    /// detail levels of bricks completed since, or starts jobs building them.
+    void commit( const StrokeStore& store )
+    {
+        collectLevels();
+
+        if ( m_pJobs && !m_completed.empty() )
+        {
+            startLevels( store );
+        }
+        else if ( !m_completed.empty() )
+        {
+            for ( size_t i = 0; i < m_completed.size(); i++ )
+            {
+                Brick& brick = m_bricks[m_completed[i]];
+
+                brick.uiLodFirst    = static_cast<uint32_t>(m_lodIndices.size());
+                brick.uiNumLevels   = buildLevels( store.chunk( brick.uiChunk ).aPoints, brick.uiFirstVertex, brick.uiNumSegments, brick.afError, m_lodIndices );
+            }
+
+            m_uiLevelStamp++;
+        }
+
+        m_completed.clear();
+
+        for ( size_t i = 0; i < m_touched.size(); i++ )
+        {
+            Brick& brick = m_bricks[m_touched[i]];
+
+            if ( brick.uiLeaf == kNone )
+            {
+                brick.uiLeaf = m_tree.insert( brick.bounds.padded( m_fMargin ), m_touched[i] );
+            }
+            else
+            {
+                m_tree.update( brick.uiLeaf, brick.bounds, m_fMargin );
+            }
+        }
+
+        m_touched.clear();
+    }
+
+    /// visitor( const Brick& ) for every brick that may be in view.
+    template<typename Visitor>
+    void forEachVisible( const Frustum& frustum, Visitor visit ) const
+    {
+        m_tree.query( frustum, [&]( uint32_t uiBrick ) { visit( m_bricks[uiBrick] ); } );
+    }
+
+    /// coarsest level whose error, projected at the brick's nearest point,
+    /// stays within view.fMaxPixelError.
+    uint32_t selectLevel( const Brick& brick, const StrokeView& view ) const
+    {
+        if ( brick.uiNumLevels == 0 || view.fMaxPixelError <= 0.0f )
+        {
+            return 0;
+        }
+
+        const float fMaxError = view.fMaxPixelError * std::sqrt( brick.bounds.distanceSquaredTo( view.vEye ) ) / view.fPixelScale;
+
+        for ( uint32_t uiLevel = brick.uiNumLevels; uiLevel > 0; uiLevel-- )
+        {
+            if ( brick.afError[uiLevel] <= fMaxError )
+            {
+                return uiLevel;
+            }
+        }
+
+        return 0;
+    }
+
+    /// range of lodIndices() holding the segments of level uiLevel >= 1.
+    static void levelRange( const Brick& brick, uint32_t uiLevel, uint32_t& uiFirst, uint32_t& uiCount )
+    {
+        uiFirst = brick.uiLodFirst;
+
+        for ( uint32_t l = 1; l < uiLevel; l++ )
+        {
+            uiFirst += levelSegments( brick, l ) * 2;
+        }
+
+        uiCount = levelSegments( brick, uiLevel ) * 2;
+    }
+
+    /// segment index pairs of every built level, chunk vertex numbering.
+    const std::vector<uint16_t>& lodIndices() const { return m_lodIndices; }
+
+    /// closest segment of a visible stroke to vPoint no further than fMaxDistance away.
+    bool nearest( const StrokeStore& store, const Leap::Vector& vPoint, float fMaxDistance, SegmentHit& hit ) const
+    {
+        float fBestSq = fMaxDistance * fMaxDistance;
+        bool  bFound  = false;
+
+        m_tree.nearest( vPoint, fBestSq, [&]( uint32_t uiBrick ) -> float
+        {
+            const Brick&        brick   = m_bricks[uiBrick];
+            const Leap::Vector* pPoints = store.chunk( brick.uiChunk ).aPoints;
+
+            if ( !store.isVisible( brick.uiStroke ) )
+            {
+                return fBestSq;
+            }
+
+            for ( uint32_t s = 0; s < brick.uiNumSegments; s++ )
+            {
+                const uint32_t      uiVertex    = brick.uiFirstVertex + s;
+                const Leap::Vector  vClosest    = closestOnSegment( pPoints[uiVertex], pPoints[uiVertex + 1], vPoint );
+                const float         fDistanceSq = (vClosest - vPoint).magnitudeSquared();
+
+                if ( fDistanceSq <= fBestSq )
+                {
+                    fBestSq         = fDistanceSq;
+                    hit.uiStroke    = brick.uiStroke;
+                    hit.uiChunk     = brick.uiChunk;
+                    hit.uiVertex    = uiVertex;
+                    hit.vClosest    = vClosest;
+                    hit.fDistance   = std::sqrt( fDistanceSq );
+                    bFound          = true;
+                }
+            }
+
+            return fBestSq;
+        } );
+
+        return bFound;
+    }
+
+    /// visitor( const SegmentHit& ) for every segment of a visible stroke within fRadius of vCenter.
+    template<typename Visitor>
+    void forEachInRadius( const StrokeStore& store, const Leap::Vector& vCenter, float fRadius, Visitor visit ) const
+    {
+        const float fRadiusSq = fRadius * fRadius;
+
+        m_tree.query( vCenter, fRadius, [&]( uint32_t uiBrick )
+        {
+            const Brick&        brick   = m_bricks[uiBrick];
+            const Leap::Vector* pPoints = store.chunk( brick.uiChunk ).aPoints;
+
+            if ( !store.isVisible( brick.uiStroke ) )
+            {
+                return;
+            }
+
+            for ( uint32_t s = 0; s < brick.uiNumSegments; s++ )
+            {
+                const uint32_t      uiVertex    = brick.uiFirstVertex + s;
+                const Leap::Vector  vClosest    = closestOnSegment( pPoints[uiVertex], pPoints[uiVertex + 1], vCenter );
+                const float         fDistanceSq = (vClosest - vCenter).magnitudeSquared();
+
+                if ( fDistanceSq <= fRadiusSq )
+                {
+                    SegmentHit hit;
+                    hit.uiStroke    = brick.uiStroke;
+                    hit.uiChunk     = brick.uiChunk;
+                    hit.uiVertex    = uiVertex;
+                    hit.vClosest    = vClosest;
+                    hit.fDistance   = std::sqrt( fDistanceSq );
+                    visit( hit );
+                }
+            }
+        } );
+    }
+
+    uint32_t            brickCount() const                  { return static_cast<uint32_t>(m_bricks.size()); }
+    const Brick&        brick( uint32_t i ) const           { return m_bricks[i]; }
+    const BoundsTree&   tree() const                        { return m_tree; }
+    size_t              memoryUsage() const                 { return m_bricks.capacity() * sizeof(Brick) + m_lodIndices.capacity() * sizeof(uint16_t) + m_tree.memoryUsage(); }
+
+private:
+    static const uint32_t kNone = 0xFFFFFFFFu;
+
+    /// completed bricks per background job.
+    enum { kLevelJobBricks = 32 };
+
+    /// the pyramid of one completed brick, built off the render thread.
+    struct LevelJob
+    {
+        uint32_t                uiBrick;
+        const Leap::Vector*     pChunkPoints;   ///< completed bricks' points don't change
+        uint32_t                uiFirstVertex;
+        uint32_t                uiNumSegments;
+        uint32_t                uiNumLevels;
+        float                   afError[kMaxLevels + 1];
+        std::vector<uint16_t>   indices;
+    };
+
+    struct LevelBatch
+    {
+        LevelBatch() : graph( kJobPriority_Background ) {}
+
+        JobGraph                graph;
+        std::vector<LevelJob>   jobs;
+    };
+
+    static uint32_t levelSegments( const Brick& brick, uint32_t uiLevel )
+    {
+        const uint32_t uiStride = 1u << uiLevel;
+        return (brick.uiNumSegments + uiStride - 1) / uiStride;
+    }
+
+    /// level L joins every 2^L-th vertex; each level is built while the one
+    /// before it still has more than one segment.  afError[0] must be set;
+    /// the index pairs go to the end of indices.  returns the number of levels.
+    static uint32_t buildLevels( const Leap::Vector* pChunkPoints, uint32_t uiFirstVertex, uint32_t uiNumSegs, float* afError, std::vector<uint16_t>& indices )
+    {
+        const Leap::Vector* pPoints     = pChunkPoints + uiFirstVertex;
+        uint32_t            uiNumLevels = 0;
+
+        for ( uint32_t uiLevel = 1; uiLevel <= kMaxLevels && (1u << (uiLevel - 1)) < uiNumSegs; uiLevel++ )
+        {
+            const uint32_t  uiStride    = 1u << uiLevel;
+            float           fErrorSq    = 0.0f;
+
+            for ( uint32_t a = 0; a < uiNumSegs; a += uiStride )
+            {
+                const uint32_t b = std::min( a + uiStride, uiNumSegs );
+
+                indices.push_back( static_cast<uint16_t>(uiFirstVertex + a) );
+                indices.push_back( static_cast<uint16_t>(uiFirstVertex + b) );
+
+                for ( uint32_t k = a + 1; k < b; k++ )
+                {
+                    fErrorSq = std::max( fErrorSq, (closestOnSegment( pPoints[a], pPoints[b], pPoints[k] ) - pPoints[k]).magnitudeSquared() );
+                }
+            }
+
+            afError[uiLevel]    = std::max( afError[uiLevel - 1], std::sqrt( fErrorSq ) );
+            uiNumLevels         = uiLevel;
+        }
+
+        return uiNumLevels;
+    }
+
+    /// one batch of jobs for the bricks completed since the last commit.
+    void startLevels( const StrokeStore& store )
+    {
+        std::unique_ptr<LevelBatch> batch( new LevelBatch );
+
+        batch->jobs.resize( m_completed.size() );
+
+        for ( size_t i = 0; i < m_completed.size(); i++ )
+        {
+            const Brick&    brick   = m_bricks[m_completed[i]];
+            LevelJob&       job     = batch->jobs[i];
+
+            job.uiBrick         = m_completed[i];
+            job.pChunkPoints    = store.chunk( brick.uiChunk ).aPoints;
+            job.uiFirstVertex   = brick.uiFirstVertex;
+            job.uiNumSegments   = brick.uiNumSegments;
+            job.uiNumLevels     = 0;
+            job.afError[0]      = 0.0f;
+        }
+
+        for ( size_t i = 0; i < batch->jobs.size(); i += kLevelJobBricks )
+        {
+            LevelJob* pFirst    = &batch->jobs[i];
+            LevelJob* pEnd      = pFirst + std::min<size_t>( kLevelJobBricks, batch->jobs.size() - i );
+
+            batch->graph.add( [pFirst, pEnd]()
+            {
+                for ( LevelJob* pJob = pFirst; pJob != pEnd; pJob++ )
+                {
+                    pJob->uiNumLevels = buildLevels( pJob->pChunkPoints, pJob->uiFirstVertex, pJob->uiNumSegments, pJob->afError, pJob->indices );
+                }
+            } );
+        }
+
+        m_pJobs->start( batch->graph );
+        m_levelBatches.push_back( std::move( batch ) );
+    }
+
+    /// hands the pyramids of finished batches to their bricks, oldest first.
+    void collectLevels()
+    {
+        while ( !m_levelBatches.empty() && m_levelBatches.front()->graph.isDone() )
+        {
+            const LevelBatch& batch = *m_levelBatches.front();
+
+            for ( size_t i = 0; i < batch.jobs.size(); i++ )
+            {
+                const LevelJob& job     = batch.jobs[i];
+                Brick&          brick   = m_bricks[job.uiBrick];
+
+                brick.uiLodFirst    = static_cast<uint32_t>(m_lodIndices.size());
+                brick.uiNumLevels   = job.uiNumLevels;
+
+                std::copy( job.afError + 1, job.afError + 1 + job.uiNumLevels, brick.afError + 1 );
+                m_lodIndices.insert( m_lodIndices.end(), job.indices.begin(), job.indices.end() );
+            }
+
+            m_levelBatches.pop_front();
+            m_uiLevelStamp++;
+        }
+    }
+
+    /// lets every batch still running finish.
+    void waitForLevels()
+    {
+        for ( size_t i = 0; i < m_levelBatches.size(); i++ )
+        {
+            m_pJobs->wait( m_levelBatches[i]->graph );
+        }
+    }
+
+    static Leap::Vector closestOnSegment( const Leap::Vector& vStart, const Leap::Vector& vEnd, const Leap::Vector& vPoint )
+    {
+        const Leap::Vector  vAxis       = vEnd - vStart;
+        const float         fLengthSq   = vAxis.magnitudeSquared();
+        const float         fT          = (fLengthSq > 0.0f) ? std::min( std::max( (vPoint - vStart).dot( vAxis ) / fLengthSq, 0.0f ), 1.0f ) : 0.0f;
+
+        return vStart + vAxis * fT;
+    }
+
+    void touch( uint32_t uiBrick )
+    {
+        if ( m_touched.empty() || m_touched.back() != uiBrick )
+        {
+            m_touched.push_back( uiBrick );
+        }
+    }
+
+private:
+    BoundsTree              m_tree;
+    std::vector<Brick>      m_bricks;
+    std::vector<uint32_t>   m_openBricks;
+    std::vector<uint32_t>   m_touched;
+    std::vector<uint32_t>   m_completed;
+    std::vector<uint16_t>   m_lodIndices;
+    float                   m_fMargin;
+    JobSystem*              m_pJobs;
+    std::deque< std::unique_ptr<LevelBatch> > m_levelBatches;  ///< started, oldest first
+    uint32_t                m_uiLevelStamp;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeIndex_h__
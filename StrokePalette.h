@@ -0,0 +1,68 @@
+/******************************************************************************\
+* LeapPaint3D stroke palette.
+*
+* Strokes keep a color index (StrokeStore::Stroke::uiColorIndex), not a color.
+* The kPaletteSize colors behind it are an even grid over the RGB cube,
+* shuffled with a fixed seed, so they are the same on every run and canvases
+* don't need to store them: the app, the exporter and the offline renderer
+* all build the palette here.
+\******************************************************************************/
+
+#if !defined(__StrokePalette_h__)
+#define __StrokePalette_h__
+
+#include "LeapMath.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace LeapPaint {
+
+enum { kPaletteSize = 256 };
+
+/// fills pColors with kPaletteSize rgb colors in 0..1.
+inline void makePalette( Leap::Vector* pColors )
+{
+    const float fMin        = 0.0f;
+    const float fMax        = 1.0f;
+    const float fNumSteps   = static_cast<float>(pow( static_cast<double>(kPaletteSize), 1.0/3.0 ));
+    const float fStepSize   = (fMax - fMin)/fNumSteps;
+    float       fR = fMin, fG = fMin, fB = fMin;
+
+    for ( uint32_t i = 0; i < kPaletteSize; i++ )
+    {
+        pColors[i] = Leap::Vector( fR, fG, std::min( fB, fMax ) );
+
+        fR += fStepSize;
+
+        if ( fR > fMax )
+        {
+            fR = fMin;
+            fG += fStepSize;
+
+            if ( fG > fMax )
+            {
+                fG = fMin;
+                fB += fStepSize;
+            }
+        }
+    }
+
+    // the 48 bit generator of juce::Random, seeded as the app always was, so
+    // indices in existing canvases keep their colors.
+    uint64_t uiSeed = 0x13491349;
+
+    for ( uint32_t i = 0; i < kPaletteSize; i++ )
+    {
+        uiSeed = (uiSeed * 0x5DEECE66DULL + 11) & 0xFFFFFFFFFFFFULL;
+
+        const int32_t   iRand       = static_cast<int32_t>( static_cast<uint32_t>(uiSeed >> 16) );
+        const uint32_t  uiRandIdx   = i + (static_cast<uint32_t>(iRand) % (kPaletteSize - i));
+
+        std::swap( pColors[i], pColors[uiRandIdx] );
+    }
+}
+
+} // namespace LeapPaint
+
+#endif // __StrokePalette_h__
@@ -0,0 +1,957 @@
+/******************************************************************************\
+* LeapPaint3D software rasterizer for painted strokes.
+*
+* Draws a StrokeStore the way renderOpenGL and setupScene do, without a GL
+* context: black clear, depth test, the three positional lights over a dark
+* grey ambient, strokes as one pixel lines or lit tube meshes with back faces
+* culled.  Used for thumbnails and turntables on machines with no display.
+*
+* capture() builds the world space geometry once per painting; render() then
+* draws it from any camera in three parallel passes over a JobSystem:
+*   - vertices are transformed and lit, four at a time with SSE,
+*   - primitives are binned, in fixed size batches, into kTileSize tiles,
+*   - tiles are filled, four pixels at a time with SSE, each by one thread,
+*     walking its bins in primitive order.
+* Every pixel is therefore written in the same order whatever the number of
+* threads, and images come out byte identical.
+*
+* Given the palette (see StrokePalette.h) strokes take their colors by index,
+* as the app draws them; without one they share a single material color.  The
+* camera's field of view and clip planes are settings since the app leaves
+* them to CameraGL.
+\******************************************************************************/
+
+#if !defined(__StrokeRaster_h__)
+#define __StrokeRaster_h__
+
+#include "JobSystem.h"
+#include "StrokeStore.h"
+#include "TubeMesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LEAPPAINT_SSE 1
+#endif
+
+namespace LeapPaint {
+
+/// a CameraGL style look-at camera with a perspective projection.
+struct RasterCamera
+{
+    RasterCamera() : vEye(0, 2, 4), vTarget(0, 0, 0), fFovDegrees(40.0f), fNear(0.1f), fFar(100.0f) {}
+
+    /// the camera moved fRadians around the vertical axis through its target,
+    /// as CameraGL::RotateOrbit does with the arrow keys.
+    RasterCamera orbited( float fRadians ) const
+    {
+        const Leap::Vector  vOffset = vEye - vTarget;
+        const float         fCos    = std::cos( fRadians );
+        const float         fSin    = std::sin( fRadians );
+        RasterCamera        camera  = *this;
+
+        camera.vEye = vTarget + Leap::Vector( vOffset.x * fCos + vOffset.z * fSin, vOffset.y, vOffset.z * fCos - vOffset.x * fSin );
+
+        return camera;
+    }
+
+    /// the camera looking the same way at the centre of a box, just far
+    /// enough back to see all of it.
+    RasterCamera framing( const Leap::Vector& vMin, const Leap::Vector& vMax, float fAspect ) const
+    {
+        const Leap::Vector  vCentre     = (vMin + vMax) * 0.5f;
+        const float         fRadius     = std::max( (vMax - vMin).magnitude() * 0.5f, 1e-3f );
+        const float         fHalfFov    = fFovDegrees * (Leap::PI / 360.0f);
+        const float         fHalfSpan   = std::min( std::tan( fHalfFov ), std::tan( fHalfFov ) * fAspect );
+        Leap::Vector        vBack       = vEye - vTarget;
+        RasterCamera        camera      = *this;
+
+        vBack = (vBack.magnitudeSquared() > 0) ? vBack.normalized() : Leap::Vector( 0, 0, 1 );
+
+        camera.vTarget  = vCentre;
+        camera.vEye     = vCentre + vBack * (fRadius * std::sqrt( 1.0f + 1.0f / (fHalfSpan * fHalfSpan) ));
+        camera.fFar     = std::max( fFar, (camera.vEye - vCentre).magnitude() + fRadius * 2.0f );
+
+        return camera;
+    }
+
+    Leap::Vector    vEye;
+    Leap::Vector    vTarget;            ///< up is always +y
+    float           fFovDegrees;        ///< vertical
+    float           fNear;
+    float           fFar;
+};
+
+class StrokeRasterizer
+{
+public:
+    enum Style
+    {
+        kStyle_Lines,
+        kStyle_Tubes
+    };
+
+    enum
+    {
+        kTileSize       = 64,
+        kBatchPrims     = 8192,
+        kNumLights      = 3,
+        kNumChannels    = 9             ///< floats a vertex keeps
+    };
+
+    struct Settings
+    {
+        Settings() : eStyle(kStyle_Tubes), fLeapScale(0.0075f), vLeapOrigin(0.0f, -2.0f, 0.5f), vColor(1, 1, 1), pColors(nullptr), uiNumColors(0) {}
+
+        Style               eStyle;
+        float               fLeapScale;     ///< leap millimetres to world units, as m_fFrameScale
+        Leap::Vector        vLeapOrigin;    ///< as m_mtxFrameTransform.origin
+        Leap::Vector        vColor;         ///< material rgb in 0..1 of every stroke, if pColors is null
+        const Leap::Vector* pColors;        ///< material rgb in 0..1 by stroke color index
+        uint32_t            uiNumColors;
+    };
+
+    StrokeRasterizer() : m_uiNumVertices(0), m_uiWidth(0), m_uiHeight(0), m_uiStride(0), m_uiTilesX(0), m_uiTilesY(0) {}
+
+    /// world space vertices and primitives of the visible strokes.  reads the
+    /// store only here, so it may change once this returns.
+    void capture( const StrokeStore& store, const Settings& settings = Settings() )
+    {
+        const bool bTubes = (settings.eStyle == kStyle_Tubes);
+
+        m_settings = settings;
+        m_uiNumVertices = 0;
+        m_indices.clear();
+
+        for ( int c = 0; c < kNumChannels; c++ )
+        {
+            m_soa[c].clear();
+        }
+
+        TubeMesher                  mesher;
+        std::vector<TubeMesher::Frame> frames;
+        std::vector<Leap::Vector>   positions;
+        std::vector<Leap::Vector>   normals;
+
+        for ( uint32_t s = 0; s < store.strokeCount(); s++ )
+        {
+            if ( !store.isVisible( s ) )
+            {
+                continue;
+            }
+
+            const StrokeStore::Stroke&  stroke  = store.stroke( s );
+            const Leap::Vector&         vColor  = (settings.pColors && settings.uiNumColors > 0) ?
+                                                  settings.pColors[stroke.uiColorIndex % settings.uiNumColors] : settings.vColor;
+            TubeMesher::Frame           carry;
+
+            for ( uint32_t r = stroke.uiFirstRun; r != StrokeStore::kInvalid; r = store.run( r ).uiNext )
+            {
+                const StrokeStore::Run&     run         = store.run( r );
+                const Leap::Vector*         pPoints     = store.runPoints( run );
+                const uint32_t              uiBase      = m_uiNumVertices;
+
+                if ( bTubes )
+                {
+                    mesher.meshRun( pPoints, run.uiCount, run.bJoint, stroke.fWidth, carry, frames, positions, normals );
+
+                    for ( size_t v = 0; v < positions.size(); v++ )
+                    {
+                        addVertex( positions[v], normals[v], vColor );
+                    }
+
+                    for ( uint32_t i = 0; i + 1 < run.uiCount; i++ )
+                    {
+                        const uint32_t uiA = uiBase / TubeMesher::kSides + i;
+
+                        m_indices.resize( m_indices.size() + TubeMesher::kIndicesPerSegment );
+                        TubeMesher::segmentIndices( uiA, uiA + 1, &m_indices[m_indices.size() - TubeMesher::kIndicesPerSegment] );
+                    }
+                }
+                else
+                {
+                    // glNormal is never set for lines, so they light with the default.
+                    for ( uint32_t i = 0; i < run.uiCount; i++ )
+                    {
+                        addVertex( pPoints[i], Leap::Vector( 0, 0, 1 ), vColor );
+                    }
+
+                    for ( uint32_t i = 0; i + 1 < run.uiCount; i++ )
+                    {
+                        m_indices.push_back( uiBase + i );
+                        m_indices.push_back( uiBase + i + 1 );
+                    }
+                }
+            }
+        }
+
+        // the vertex pass works on whole groups of four.
+        for ( int c = 0; c < kNumChannels; c++ )
+        {
+            m_soa[c].resize( (m_uiNumVertices + 3) & ~3u, 0.0f );
+        }
+
+        m_screen.resize( m_soa[0].size() );
+    }
+
+    uint32_t vertexCount() const        { return m_uiNumVertices; }
+    uint32_t primitiveCount() const     { return static_cast<uint32_t>(m_indices.size() / verticesPerPrimitive()); }
+
+    /// world space bounds of the captured geometry, false if there is none.
+    bool bounds( Leap::Vector& vMin, Leap::Vector& vMax ) const
+    {
+        if ( !m_uiNumVertices )
+        {
+            return false;
+        }
+
+        const float* const apAxes[3] = { &m_soa[0][0], &m_soa[1][0], &m_soa[2][0] };
+        float afMin[3], afMax[3];
+
+        for ( int a = 0; a < 3; a++ )
+        {
+            afMin[a] = *std::min_element( apAxes[a], apAxes[a] + m_uiNumVertices );
+            afMax[a] = *std::max_element( apAxes[a], apAxes[a] + m_uiNumVertices );
+        }
+
+        vMin = Leap::Vector( afMin[0], afMin[1], afMin[2] );
+        vMax = Leap::Vector( afMax[0], afMax[1], afMax[2] );
+
+        return true;
+    }
+
+    /// draws the captured geometry into image().  runs inline without pJobs.
+    void render( const RasterCamera& camera, uint32_t uiWidth, uint32_t uiHeight, JobSystem* pJobs = nullptr )
+    {
+        resize( std::max( 1u, uiWidth ), std::max( 1u, uiHeight ) );
+        setupTransform( camera );
+
+        const uint32_t uiNumGroups  = static_cast<uint32_t>(m_soa[0].size() / 4);
+        const uint32_t uiNumPrims   = primitiveCount();
+        const uint32_t uiNumBatches = (uiNumPrims + kBatchPrims - 1) / kBatchPrims;
+        const uint32_t uiNumTiles   = m_uiTilesX * m_uiTilesY;
+
+        JobSystem::parallelFor( pJobs, uiNumGroups, 1024, [this]( uint32_t uiBegin, uint32_t uiEnd )
+        {
+            shadeVertices( uiBegin * 4, uiEnd * 4 );
+        } );
+
+        m_bins.resize( static_cast<size_t>(uiNumBatches) * uiNumTiles );
+
+        JobSystem::parallelFor( pJobs, uiNumBatches, 1, [this, uiNumPrims]( uint32_t uiBegin, uint32_t uiEnd )
+        {
+            for ( uint32_t b = uiBegin; b < uiEnd; b++ )
+            {
+                binBatch( b, std::min( uiNumPrims, (b + 1) * static_cast<uint32_t>(kBatchPrims) ) );
+            }
+        } );
+
+        JobSystem::parallelFor( pJobs, uiNumTiles, 1, [this, uiNumBatches]( uint32_t uiBegin, uint32_t uiEnd )
+        {
+            for ( uint32_t t = uiBegin; t < uiEnd; t++ )
+            {
+                fillTile( t, uiNumBatches );
+            }
+        } );
+    }
+
+    uint32_t width() const              { return m_uiWidth; }
+    uint32_t height() const             { return m_uiHeight; }
+
+    /// the last render, top row first.  rows are stride() pixels apart, each
+    /// pixel 0xAABBGGRR.
+    const uint32_t* image() const       { return m_image.empty() ? nullptr : &m_image[0]; }
+    uint32_t stride() const             { return m_uiStride; }
+
+private:
+    /// a vertex in clip space (c*) and, when in front of the near plane, in
+    /// pixels with depth in 0..1 and 1 / w.  lit color in 0..255.
+    struct ScreenVertex
+    {
+        float cx, cy, cz, cw;
+        float x, y, z, iw;
+        float r, g, b, pad;
+    };
+
+    struct Tile
+    {
+        int32_t x0, y0, x1, y1;         ///< pixels, x1 and y1 exclusive
+    };
+
+    /// the column-major GL matrices the app would have set, flattened to
+    /// what the vertex pass needs.
+    struct Transform
+    {
+        float afView[12];               ///< rows of the world to eye matrix
+        float fScaleX, fScaleY;         ///< projection diagonal
+        float fDepthA, fDepthB;         ///< clip z = a * eye z + b
+        float afLightPos[kNumLights][3];///< eye space
+        float afLightColor[kNumLights][3];
+        float afAmbient[3];
+    };
+
+    uint32_t verticesPerPrimitive() const { return (m_settings.eStyle == kStyle_Tubes) ? 3 : 2; }
+
+    void addVertex( const Leap::Vector& vLeap, const Leap::Vector& vNormal, const Leap::Vector& vColor )
+    {
+        const Leap::Vector vWorld = vLeap * m_settings.fLeapScale + m_settings.vLeapOrigin;
+
+        m_soa[0].push_back( vWorld.x );
+        m_soa[1].push_back( vWorld.y );
+        m_soa[2].push_back( vWorld.z );
+        m_soa[3].push_back( vNormal.x );
+        m_soa[4].push_back( vNormal.y );
+        m_soa[5].push_back( vNormal.z );
+        m_soa[6].push_back( vColor.x );
+        m_soa[7].push_back( vColor.y );
+        m_soa[8].push_back( vColor.z );
+        m_uiNumVertices++;
+    }
+
+    void resize( uint32_t uiWidth, uint32_t uiHeight )
+    {
+        // rows are padded to whole four pixel blocks, which therefore never
+        // straddle two tiles.
+        m_uiWidth   = uiWidth;
+        m_uiHeight  = uiHeight;
+        m_uiStride  = (uiWidth + 3) & ~3u;
+        m_uiTilesX  = (uiWidth + kTileSize - 1) / kTileSize;
+        m_uiTilesY  = (uiHeight + kTileSize - 1) / kTileSize;
+
+        m_image.resize( static_cast<size_t>(m_uiStride) * uiHeight );
+        m_depth.resize( m_image.size() );
+    }
+
+    void setupTransform( const RasterCamera& camera )
+    {
+        // gluLookAt with +y up.
+        const Leap::Vector vForward = (camera.vTarget - camera.vEye).normalized();
+        const Leap::Vector vSide    = vForward.cross( Leap::Vector( 0, 1, 0 ) ).normalized();
+        const Leap::Vector vUp      = vSide.cross( vForward );
+        const Leap::Vector aRows[3] = { vSide, vUp, -vForward };
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            m_transform.afView[i * 4 + 0] = aRows[i].x;
+            m_transform.afView[i * 4 + 1] = aRows[i].y;
+            m_transform.afView[i * 4 + 2] = aRows[i].z;
+            m_transform.afView[i * 4 + 3] = -aRows[i].dot( camera.vEye );
+        }
+
+        // gluPerspective.
+        const float fFocal = 1.0f / std::tan( camera.fFovDegrees * (Leap::PI / 360.0f) );
+
+        m_transform.fScaleX = fFocal * m_uiHeight / static_cast<float>(m_uiWidth);
+        m_transform.fScaleY = fFocal;
+        m_transform.fDepthA = (camera.fFar + camera.fNear) / (camera.fNear - camera.fFar);
+        m_transform.fDepthB = 2.0f * camera.fFar * camera.fNear / (camera.fNear - camera.fFar);
+
+        // setupScene's lights, placed under an identity modelview so already
+        // in eye space.  colors are the bytes JUCE's HSB conversion gives.
+        static const float s_afLightPos[kNumLights][3]      = { { -3.0f, 3.0f, -3.0f }, { 3.0f, 0.0f, -1.5f }, { 0.0f, 0.0f, -3.0f } };
+        static const float s_afLightColor[kNumLights][3]    = { { 61, 102, 102 }, { 64, 64, 64 }, { 38, 38, 33 } };
+
+        for ( int l = 0; l < kNumLights; l++ )
+        {
+            for ( int c = 0; c < 3; c++ )
+            {
+                m_transform.afLightPos[l][c]    = s_afLightPos[l][c];
+                m_transform.afLightColor[l][c]  = s_afLightColor[l][c] / 255.0f;
+            }
+        }
+
+        // Colours::darkgrey.
+        m_transform.afAmbient[0] = m_transform.afAmbient[1] = m_transform.afAmbient[2] = 0x55 / 255.0f;
+    }
+
+    /// transforms and lights vertices uiBegin .. uiEnd, both multiples of four.
+    void shadeVertices( uint32_t uiBegin, uint32_t uiEnd )
+    {
+        const Transform& t = m_transform;
+
+#if defined(LEAPPAINT_SSE)
+        const float* const pX   = &m_soa[0][0];
+        const float* const pY   = &m_soa[1][0];
+        const float* const pZ   = &m_soa[2][0];
+        const float* const pNX  = &m_soa[3][0];
+        const float* const pNY  = &m_soa[4][0];
+        const float* const pNZ  = &m_soa[5][0];
+        const float* const pR   = &m_soa[6][0];
+        const float* const pG   = &m_soa[7][0];
+        const float* const pB   = &m_soa[8][0];
+        const __m128 zero       = _mm_setzero_ps();
+        const __m128 one        = _mm_set1_ps( 1.0f );
+        const __m128 half       = _mm_set1_ps( 0.5f );
+        const __m128 width      = _mm_set1_ps( static_cast<float>(m_uiWidth) );
+        const __m128 height     = _mm_set1_ps( static_cast<float>(m_uiHeight) );
+        const __m128 scale255   = _mm_set1_ps( 255.0f );
+
+        for ( uint32_t v = uiBegin; v < uiEnd; v += 4 )
+        {
+            const __m128 x  = _mm_loadu_ps( pX + v );
+            const __m128 y  = _mm_loadu_ps( pY + v );
+            const __m128 z  = _mm_loadu_ps( pZ + v );
+            const __m128 nx = _mm_loadu_ps( pNX + v );
+            const __m128 ny = _mm_loadu_ps( pNY + v );
+            const __m128 nz = _mm_loadu_ps( pNZ + v );
+
+            __m128 e[3], n[3];
+
+            for ( int i = 0; i < 3; i++ )
+            {
+                const float* const r = t.afView + i * 4;
+
+                e[i] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( r[0] ), x ), _mm_mul_ps( _mm_set1_ps( r[1] ), y ) ),
+                                   _mm_add_ps( _mm_mul_ps( _mm_set1_ps( r[2] ), z ), _mm_set1_ps( r[3] ) ) );
+                n[i] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( r[0] ), nx ), _mm_mul_ps( _mm_set1_ps( r[1] ), ny ) ),
+                                   _mm_mul_ps( _mm_set1_ps( r[2] ), nz ) );
+            }
+
+            // GL_NORMALIZE.
+            const __m128 nlen2  = _mm_add_ps( _mm_add_ps( _mm_mul_ps( n[0], n[0] ), _mm_mul_ps( n[1], n[1] ) ), _mm_mul_ps( n[2], n[2] ) );
+            const __m128 ninv   = _mm_div_ps( one, _mm_sqrt_ps( _mm_max_ps( nlen2, _mm_set1_ps( 1e-20f ) ) ) );
+
+            __m128 sum[3];
+
+            for ( int c = 0; c < 3; c++ )
+            {
+                sum[c] = _mm_set1_ps( t.afAmbient[c] );
+            }
+
+            for ( int l = 0; l < kNumLights; l++ )
+            {
+                const __m128 lx     = _mm_sub_ps( _mm_set1_ps( t.afLightPos[l][0] ), e[0] );
+                const __m128 ly     = _mm_sub_ps( _mm_set1_ps( t.afLightPos[l][1] ), e[1] );
+                const __m128 lz     = _mm_sub_ps( _mm_set1_ps( t.afLightPos[l][2] ), e[2] );
+                const __m128 llen2  = _mm_add_ps( _mm_add_ps( _mm_mul_ps( lx, lx ), _mm_mul_ps( ly, ly ) ), _mm_mul_ps( lz, lz ) );
+                const __m128 ndotl  = _mm_add_ps( _mm_add_ps( _mm_mul_ps( n[0], lx ), _mm_mul_ps( n[1], ly ) ), _mm_mul_ps( n[2], lz ) );
+                const __m128 lambert = _mm_max_ps( zero, _mm_div_ps( _mm_mul_ps( ndotl, ninv ),
+                                                                     _mm_sqrt_ps( _mm_max_ps( llen2, _mm_set1_ps( 1e-20f ) ) ) ) );
+
+                for ( int c = 0; c < 3; c++ )
+                {
+                    sum[c] = _mm_add_ps( sum[c], _mm_mul_ps( lambert, _mm_set1_ps( t.afLightColor[l][c] ) ) );
+                }
+            }
+
+            const __m128 cx = _mm_mul_ps( _mm_set1_ps( t.fScaleX ), e[0] );
+            const __m128 cy = _mm_mul_ps( _mm_set1_ps( t.fScaleY ), e[1] );
+            const __m128 cz = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( t.fDepthA ), e[2] ), _mm_set1_ps( t.fDepthB ) );
+            const __m128 cw = _mm_sub_ps( zero, e[2] );
+            // lanes behind the eye divide by zero or less; clipping never reads them.
+            const __m128 iw = _mm_div_ps( one, cw );
+            const __m128 sx = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( _mm_mul_ps( cx, iw ), half ), half ), width );
+            const __m128 sy = _mm_mul_ps( _mm_sub_ps( half, _mm_mul_ps( _mm_mul_ps( cy, iw ), half ) ), height );
+            const __m128 sz = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( cz, iw ), half ), half );
+
+            __m128 r = _mm_mul_ps( _mm_min_ps( one, _mm_mul_ps( sum[0], _mm_loadu_ps( pR + v ) ) ), scale255 );
+            __m128 g = _mm_mul_ps( _mm_min_ps( one, _mm_mul_ps( sum[1], _mm_loadu_ps( pG + v ) ) ), scale255 );
+            __m128 b = _mm_mul_ps( _mm_min_ps( one, _mm_mul_ps( sum[2], _mm_loadu_ps( pB + v ) ) ), scale255 );
+            __m128 p = zero;
+
+            __m128 c0 = cx, c1 = cy, c2 = cz, c3 = cw;
+            __m128 s0 = sx, s1 = sy, s2 = sz, s3 = iw;
+
+            _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+            _MM_TRANSPOSE4_PS( s0, s1, s2, s3 );
+            _MM_TRANSPOSE4_PS( r, g, b, p );
+
+            const __m128 aClip[4]   = { c0, c1, c2, c3 };
+            const __m128 aScreen[4] = { s0, s1, s2, s3 };
+            const __m128 aColor[4]  = { r, g, b, p };
+
+            for ( int i = 0; i < 4; i++ )
+            {
+                ScreenVertex& out = m_screen[v + i];
+
+                _mm_storeu_ps( &out.cx, aClip[i] );
+                _mm_storeu_ps( &out.x, aScreen[i] );
+                _mm_storeu_ps( &out.r, aColor[i] );
+            }
+        }
+#else
+        for ( uint32_t v = uiBegin; v < uiEnd; v++ )
+        {
+            const float afPos[3]    = { m_soa[0][v], m_soa[1][v], m_soa[2][v] };
+            const float afNormal[3] = { m_soa[3][v], m_soa[4][v], m_soa[5][v] };
+            float       afEye[3], afN[3];
+
+            for ( int i = 0; i < 3; i++ )
+            {
+                const float* const r = t.afView + i * 4;
+
+                afEye[i]    = r[0] * afPos[0] + r[1] * afPos[1] + r[2] * afPos[2] + r[3];
+                afN[i]      = r[0] * afNormal[0] + r[1] * afNormal[1] + r[2] * afNormal[2];
+            }
+
+            const float fInvN = 1.0f / std::sqrt( std::max( afN[0] * afN[0] + afN[1] * afN[1] + afN[2] * afN[2], 1e-20f ) );
+            float       afSum[3] = { t.afAmbient[0], t.afAmbient[1], t.afAmbient[2] };
+
+            for ( int l = 0; l < kNumLights; l++ )
+            {
+                const float afL[3]  = { t.afLightPos[l][0] - afEye[0], t.afLightPos[l][1] - afEye[1], t.afLightPos[l][2] - afEye[2] };
+                const float fLen    = std::sqrt( std::max( afL[0] * afL[0] + afL[1] * afL[1] + afL[2] * afL[2], 1e-20f ) );
+                const float fDot    = (afN[0] * afL[0] + afN[1] * afL[1] + afN[2] * afL[2]) * fInvN / fLen;
+
+                for ( int c = 0; c < 3; c++ )
+                {
+                    afSum[c] += std::max( 0.0f, fDot ) * t.afLightColor[l][c];
+                }
+            }
+
+            ScreenVertex& out = m_screen[v];
+
+            out.cx  = t.fScaleX * afEye[0];
+            out.cy  = t.fScaleY * afEye[1];
+            out.cz  = t.fDepthA * afEye[2] + t.fDepthB;
+            out.cw  = -afEye[2];
+            out.r   = std::min( 1.0f, afSum[0] * m_soa[6][v] ) * 255.0f;
+            out.g   = std::min( 1.0f, afSum[1] * m_soa[7][v] ) * 255.0f;
+            out.b   = std::min( 1.0f, afSum[2] * m_soa[8][v] ) * 255.0f;
+            out.pad = 0;
+
+            project( out );
+        }
+#endif
+    }
+
+    void project( ScreenVertex& v ) const
+    {
+        v.iw    = 1.0f / v.cw;
+        v.x     = (v.cx * v.iw * 0.5f + 0.5f) * m_uiWidth;
+        v.y     = (0.5f - v.cy * v.iw * 0.5f) * m_uiHeight;
+        v.z     = v.cz * v.iw * 0.5f + 0.5f;
+    }
+
+    static bool inFront( const ScreenVertex& v )    { return v.cz + v.cw >= 0.0f; }
+
+    /// the part of a primitive in front of the near plane, as a fan or a
+    /// segment of at most four vertices.
+    uint32_t clipNear( const ScreenVertex* const* apIn, uint32_t uiNum, ScreenVertex* pOut ) const
+    {
+        uint32_t uiOut = 0;
+
+        for ( uint32_t i = 0; i < uiNum; i++ )
+        {
+            // a segment has one edge, not a closed loop.
+            if ( uiNum == 2 && i == 1 )
+            {
+                if ( inFront( *apIn[1] ) )
+                {
+                    pOut[uiOut++] = *apIn[1];
+                }
+
+                break;
+            }
+
+            const ScreenVertex& a   = *apIn[i];
+            const ScreenVertex& b   = *apIn[(i + 1) % uiNum];
+            const float         fA  = a.cz + a.cw;
+            const float         fB  = b.cz + b.cw;
+
+            if ( fA >= 0.0f )
+            {
+                pOut[uiOut++] = a;
+            }
+
+            if ( (fA >= 0.0f) != (fB >= 0.0f) )
+            {
+                const float     fT  = fA / (fA - fB);
+                ScreenVertex&   v   = pOut[uiOut++];
+
+                v.cx    = a.cx + (b.cx - a.cx) * fT;
+                v.cy    = a.cy + (b.cy - a.cy) * fT;
+                v.cz    = a.cz + (b.cz - a.cz) * fT;
+                v.cw    = a.cw + (b.cw - a.cw) * fT;
+                v.r     = a.r + (b.r - a.r) * fT;
+                v.g     = a.g + (b.g - a.g) * fT;
+                v.b     = a.b + (b.b - a.b) * fT;
+                v.pad   = 0;
+
+                project( v );
+            }
+        }
+
+        return uiOut;
+    }
+
+    /// the vertices of primitive p, near clipped when needed.  returns how
+    /// many, zero when nothing of it is in front of the camera.
+    uint32_t primitive( uint32_t p, ScreenVertex* pClipped, const ScreenVertex** apOut ) const
+    {
+        const uint32_t uiNum = verticesPerPrimitive();
+        const uint32_t* pIndices = &m_indices[static_cast<size_t>(p) * uiNum];
+        const ScreenVertex* apIn[3];
+        bool bAllInFront = true;
+
+        for ( uint32_t i = 0; i < uiNum; i++ )
+        {
+            apIn[i] = &m_screen[pIndices[i]];
+            bAllInFront = bAllInFront && inFront( *apIn[i] );
+        }
+
+        if ( bAllInFront )
+        {
+            std::copy( apIn, apIn + uiNum, apOut );
+            return uiNum;
+        }
+
+        const uint32_t uiOut = clipNear( apIn, uiNum, pClipped );
+
+        for ( uint32_t i = 0; i < uiOut; i++ )
+        {
+            apOut[i] = &pClipped[i];
+        }
+
+        return (uiOut >= uiNum) ? uiOut : 0;
+    }
+
+    /// twice the signed pixel area; GL's counter clockwise front faces come
+    /// out negative with y pointing down.
+    static float area( const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c )
+    {
+        return (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    }
+
+    /// files primitives uiBegin .. uiEnd of batch b under every tile their
+    /// bounds touch.
+    void binBatch( uint32_t b, uint32_t uiEnd )
+    {
+        const uint32_t      uiNumTiles  = m_uiTilesX * m_uiTilesY;
+        std::vector<uint32_t>* pBins    = &m_bins[static_cast<size_t>(b) * uiNumTiles];
+        const bool          bTubes      = (m_settings.eStyle == kStyle_Tubes);
+        ScreenVertex        aClipped[4];
+        const ScreenVertex* apVerts[4];
+
+        for ( uint32_t t = 0; t < uiNumTiles; t++ )
+        {
+            pBins[t].clear();
+        }
+
+        for ( uint32_t p = b * static_cast<uint32_t>(kBatchPrims); p < uiEnd; p++ )
+        {
+            const uint32_t uiNum = primitive( p, aClipped, apVerts );
+
+            if ( !uiNum || (bTubes && uiNum == 3 && area( *apVerts[0], *apVerts[1], *apVerts[2] ) >= 0.0f) )
+            {
+                continue;
+            }
+
+            float fMinX = apVerts[0]->x, fMaxX = fMinX, fMinY = apVerts[0]->y, fMaxY = fMinY;
+
+            for ( uint32_t i = 1; i < uiNum; i++ )
+            {
+                fMinX = std::min( fMinX, apVerts[i]->x );
+                fMaxX = std::max( fMaxX, apVerts[i]->x );
+                fMinY = std::min( fMinY, apVerts[i]->y );
+                fMaxY = std::max( fMaxY, apVerts[i]->y );
+            }
+
+            // NaN bounds fail these too.
+            if ( !(fMaxX >= 0.0f && fMaxY >= 0.0f && fMinX < m_uiWidth && fMinY < m_uiHeight) )
+            {
+                continue;
+            }
+
+            const int32_t iTileX0 = pixelClamp( fMinX, m_uiWidth ) / kTileSize;
+            const int32_t iTileX1 = pixelClamp( fMaxX, m_uiWidth ) / kTileSize;
+            const int32_t iTileY0 = pixelClamp( fMinY, m_uiHeight ) / kTileSize;
+            const int32_t iTileY1 = pixelClamp( fMaxY, m_uiHeight ) / kTileSize;
+
+            for ( int32_t ty = iTileY0; ty <= iTileY1; ty++ )
+            {
+                for ( int32_t tx = iTileX0; tx <= iTileX1; tx++ )
+                {
+                    pBins[ty * m_uiTilesX + tx].push_back( p );
+                }
+            }
+        }
+    }
+
+    /// the pixel holding coordinate f, clamped to the image.
+    static int32_t pixelClamp( float f, uint32_t uiSize )
+    {
+        return static_cast<int32_t>( std::min( std::max( f, 0.0f ), static_cast<float>(uiSize - 1) ) );
+    }
+
+    void fillTile( uint32_t t, uint32_t uiNumBatches )
+    {
+        const uint32_t  uiNumTiles  = m_uiTilesX * m_uiTilesY;
+        const bool      bTubes      = (m_settings.eStyle == kStyle_Tubes);
+        Tile            tile;
+
+        tile.x0 = (t % m_uiTilesX) * kTileSize;
+        tile.y0 = (t / m_uiTilesX) * kTileSize;
+        // the last column also owns the row padding.
+        tile.x1 = std::min<int32_t>( tile.x0 + kTileSize, m_uiStride );
+        tile.y1 = std::min<int32_t>( tile.y0 + kTileSize, m_uiHeight );
+
+        for ( int32_t y = tile.y0; y < tile.y1; y++ )
+        {
+            std::fill( &m_image[y * m_uiStride + tile.x0], &m_image[y * m_uiStride + tile.x1], 0xFF000000u );
+            std::fill( &m_depth[y * m_uiStride + tile.x0], &m_depth[y * m_uiStride + tile.x1], 1.0f );
+        }
+
+        ScreenVertex        aClipped[4];
+        const ScreenVertex* apVerts[4];
+
+        for ( uint32_t b = 0; b < uiNumBatches; b++ )
+        {
+            const std::vector<uint32_t>& bin = m_bins[static_cast<size_t>(b) * uiNumTiles + t];
+
+            for ( size_t i = 0; i < bin.size(); i++ )
+            {
+                const uint32_t uiNum = primitive( bin[i], aClipped, apVerts );
+
+                if ( !bTubes )
+                {
+                    drawLine( *apVerts[0], *apVerts[1], tile );
+                    continue;
+                }
+
+                // a clipped triangle is a fan.
+                for ( uint32_t v = 2; v < uiNum; v++ )
+                {
+                    fillTriangle( *apVerts[0], *apVerts[v - 1], *apVerts[v], tile );
+                }
+            }
+        }
+    }
+
+    /// a front facing triangle, pixel centres on an edge included, colors
+    /// interpolated perspective correct.
+    void fillTriangle( const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, const Tile& tile )
+    {
+        const float fArea = area( v0, v1, v2 );
+
+        if ( !(fArea < 0.0f) )
+        {
+            return;
+        }
+
+        const int32_t iX0 = std::max<int32_t>( tile.x0, static_cast<int32_t>( std::ceil( std::max( std::min( std::min( v0.x, v1.x ), v2.x ) - 0.5f, -1.0f ) ) ) );
+        const int32_t iX1 = std::min<int32_t>( tile.x1 - 1, static_cast<int32_t>( std::floor( std::min( std::max( std::max( v0.x, v1.x ), v2.x ) - 0.5f, 1e9f ) ) ) );
+        const int32_t iY0 = std::max<int32_t>( tile.y0, static_cast<int32_t>( std::ceil( std::max( std::min( std::min( v0.y, v1.y ), v2.y ) - 0.5f, -1.0f ) ) ) );
+        const int32_t iY1 = std::min<int32_t>( tile.y1 - 1, static_cast<int32_t>( std::floor( std::min( std::max( std::max( v0.y, v1.y ), v2.y ) - 0.5f, 1e9f ) ) ) );
+
+        if ( iX0 > iX1 || iY0 > iY1 )
+        {
+            return;
+        }
+
+        // edge i is opposite vertex i, positive inside: w = a * x + b * y + c.
+        const ScreenVertex* const apV[3] = { &v0, &v1, &v2 };
+        float afA[3], afB[3], afC[3];
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            const ScreenVertex& a = *apV[(i + 1) % 3];
+            const ScreenVertex& b = *apV[(i + 2) % 3];
+
+            afA[i] = b.y - a.y;
+            afB[i] = a.x - b.x;
+            afC[i] = (b.x - a.x) * a.y - (b.y - a.y) * a.x;
+        }
+
+        const float fInvSum = -1.0f / fArea;
+        // depth and the perspective weights per vertex, colors premultiplied by them.
+        float afZ[3], afK[3], afKR[3], afKG[3], afKB[3];
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            afZ[i]  = apV[i]->z * fInvSum;
+            afK[i]  = apV[i]->iw;
+            afKR[i] = apV[i]->r * apV[i]->iw;
+            afKG[i] = apV[i]->g * apV[i]->iw;
+            afKB[i] = apV[i]->b * apV[i]->iw;
+        }
+
+#if defined(LEAPPAINT_SSE)
+        const __m128 zero   = _mm_setzero_ps();
+        const __m128 lanes  = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+        __m128 a[3], z[3], k[3], kr[3], kg[3], kb[3];
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            a[i]    = _mm_set1_ps( afA[i] );
+            z[i]    = _mm_set1_ps( afZ[i] );
+            k[i]    = _mm_set1_ps( afK[i] );
+            kr[i]   = _mm_set1_ps( afKR[i] );
+            kg[i]   = _mm_set1_ps( afKG[i] );
+            kb[i]   = _mm_set1_ps( afKB[i] );
+        }
+
+        for ( int32_t y = iY0; y <= iY1; y++ )
+        {
+            const float fY      = y + 0.5f;
+            uint32_t*   pColor  = &m_image[y * m_uiStride];
+            float*      pDepth  = &m_depth[y * m_uiStride];
+            __m128      row[3];
+
+            for ( int i = 0; i < 3; i++ )
+            {
+                row[i] = _mm_set1_ps( afB[i] * fY + afC[i] );
+            }
+
+            for ( int32_t x = iX0 & ~3; x <= iX1; x += 4 )
+            {
+                const __m128 px = _mm_add_ps( _mm_set1_ps( static_cast<float>(x) ), lanes );
+                const __m128 w0 = _mm_add_ps( _mm_mul_ps( a[0], px ), row[0] );
+                const __m128 w1 = _mm_add_ps( _mm_mul_ps( a[1], px ), row[1] );
+                const __m128 w2 = _mm_add_ps( _mm_mul_ps( a[2], px ), row[2] );
+                const __m128 inside = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( w0, zero ), _mm_cmpge_ps( w1, zero ) ), _mm_cmpge_ps( w2, zero ) );
+
+                if ( !_mm_movemask_ps( inside ) )
+                {
+                    continue;
+                }
+
+                const __m128 depth  = _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, z[0] ), _mm_mul_ps( w1, z[1] ) ), _mm_mul_ps( w2, z[2] ) );
+                const __m128 old    = _mm_loadu_ps( pDepth + x );
+                const __m128 pass   = _mm_and_ps( inside, _mm_cmplt_ps( depth, old ) );
+                const int    iMask  = _mm_movemask_ps( pass );
+
+                if ( !iMask )
+                {
+                    continue;
+                }
+
+                _mm_storeu_ps( pDepth + x, _mm_or_ps( _mm_and_ps( pass, depth ), _mm_andnot_ps( pass, old ) ) );
+
+                const __m128 inv = _mm_div_ps( _mm_set1_ps( 1.0f ), _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, k[0] ), _mm_mul_ps( w1, k[1] ) ), _mm_mul_ps( w2, k[2] ) ) );
+                float afRed[4], afGreen[4], afBlue[4];
+
+                _mm_storeu_ps( afRed, _mm_mul_ps( inv, _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, kr[0] ), _mm_mul_ps( w1, kr[1] ) ), _mm_mul_ps( w2, kr[2] ) ) ) );
+                _mm_storeu_ps( afGreen, _mm_mul_ps( inv, _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, kg[0] ), _mm_mul_ps( w1, kg[1] ) ), _mm_mul_ps( w2, kg[2] ) ) ) );
+                _mm_storeu_ps( afBlue, _mm_mul_ps( inv, _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, kb[0] ), _mm_mul_ps( w1, kb[1] ) ), _mm_mul_ps( w2, kb[2] ) ) ) );
+
+                for ( int l = 0; l < 4; l++ )
+                {
+                    if ( iMask & (1 << l) )
+                    {
+                        pColor[x + l] = pack( afRed[l], afGreen[l], afBlue[l] );
+                    }
+                }
+            }
+        }
+#else
+        for ( int32_t y = iY0; y <= iY1; y++ )
+        {
+            const float fY = y + 0.5f;
+
+            for ( int32_t x = iX0; x <= iX1; x++ )
+            {
+                const float fX = x + 0.5f;
+                float       w[3];
+
+                for ( int i = 0; i < 3; i++ )
+                {
+                    w[i] = afA[i] * fX + afB[i] * fY + afC[i];
+                }
+
+                if ( w[0] < 0.0f || w[1] < 0.0f || w[2] < 0.0f )
+                {
+                    continue;
+                }
+
+                const float fDepth  = w[0] * afZ[0] + w[1] * afZ[1] + w[2] * afZ[2];
+                float&      fOld    = m_depth[y * m_uiStride + x];
+
+                if ( !(fDepth < fOld) )
+                {
+                    continue;
+                }
+
+                const float fInv = 1.0f / (w[0] * afK[0] + w[1] * afK[1] + w[2] * afK[2]);
+
+                fOld = fDepth;
+                m_image[y * m_uiStride + x] = pack( (w[0] * afKR[0] + w[1] * afKR[1] + w[2] * afKR[2]) * fInv,
+                                                    (w[0] * afKG[0] + w[1] * afKG[1] + w[2] * afKG[2]) * fInv,
+                                                    (w[0] * afKB[0] + w[1] * afKB[1] + w[2] * afKB[2]) * fInv );
+            }
+        }
+#endif
+    }
+
+    /// a one pixel line, one pixel per column or row along its major axis.
+    void drawLine( const ScreenVertex& a, const ScreenVertex& b, const Tile& tile )
+    {
+        const bool bXMajor = std::fabs( b.x - a.x ) >= std::fabs( b.y - a.y );
+        // walk from the smaller major coordinate.
+        const ScreenVertex& p = ((bXMajor ? a.x <= b.x : a.y <= b.y)) ? a : b;
+        const ScreenVertex& q = (&p == &a) ? b : a;
+        const float fMajor0 = bXMajor ? p.x : p.y;
+        const float fMajor1 = bXMajor ? q.x : q.y;
+        const float fSpan   = fMajor1 - fMajor0;
+
+        if ( !(fSpan > 0.0f) )
+        {
+            return;
+        }
+
+        const int32_t iMin  = bXMajor ? tile.x0 : tile.y0;
+        const int32_t iMax  = bXMajor ? std::min<int32_t>( tile.x1, m_uiWidth ) - 1 : tile.y1 - 1;
+        const int32_t iMinorMin = bXMajor ? tile.y0 : tile.x0;
+        const int32_t iMinorMax = bXMajor ? tile.y1 - 1 : std::min<int32_t>( tile.x1, m_uiWidth ) - 1;
+        const int32_t iFirst    = std::max<int32_t>( iMin, static_cast<int32_t>( std::ceil( std::max( fMajor0 - 0.5f, -1.0f ) ) ) );
+        const int32_t iLast     = std::min<int32_t>( iMax, static_cast<int32_t>( std::ceil( std::min( fMajor1 - 0.5f, 1e9f ) ) ) - 1 );
+
+        for ( int32_t i = iFirst; i <= iLast; i++ )
+        {
+            const float     fT      = (i + 0.5f - fMajor0) / fSpan;
+            const float     fMinor  = bXMajor ? p.y + (q.y - p.y) * fT : p.x + (q.x - p.x) * fT;
+
+            if ( !(fMinor >= iMinorMin && fMinor < iMinorMax + 1) )
+            {
+                continue;
+            }
+
+            const int32_t   iMinor  = static_cast<int32_t>( fMinor );
+            const size_t    uiPixel = bXMajor ? static_cast<size_t>(iMinor) * m_uiStride + i : static_cast<size_t>(i) * m_uiStride + iMinor;
+            const float     fDepth  = p.z + (q.z - p.z) * fT;
+
+            if ( !(fDepth < m_depth[uiPixel]) )
+            {
+                continue;
+            }
+
+            const float fK0     = p.iw * (1.0f - fT);
+            const float fK1     = q.iw * fT;
+            const float fInv    = 1.0f / (fK0 + fK1);
+
+            m_depth[uiPixel] = fDepth;
+            m_image[uiPixel] = pack( (p.r * fK0 + q.r * fK1) * fInv, (p.g * fK0 + q.g * fK1) * fInv, (p.b * fK0 + q.b * fK1) * fInv );
+        }
+    }
+
+    static uint32_t pack( float fR, float fG, float fB )
+    {
+        const uint32_t uiR = static_cast<uint32_t>( std::min( std::max( fR, 0.0f ), 255.0f ) + 0.5f );
+        const uint32_t uiG = static_cast<uint32_t>( std::min( std::max( fG, 0.0f ), 255.0f ) + 0.5f );
+        const uint32_t uiB = static_cast<uint32_t>( std::min( std::max( fB, 0.0f ), 255.0f ) + 0.5f );
+
+        return 0xFF000000u | (uiB << 16) | (uiG << 8) | uiR;
+    }
+
+    Settings                            m_settings;
+    std::vector<float>                  m_soa[kNumChannels];  ///< world x, y, z, normal x, y, z and material r, g, b
+    uint32_t                            m_uiNumVertices;
+    std::vector<uint32_t>               m_indices;      ///< triangles or segments
+    std::vector<ScreenVertex>           m_screen;
+    Transform                           m_transform;
+    std::vector<std::vector<uint32_t> > m_bins;         ///< primitives by batch, then tile
+    std::vector<uint32_t>               m_image;
+    std::vector<float>                  m_depth;
+    uint32_t                            m_uiWidth;
+    uint32_t                            m_uiHeight;
+    uint32_t                            m_uiStride;
+    uint32_t                            m_uiTilesX;
+    uint32_t                            m_uiTilesY;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeRaster_h__
@@ -0,0 +1,571 @@
+/******************************************************************************\
+* LeapPaint3D stroke rendering.
+*
+* Every StrokeStore chunk is mirrored by one vertex buffer and one index buffer
+* that are allocated once and then only ever appended to, so each frame uploads
+* just the points recorded since the previous frame.  All line segments of a
+* chunk are drawn with a single glDrawElements call, or, given a view, one call
+* per run of adjacent segment bricks the StrokeIndex finds in view.  Bricks far
+* enough away to use a coarser level of detail have that level's indices
+* gathered into a streamed index buffer, one more call per chunk.
+*
+* Given a palette, every stroke is drawn in its own color and adjacent bricks
+* share a call only when their colors match; without one, strokes take the
+* current GL color.
+*
+* In tube style each chunk additionally gets a TubeMesher mesh with normals,
+* whose rings and triangles are extended at the tail the same way, and bricks
+* are drawn as triangles at full detail.  Given a JobSystem, large batches of
+* rings are built on its workers and detail levels in the background.
+*
+* Only OpenGL 1.5 buffer objects and client vertex arrays are used, which keeps
+* this runnable on software implementations such as Mesa llvmpipe
+* (LIBGL_ALWAYS_SOFTWARE=1); tools/PaintGLCheck.cpp checks it there against
+* StrokeRasterizer.  GL headers must be included before this file.
+\******************************************************************************/
+
+#if !defined(__StrokeRenderer_h__)
+#define __StrokeRenderer_h__
+
+#include "StrokeBatcher.h"
+#include "TubeMesh.h"
+#include <algorithm>
+#include <vector>
+
+namespace LeapPaint {
+
+/// GLFunctions is anything exposing glGenBuffers, glDeleteBuffers, glBindBuffer,
+/// glBufferData and glBufferSubData members, e.g. JUCE's OpenGLExtensionFunctions.
+template<typename GLFunctions>
+class StrokeRenderer
+{
+public:
+    enum Style
+    {
+        kStyle_Lines,
+        kStyle_Tubes
+    };
+
+    explicit StrokeRenderer( GLFunctions& gl )
+      : m_gl(gl),
+        m_uiStreamIndices(0),
+        m_eStyle(kStyle_Lines),
+        m_bDrawListValid(false),
+        m_bDrawListHasView(false),
+        m_eDrawListStyle(kStyle_Lines),
+        m_uiDrawListVisibility(0),
+        m_uiDrawListLevels(0),
+        m_pJobs(nullptr),
+        m_pColors(nullptr),
+        m_uiNumColors(0)
+    {
+    }
+
+    ~StrokeRenderer() { release(); }
+
+    /// switching to tubes meshes the whole painting once on the next update.
+    void setStyle( Style eStyle )
+    {
+        if ( eStyle == kStyle_Tubes && m_eStyle != kStyle_Tubes )
+        {
+            m_batcher.invalidate();
+        }
+
+        m_eStyle = eStyle;
+    }
+
+    Style style() const { return m_eStyle; }
+
+    /// null does all the work on the GL thread.  must outlive the renderer.
+    void setJobSystem( JobSystem* pJobs )
+    {
+        m_pJobs = pJobs;
+        m_batcher.setJobSystem( pJobs );
+    }
+
+    /// rgb in 0..1 by stroke color index, read every draw.  null draws
+    /// everything in the current GL color.  must outlive the renderer.
+    void setColors( const Leap::Vector* pColors, uint32_t uiNumColors )
+    {
+        m_pColors           = pColors;
+        m_uiNumColors       = uiNumColors;
+        m_bDrawListValid    = false;
+    }
+
+    /// uploads geometry appended since the last call.  must run on the GL thread.
+    void update( const StrokeStore& store )
+    {
+        if ( m_batcher.sync( store ) )
+        {
+            m_mesher.reset();
+        }
+
+        const bool                      bTubes  = (m_eStyle == kStyle_Tubes);
+        const std::vector<uint32_t>&    dirty   = m_batcher.dirtyChunks();
+
+        if ( !dirty.empty() )
+        {
+            m_bDrawListValid = false;
+        }
+
+        for ( size_t i = 0; i < dirty.size(); i++ )
+        {
+            const uint32_t                  uiChunk     = dirty[i];
+            StrokeBatcher::ChunkGeometry&   geometry    = m_batcher.chunkGeometry( uiChunk );
+            const Buffers&                  buffers     = chunkBuffers( uiChunk, bTubes );
+
+            if ( geometry.uiNumVerticesUploaded < geometry.uiNumVertices )
+            {
+                const uint32_t uiFirst = geometry.uiNumVerticesUploaded;
+
+                m_gl.glBindBuffer( GL_ARRAY_BUFFER, buffers.uiVertices );
+                m_gl.glBufferSubData( GL_ARRAY_BUFFER,
+                                      uiFirst * sizeof(Leap::Vector),
+                                      (geometry.uiNumVertices - uiFirst) * sizeof(Leap::Vector),
+                                      store.chunk( uiChunk ).aPoints + uiFirst );
+
+                geometry.uiNumVerticesUploaded = geometry.uiNumVertices;
+            }
+
+            const uint32_t uiNumIndices = static_cast<uint32_t>(geometry.indices.size());
+
+            if ( geometry.uiNumIndicesUploaded < uiNumIndices )
+            {
+                const uint32_t uiFirst = geometry.uiNumIndicesUploaded;
+
+                m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers.uiIndices );
+                m_gl.glBufferSubData( GL_ELEMENT_ARRAY_BUFFER,
+                                      uiFirst * sizeof(uint16_t),
+                                      (uiNumIndices - uiFirst) * sizeof(uint16_t),
+                                      &geometry.indices[uiFirst] );
+
+                if ( bTubes )
+                {
+                    uploadTubeIndices( buffers, geometry, uiFirst, uiNumIndices );
+                }
+
+                geometry.uiNumIndicesUploaded = uiNumIndices;
+            }
+        }
+
+        if ( bTubes )
+        {
+            uploadTubeRings( store );
+        }
+
+        m_gl.glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+    }
+
+    /// vertices are in leap space, so the caller sets up the leap-to-world
+    /// transform on the model view matrix.  pView, if given, is in leap space
+    /// too; it limits drawing to bricks that may be in view and picks their
+    /// level of detail.  bricks of strokes the store hides are skipped, their
+    /// geometry stays uploaded for when an undo shows them again.  the list
+    /// of draw calls is kept until the view, the geometry or what is hidden
+    /// changes, so a still painting costs no CPU work beyond issuing it.
+    void draw( const StrokeStore& store, const StrokeView* pView = nullptr )
+    {
+        const bool bTubes = (m_eStyle == kStyle_Tubes);
+
+        if ( !m_bDrawListValid || m_eDrawListStyle != m_eStyle || m_uiDrawListVisibility != store.visibilityStamp() ||
+             m_uiDrawListLevels != m_batcher.index().levelStamp() ||
+             m_bDrawListHasView != (pView != nullptr) || (pView && !pView->sameAs( m_drawListView )) )
+        {
+            buildDrawList( store, pView );
+        }
+
+        glEnableClientState( GL_VERTEX_ARRAY );
+
+        if ( bTubes )
+        {
+            glEnableClientState( GL_NORMAL_ARRAY );
+        }
+
+        if ( m_pColors )
+        {
+            glPushAttrib( GL_CURRENT_BIT );
+        }
+
+        // ranges are in line indices, two per segment.
+        const uint32_t  uiIndexScale    = bTubes ? TubeMesher::kIndicesPerSegment / 2 : 1;
+        uint32_t        uiBoundChunk    = StrokeStore::kInvalid;
+        uint32_t        uiColorIndex    = StrokeStore::kInvalid;
+
+        for ( size_t i = 0; i < m_ranges.size(); i++ )
+        {
+            const IndexRange&   range   = m_ranges[i];
+            const Buffers&      buffers = m_buffers[range.uiChunk];
+
+            setColor( range.uiColorIndex, uiColorIndex );
+
+            if ( range.uiChunk != uiBoundChunk )
+            {
+                if ( bTubes )
+                {
+                    m_gl.glBindBuffer( GL_ARRAY_BUFFER, buffers.uiTubeVertices );
+                    m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers.uiTubeIndices );
+                    glVertexPointer( 3, GL_FLOAT, sizeof(Leap::Vector), 0 );
+                    glNormalPointer( GL_FLOAT, sizeof(Leap::Vector), reinterpret_cast<const GLvoid*>( kTubeNormalsOffset ) );
+                }
+                else
+                {
+                    m_gl.glBindBuffer( GL_ARRAY_BUFFER, buffers.uiVertices );
+                    m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers.uiIndices );
+                    glVertexPointer( 3, GL_FLOAT, sizeof(Leap::Vector), 0 );
+                }
+
+                uiBoundChunk = range.uiChunk;
+            }
+
+            glDrawElements( bTubes ? GL_TRIANGLES : GL_LINES, range.uiCount * uiIndexScale, GL_UNSIGNED_SHORT,
+                            reinterpret_cast<const GLvoid*>( static_cast<size_t>(range.uiFirst * uiIndexScale) * sizeof(uint16_t) ) );
+        }
+
+        drawLevelsOfDetail( uiColorIndex );
+
+        m_gl.glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+        if ( m_pColors )
+        {
+            glPopAttrib();
+        }
+
+        if ( bTubes )
+        {
+            glDisableClientState( GL_NORMAL_ARRAY );
+        }
+
+        glDisableClientState( GL_VERTEX_ARRAY );
+    }
+
+    /// frees the GL buffers.  call while the context is still current.
+    void release()
+    {
+        for ( size_t i = 0; i < m_buffers.size(); i++ )
+        {
+            m_gl.glDeleteBuffers( 1, &m_buffers[i].uiVertices );
+            m_gl.glDeleteBuffers( 1, &m_buffers[i].uiIndices );
+
+            if ( m_buffers[i].uiTubeVertices != 0 )
+            {
+                m_gl.glDeleteBuffers( 1, &m_buffers[i].uiTubeVertices );
+                m_gl.glDeleteBuffers( 1, &m_buffers[i].uiTubeIndices );
+            }
+        }
+
+        m_buffers.clear();
+
+        if ( m_uiStreamIndices != 0 )
+        {
+            m_gl.glDeleteBuffers( 1, &m_uiStreamIndices );
+            m_uiStreamIndices = 0;
+        }
+
+        m_batcher.invalidate();
+        m_bDrawListValid = false;
+    }
+
+    /// every synced segment, for picking and future tools.
+    const StrokeIndex& index() const { return m_batcher.index(); }
+
+private:
+    /// tube vertex buffers hold all positions, then all normals.
+    static const size_t kTubeNormalsOffset = TubeMesher::kChunkVertices * sizeof(Leap::Vector);
+
+    struct Buffers
+    {
+        GLuint uiVertices;
+        GLuint uiIndices;
+        GLuint uiTubeVertices;      ///< 0 until tubes are drawn
+        GLuint uiTubeIndices;
+    };
+
+    struct IndexRange
+    {
+        uint32_t uiChunk;
+        uint32_t uiFirst;
+        uint32_t uiCount;
+        uint32_t uiColorIndex;      ///< of its strokes, 0 without a palette
+
+        bool operator<( const IndexRange& other ) const
+        {
+            return uiChunk != other.uiChunk ? uiChunk < other.uiChunk : uiFirst < other.uiFirst;
+        }
+    };
+
+    /// sets the GL color of a range when it differs from the last one set.
+    void setColor( uint32_t uiColorIndex, uint32_t& uiCurrent ) const
+    {
+        if ( m_pColors && uiColorIndex != uiCurrent )
+        {
+            const Leap::Vector& vColor = m_pColors[uiColorIndex % m_uiNumColors];
+
+            glColor3f( vColor.x, vColor.y, vColor.z );
+            uiCurrent = uiColorIndex;
+        }
+    }
+
+    uint32_t colorIndex( const StrokeStore& store, StrokeStore::StrokeId uiStroke ) const
+    {
+        return m_pColors ? store.stroke( uiStroke ).uiColorIndex : 0;
+    }
+
+    /// triangles for the line segments uiFirst / 2 .. uiEnd / 2 of a chunk.
+    void uploadTubeIndices( const Buffers& buffers, const StrokeBatcher::ChunkGeometry& geometry, uint32_t uiFirst, uint32_t uiEnd )
+    {
+        m_tubeIndices.resize( (uiEnd - uiFirst) / 2 * TubeMesher::kIndicesPerSegment );
+
+        for ( uint32_t i = uiFirst, o = 0; i < uiEnd; i += 2, o += TubeMesher::kIndicesPerSegment )
+        {
+            TubeMesher::segmentIndices( geometry.indices[i], geometry.indices[i + 1], &m_tubeIndices[o] );
+        }
+
+        m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers.uiTubeIndices );
+        m_gl.glBufferSubData( GL_ELEMENT_ARRAY_BUFFER,
+                              uiFirst / 2 * TubeMesher::kIndicesPerSegment * sizeof(uint16_t),
+                              m_tubeIndices.size() * sizeof(uint16_t),
+                              &m_tubeIndices[0] );
+    }
+
+    /// rebuilds the rings of every point that was added or moved.
+    void uploadTubeRings( const StrokeStore& store )
+    {
+        m_ringBuilder.build( store, m_mesher, m_batcher.changedRuns(), m_pJobs,
+                             [this]( const StrokeStore::Run& run, uint32_t uiStart, const std::vector<Leap::Vector>& positions, const std::vector<Leap::Vector>& normals )
+        {
+            const size_t uiOffset   = (run.uiFirst + uiStart) * TubeMesher::kSides * sizeof(Leap::Vector);
+            const size_t uiBytes    = positions.size() * sizeof(Leap::Vector);
+
+            m_gl.glBindBuffer( GL_ARRAY_BUFFER, chunkBuffers( run.uiChunk, true ).uiTubeVertices );
+            m_gl.glBufferSubData( GL_ARRAY_BUFFER, uiOffset, uiBytes, &positions[0] );
+            m_gl.glBufferSubData( GL_ARRAY_BUFFER, kTubeNormalsOffset + uiOffset, uiBytes, &normals[0] );
+        } );
+    }
+
+    /// coarse bricks only ever reference vertices that were uploaded, so their
+    /// indices are gathered per chunk and streamed.
+    /// works out which index ranges of which chunks to draw.  full detail
+    /// ranges of adjacent bricks are merged into one call, coarser levels of
+    /// all chunks are gathered into the streamed index buffer, uploaded once
+    /// here rather than every frame.
+    void buildDrawList( const StrokeStore& store, const StrokeView* pView )
+    {
+        const bool          bTubes  = (m_eStyle == kStyle_Tubes);
+        const StrokeIndex&  index   = m_batcher.index();
+
+        m_bDrawListValid        = true;
+        m_eDrawListStyle        = m_eStyle;
+        m_uiDrawListVisibility  = store.visibilityStamp();
+        m_uiDrawListLevels      = index.levelStamp();
+        m_bDrawListHasView      = (pView != nullptr);
+
+        if ( pView )
+        {
+            m_drawListView = *pView;
+        }
+
+        m_gathered.clear();
+        m_lodGathered.clear();
+
+        // whole chunks go out in one call only when nothing is hidden,
+        // culled or colored per stroke.
+        if ( pView || store.hasHiddenStrokes() || m_pColors )
+        {
+            const auto gather = [&]( const StrokeIndex::Brick& brick )
+            {
+                if ( !store.isVisible( brick.uiStroke ) )
+                {
+                    return;
+                }
+
+                // tubes have no coarser levels.
+                const uint32_t uiLevel = (bTubes || !pView) ? 0 : index.selectLevel( brick, *pView );
+
+                const uint32_t uiColorIndex = colorIndex( store, brick.uiStroke );
+
+                if ( uiLevel == 0 )
+                {
+                    const IndexRange range = { brick.uiChunk, brick.uiFirstIndex, brick.uiNumSegments * 2, uiColorIndex };
+                    m_gathered.push_back( range );
+                }
+                else
+                {
+                    IndexRange range = { brick.uiChunk, 0, 0, uiColorIndex };
+                    StrokeIndex::levelRange( brick, uiLevel, range.uiFirst, range.uiCount );
+                    m_lodGathered.push_back( range );
+                }
+            };
+
+            if ( pView )
+            {
+                index.forEachVisible( pView->frustum, gather );
+            }
+            else
+            {
+                for ( uint32_t i = 0; i < index.brickCount(); i++ )
+                {
+                    gather( index.brick( i ) );
+                }
+            }
+
+            std::sort( m_gathered.begin(), m_gathered.end() );
+            std::sort( m_lodGathered.begin(), m_lodGathered.end() );
+        }
+        else
+        {
+            for ( uint32_t i = 0, e = static_cast<uint32_t>(m_buffers.size()); i < e; i++ )
+            {
+                const IndexRange range = { i, 0, m_batcher.chunkGeometry( i ).uiNumIndicesUploaded, 0 };
+                m_gathered.push_back( range );
+            }
+        }
+
+        m_ranges.clear();
+
+        for ( size_t i = 0; i < m_gathered.size(); )
+        {
+            IndexRange range = m_gathered[i++];
+
+            // adjacent bricks of a chunk in one color go out in one call.
+            while ( i < m_gathered.size() && m_gathered[i].uiChunk == range.uiChunk && m_gathered[i].uiFirst == range.uiFirst + range.uiCount &&
+                    m_gathered[i].uiColorIndex == range.uiColorIndex )
+            {
+                range.uiCount += m_gathered[i++].uiCount;
+            }
+
+            if ( range.uiChunk >= m_buffers.size() )
+            {
+                continue;
+            }
+
+            // nothing past what has been uploaded.
+            const uint32_t uiNumUploaded = m_batcher.chunkGeometry( range.uiChunk ).uiNumIndicesUploaded;
+
+            if ( range.uiFirst < uiNumUploaded )
+            {
+                range.uiCount = std::min( range.uiCount, uiNumUploaded - range.uiFirst );
+                m_ranges.push_back( range );
+            }
+        }
+
+        // one range of the streamed buffer per chunk and color.
+        const std::vector<uint16_t>& lodIndices = index.lodIndices();
+
+        m_lodRanges.clear();
+        m_streamed.clear();
+
+        for ( size_t i = 0; i < m_lodGathered.size(); )
+        {
+            const uint32_t  uiChunk         = m_lodGathered[i].uiChunk;
+            const uint32_t  uiColorIndex    = m_lodGathered[i].uiColorIndex;
+            IndexRange      range           = { uiChunk, static_cast<uint32_t>(m_streamed.size()), 0, uiColorIndex };
+
+            for ( ; i < m_lodGathered.size() && m_lodGathered[i].uiChunk == uiChunk && m_lodGathered[i].uiColorIndex == uiColorIndex; i++ )
+            {
+                m_streamed.insert( m_streamed.end(),
+                                   lodIndices.begin() + m_lodGathered[i].uiFirst,
+                                   lodIndices.begin() + m_lodGathered[i].uiFirst + m_lodGathered[i].uiCount );
+            }
+
+            range.uiCount = static_cast<uint32_t>(m_streamed.size()) - range.uiFirst;
+
+            if ( uiChunk < m_buffers.size() )
+            {
+                m_lodRanges.push_back( range );
+            }
+        }
+
+        if ( !m_streamed.empty() )
+        {
+            if ( m_uiStreamIndices == 0 )
+            {
+                m_gl.glGenBuffers( 1, &m_uiStreamIndices );
+            }
+
+            m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m_uiStreamIndices );
+            m_gl.glBufferData( GL_ELEMENT_ARRAY_BUFFER, m_streamed.size() * sizeof(uint16_t), &m_streamed[0], GL_DYNAMIC_DRAW );
+            m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+        }
+    }
+
+    void drawLevelsOfDetail( uint32_t& uiColorIndex )
+    {
+        for ( size_t i = 0; i < m_lodRanges.size(); i++ )
+        {
+            const IndexRange& range = m_lodRanges[i];
+
+            setColor( range.uiColorIndex, uiColorIndex );
+
+            m_gl.glBindBuffer( GL_ARRAY_BUFFER, m_buffers[range.uiChunk].uiVertices );
+            m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m_uiStreamIndices );
+
+            glVertexPointer( 3, GL_FLOAT, sizeof(Leap::Vector), 0 );
+            glDrawElements( GL_LINES, static_cast<GLsizei>(range.uiCount), GL_UNSIGNED_SHORT,
+                            reinterpret_cast<const GLvoid*>( static_cast<size_t>(range.uiFirst) * sizeof(uint16_t) ) );
+        }
+    }
+
+    const Buffers& chunkBuffers( uint32_t uiChunk, bool bTubes )
+    {
+        while ( m_buffers.size() <= uiChunk )
+        {
+            // a chunk never holds more segments than points.
+            Buffers buffers = { 0, 0, 0, 0 };
+
+            m_gl.glGenBuffers( 1, &buffers.uiVertices );
+            m_gl.glBindBuffer( GL_ARRAY_BUFFER, buffers.uiVertices );
+            m_gl.glBufferData( GL_ARRAY_BUFFER, StrokeStore::kChunkPoints * sizeof(Leap::Vector), nullptr, GL_DYNAMIC_DRAW );
+
+            m_gl.glGenBuffers( 1, &buffers.uiIndices );
+            m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers.uiIndices );
+            m_gl.glBufferData( GL_ELEMENT_ARRAY_BUFFER, StrokeStore::kChunkPoints * 2 * sizeof(uint16_t), nullptr, GL_DYNAMIC_DRAW );
+
+            m_buffers.push_back( buffers );
+        }
+
+        Buffers& buffers = m_buffers[uiChunk];
+
+        if ( bTubes && buffers.uiTubeVertices == 0 )
+        {
+            m_gl.glGenBuffers( 1, &buffers.uiTubeVertices );
+            m_gl.glBindBuffer( GL_ARRAY_BUFFER, buffers.uiTubeVertices );
+            m_gl.glBufferData( GL_ARRAY_BUFFER, 2 * kTubeNormalsOffset, nullptr, GL_DYNAMIC_DRAW );
+
+            m_gl.glGenBuffers( 1, &buffers.uiTubeIndices );
+            m_gl.glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffers.uiTubeIndices );
+            m_gl.glBufferData( GL_ELEMENT_ARRAY_BUFFER, StrokeStore::kChunkPoints * TubeMesher::kIndicesPerSegment * sizeof(uint16_t), nullptr, GL_DYNAMIC_DRAW );
+        }
+
+        return buffers;
+    }
+
+private:
+    GLFunctions&                            m_gl;
+    StrokeBatcher                           m_batcher;
+    TubeMesher                              m_mesher;
+    TubeRingBuilder                         m_ringBuilder;
+    std::vector<Buffers>                    m_buffers;
+    std::vector<IndexRange>                 m_gathered;
+    std::vector<IndexRange>                 m_lodGathered;
+    std::vector<IndexRange>                 m_ranges;           ///< merged full detail draws
+    std::vector<IndexRange>                 m_lodRanges;        ///< into m_uiStreamIndices, one per chunk
+    std::vector<uint16_t>                   m_streamed;
+    std::vector<uint16_t>                   m_tubeIndices;
+    GLuint                                  m_uiStreamIndices;
+    Style                                   m_eStyle;
+    bool                                    m_bDrawListValid;
+    bool                                    m_bDrawListHasView;
+    StrokeView                              m_drawListView;
+    Style                                   m_eDrawListStyle;
+    uint32_t                                m_uiDrawListVisibility;
+    uint32_t                                m_uiDrawListLevels;
+    JobSystem*                              m_pJobs;
+    const Leap::Vector*                     m_pColors;
+    uint32_t                                m_uiNumColors;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeRenderer_h__
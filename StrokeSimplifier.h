@@ -0,0 +1,156 @@
+/******************************************************************************\
+* LeapPaint3D incremental stroke simplification.
+*
+* Samples arrive at the tracking rate whether or not the finger moves.  Each
+* one is first resampled against a minimum spacing, then fed to a streaming
+* Douglas-Peucker style reduction: raw samples pile up behind the last kept
+* point for as long as a single segment to the newest sample stays within the
+* tolerance of all of them.  Once it doesn't, the previous sample is kept and
+* becomes the new anchor.
+*
+* Kept points are final.  Only the stroke's last point, the live tip, moves
+* while the reduction is still deciding, so the unsettled tail is always drawn.
+\******************************************************************************/
+
+#if !defined(__StrokeSimplifier_h__)
+#define __StrokeSimplifier_h__
+
+#include "LeapMath.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace LeapPaint {
+
+/// distances are in leap millimetres.  a tolerance of zero keeps every sample.
+struct SimplifierSettings
+{
+    SimplifierSettings() : fMinSpacing(1.0f), fTolerance(0.5f), fMaxTurnDegrees(45.0f) {}
+
+    float fMinSpacing;          ///< samples closer than this to the tip are dropped
+    float fTolerance;           ///< maximum deviation of a dropped sample from the kept line
+    float fMaxTurnDegrees;      ///< sharper turns keep the corner regardless of tolerance
+};
+
+class StrokeSimplifier
+{
+public:
+    /// what the caller has to do to the stored stroke after add().
+    enum Step
+    {
+        kStep_Skip,         ///< nothing, the sample was dropped
+        kStep_MoveTip,      ///< overwrite the stroke's last point with the sample
+        kStep_Append        ///< the last point is now final, append the sample as the new tip
+    };
+
+    enum { kMaxPending = 64 };
+
+    StrokeSimplifier() : m_uiNumPending(0), m_bStarted(false) { configure( SimplifierSettings() ); }
+
+    void configure( const SimplifierSettings& settings )
+    {
+        m_fMinSpacingSq = settings.fMinSpacing * settings.fMinSpacing;
+        m_fToleranceSq  = settings.fTolerance * settings.fTolerance;
+        m_fMinTurnCos   = std::cos( settings.fMaxTurnDegrees * Leap::DEG_TO_RAD );
+        m_bEnabled      = settings.fTolerance > 0.0f;
+    }
+
+    /// forget the current stroke.  the next sample starts a new one.
+    void reset()
+    {
+        m_uiNumPending  = 0;
+        m_bStarted      = false;
+    }
+
+    Step add( const Leap::Vector& vSample )
+    {
+        if ( !m_bStarted )
+        {
+            m_vAnchor       = vSample;
+            m_uiNumPending  = 0;
+            m_bStarted      = true;
+            return kStep_Append;
+        }
+
+        const Leap::Vector& vTip = m_uiNumPending ? m_aPending[m_uiNumPending - 1] : m_vAnchor;
+
+        if ( !m_bEnabled )
+        {
+            return kStep_Append;
+        }
+
+        if ( (vSample - vTip).magnitudeSquared() < m_fMinSpacingSq )
+        {
+            return kStep_Skip;
+        }
+
+        if ( m_uiNumPending == 0 )
+        {
+            m_aPending[m_uiNumPending++] = vSample;
+            return kStep_Append;
+        }
+
+        if ( m_uiNumPending < kMaxPending && !isCorner( vSample ) && fitsSegment( vSample ) )
+        {
+            m_aPending[m_uiNumPending++] = vSample;
+            return kStep_MoveTip;
+        }
+
+        // the tip is kept where it is and everything before it was within
+        // tolerance of the segment leading to it.
+        m_vAnchor                   = vTip;
+        m_aPending[0]               = vSample;
+        m_uiNumPending              = 1;
+
+        return kStep_Append;
+    }
+
+private:
+    /// the turn is measured against the kept line rather than the previous raw
+    /// sample, so tracking jitter doesn't read as corners.
+    bool isCorner( const Leap::Vector& vSample ) const
+    {
+        const Leap::Vector& vTip    = m_aPending[m_uiNumPending - 1];
+
+        const Leap::Vector  vIn     = vTip - m_vAnchor;
+        const Leap::Vector  vOut    = vSample - vTip;
+        const float         fDot    = vIn.dot( vOut );
+
+        return fDot < m_fMinTurnCos * std::sqrt( vIn.magnitudeSquared() * vOut.magnitudeSquared() );
+    }
+
+    /// true when every pending sample lies within tolerance of anchor -> vEnd.
+    bool fitsSegment( const Leap::Vector& vEnd ) const
+    {
+        const Leap::Vector  vAxis       = vEnd - m_vAnchor;
+        const float         fLengthSq   = vAxis.magnitudeSquared();
+
+        for ( uint32_t i = 0; i < m_uiNumPending; i++ )
+        {
+            const Leap::Vector  vOffset = m_aPending[i] - m_vAnchor;
+            const float         fT      = (fLengthSq > 0.0f) ? std::min( std::max( vOffset.dot( vAxis ) / fLengthSq, 0.0f ), 1.0f ) : 0.0f;
+            const Leap::Vector  vDelta  = vOffset - vAxis * fT;
+
+            if ( vDelta.magnitudeSquared() > m_fToleranceSq )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    Leap::Vector    m_vAnchor;
+    Leap::Vector    m_aPending[kMaxPending];
+    uint32_t        m_uiNumPending;
+    float           m_fMinSpacingSq;
+    float           m_fToleranceSq;
+    float           m_fMinTurnCos;
+    bool            m_bEnabled;
+    bool            m_bStarted;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeSimplifier_h__
@@ -0,0 +1,452 @@
+/******************************************************************************\
+* LeapPaint3D stroke storage.
+*
+* Points are kept in fixed-size chunks handed out by a pool, so appending never
+* moves previously recorded data and an empty canvas costs next to nothing.
+* A stroke is a linked list of runs, each run being a contiguous range of
+* points inside a single chunk.  Chunks may also live in memory owned by
+* someone else, such as a mapped canvas file (see adopt()).
+*
+* Strokes can be hidden without touching their points, either one at a time
+* (erased) or all strokes older than a clear mark, which is what makes undo
+* of any edit O(1).  Hidden points stay in their chunks until the store is
+* rebuilt, see copyVisible().
+\******************************************************************************/
+
+#if !defined(__StrokeStore_h__)
+#define __StrokeStore_h__
+
+#include "LeapMath.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace LeapPaint {
+
+/// append-only array made of fixed-size blocks.  elements never move once
+/// pushed, and growth never copies existing elements.
+template<typename T, uint32_t kBlockSize = 1024>
+class SegmentedArray
+{
+public:
+    SegmentedArray() : m_uiSize(0) {}
+
+    uint32_t size() const { return m_uiSize; }
+    bool     empty() const { return m_uiSize == 0; }
+
+    T& push_back( const T& value )
+    {
+        const uint32_t uiBlock = m_uiSize / kBlockSize;
+
+        if ( uiBlock == m_blocks.size() )
+        {
+            m_blocks.push_back( std::unique_ptr<T[]>( new T[kBlockSize] ) );
+        }
+
+        T& slot = m_blocks[uiBlock][m_uiSize % kBlockSize];
+        slot = value;
+        m_uiSize++;
+        return slot;
+    }
+
+    void pop_back() { assert( m_uiSize > 0 ); m_uiSize--; }
+
+    T&       operator[]( uint32_t i )       { assert( i < m_uiSize ); return m_blocks[i / kBlockSize][i % kBlockSize]; }
+    const T& operator[]( uint32_t i ) const { assert( i < m_uiSize ); return m_blocks[i / kBlockSize][i % kBlockSize]; }
+
+    T&       back()       { return (*this)[m_uiSize - 1]; }
+    const T& back() const { return (*this)[m_uiSize - 1]; }
+
+    /// keeps the allocated blocks around for reuse.
+    void clear() { m_uiSize = 0; }
+
+    size_t capacityBytes() const { return m_blocks.size() * kBlockSize * sizeof(T); }
+
+private:
+    std::vector< std::unique_ptr<T[]> > m_blocks;
+    uint32_t                            m_uiSize;
+};
+
+class StrokeStore
+{
+public:
+    enum { kChunkPoints = 4096 };
+
+    typedef uint32_t StrokeId;
+
+    static const uint32_t kInvalid = 0xFFFFFFFFu;
+
+    struct Chunk
+    {
+        uint32_t        uiCount;
+        Leap::Vector    aPoints[kChunkPoints];
+    };
+
+    /// contiguous points of one stroke inside one chunk.  when a stroke spills
+    /// into a new chunk the last point of the previous run is repeated as the
+    /// first point of the new run (bJoint) so every run is a self-contained
+    /// line strip.
+    struct Run
+    {
+        StrokeId    uiStroke;
+        uint32_t    uiChunk;
+        uint32_t    uiFirst;
+        uint32_t    uiCount;
+        uint32_t    uiNext;
+        bool        bJoint;
+    };
+
+    struct Stroke
+    {
+        uint32_t        uiColorIndex;
+        float           fWidth;
+        int64_t         iStartTimestamp;
+        int64_t         iEndTimestamp;
+        uint32_t        uiNumPoints;
+        uint32_t        uiFirstRun;
+        uint32_t        uiLastRun;
+        Leap::Vector    vMin;
+        Leap::Vector    vMax;
+        bool            bOpen;
+        bool            bErased;
+    };
+
+public:
+    StrokeStore() : m_uiNumPoints(0), m_uiNumOpen(0), m_uiNumErased(0), m_uiClearMark(0), m_uiGeneration(0), m_uiVisibilityStamp(0) {}
+
+    StrokeId beginStroke( uint32_t uiColorIndex, float fWidth, int64_t iTimestamp )
+    {
+        const float kfHuge = std::numeric_limits<float>::max();
+
+        Stroke stroke;
+        stroke.uiColorIndex     = uiColorIndex;
+        stroke.fWidth           = fWidth;
+        stroke.iStartTimestamp  = iTimestamp;
+        stroke.iEndTimestamp    = iTimestamp;
+        stroke.uiNumPoints      = 0;
+        stroke.uiFirstRun       = kInvalid;
+        stroke.uiLastRun        = kInvalid;
+        stroke.vMin             = Leap::Vector(  kfHuge,  kfHuge,  kfHuge );
+        stroke.vMax             = Leap::Vector( -kfHuge, -kfHuge, -kfHuge );
+        stroke.bOpen            = true;
+        stroke.bErased          = false;
+
+        m_strokes.push_back( stroke );
+        m_uiNumOpen++;
+
+        return m_strokes.size() - 1;
+    }
+
+    void appendPoint( StrokeId id, const Leap::Vector& vPoint, int64_t iTimestamp )
+    {
+        Stroke& stroke = m_strokes[id];
+
+        assert( stroke.bOpen );
+
+        Run* pRun = (stroke.uiLastRun != kInvalid) ? &m_runs[stroke.uiLastRun] : nullptr;
+
+        if ( !pRun || m_chunks[pRun->uiChunk]->uiCount == kChunkPoints )
+        {
+            pRun = &startRun( id, pRun );
+        }
+
+        Chunk& chunk = *m_chunks[pRun->uiChunk];
+
+        chunk.aPoints[chunk.uiCount++] = vPoint;
+        pRun->uiCount++;
+
+        stroke.uiNumPoints++;
+        stroke.iEndTimestamp = iTimestamp;
+        stroke.vMin = Leap::Vector( std::min(stroke.vMin.x, vPoint.x), std::min(stroke.vMin.y, vPoint.y), std::min(stroke.vMin.z, vPoint.z) );
+        stroke.vMax = Leap::Vector( std::max(stroke.vMax.x, vPoint.x), std::max(stroke.vMax.y, vPoint.y), std::max(stroke.vMax.z, vPoint.z) );
+
+        m_uiNumPoints++;
+    }
+
+    /// overwrites the last point of an open stroke, used for the live tip while
+    /// the simplifier hasn't settled it yet.  the bounds only ever grow.
+    void moveLastPoint( StrokeId id, const Leap::Vector& vPoint, int64_t iTimestamp )
+    {
+        Stroke& stroke = m_strokes[id];
+
+        assert( stroke.bOpen && stroke.uiLastRun != kInvalid );
+
+        const Run& run = m_runs[stroke.uiLastRun];
+
+        m_chunks[run.uiChunk]->aPoints[run.uiFirst + run.uiCount - 1] = vPoint;
+
+        stroke.iEndTimestamp = iTimestamp;
+        stroke.vMin = Leap::Vector( std::min(stroke.vMin.x, vPoint.x), std::min(stroke.vMin.y, vPoint.y), std::min(stroke.vMin.z, vPoint.z) );
+        stroke.vMax = Leap::Vector( std::max(stroke.vMax.x, vPoint.x), std::max(stroke.vMax.y, vPoint.y), std::max(stroke.vMax.z, vPoint.z) );
+    }
+
+    /// pen lift.  the chunk the stroke was writing into goes back to the pool of
+    /// partially filled chunks so the next stroke keeps filling it.
+    void endStroke( StrokeId id )
+    {
+        Stroke& stroke = m_strokes[id];
+
+        if ( !stroke.bOpen )
+        {
+            return;
+        }
+
+        stroke.bOpen = false;
+        m_uiNumOpen--;
+
+        if ( stroke.uiLastRun != kInvalid )
+        {
+            releaseChunk( m_runs[stroke.uiLastRun].uiChunk );
+        }
+    }
+
+    void clear()
+    {
+        m_strokes.clear();
+        m_runs.clear();
+        m_partialChunks.clear();
+        m_freeChunks.clear();
+
+        for ( uint32_t i = 0; i < m_chunks.size(); i++ )
+        {
+            m_chunks[i]->uiCount = 0;
+            m_freeChunks.push_back( i );
+        }
+
+        // hand chunks out again in their original order.
+        std::reverse( m_freeChunks.begin(), m_freeChunks.end() );
+
+        m_uiNumPoints   = 0;
+        m_uiNumOpen     = 0;
+        m_uiNumErased   = 0;
+        m_uiClearMark   = 0;
+        m_uiGeneration++;
+        m_uiVisibilityStamp++;
+    }
+
+    /// hides or shows a single stroke.
+    void setErased( StrokeId id, bool bErased )
+    {
+        Stroke& stroke = m_strokes[id];
+
+        if ( stroke.bErased != bErased )
+        {
+            stroke.bErased  = bErased;
+            m_uiNumErased   = bErased ? m_uiNumErased + 1 : m_uiNumErased - 1;
+            m_uiVisibilityStamp++;
+        }
+    }
+
+    /// hides every stroke before uiMark, strokeCount() for all of them.
+    /// lowering the mark again brings them back.
+    void setClearMark( uint32_t uiMark )
+    {
+        assert( uiMark <= m_strokes.size() );
+        m_uiClearMark = uiMark;
+        m_uiVisibilityStamp++;
+    }
+
+    void setColor( StrokeId id, uint32_t uiColorIndex )
+    {
+        m_strokes[id].uiColorIndex = uiColorIndex;
+        m_uiVisibilityStamp++;
+    }
+
+    /// appends the strokes of other that are not hidden, closed, to this
+    /// store.  the only way points of hidden strokes are ever reclaimed.
+    void copyVisible( const StrokeStore& other )
+    {
+        for ( uint32_t s = 0; s < other.strokeCount(); s++ )
+        {
+            if ( !other.isVisible( s ) )
+            {
+                continue;
+            }
+
+            const Stroke&   source  = other.stroke( s );
+            const StrokeId  id      = beginStroke( source.uiColorIndex, source.fWidth, source.iStartTimestamp );
+
+            other.forEachPoint( s, [&]( const Leap::Vector& vPoint ) { appendPoint( id, vPoint, source.iEndTimestamp ); } );
+
+            m_strokes[id].vMin = source.vMin;
+            m_strokes[id].vMax = source.vMax;
+            endStroke( id );
+        }
+    }
+
+    /// replaces the whole painting.  chunks are used in place, not copied;
+    /// pBacking keeps the memory they point into alive for as long as the
+    /// store uses them.  all strokes must be closed.
+    void adopt( const std::vector<Stroke>& strokes, const std::vector<Run>& runs, const std::vector<Chunk*>& chunks, std::shared_ptr<void> pBacking )
+    {
+        clear();
+
+        m_chunks.assign( chunks.begin(), chunks.end() );
+        m_ownedChunks.clear();
+        m_freeChunks.clear();
+        m_pBacking = pBacking;
+
+        for ( size_t i = 0; i < strokes.size(); i++ )
+        {
+            assert( !strokes[i].bOpen );
+            m_strokes.push_back( strokes[i] );
+            m_uiNumPoints += strokes[i].uiNumPoints;
+        }
+
+        for ( size_t i = 0; i < runs.size(); i++ )
+        {
+            m_runs.push_back( runs[i] );
+        }
+
+        for ( uint32_t i = 0; i < m_chunks.size(); i++ )
+        {
+            releaseChunk( i );
+        }
+
+        // partial chunks are taken from the back, so fill them in file order.
+        std::reverse( m_partialChunks.begin(), m_partialChunks.end() );
+    }
+
+    /// bumped by clear() so consumers caching chunk contents know to start over.
+    uint32_t        generation() const                  { return m_uiGeneration; }
+    uint64_t        pointCount() const                  { return m_uiNumPoints; }
+    uint32_t        strokeCount() const                 { return m_strokes.size(); }
+    uint32_t        openStrokeCount() const             { return m_uiNumOpen; }
+    uint32_t        clearMark() const                   { return m_uiClearMark; }
+    bool            hasHiddenStrokes() const            { return m_uiClearMark > 0 || m_uiNumErased > 0; }
+    bool            isVisible( StrokeId id ) const      { return id >= m_uiClearMark && !m_strokes[id].bErased; }
+    /// bumped whenever strokes are hidden, shown or recolored.
+    uint32_t        visibilityStamp() const             { return m_uiVisibilityStamp; }
+    const Stroke&   stroke( StrokeId id ) const         { return m_strokes[id]; }
+    uint32_t        runCount() const                    { return m_runs.size(); }
+    const Run&      run( uint32_t i ) const             { return m_runs[i]; }
+    uint32_t        chunkCount() const                  { return static_cast<uint32_t>(m_chunks.size()); }
+    const Chunk&    chunk( uint32_t i ) const           { return *m_chunks[i]; }
+
+    const Leap::Vector* runPoints( const Run& run ) const
+    {
+        return m_chunks[run.uiChunk]->aPoints + run.uiFirst;
+    }
+
+    /// visits every recorded point of a stroke in order, skipping joint copies.
+    template<typename Visitor>
+    void forEachPoint( StrokeId id, Visitor visit ) const
+    {
+        for ( uint32_t r = m_strokes[id].uiFirstRun; r != kInvalid; r = m_runs[r].uiNext )
+        {
+            const Run&          run     = m_runs[r];
+            const Leap::Vector* pPoints = runPoints( run );
+
+            for ( uint32_t i = run.bJoint ? 1 : 0; i < run.uiCount; i++ )
+            {
+                visit( pPoints[i] );
+            }
+        }
+    }
+
+    size_t memoryUsage() const
+    {
+        return m_chunks.size() * sizeof(Chunk) + m_strokes.capacityBytes() + m_runs.capacityBytes();
+    }
+
+private:
+    Run& startRun( StrokeId id, Run* pPrevRun )
+    {
+        Stroke& stroke = m_strokes[id];
+
+        Leap::Vector vJoint;
+        const bool   bJoint = (pPrevRun != nullptr);
+
+        if ( bJoint )
+        {
+            const Chunk& prevChunk = *m_chunks[pPrevRun->uiChunk];
+            vJoint = prevChunk.aPoints[pPrevRun->uiFirst + pPrevRun->uiCount - 1];
+            // the full chunk is not handed back to the partial pool.
+        }
+
+        Run run;
+        run.uiStroke    = id;
+        run.uiChunk     = acquireChunk();
+        run.uiFirst     = m_chunks[run.uiChunk]->uiCount;
+        run.uiCount     = 0;
+        run.uiNext      = kInvalid;
+        run.bJoint      = bJoint;
+
+        const uint32_t uiRun = m_runs.size();
+        Run& newRun = m_runs.push_back( run );
+
+        if ( stroke.uiLastRun != kInvalid )
+        {
+            m_runs[stroke.uiLastRun].uiNext = uiRun;
+        }
+        else
+        {
+            stroke.uiFirstRun = uiRun;
+        }
+
+        stroke.uiLastRun = uiRun;
+
+        if ( bJoint )
+        {
+            Chunk& chunk = *m_chunks[newRun.uiChunk];
+            chunk.aPoints[chunk.uiCount++] = vJoint;
+            newRun.uiCount++;
+        }
+
+        return newRun;
+    }
+
+    uint32_t acquireChunk()
+    {
+        if ( !m_partialChunks.empty() )
+        {
+            const uint32_t uiChunk = m_partialChunks.back();
+            m_partialChunks.pop_back();
+            return uiChunk;
+        }
+
+        if ( !m_freeChunks.empty() )
+        {
+            const uint32_t uiChunk = m_freeChunks.back();
+            m_freeChunks.pop_back();
+            return uiChunk;
+        }
+
+        m_ownedChunks.push_back( std::unique_ptr<Chunk>( new Chunk ) );
+        m_ownedChunks.back()->uiCount = 0;
+        m_chunks.push_back( m_ownedChunks.back().get() );
+
+        return static_cast<uint32_t>(m_chunks.size() - 1);
+    }
+
+    void releaseChunk( uint32_t uiChunk )
+    {
+        // keep room for at least a joint and a couple of real points.
+        if ( m_chunks[uiChunk]->uiCount + 4 <= kChunkPoints )
+        {
+            m_partialChunks.push_back( uiChunk );
+        }
+    }
+
+private:
+    std::vector<Chunk*>                     m_chunks;
+    std::vector< std::unique_ptr<Chunk> >   m_ownedChunks;
+    std::shared_ptr<void>                   m_pBacking;     ///< keeps adopted chunks alive
+    std::vector<uint32_t>                   m_partialChunks;
+    std::vector<uint32_t>                   m_freeChunks;
+    SegmentedArray<Stroke>                  m_strokes;
+    SegmentedArray<Run>                     m_runs;
+    uint64_t                                m_uiNumPoints;
+    uint32_t                                m_uiNumOpen;
+    uint32_t                                m_uiNumErased;
+    uint32_t                                m_uiClearMark;
+    uint32_t                                m_uiGeneration;
+    uint32_t                                m_uiVisibilityStamp;
+};
+
+} // namespace LeapPaint
+
+#endif // __StrokeStore_h__
@@ -0,0 +1,272 @@
+/******************************************************************************\
+* LeapPaint3D fingertip filtering and prediction.
+*
+* Raw tip positions jitter by a fraction of a millimetre from frame to frame,
+* and whatever is drawn shows where the finger was a frame or more ago.  Every
+* pointable of a frame gets its own filter state, keyed by pointable id and
+* stepped by the frame's device timestamp:
+*
+*  - a One-Euro filter, a low-pass whose cutoff rises with speed, removes the
+*    jitter of a resting finger without adding much lag to a moving one,
+*  - or a constant velocity Kalman filter does the smoothing instead,
+*  - and either way the Kalman velocity extrapolates the smoothed tip by a
+*    fixed lead, roughly the time from tracking to the frame being shown.
+*
+* Smoothed positions are what strokes keep, predicted ones are only ever
+* drawn.  Both filters are a few dozen flops per tip and never allocate.
+\******************************************************************************/
+
+#if !defined(__TipFilter_h__)
+#define __TipFilter_h__
+
+#include "FrameRecording.h"
+#include "LeapMath.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace LeapPaint {
+
+/// distances in leap millimetres, times in seconds.
+struct TipFilterSettings
+{
+    enum Smoothing
+    {
+        kSmoothing_None,
+        kSmoothing_OneEuro,
+        kSmoothing_Kalman
+    };
+
+    TipFilterSettings()
+      : eSmoothing(kSmoothing_OneEuro),
+        fMinCutoffHz(1.0f),
+        fBeta(0.2f),
+        fDerivativeCutoffHz(1.0f),
+        fMeasurementNoise(0.5f),
+        fAcceleration(5000.0f),
+        fLeadSeconds(0.015f)
+    {}
+
+    Smoothing   eSmoothing;
+    float       fMinCutoffHz;           ///< One-Euro cutoff of a resting finger
+    float       fBeta;                  ///< One-Euro cutoff added per mm/s of speed
+    float       fDerivativeCutoffHz;    ///< One-Euro cutoff of the speed estimate
+    float       fMeasurementNoise;      ///< Kalman: standard deviation of a raw sample
+    float       fAcceleration;          ///< Kalman: typical finger acceleration, mm/s^2
+    float       fLeadSeconds;           ///< how far ahead predictions are, 0 for none
+};
+
+/// filter state of every pointable in the latest frame.  used by one thread.
+class TipFilter
+{
+public:
+    /// a tip's filtered position, smoothed, and where it should be by the
+    /// time it is shown.
+    struct Tip
+    {
+        Leap::Vector    vSmoothed;
+        Leap::Vector    vPredicted;
+    };
+
+    TipFilter() : m_uiNumSlots(0) { configure( TipFilterSettings() ); }
+
+    void configure( const TipFilterSettings& settings )
+    {
+        m_settings  = settings;
+        m_fR        = settings.fMeasurementNoise * settings.fMeasurementNoise;
+        m_fQ        = settings.fAcceleration * settings.fAcceleration;
+    }
+
+    /// steps the filter of every pointable in the frame.  pointables that
+    /// left the frame are forgotten, new ones start at their raw position.
+    void update( const FrameData& frame )
+    {
+        // slot i ends up holding pointable i.  slots before i are taken, the
+        // rest are last frame's, not yet matched.
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            const PointableData& pointable = frame.aPointables[i];
+
+            uint32_t j = i;
+
+            while ( j < m_uiNumSlots && m_aSlots[j].iId != pointable.iId )
+            {
+                j++;
+            }
+
+            if ( j < m_uiNumSlots )
+            {
+                std::swap( m_aSlots[i], m_aSlots[j] );
+                step( m_aSlots[i], pointable.vTipPosition, frame.iTimestamp );
+                continue;
+            }
+
+            if ( i < m_uiNumSlots && m_uiNumSlots < FrameData::kMaxPointables )
+            {
+                // a later pointable may still want it.
+                m_aSlots[m_uiNumSlots++] = m_aSlots[i];
+            }
+
+            start( m_aSlots[i], pointable.iId, pointable.vTipPosition, frame.iTimestamp );
+            m_uiNumSlots = std::max( m_uiNumSlots, i + 1 );
+        }
+
+        m_uiNumSlots = frame.uiNumPointables;
+    }
+
+    /// the filtered tip of a pointable in the last frame, null if it wasn't in it.
+    const Tip* find( int32_t iPointableId ) const
+    {
+        const Slot* pSlot = findSlot( iPointableId );
+        return pSlot ? &pSlot->tip : nullptr;
+    }
+
+    /// replaces the tip positions of the frame last passed to update() by
+    /// their predictions, for drawing.
+    void predictTips( FrameData& frame ) const
+    {
+        for ( uint32_t i = 0; i < frame.uiNumPointables; i++ )
+        {
+            if ( const Tip* pTip = find( frame.aPointables[i].iId ) )
+            {
+                frame.aPointables[i].vTipPosition = pTip->vPredicted;
+            }
+        }
+    }
+
+private:
+    /// a gap in tracking longer than this starts the filter over.
+    enum { kMaxGapMicros = 100000 };
+
+    struct Slot
+    {
+        int32_t         iId;
+        int64_t         iTimestamp;
+        Tip             tip;
+        Leap::Vector    vSpeed;             ///< One-Euro: filtered derivative
+        Leap::Vector    vPosition;          ///< Kalman: state, per axis
+        Leap::Vector    vVelocity;
+        float           fP00, fP01, fP11;   ///< Kalman covariance, the same for every axis
+    };
+
+    const Slot* findSlot( int32_t iId ) const
+    {
+        for ( uint32_t i = 0; i < m_uiNumSlots; i++ )
+        {
+            if ( m_aSlots[i].iId == iId )
+            {
+                return &m_aSlots[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    void start( Slot& slot, int32_t iId, const Leap::Vector& vRaw, int64_t iTimestamp ) const
+    {
+        slot.iId            = iId;
+        slot.iTimestamp     = iTimestamp;
+        slot.tip.vSmoothed  = vRaw;
+        slot.tip.vPredicted = vRaw;
+        slot.vSpeed         = Leap::Vector::zero();
+        slot.vPosition      = vRaw;
+        slot.vVelocity      = Leap::Vector::zero();
+        slot.fP00           = m_fR;
+        slot.fP01           = 0.0f;
+        slot.fP11           = 1.0e6f;   // (1 m/s)^2, nothing is known about the velocity yet
+    }
+
+    void step( Slot& slot, const Leap::Vector& vRaw, int64_t iTimestamp ) const
+    {
+        const int64_t iDeltaMicros = iTimestamp - slot.iTimestamp;
+
+        if ( iDeltaMicros <= 0 )
+        {
+            // the same frame again.
+            return;
+        }
+
+        if ( iDeltaMicros > kMaxGapMicros )
+        {
+            start( slot, slot.iId, vRaw, iTimestamp );
+            return;
+        }
+
+        const float fDt = static_cast<float>(iDeltaMicros) * 1.0e-6f;
+        slot.iTimestamp = iTimestamp;
+
+        if ( m_settings.eSmoothing == TipFilterSettings::kSmoothing_Kalman || m_settings.fLeadSeconds > 0.0f )
+        {
+            stepKalman( slot, vRaw, fDt );
+        }
+
+        switch ( m_settings.eSmoothing )
+        {
+        case TipFilterSettings::kSmoothing_OneEuro:
+            {
+                const Leap::Vector vSpeed = (vRaw - slot.tip.vSmoothed) / fDt;
+                slot.vSpeed += (vSpeed - slot.vSpeed) * alpha( m_settings.fDerivativeCutoffHz, fDt );
+
+                const float fCutoffHz = m_settings.fMinCutoffHz + m_settings.fBeta * slot.vSpeed.magnitude();
+                slot.tip.vSmoothed += (vRaw - slot.tip.vSmoothed) * alpha( fCutoffHz, fDt );
+            }
+            break;
+
+        case TipFilterSettings::kSmoothing_Kalman:
+            slot.tip.vSmoothed = slot.vPosition;
+            break;
+
+        default:
+            slot.tip.vSmoothed = vRaw;
+            break;
+        }
+
+        slot.tip.vPredicted = slot.tip.vSmoothed;
+
+        if ( m_settings.fLeadSeconds > 0.0f )
+        {
+            slot.tip.vPredicted += slot.vVelocity * m_settings.fLeadSeconds;
+        }
+    }
+
+    /// constant velocity model, white noise acceleration.  the three axes
+    /// share their covariance, so the gain is worked out once.
+    void stepKalman( Slot& slot, const Leap::Vector& vRaw, float fDt ) const
+    {
+        const float fDt2 = fDt * fDt;
+
+        slot.vPosition += slot.vVelocity * fDt;
+
+        const float fP00 = slot.fP00 + fDt * (2.0f * slot.fP01 + fDt * slot.fP11) + m_fQ * fDt2 * fDt2 * 0.25f;
+        const float fP01 = slot.fP01 + fDt * slot.fP11 + m_fQ * fDt2 * fDt * 0.5f;
+        const float fP11 = slot.fP11 + m_fQ * fDt2;
+
+        const float fK0 = fP00 / (fP00 + m_fR);
+        const float fK1 = fP01 / (fP00 + m_fR);
+
+        const Leap::Vector vInnovation = vRaw - slot.vPosition;
+        slot.vPosition += vInnovation * fK0;
+        slot.vVelocity += vInnovation * fK1;
+
+        slot.fP00 = (1.0f - fK0) * fP00;
+        slot.fP01 = (1.0f - fK0) * fP01;
+        slot.fP11 = fP11 - fK1 * fP01;
+    }
+
+    /// smoothing factor of a first order low-pass at fCutoffHz.
+    static float alpha( float fCutoffHz, float fDt )
+    {
+        const float fTau = 1.0f / (2.0f * Leap::PI * fCutoffHz);
+        return 1.0f / (1.0f + fTau / fDt);
+    }
+
+private:
+    TipFilterSettings   m_settings;
+    float               m_fR;
+    float               m_fQ;
+    Slot                m_aSlots[FrameData::kMaxPointables];
+    uint32_t            m_uiNumSlots;
+};
+
+} // namespace LeapPaint
+
+#endif // __TipFilter_h__
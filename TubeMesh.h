@@ -0,0 +1,443 @@
+/******************************************************************************\
+* LeapPaint3D tube meshes for painted strokes.
+*
+* Every stroke point gets a ring of kSides vertices around it, oriented by a
+* parallel transported frame so the tube doesn't twist, and every segment
+* becomes kSides quads between two rings.  The layout follows StrokeStore:
+* point slot p of a chunk owns ring vertices p * kSides .. p * kSides + kSides - 1
+* of that chunk's mesh, and segment s of the chunk's line index list owns
+* triangle indices s * kIndicesPerSegment onwards.  Appending points therefore
+* only ever adds rings and triangles at the tail.
+*
+* Only the last two rings of a growing run are provisional (the tip may still
+* move and the ring before it is oriented by it), so the work per update is
+* proportional to the new points.  Rings are expanded four vertices at a time
+* with SSE where available.
+*
+* TubeRingBuilder spreads that work over a JobSystem when there is enough of
+* it, e.g. meshing the whole painting after switching to tubes.
+\******************************************************************************/
+
+#if !defined(__TubeMesh_h__)
+#define __TubeMesh_h__
+
+#include "JobSystem.h"
+#include "StrokeBatcher.h"
+#include "StrokeStore.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LEAPPAINT_SSE 1
+#endif
+
+namespace LeapPaint {
+
+class TubeMesher
+{
+public:
+    enum
+    {
+        kSides              = 8,
+        kIndicesPerSegment  = kSides * 6,
+        kChunkVertices      = StrokeStore::kChunkPoints * kSides
+    };
+
+    /// orientation of the ring around one point.
+    struct Frame
+    {
+        Leap::Vector vTangent;
+        Leap::Vector vNormal;
+    };
+
+    /// tube radius in leap millimetres per unit of stroke width.
+    explicit TubeMesher( float fRadiusPerWidth = 1.5f ) : m_fRadiusPerWidth(fRadiusPerWidth)
+    {
+        for ( int k = 0; k < kSides; k++ )
+        {
+            const float fAngle = k * (2.0f * Leap::PI / kSides);
+            m_afCos[k] = std::cos( fAngle );
+            m_afSin[k] = std::sin( fAngle );
+        }
+    }
+
+    void reset()
+    {
+        m_chunkFrames.clear();
+        m_strokeEnds.clear();
+    }
+
+    /// makes room for every chunk and stroke of the store, after which
+    /// buildRings may run for runs of different strokes at once.
+    void prepare( const StrokeStore& store )
+    {
+        if ( store.chunkCount() > 0 )
+        {
+            chunkFrames( store.chunkCount() - 1 );
+        }
+
+        if ( m_strokeEnds.size() < store.strokeCount() )
+        {
+            m_strokeEnds.resize( store.strokeCount() );
+        }
+    }
+
+    /// (re)builds the rings of run points uiFirstChanged - 1 onwards, the ring
+    /// before the first changed point being oriented by it.  positions and
+    /// normals receive kSides entries per ring.  returns the first ring built,
+    /// relative to the run.  a new run (uiFirstChanged 0) must be built after
+    /// the runs before it in its stroke.
+    uint32_t buildRings( const StrokeStore& store, const StrokeStore::Run& run, uint32_t uiFirstChanged,
+                         std::vector<Leap::Vector>& positions, std::vector<Leap::Vector>& normals )
+    {
+        const uint32_t      uiCount = run.uiCount;
+        // a joint ring is copied from the previous run once and never changes.
+        const uint32_t      uiStart = (uiFirstChanged > 0) ? std::max( uiFirstChanged - 1, run.bJoint ? 1u : 0u ) : 0;
+        const Leap::Vector* pPoints = store.runPoints( run );
+        Frame*              pFrames = chunkFrames( run.uiChunk ) + run.uiFirst;
+
+        if ( m_strokeEnds.size() <= run.uiStroke )
+        {
+            m_strokeEnds.resize( run.uiStroke + 1 );
+        }
+
+        transport( pPoints, uiCount, uiStart, run.bJoint, m_strokeEnds[run.uiStroke], pFrames );
+
+        if ( uiStart < uiCount )
+        {
+            m_strokeEnds[run.uiStroke] = pFrames[uiCount - 1];
+        }
+
+        const float     fRadius     = store.stroke( run.uiStroke ).fWidth * m_fRadiusPerWidth;
+        const uint32_t  uiNumRings  = uiCount > uiStart ? uiCount - uiStart : 0;
+
+        positions.resize( uiNumRings * kSides );
+        normals.resize( uiNumRings * kSides );
+
+        if ( uiNumRings )
+        {
+            expandRings( pPoints + uiStart, pFrames + uiStart, uiNumRings, fRadius, &positions[0], &normals[0] );
+        }
+
+        return uiStart;
+    }
+
+    /// rings of a whole run without keeping any state, for one-off meshing
+    /// such as export.  carry is the last frame of the stroke's previous run
+    /// on entry and this run's last frame on return.  frames is scratch.
+    void meshRun( const Leap::Vector* pPoints, uint32_t uiCount, bool bJoint, float fWidth, Frame& carry, std::vector<Frame>& frames,
+                  std::vector<Leap::Vector>& positions, std::vector<Leap::Vector>& normals ) const
+    {
+        endFrame( pPoints, uiCount, bJoint, carry, frames );
+
+        positions.resize( uiCount * kSides );
+        normals.resize( uiCount * kSides );
+
+        if ( uiCount )
+        {
+            expandRings( pPoints, &frames[0], uiCount, fWidth * m_fRadiusPerWidth, &positions[0], &normals[0] );
+        }
+    }
+
+    /// only carries the frame across the run, which is all a run meshed
+    /// later by someone else needs from the ones before it.
+    static void endFrame( const Leap::Vector* pPoints, uint32_t uiCount, bool bJoint, Frame& carry, std::vector<Frame>& frames )
+    {
+        frames.resize( uiCount );
+
+        if ( uiCount )
+        {
+            transport( pPoints, uiCount, 0, bJoint, carry, &frames[0] );
+            carry = frames[uiCount - 1];
+        }
+    }
+
+    /// the kIndicesPerSegment triangle indices joining the rings of points
+    /// uiFrom and uiTo, counter clockwise seen from outside.  the renderer
+    /// uses chunk slots and 16 bit indices, exporters global 32 bit ones.
+    template<typename Index>
+    static void segmentIndices( uint32_t uiFrom, uint32_t uiTo, Index* pOut )
+    {
+        const uint32_t uiRingA = uiFrom * kSides;
+        const uint32_t uiRingB = uiTo * kSides;
+
+        for ( uint32_t k = 0; k < kSides; k++ )
+        {
+            const uint32_t k1 = (k + 1) % kSides;
+
+            *pOut++ = static_cast<Index>(uiRingA + k);
+            *pOut++ = static_cast<Index>(uiRingA + k1);
+            *pOut++ = static_cast<Index>(uiRingB + k1);
+
+            *pOut++ = static_cast<Index>(uiRingA + k);
+            *pOut++ = static_cast<Index>(uiRingB + k1);
+            *pOut++ = static_cast<Index>(uiRingB + k);
+        }
+    }
+
+    size_t memoryUsage() const
+    {
+        return m_chunkFrames.size() * StrokeStore::kChunkPoints * sizeof(Frame) + m_strokeEnds.capacity() * sizeof(Frame);
+    }
+
+private:
+    /// parallel transports frames along points uiStart onwards of a run.
+    /// pFrames[uiStart - 1] must be set, or carry for a joint run's ring 0.
+    static void transport( const Leap::Vector* pPoints, uint32_t uiCount, uint32_t uiStart, bool bJoint, const Frame& carry, Frame* pFrames )
+    {
+        for ( uint32_t i = uiStart; i < uiCount; i++ )
+        {
+            Frame& frame = pFrames[i];
+
+            if ( i == 0 && bJoint )
+            {
+                // same ring as the end of the stroke's previous run.
+                frame = carry;
+            }
+            else if ( i == 0 )
+            {
+                frame.vTangent  = direction( pPoints[uiCount > 1 ? 1 : 0] - pPoints[0], Leap::Vector::yAxis() );
+                frame.vNormal   = perpendicular( frame.vTangent );
+            }
+            else
+            {
+                const Frame& prev = pFrames[i - 1];
+
+                frame.vTangent  = direction( pPoints[i + 1 < uiCount ? i + 1 : i] - pPoints[i - 1], prev.vTangent );
+                frame.vNormal   = prev.vNormal - frame.vTangent * prev.vNormal.dot( frame.vTangent );
+
+                const float fLengthSq = frame.vNormal.magnitudeSquared();
+                frame.vNormal = (fLengthSq > 1e-12f) ? frame.vNormal / std::sqrt( fLengthSq ) : perpendicular( frame.vTangent );
+            }
+        }
+    }
+
+    static Leap::Vector direction( const Leap::Vector& vDelta, const Leap::Vector& vFallback )
+    {
+        const float fLengthSq = vDelta.magnitudeSquared();
+        return (fLengthSq > 1e-12f) ? vDelta / std::sqrt( fLengthSq ) : vFallback;
+    }
+
+    /// any unit vector perpendicular to vTangent.
+    static Leap::Vector perpendicular( const Leap::Vector& vTangent )
+    {
+        const Leap::Vector vAxis = (std::fabs( vTangent.x ) < 0.9f) ? Leap::Vector::xAxis() : Leap::Vector::yAxis();
+        return vTangent.cross( vAxis ).normalized();
+    }
+
+    Frame* chunkFrames( uint32_t uiChunk )
+    {
+        while ( m_chunkFrames.size() <= uiChunk )
+        {
+            m_chunkFrames.push_back( std::unique_ptr<Frame[]>( new Frame[StrokeStore::kChunkPoints] ) );
+        }
+
+        return m_chunkFrames[uiChunk].get();
+    }
+
+    /// ring vertex k of point i sits at centre + radius * (cos_k * normal + sin_k * binormal).
+    void expandRings( const Leap::Vector* pCenters, const Frame* pFrames, uint32_t uiCount, float fRadius,
+                      Leap::Vector* pPositions, Leap::Vector* pNormals ) const
+    {
+#if defined(LEAPPAINT_SSE)
+        static_assert( kSides % 4 == 0, "the SSE ring kernel expands four sides at a time" );
+
+        const __m128 radius = _mm_set1_ps( fRadius );
+
+        for ( uint32_t i = 0; i < uiCount; i++ )
+        {
+            const Leap::Vector& c   = pCenters[i];
+            const Leap::Vector& n   = pFrames[i].vNormal;
+            const Leap::Vector  b   = pFrames[i].vTangent.cross( n );
+
+            for ( uint32_t k = 0; k < kSides; k += 4 )
+            {
+                const __m128 cosines    = _mm_loadu_ps( m_afCos + k );
+                const __m128 sines      = _mm_loadu_ps( m_afSin + k );
+
+                const __m128 dx = _mm_add_ps( _mm_mul_ps( cosines, _mm_set1_ps( n.x ) ), _mm_mul_ps( sines, _mm_set1_ps( b.x ) ) );
+                const __m128 dy = _mm_add_ps( _mm_mul_ps( cosines, _mm_set1_ps( n.y ) ), _mm_mul_ps( sines, _mm_set1_ps( b.y ) ) );
+                const __m128 dz = _mm_add_ps( _mm_mul_ps( cosines, _mm_set1_ps( n.z ) ), _mm_mul_ps( sines, _mm_set1_ps( b.z ) ) );
+
+                const __m128 px = _mm_add_ps( _mm_set1_ps( c.x ), _mm_mul_ps( radius, dx ) );
+                const __m128 py = _mm_add_ps( _mm_set1_ps( c.y ), _mm_mul_ps( radius, dy ) );
+                const __m128 pz = _mm_add_ps( _mm_set1_ps( c.z ), _mm_mul_ps( radius, dz ) );
+
+                storeInterleaved( px, py, pz, reinterpret_cast<float*>( pPositions + i * kSides + k ) );
+                storeInterleaved( dx, dy, dz, reinterpret_cast<float*>( pNormals + i * kSides + k ) );
+            }
+        }
+#else
+        for ( uint32_t i = 0; i < uiCount; i++ )
+        {
+            const Leap::Vector& c   = pCenters[i];
+            const Leap::Vector& n   = pFrames[i].vNormal;
+            const Leap::Vector  b   = pFrames[i].vTangent.cross( n );
+
+            for ( uint32_t k = 0; k < kSides; k++ )
+            {
+                const Leap::Vector vDir = n * m_afCos[k] + b * m_afSin[k];
+
+                pPositions[i * kSides + k]  = c + vDir * fRadius;
+                pNormals[i * kSides + k]    = vDir;
+            }
+        }
+#endif
+    }
+
+#if defined(LEAPPAINT_SSE)
+    /// x0..x3, y0..y3, z0..z3 -> x0 y0 z0 x1 y1 z1 x2 y2 z2 x3 y3 z3.
+    static void storeInterleaved( __m128 x, __m128 y, __m128 z, float* pOut )
+    {
+        const __m128 xy01 = _mm_unpacklo_ps( x, y );    // x0 y0 x1 y1
+        const __m128 xy23 = _mm_unpackhi_ps( x, y );    // x2 y2 x3 y3
+        const __m128 zx01 = _mm_unpacklo_ps( z, x );    // z0 x0 z1 x1
+        const __m128 zx23 = _mm_unpackhi_ps( z, x );    // z2 x2 z3 x3
+        const __m128 yz01 = _mm_unpacklo_ps( y, z );    // y0 z0 y1 z1
+        const __m128 yz23 = _mm_unpackhi_ps( y, z );    // y2 z2 y3 z3
+
+        _mm_storeu_ps( pOut,     _mm_shuffle_ps( xy01, zx01, _MM_SHUFFLE(3, 0, 1, 0) ) );
+        _mm_storeu_ps( pOut + 4, _mm_shuffle_ps( yz01, xy23, _MM_SHUFFLE(1, 0, 3, 2) ) );
+        _mm_storeu_ps( pOut + 8, _mm_shuffle_ps( zx23, yz23, _MM_SHUFFLE(3, 2, 3, 0) ) );
+    }
+#endif
+
+private:
+    std::vector< std::unique_ptr<Frame[]> > m_chunkFrames;
+    std::vector<Frame>                      m_strokeEnds;
+    float                                   m_afCos[kSides];
+    float                                   m_afSin[kSides];
+    float                                   m_fRadiusPerWidth;
+};
+
+/// rebuilds the rings of every run a sync changed and hands them to
+/// upload( run, uiStart, positions, normals ) on the calling thread, in run
+/// order.  with a job system and enough points, runs go in waves of about
+/// kWavePoints points, each run a job that follows the job of its stroke's
+/// run before it, since a joint copies that run's last ring.  waves keep the
+/// rings waiting for upload bounded.
+class TubeRingBuilder
+{
+public:
+    enum
+    {
+        kWavePoints     = 16384,
+        kMinJobPoints   = 2048      ///< fewer changed points than this aren't worth the jobs
+    };
+
+    TubeRingBuilder() : m_graph( kJobPriority_Frame ) {}
+
+    template<typename Upload>
+    void build( const StrokeStore& store, TubeMesher& mesher, const std::vector<StrokeBatcher::ChangedRun>& changed, JobSystem* pJobs, Upload upload )
+    {
+        m_runs = changed;
+        std::sort( m_runs.begin(), m_runs.end() );
+
+        uint64_t uiNumPoints = 0;
+
+        for ( size_t i = 0; i < m_runs.size(); i++ )
+        {
+            uiNumPoints += store.run( m_runs[i].uiRun ).uiCount - m_runs[i].uiFirstChanged;
+        }
+
+        if ( !pJobs || uiNumPoints < kMinJobPoints )
+        {
+            Rings& rings = result( 0 );
+
+            for ( size_t i = 0; i < m_runs.size(); i++ )
+            {
+                const StrokeStore::Run& run = store.run( m_runs[i].uiRun );
+
+                rings.uiStart = mesher.buildRings( store, run, m_runs[i].uiFirstChanged, rings.positions, rings.normals );
+
+                if ( !rings.positions.empty() )
+                {
+                    upload( run, rings.uiStart, rings.positions, rings.normals );
+                }
+            }
+
+            return;
+        }
+
+        mesher.prepare( store );
+        m_strokeJobs.assign( store.strokeCount(), static_cast<uint32_t>(kNone) );
+
+        for ( size_t i = 0; i < m_runs.size(); )
+        {
+            const size_t    uiWaveStart     = i;
+            uint32_t        uiWavePoints    = 0;
+
+            m_graph.clear();
+
+            for ( ; i < m_runs.size() && uiWavePoints < kWavePoints; i++ )
+            {
+                const StrokeBatcher::ChangedRun&    changedRun  = m_runs[i];
+                const StrokeStore::Run&             run         = store.run( changedRun.uiRun );
+                Rings&                              rings       = result( i - uiWaveStart );
+
+                const JobGraph::JobId uiJob = m_graph.add( [&store, &mesher, &run, &rings, changedRun]()
+                {
+                    rings.uiStart = mesher.buildRings( store, run, changedRun.uiFirstChanged, rings.positions, rings.normals );
+                } );
+
+                uint32_t& uiStrokeJob = m_strokeJobs[run.uiStroke];
+
+                // a run of an earlier wave is done already.
+                if ( uiStrokeJob != kNone && uiStrokeJob >= uiWaveStart )
+                {
+                    m_graph.precede( static_cast<JobGraph::JobId>(uiStrokeJob - uiWaveStart), uiJob );
+                }
+
+                uiStrokeJob     = static_cast<uint32_t>(i);
+                uiWavePoints   += run.uiCount - changedRun.uiFirstChanged;
+            }
+
+            pJobs->run( m_graph );
+
+            for ( size_t r = uiWaveStart; r < i; r++ )
+            {
+                const Rings& rings = m_results[r - uiWaveStart];
+
+                if ( !rings.positions.empty() )
+                {
+                    upload( store.run( m_runs[r].uiRun ), rings.uiStart, rings.positions, rings.normals );
+                }
+            }
+        }
+    }
+
+private:
+    static const uint32_t kNone = 0xFFFFFFFFu;
+
+    struct Rings
+    {
+        uint32_t                    uiStart;
+        std::vector<Leap::Vector>   positions;
+        std::vector<Leap::Vector>   normals;
+    };
+
+    Rings& result( size_t i )
+    {
+        while ( m_results.size() <= i )
+        {
+            m_results.push_back( Rings() );
+        }
+
+        return m_results[i];
+    }
+
+private:
+    std::vector<StrokeBatcher::ChangedRun>  m_runs;
+    std::deque<Rings>                       m_results;      ///< one per run of a wave, reused
+    std::vector<uint32_t>                   m_strokeJobs;   ///< latest run of each stroke, index into m_runs
+    JobGraph                                m_graph;
+};
+
+} // namespace LeapPaint
+
+#endif // __TubeMesh_h__
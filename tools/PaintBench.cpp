@@ -0,0 +1,603 @@
+/******************************************************************************\
+* LeapPaint3D headless benchmarks.
+*
+* Drives synthetic or recorded fingertip streams through the same capture,
+* stroke building and geometry submission code the app runs, without a window,
+* GL context or Leap device.  One JSON object per run is written to stdout.
+*
+* Build (only the Leap SDK headers are needed, nothing is linked):
+*   c++ -O2 -std=c++11 -I.. -I<LeapSDK>/include PaintBench.cpp -o PaintBench -pthread
+*
+* Usage:
+*   PaintBench [--sizes 10000,100000,1000000] [--recording file.lprc]
+*              [--render-every 2] [--tolerance 0.5] [--canvas file.lpcv]
+*              [--filter one-euro|kalman|none] [--predict-ms 15]
+*              [--hands 1] [--pen one-finger|touch] [--jobs 1]
+*
+* Sizes count fingertip samples; "points" is what the stroke simplifier kept
+* of them (--tolerance 0 keeps every sample).  The mesh stage is the tube
+* meshing StrokeRenderer does on top of submission in its tube style.  The
+* capture stage includes fingertip filtering, configured as in the app.
+* --hands paints with up to four synthetic hands at once, one stroke each.
+* --jobs N runs ring meshing and detail levels on a JobSystem of N threads,
+* the benchmark's own included, as the app does; 1 keeps it all on one
+* thread.  remesh_ns is meshing the whole painting from scratch, which is
+* what switching to tubes costs.
+*
+* With --canvas, ingestion also journals to that canvas (flushed every render
+* frame, as the app does) and each run ends by saving it and opening it
+* again.  Existing files of that canvas are replaced.
+*
+* Each run is forked into its own process on POSIX systems so peak_rss_kb
+* reflects that run alone.
+\******************************************************************************/
+
+#include "../JobSystem.h"
+#include "../PaintPipeline.h"
+#include "../StrokeBatcher.h"
+#include "../TubeMesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define PAINTBENCH_POSIX 1
+#endif
+
+using namespace LeapPaint;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+inline uint64_t elapsedNs( Clock::time_point start )
+{
+    return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - start ).count() );
+}
+
+long peakRssKb()
+{
+#if defined(PAINTBENCH_POSIX)
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/// source of tracking frames for a run.
+class FrameStream
+{
+public:
+    virtual ~FrameStream() {}
+    virtual bool next( FrameData& frame ) = 0;
+};
+
+/// one finger per hand tracing a wobbly helix at 110Hz, up to four hands.
+/// every 600 frames a hand shows two fingers for 20 frames, which lifts its
+/// pen; the hands take turns at that.
+class SyntheticStream : public FrameStream
+{
+public:
+    explicit SyntheticStream( uint32_t uiNumHands = 1 )
+      : m_uiNumHands(std::min<uint32_t>( uiNumHands, FrameData::kMaxHands )),
+        m_uiFrame(0),
+        m_uiSeed(12345)
+    {}
+
+    virtual bool next( FrameData& frame )
+    {
+        frame.iId               = m_uiFrame;
+        frame.iTimestamp        = static_cast<int64_t>(m_uiFrame) * 9091;
+        frame.uiNumHands        = m_uiNumHands;
+        frame.uiNumPointables   = 0;
+        frame.uiNumGestures     = 0;
+
+        for ( uint32_t h = 0; h < m_uiNumHands; h++ )
+        {
+            const uint32_t  uiPhase     = (m_uiFrame + h * 150) % 620;
+            const float     t           = m_uiFrame * 0.01f + h;
+            const bool      bPenLift    = uiPhase >= 600;
+
+            HandData& hand = frame.aHands[h];
+            hand.iId            = 1 + h;
+            hand.fSphereRadius  = 80.0f;
+            hand.vPalmPosition  = Leap::Vector( h * 250.0f, 200, 0 );
+            hand.vPalmNormal    = Leap::Vector( 0, -1, 0 );
+            hand.vDirection     = Leap::Vector( 0, 0, -1 );
+
+            for ( uint32_t i = 0; i < (bPenLift ? 2u : 1u); i++ )
+            {
+                PointableData& finger = frame.aPointables[frame.uiNumPointables++];
+                finger.iId          = 10 + 2 * h + i;
+                finger.iHandId      = hand.iId;
+                finger.uiIsTool     = 0;
+                finger.vDirection   = Leap::Vector( 0, 0, -1 );
+                finger.vTipPosition = Leap::Vector( 120.0f * std::cos( t ) + jitter() + i * 20.0f + h * 250.0f,
+                                                    200.0f + 80.0f * std::sin( t * 1.3f ) + jitter(),
+                                                    60.0f * std::sin( t * 0.7f ) + jitter() );
+            }
+        }
+
+        m_uiFrame++;
+        return true;
+    }
+
+private:
+    float jitter()
+    {
+        m_uiSeed = m_uiSeed * 1664525u + 1013904223u;
+        return ((m_uiSeed >> 8) & 0xFFFF) / 65535.0f - 0.5f;
+    }
+
+    uint32_t m_uiNumHands;
+    uint32_t m_uiFrame;
+    uint32_t m_uiSeed;
+};
+
+/// loops a recording as long as needed.
+class RecordedStream : public FrameStream
+{
+public:
+    bool open( const char* szPath ) { return m_reader.open( szPath ); }
+
+    virtual bool next( FrameData& frame )
+    {
+        if ( m_reader.next( frame ) )
+        {
+            return true;
+        }
+
+        m_reader.rewind();
+        return m_reader.next( frame );
+    }
+
+private:
+    FrameReader m_reader;
+};
+
+struct Percentiles
+{
+    uint64_t uiP50, uiP99, uiMax;
+};
+
+Percentiles percentiles( std::vector<uint32_t>& samples )
+{
+    Percentiles result = { 0, 0, 0 };
+
+    if ( samples.empty() )
+    {
+        return result;
+    }
+
+    const size_t uiP50 = samples.size() / 2;
+    const size_t uiP99 = std::min( samples.size() - 1, samples.size() * 99 / 100 );
+
+    std::nth_element( samples.begin(), samples.begin() + uiP50, samples.end() );
+    result.uiP50 = samples[uiP50];
+    std::nth_element( samples.begin(), samples.begin() + uiP99, samples.end() );
+    result.uiP99 = samples[uiP99];
+    result.uiMax = *std::max_element( samples.begin(), samples.end() );
+
+    return result;
+}
+
+struct RunConfig
+{
+    const char* szSource;
+    const char* szRecording;
+    uint64_t    uiNumSamples;
+    uint32_t    uiRenderEvery;
+    float       fTolerance;
+    const char* szCanvas;
+    TipFilterSettings filterSettings;
+    PenSettings penSettings;
+    uint32_t    uiNumHands;
+    uint32_t    uiNumJobs;
+};
+
+/// one render frame = uiRenderEvery device frames captured, then ingest,
+/// meshing and geometry submission.
+void runBenchmark( const RunConfig& config )
+{
+    SyntheticStream syntheticStream( config.uiNumHands );
+    RecordedStream  recordedStream;
+    FrameStream*    pStream = &syntheticStream;
+
+    if ( config.szRecording )
+    {
+        if ( !recordedStream.open( config.szRecording ) )
+        {
+            fprintf( stderr, "PaintBench: could not open %s\n", config.szRecording );
+            return;
+        }
+
+        pStream = &recordedStream;
+    }
+
+    std::unique_ptr<JobSystem> jobs( config.uiNumJobs > 1 ? new JobSystem( config.uiNumJobs - 1 ) : nullptr );
+
+    SampleQueue*    pQueue = new SampleQueue;
+    StrokeStore     store;
+    TipCapture      capture( *pQueue, config.filterSettings, config.penSettings );
+    SimplifierSettings simplifierSettings;
+    simplifierSettings.fTolerance = config.fTolerance;
+
+    StrokeBuilder   builder( store, 256, simplifierSettings );
+    StrokeBatcher   batcher;
+    TubeMesher      mesher;
+    CanvasDocument  canvas;
+    TubeRingBuilder ringBuilder;
+
+    batcher.setJobSystem( jobs.get() );
+
+    if ( config.szCanvas )
+    {
+        const std::string strCanvas = config.szCanvas;
+
+        remove( strCanvas.c_str() );
+        remove( (strCanvas + ".1").c_str() );
+        remove( (strCanvas + ".journal").c_str() );
+
+        if ( !canvas.open( strCanvas, store ) )
+        {
+            fprintf( stderr, "PaintBench: could not open canvas %s\n", config.szCanvas );
+            return;
+        }
+
+        builder.setJournal( &canvas.journal() );
+    }
+
+    std::vector<uint16_t>       tubeIndices( StrokeStore::kChunkPoints * TubeMesher::kIndicesPerSegment );
+    std::vector<uint8_t>        staging( StrokeStore::kChunkPoints * sizeof(Leap::Vector) + StrokeStore::kChunkPoints * 4 );
+    std::vector<uint32_t>       frameNs;
+    std::vector<uint32_t>       captureNs;
+
+    frameNs.reserve( static_cast<size_t>(config.uiNumSamples / config.uiRenderEvery + 1) );
+    captureNs.reserve( static_cast<size_t>(config.uiNumSamples + config.uiNumSamples / 20) );
+
+    uint64_t uiStageCapture = 0, uiStageIngest = 0, uiStageSubmit = 0, uiStageMesh = 0;
+    uint64_t uiNumFrames = 0, uiNumRenderFrames = 0, uiBytesSubmitted = 0, uiMeshBytes = 0, uiNumSamples = 0;
+
+    uint64_t uiIdleFrames = 0;
+
+    FrameData frame;
+
+    const Clock::time_point runStart = Clock::now();
+
+    while ( uiNumSamples < config.uiNumSamples )
+    {
+        uint64_t uiCaptureFrameNs = 0;
+
+        for ( uint32_t i = 0; i < config.uiRenderEvery; i++ )
+        {
+            if ( !pStream->next( frame ) )
+            {
+                break;
+            }
+
+            const Clock::time_point captureStart = Clock::now();
+            capture.onFrame( frame );
+            const uint64_t uiNs = elapsedNs( captureStart );
+
+            captureNs.push_back( static_cast<uint32_t>(uiNs) );
+            uiCaptureFrameNs += uiNs;
+            uiNumFrames++;
+        }
+
+        uiStageCapture += uiCaptureFrameNs;
+
+        // a recording without any single finger frames would never finish.
+        if ( uiIdleFrames > 1000000 )
+        {
+            fprintf( stderr, "PaintBench: stream stopped producing samples\n" );
+            break;
+        }
+
+        // ingest
+        Clock::time_point stageStart = Clock::now();
+        const uint32_t uiNumDrained = builder.drain( *pQueue );
+        canvas.journal().flush();
+        const uint64_t uiIngestNs = elapsedNs( stageStart );
+
+        // geometry submission: what StrokeRenderer::update hands to glBufferSubData
+        stageStart = Clock::now();
+
+        if ( batcher.sync( store ) )
+        {
+            mesher.reset();
+        }
+
+        const uint64_t uiSyncNs = elapsedNs( stageStart );
+
+        const std::vector<uint32_t>& dirty = batcher.dirtyChunks();
+
+        // tube triangles for the new segments and rings for the new or moved points
+        stageStart = Clock::now();
+
+        for ( size_t i = 0; i < dirty.size(); i++ )
+        {
+            const StrokeBatcher::ChunkGeometry& geometry = batcher.chunkGeometry( dirty[i] );
+            uint16_t*                           pOut     = &tubeIndices[0];
+
+            for ( size_t s = geometry.uiNumIndicesUploaded; s < geometry.indices.size(); s += 2, pOut += TubeMesher::kIndicesPerSegment )
+            {
+                TubeMesher::segmentIndices( geometry.indices[s], geometry.indices[s + 1], pOut );
+            }
+
+            uiMeshBytes += (pOut - &tubeIndices[0]) * sizeof(uint16_t);
+        }
+
+        ringBuilder.build( store, mesher, batcher.changedRuns(), jobs.get(),
+                           [&]( const StrokeStore::Run&, uint32_t, const std::vector<Leap::Vector>& positions, const std::vector<Leap::Vector>& )
+        {
+            uiMeshBytes += 2 * positions.size() * sizeof(Leap::Vector);
+        } );
+
+        const uint64_t uiMeshNs = elapsedNs( stageStart );
+
+        stageStart = Clock::now();
+
+        for ( size_t i = 0; i < dirty.size(); i++ )
+        {
+            StrokeBatcher::ChunkGeometry& geometry = batcher.chunkGeometry( dirty[i] );
+
+            const size_t uiVertexBytes = (geometry.uiNumVertices - geometry.uiNumVerticesUploaded) * sizeof(Leap::Vector);
+            const size_t uiIndexBytes  = (geometry.indices.size() - geometry.uiNumIndicesUploaded) * sizeof(uint16_t);
+
+            memcpy( &staging[0], store.chunk( dirty[i] ).aPoints + geometry.uiNumVerticesUploaded, uiVertexBytes );
+
+            if ( uiIndexBytes )
+            {
+                memcpy( &staging[uiVertexBytes], &geometry.indices[geometry.uiNumIndicesUploaded], uiIndexBytes );
+            }
+
+            uiBytesSubmitted += uiVertexBytes + uiIndexBytes;
+
+            geometry.uiNumVerticesUploaded = geometry.uiNumVertices;
+            geometry.uiNumIndicesUploaded  = static_cast<uint32_t>(geometry.indices.size());
+        }
+
+        const uint64_t uiSubmitNs = uiSyncNs + elapsedNs( stageStart );
+
+        uiStageIngest       += uiIngestNs;
+        uiStageSubmit       += uiSubmitNs;
+        uiStageMesh         += uiMeshNs;
+
+        frameNs.push_back( static_cast<uint32_t>(uiCaptureFrameNs + uiIngestNs + uiSubmitNs + uiMeshNs) );
+        uiNumRenderFrames++;
+
+        uiNumSamples   += uiNumDrained;
+        uiIdleFrames    = uiNumDrained ? 0 : uiIdleFrames + config.uiRenderEvery;
+    }
+
+    const double fSeconds = elapsedNs( runStart ) * 1e-9;
+
+    // segments, bricks, detail levels and rings of the whole painting again.
+    const Clock::time_point remeshStart = Clock::now();
+
+    {
+        StrokeBatcher   remeshBatcher;
+        TubeMesher      remeshMesher;
+
+        remeshBatcher.setJobSystem( jobs.get() );
+        remeshBatcher.sync( store );
+        ringBuilder.build( store, remeshMesher, remeshBatcher.changedRuns(), jobs.get(),
+                           []( const StrokeStore::Run&, uint32_t, const std::vector<Leap::Vector>&, const std::vector<Leap::Vector>& ) {} );
+    }
+
+    const uint64_t uiRemeshNs = elapsedNs( remeshStart );
+
+    // what closing the app and starting it again costs.
+    uint64_t uiCanvasSaveNs = 0, uiCanvasOpenNs = 0;
+
+    if ( config.szCanvas )
+    {
+        builder.liftPen();
+
+        const Clock::time_point saveStart = Clock::now();
+
+        if ( !canvas.save( store ) )
+        {
+            fprintf( stderr, "PaintBench: could not save canvas %s\n", config.szCanvas );
+        }
+
+        uiCanvasSaveNs = elapsedNs( saveStart );
+
+        StrokeStore     reopened;
+        CanvasDocument  reopenedCanvas;
+
+        const Clock::time_point openStart = Clock::now();
+        reopenedCanvas.open( config.szCanvas, reopened );
+        uiCanvasOpenNs = elapsedNs( openStart );
+
+        if ( reopened.pointCount() != store.pointCount() )
+        {
+            fprintf( stderr, "PaintBench: canvas reopened with %llu of %llu points\n",
+                     static_cast<unsigned long long>(reopened.pointCount()), static_cast<unsigned long long>(store.pointCount()) );
+        }
+    }
+
+    const Percentiles frameStats    = percentiles( frameNs );
+    const Percentiles captureStats  = percentiles( captureNs );
+
+    printf( "{\"benchmark\":\"pipeline\",\"source\":\"%s\",\"hands\":%u,\"samples\":%llu,\"device_frames\":%llu,\"render_frames\":%llu,"
+            "\"points\":%llu,\"strokes\":%u,\"runs\":%u,\"seconds\":%.6f,\"samples_per_sec\":%.1f,"
+            "\"frame_ns\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu},"
+            "\"capture_ns\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu},"
+            "\"stage_ns_total\":{\"capture\":%llu,\"ingest\":%llu,\"submit\":%llu,\"mesh\":%llu},"
+            "\"jobs\":%u,\"remesh_ns\":%llu,\"bytes_submitted\":%llu,\"mesh_bytes\":%llu,\"store_bytes\":%llu,\"index_bytes\":%llu,"
+            "\"canvas_save_ns\":%llu,\"canvas_open_ns\":%llu,\"peak_rss_kb\":%ld}\n",
+            config.szSource,
+            config.szRecording ? 0 : config.uiNumHands,
+            static_cast<unsigned long long>(uiNumSamples),
+            static_cast<unsigned long long>(uiNumFrames),
+            static_cast<unsigned long long>(uiNumRenderFrames),
+            static_cast<unsigned long long>(store.pointCount()),
+            store.strokeCount(),
+            store.runCount(),
+            fSeconds,
+            uiNumSamples / (fSeconds > 0 ? fSeconds : 1),
+            static_cast<unsigned long long>(frameStats.uiP50),
+            static_cast<unsigned long long>(frameStats.uiP99),
+            static_cast<unsigned long long>(frameStats.uiMax),
+            static_cast<unsigned long long>(captureStats.uiP50),
+            static_cast<unsigned long long>(captureStats.uiP99),
+            static_cast<unsigned long long>(captureStats.uiMax),
+            static_cast<unsigned long long>(uiStageCapture),
+            static_cast<unsigned long long>(uiStageIngest),
+            static_cast<unsigned long long>(uiStageSubmit),
+            static_cast<unsigned long long>(uiStageMesh),
+            jobs ? jobs->concurrency() : 1u,
+            static_cast<unsigned long long>(uiRemeshNs),
+            static_cast<unsigned long long>(uiBytesSubmitted),
+            static_cast<unsigned long long>(uiMeshBytes),
+            static_cast<unsigned long long>(store.memoryUsage()),
+            static_cast<unsigned long long>(batcher.index().memoryUsage()),
+            static_cast<unsigned long long>(uiCanvasSaveNs),
+            static_cast<unsigned long long>(uiCanvasOpenNs),
+            peakRssKb() );
+    fflush( stdout );
+
+    delete pQueue;
+}
+
+void runIsolated( const RunConfig& config )
+{
+#if defined(PAINTBENCH_POSIX)
+    const pid_t pid = fork();
+
+    if ( pid == 0 )
+    {
+        runBenchmark( config );
+        _exit( 0 );
+    }
+
+    if ( pid > 0 )
+    {
+        int iStatus = 0;
+        waitpid( pid, &iStatus, 0 );
+        return;
+    }
+#endif
+
+    runBenchmark( config );
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    std::vector<uint64_t>   sizes;
+    const char*             szRecording     = nullptr;
+    uint32_t                uiRenderEvery   = 2;
+    float                   fTolerance      = SimplifierSettings().fTolerance;
+    const char*             szCanvas        = nullptr;
+    TipFilterSettings       filterSettings;
+    PenSettings             penSettings;
+    uint32_t                uiNumHands      = 1;
+    uint32_t                uiNumJobs       = 1;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp( argv[i], "--sizes" ) && i + 1 < argc )
+        {
+            for ( char* p = argv[++i]; *p; )
+            {
+                sizes.push_back( strtoull( p, &p, 10 ) );
+
+                if ( *p == ',' )
+                {
+                    p++;
+                }
+            }
+        }
+        else if ( !strcmp( argv[i], "--recording" ) && i + 1 < argc )
+        {
+            szRecording = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--render-every" ) && i + 1 < argc )
+        {
+            uiRenderEvery = std::max( 1, atoi( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--tolerance" ) && i + 1 < argc )
+        {
+            fTolerance = std::max( 0.0f, static_cast<float>( atof( argv[++i] ) ) );
+        }
+        else if ( !strcmp( argv[i], "--canvas" ) && i + 1 < argc )
+        {
+            szCanvas = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--filter" ) && i + 1 < argc )
+        {
+            const char* szFilter = argv[++i];
+
+            filterSettings.eSmoothing = !strcmp( szFilter, "none" )   ? TipFilterSettings::kSmoothing_None :
+                                        !strcmp( szFilter, "kalman" ) ? TipFilterSettings::kSmoothing_Kalman :
+                                                                        TipFilterSettings::kSmoothing_OneEuro;
+        }
+        else if ( !strcmp( argv[i], "--predict-ms" ) && i + 1 < argc )
+        {
+            filterSettings.fLeadSeconds = std::max( 0.0f, static_cast<float>( atof( argv[++i] ) ) ) * 0.001f;
+        }
+        else if ( !strcmp( argv[i], "--hands" ) && i + 1 < argc )
+        {
+            uiNumHands = static_cast<uint32_t>( std::max( 1, std::min( atoi( argv[++i] ), static_cast<int>(FrameData::kMaxHands) ) ) );
+        }
+        else if ( !strcmp( argv[i], "--pen" ) && i + 1 < argc )
+        {
+            penSettings.eMode = !strcmp( argv[++i], "touch" ) ? PenSettings::kPen_Touch : PenSettings::kPen_OneFinger;
+        }
+        else if ( !strcmp( argv[i], "--jobs" ) && i + 1 < argc )
+        {
+            uiNumJobs = static_cast<uint32_t>( std::max( 1, atoi( argv[++i] ) ) );
+        }
+        else
+        {
+            fprintf( stderr, "usage: %s [--sizes N,N,...] [--recording file] [--render-every N] [--tolerance mm] [--canvas file]\n"
+                             "       [--filter one-euro|kalman|none] [--predict-ms ms] [--hands N] [--pen one-finger|touch] [--jobs N]\n", argv[0] );
+            return 1;
+        }
+    }
+
+    if ( sizes.empty() )
+    {
+        sizes.push_back( 10000 );
+        sizes.push_back( 100000 );
+        sizes.push_back( 1000000 );
+        sizes.push_back( 10000000 );
+    }
+
+    for ( size_t i = 0; i < sizes.size(); i++ )
+    {
+        RunConfig config;
+        config.szSource         = szRecording ? "recorded" : "synthetic";
+        config.szRecording      = szRecording;
+        config.uiNumSamples     = sizes[i];
+        config.uiRenderEvery    = uiRenderEvery;
+        config.fTolerance       = fTolerance;
+        config.szCanvas         = szCanvas;
+        config.filterSettings   = filterSettings;
+        config.penSettings      = penSettings;
+        config.uiNumHands       = uiNumHands;
+        config.uiNumJobs        = uiNumJobs;
+
+        runIsolated( config );
+    }
+
+    return 0;
+}
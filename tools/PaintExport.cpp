@@ -0,0 +1,144 @@
+/******************************************************************************\
+* LeapPaint3D canvas export.
+*
+* Writes the strokes of a saved canvas (and whatever its journal adds) to PLY,
+* OBJ or binary glTF with the same exporter as the app's 'e' key, without a
+* window or Leap device.  The canvas is only read.  Strokes take the app's
+* palette colors (StrokePalette.h).  One JSON object describing the export is
+* written to stdout.
+*
+* Build (only the Leap SDK headers are needed, nothing is linked):
+*   c++ -O2 -std=c++11 -I.. -I<LeapSDK>/include PaintExport.cpp -o PaintExport -pthread
+*
+* Usage:
+*   PaintExport canvas.lpcv out.(ply|obj|glb) [--lines] [--threads N]
+*
+* --threads counts this thread, the rest are JobSystem workers; the default
+* is one per core.
+\******************************************************************************/
+
+#include "../CanvasFile.h"
+#include "../StrokeExport.h"
+#include "../StrokePalette.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define PAINTEXPORT_POSIX 1
+#endif
+
+using namespace LeapPaint;
+
+namespace {
+
+long peakRssKb()
+{
+#if defined(PAINTEXPORT_POSIX)
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    const char*                 szCanvas        = nullptr;
+    const char*                 szOutput        = nullptr;
+    uint32_t                    uiNumThreads    = 0;
+    StrokeExporter::Settings    settings;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp( argv[i], "--lines" ) )
+        {
+            settings.eGeometry = StrokeExporter::kGeometry_Lines;
+        }
+        else if ( !strcmp( argv[i], "--threads" ) && i + 1 < argc )
+        {
+            uiNumThreads = static_cast<uint32_t>( std::max( 1, atoi( argv[++i] ) ) );
+        }
+        else if ( argv[i][0] != '-' && !szCanvas )
+        {
+            szCanvas = argv[i];
+        }
+        else if ( argv[i][0] != '-' && !szOutput )
+        {
+            szOutput = argv[i];
+        }
+        else
+        {
+            szCanvas = nullptr;
+            break;
+        }
+    }
+
+    if ( !szCanvas || !szOutput || !StrokeExporter::formatFromPath( szOutput, settings.eFormat ) )
+    {
+        fprintf( stderr, "usage: %s canvas.lpcv out.(ply|obj|glb) [--lines] [--threads N]\n", argv[0] );
+        return 1;
+    }
+
+    StrokeStore store;
+
+    if ( !CanvasDocument::read( szCanvas, store ) )
+    {
+        fprintf( stderr, "%s: can't read canvas %s\n", argv[0], szCanvas );
+        return 1;
+    }
+
+    Leap::Vector avColors[kPaletteSize];
+
+    makePalette( avColors );
+    settings.pColors        = avColors;
+    settings.uiNumColors    = kPaletteSize;
+
+    std::unique_ptr<JobSystem> jobs;
+
+    if ( uiNumThreads != 1 )
+    {
+        jobs.reset( new JobSystem( uiNumThreads ? uiNumThreads - 1 : 0 ) );
+        settings.pJobs = jobs.get();
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    StrokeExporter exporter;
+    exporter.capture( store );
+
+    if ( !exporter.write( szOutput, settings ) )
+    {
+        fprintf( stderr, "%s: can't write %s\n", argv[0], szOutput );
+        return 1;
+    }
+
+    const double fSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    long iBytes = -1;
+
+    if ( FILE* pFile = fopen( szOutput, "rb" ) )
+    {
+        fseek( pFile, 0, SEEK_END );
+        iBytes = ftell( pFile );
+        fclose( pFile );
+    }
+
+    printf( "{\"output\":\"%s\",\"geometry\":\"%s\",\"points\":%llu,\"seconds\":%.3f,\"bytes\":%ld,\"peak_rss_kb\":%ld}\n",
+            szOutput, settings.eGeometry == StrokeExporter::kGeometry_Tubes ? "tubes" : "lines",
+            static_cast<unsigned long long>( exporter.pointCount() ), fSeconds, iBytes, peakRssKb() );
+
+    return 0;
+}
@@ -0,0 +1,376 @@
+/******************************************************************************\
+* LeapPaint3D offscreen GL check.
+*
+* Draws a saved canvas (and whatever its journal adds) with StrokeRenderer in
+* an EGL pbuffer, set up as the app draws it: the leap to world mapping on the
+* model view, a StrokeView for culling and detail levels, the app's palette.
+* The same canvas is then drawn by StrokeRasterizer from the same camera and
+* the two coverages are compared, each lit pixel having to find a lit pixel
+* of the other image within one pixel.  One JSON object describing the check
+* is written to stdout; the exit code is 0 only if it passed.
+*
+* Build (the Leap SDK headers, EGL and GL):
+*   c++ -O2 -std=c++11 -I.. -I<LeapSDK>/include PaintGLCheck.cpp -o PaintGLCheck -pthread -lEGL -lGL
+*
+* Usage:
+*   PaintGLCheck canvas.lpcv [--size WxH] [--lines] [--threads N]
+*
+* No display is needed where Mesa's surfaceless platform is available; run
+* with LIBGL_ALWAYS_SOFTWARE=1 to check under llvmpipe.  --threads counts
+* this thread, the rest are JobSystem workers; the default is one per core.
+\******************************************************************************/
+
+#define GL_GLEXT_PROTOTYPES 1
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "../CanvasFile.h"
+#include "../StrokePalette.h"
+#include "../StrokeRaster.h"
+#include "../StrokeRenderer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace LeapPaint;
+
+namespace {
+
+enum { kMatchPercent = 97 };
+
+/// the buffer object entry points StrokeRenderer takes, straight from libGL.
+struct GLFunctions
+{
+    void glGenBuffers( GLsizei n, GLuint* puiBuffers )                                     { ::glGenBuffers( n, puiBuffers ); }
+    void glDeleteBuffers( GLsizei n, const GLuint* puiBuffers )                            { ::glDeleteBuffers( n, puiBuffers ); }
+    void glBindBuffer( GLenum eTarget, GLuint uiBuffer )                                   { ::glBindBuffer( eTarget, uiBuffer ); }
+    void glBufferData( GLenum eTarget, GLsizeiptr iSize, const GLvoid* pData, GLenum eUsage ) { ::glBufferData( eTarget, iSize, pData, eUsage ); }
+    void glBufferSubData( GLenum eTarget, GLintptr iOffset, GLsizeiptr iSize, const GLvoid* pData ) { ::glBufferSubData( eTarget, iOffset, iSize, pData ); }
+};
+
+/// a desktop GL context current on a pbuffer, on Mesa's surfaceless platform
+/// if there is one.
+class OffscreenContext
+{
+public:
+    OffscreenContext() : m_display(EGL_NO_DISPLAY), m_surface(EGL_NO_SURFACE), m_context(EGL_NO_CONTEXT) {}
+
+    ~OffscreenContext()
+    {
+        if ( m_display != EGL_NO_DISPLAY )
+        {
+            eglMakeCurrent( m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+
+            if ( m_context != EGL_NO_CONTEXT )
+            {
+                eglDestroyContext( m_display, m_context );
+            }
+
+            if ( m_surface != EGL_NO_SURFACE )
+            {
+                eglDestroySurface( m_display, m_surface );
+            }
+
+            eglTerminate( m_display );
+        }
+    }
+
+    bool create( uint32_t uiWidth, uint32_t uiHeight )
+    {
+        const char* szExtensions = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+
+        if ( szExtensions && strstr( szExtensions, "EGL_MESA_platform_surfaceless" ) )
+        {
+            PFNEGLGETPLATFORMDISPLAYEXTPROC pfnGetPlatformDisplay =
+                reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>( eglGetProcAddress( "eglGetPlatformDisplayEXT" ) );
+
+            if ( pfnGetPlatformDisplay )
+            {
+                m_display = pfnGetPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+            }
+        }
+
+        if ( m_display == EGL_NO_DISPLAY )
+        {
+            m_display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+        }
+
+        EGLint iMajor = 0, iMinor = 0;
+
+        if ( m_display == EGL_NO_DISPLAY || !eglInitialize( m_display, &iMajor, &iMinor ) )
+        {
+            m_display = EGL_NO_DISPLAY;
+            return false;
+        }
+
+        const EGLint aiConfig[] =
+        {
+            EGL_SURFACE_TYPE,       EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE,    EGL_OPENGL_BIT,
+            EGL_RED_SIZE,           8,
+            EGL_GREEN_SIZE,         8,
+            EGL_BLUE_SIZE,          8,
+            EGL_ALPHA_SIZE,         8,
+            EGL_DEPTH_SIZE,         24,
+            EGL_NONE
+        };
+        const EGLint aiSurface[] = { EGL_WIDTH, static_cast<EGLint>(uiWidth), EGL_HEIGHT, static_cast<EGLint>(uiHeight), EGL_NONE };
+
+        EGLConfig   config;
+        EGLint      iNumConfigs = 0;
+
+        if ( !eglChooseConfig( m_display, aiConfig, &config, 1, &iNumConfigs ) || iNumConfigs < 1 || !eglBindAPI( EGL_OPENGL_API ) )
+        {
+            return false;
+        }
+
+        m_surface = eglCreatePbufferSurface( m_display, config, aiSurface );
+        m_context = eglCreateContext( m_display, config, EGL_NO_CONTEXT, nullptr );
+
+        return m_surface != EGL_NO_SURFACE && m_context != EGL_NO_CONTEXT &&
+               eglMakeCurrent( m_display, m_surface, m_surface, m_context );
+    }
+
+private:
+    EGLDisplay  m_display;
+    EGLSurface  m_surface;
+    EGLContext  m_context;
+};
+
+/// column major gluLookAt and gluPerspective for a RasterCamera.
+void loadCamera( const RasterCamera& camera, uint32_t uiWidth, uint32_t uiHeight )
+{
+    const float fTop = camera.fNear * std::tan( camera.fFovDegrees * (Leap::PI / 360.0f) );
+    const float fRight = fTop * uiWidth / static_cast<float>(uiHeight);
+
+    glMatrixMode( GL_PROJECTION );
+    glLoadIdentity();
+    glFrustum( -fRight, fRight, -fTop, fTop, camera.fNear, camera.fFar );
+
+    const Leap::Vector vForward = (camera.vTarget - camera.vEye).normalized();
+    const Leap::Vector vSide    = vForward.cross( Leap::Vector( 0, 1, 0 ) ).normalized();
+    const Leap::Vector vUp      = vSide.cross( vForward );
+
+    const GLfloat afView[16] =
+    {
+        vSide.x,                  vUp.x,                  -vForward.x,                0,
+        vSide.y,                  vUp.y,                  -vForward.y,                0,
+        vSide.z,                  vUp.z,                  -vForward.z,                0,
+        -vSide.dot( camera.vEye ), -vUp.dot( camera.vEye ), vForward.dot( camera.vEye ), 1
+    };
+
+    glMatrixMode( GL_MODELVIEW );
+    glLoadMatrixf( afView );
+}
+
+/// the share of pixels lit in one mask with a lit pixel of the other at most
+/// one pixel away.
+uint32_t matchedPercent( const std::vector<bool>& from, const std::vector<bool>& to, uint32_t uiWidth, uint32_t uiHeight, uint32_t& uiNumLit )
+{
+    uint32_t uiNumMatched = 0;
+
+    uiNumLit = 0;
+
+    for ( uint32_t y = 0; y < uiHeight; y++ )
+    {
+        for ( uint32_t x = 0; x < uiWidth; x++ )
+        {
+            if ( !from[y * uiWidth + x] )
+            {
+                continue;
+            }
+
+            bool bMatched = false;
+
+            for ( uint32_t v = (y ? y - 1 : 0); v <= std::min( y + 1, uiHeight - 1 ) && !bMatched; v++ )
+            {
+                for ( uint32_t u = (x ? x - 1 : 0); u <= std::min( x + 1, uiWidth - 1 ) && !bMatched; u++ )
+                {
+                    bMatched = to[v * uiWidth + u];
+                }
+            }
+
+            uiNumLit++;
+            uiNumMatched += bMatched ? 1 : 0;
+        }
+    }
+
+    return uiNumLit ? static_cast<uint32_t>( 100.0 * uiNumMatched / uiNumLit ) : 100;
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    const char*                 szCanvas        = nullptr;
+    uint32_t                    uiNumThreads    = 0;
+    uint32_t                    uiWidth         = 640;
+    uint32_t                    uiHeight        = 480;
+    bool                        bUsage          = false;
+    StrokeRasterizer::Settings  settings;
+
+    for ( int i = 1; i < argc && !bUsage; i++ )
+    {
+        if ( !strcmp( argv[i], "--lines" ) )
+        {
+            settings.eStyle = StrokeRasterizer::kStyle_Lines;
+        }
+        else if ( !strcmp( argv[i], "--size" ) && i + 1 < argc )
+        {
+            unsigned uiW = 0, uiH = 0;
+            bUsage = (sscanf( argv[++i], "%ux%u", &uiW, &uiH ) != 2 || !uiW || !uiH || uiW > 4096 || uiH > 4096);
+            uiWidth     = uiW;
+            uiHeight    = uiH;
+        }
+        else if ( !strcmp( argv[i], "--threads" ) && i + 1 < argc )
+        {
+            uiNumThreads = static_cast<uint32_t>( std::max( 1, atoi( argv[++i] ) ) );
+        }
+        else if ( argv[i][0] != '-' && !szCanvas )
+        {
+            szCanvas = argv[i];
+        }
+        else
+        {
+            bUsage = true;
+        }
+    }
+
+    if ( bUsage || !szCanvas )
+    {
+        fprintf( stderr, "usage: %s canvas.lpcv [--size WxH] [--lines] [--threads N]\n", argv[0] );
+        return 1;
+    }
+
+    StrokeStore store;
+
+    if ( !CanvasDocument::read( szCanvas, store ) )
+    {
+        fprintf( stderr, "%s: can't read canvas %s\n", argv[0], szCanvas );
+        return 1;
+    }
+
+    std::unique_ptr<JobSystem> jobs;
+
+    if ( uiNumThreads != 1 )
+    {
+        jobs.reset( new JobSystem( uiNumThreads ? uiNumThreads - 1 : 0 ) );
+    }
+
+    // the reference: every stroke one color, so black palette entries still
+    // count as lit.
+    StrokeRasterizer    rasterizer;
+    RasterCamera        camera;
+    Leap::Vector        vMin, vMax;
+
+    rasterizer.capture( store, settings );
+
+    if ( rasterizer.bounds( vMin, vMax ) )
+    {
+        camera = camera.framing( vMin, vMax, uiWidth / static_cast<float>(uiHeight) );
+    }
+
+    rasterizer.render( camera, uiWidth, uiHeight, jobs.get() );
+
+    OffscreenContext context;
+
+    if ( !context.create( uiWidth, uiHeight ) )
+    {
+        fprintf( stderr, "%s: can't create an offscreen GL context (error 0x%x)\n", argv[0], eglGetError() );
+        return 1;
+    }
+
+    const bool      bTubes      = (settings.eStyle == StrokeRasterizer::kStyle_Tubes);
+    const char*     szRenderer  = reinterpret_cast<const char*>( glGetString( GL_RENDERER ) );
+    const std::string strRenderer = szRenderer ? szRenderer : "";
+    uint32_t        uiNumErrors = 0;
+    Leap::Vector    avColors[kPaletteSize];
+    std::vector<uint8_t> pixels( static_cast<size_t>(uiWidth) * uiHeight * 4 );
+
+    makePalette( avColors );
+
+    {
+        GLFunctions                     gl;
+        StrokeRenderer<GLFunctions>     renderer( gl );
+
+        renderer.setStyle( bTubes ? StrokeRenderer<GLFunctions>::kStyle_Tubes : StrokeRenderer<GLFunctions>::kStyle_Lines );
+        renderer.setJobSystem( jobs.get() );
+        renderer.setColors( avColors, kPaletteSize );
+
+        // lit pixels are told apart by alpha, which strokes always write as 1.
+        glViewport( 0, 0, uiWidth, uiHeight );
+        glClearColor( 0, 0, 0, 0 );
+        glEnable( GL_DEPTH_TEST );
+        glEnable( GL_CULL_FACE );
+        glCullFace( GL_BACK );
+
+        loadCamera( camera, uiWidth, uiHeight );
+
+        const GLfloat afLeapToWorld[16] =
+        {
+            settings.fLeapScale,    0,                      0,                      0,
+            0,                      settings.fLeapScale,    0,                      0,
+            0,                      0,                      settings.fLeapScale,    0,
+            settings.vLeapOrigin.x, settings.vLeapOrigin.y, settings.vLeapOrigin.z, 1
+        };
+
+        glMultMatrixf( afLeapToWorld );
+
+        GLfloat afProjection[16], afModelView[16];
+        glGetFloatv( GL_PROJECTION_MATRIX, afProjection );
+        glGetFloatv( GL_MODELVIEW_MATRIX, afModelView );
+
+        const StrokeView view = StrokeView::fromGL( afProjection, afModelView, static_cast<float>(uiHeight), 1.0f );
+
+        // the second frame draws from the kept draw list.
+        for ( int f = 0; f < 2; f++ )
+        {
+            glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+            renderer.update( store );
+            renderer.draw( store, &view );
+
+            while ( glGetError() != GL_NO_ERROR )
+            {
+                uiNumErrors++;
+            }
+        }
+
+        glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+        glReadPixels( 0, 0, uiWidth, uiHeight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0] );
+
+        renderer.release();
+    }
+
+    // GL rows go bottom up.
+    std::vector<bool> glLit( static_cast<size_t>(uiWidth) * uiHeight ), rasterLit( glLit.size() );
+
+    for ( uint32_t y = 0; y < uiHeight; y++ )
+    {
+        for ( uint32_t x = 0; x < uiWidth; x++ )
+        {
+            glLit[y * uiWidth + x]      = pixels[(static_cast<size_t>(uiHeight - 1 - y) * uiWidth + x) * 4 + 3] != 0;
+            rasterLit[y * uiWidth + x]  = (rasterizer.image()[static_cast<size_t>(y) * rasterizer.stride() + x] & 0xFFFFFF) != 0;
+        }
+    }
+
+    uint32_t        uiGLLit = 0, uiRasterLit = 0;
+    const uint32_t  uiGLMatched     = matchedPercent( glLit, rasterLit, uiWidth, uiHeight, uiGLLit );
+    const uint32_t  uiRasterMatched = matchedPercent( rasterLit, glLit, uiWidth, uiHeight, uiRasterLit );
+    const bool      bOk             = uiNumErrors == 0 && uiGLLit > 0 &&
+                                      uiGLMatched >= static_cast<uint32_t>(kMatchPercent) && uiRasterMatched >= static_cast<uint32_t>(kMatchPercent);
+
+    printf( "{\"canvas\":\"%s\",\"renderer\":\"%s\",\"style\":\"%s\",\"width\":%u,\"height\":%u,\"gl_errors\":%u,"
+            "\"gl_pixels\":%u,\"raster_pixels\":%u,\"gl_matched_percent\":%u,\"raster_matched_percent\":%u,\"ok\":%s}\n",
+            szCanvas, strRenderer.c_str(), bTubes ? "tubes" : "lines", uiWidth, uiHeight, uiNumErrors,
+            uiGLLit, uiRasterLit, uiGLMatched, uiRasterMatched, bOk ? "true" : "false" );
+
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+/******************************************************************************\
+* LeapPaint3D canvas mirror client.
+*
+* Connects to an app started with --mirror and keeps a copy of its painting
+* up to date, the way a second display process would, printing one JSON line
+* a second with what it holds.  It stops when the app goes away.
+*
+* With --loopback it is its own server instead: a painting (a saved canvas,
+* or synthetic strokes) is painted into a store frame by frame, with a moving
+* tip, and published to two clients in the same process, one connected from
+* the start and one joining halfway through on a snapshot.  Both copies are
+* then checked against the store.  One JSON object describing the run is
+* written to stdout, and the exit code is 0 only if both copies match.
+*
+* Build (only the Leap SDK headers are needed, nothing is linked):
+*   c++ -O2 -std=c++11 -I.. -I<LeapSDK>/include PaintMirror.cpp -o PaintMirror -pthread
+*
+* Usage:
+*   PaintMirror <address>
+*   PaintMirror --loopback [canvas.lpcv] [--address 47411] [--points-per-frame 8]
+*
+* An address is a TCP port on 127.0.0.1, or the path of a Unix domain socket.
+\******************************************************************************/
+
+#include "../CanvasMirror.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace LeapPaint;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/// a painting that exercises every kind of journal record.
+void syntheticPainting( StrokeStore& store )
+{
+    const uint32_t  kNumStrokes = 200;
+    const uint32_t  kNumPoints  = 400;
+    int64_t         iTimestamp  = 1000000;
+
+    for ( uint32_t s = 0; s < kNumStrokes; s++ )
+    {
+        const StrokeStore::StrokeId id = store.beginStroke( s % 7, 0.5f + 0.25f * (s % 5), iTimestamp );
+
+        for ( uint32_t i = 0; i < kNumPoints; i++ )
+        {
+            const float fAngle = 0.05f * i + 0.7f * s;
+
+            store.appendPoint( id, Leap::Vector( 80.0f * std::cos( fAngle ), 150.0f + 0.3f * i - 0.2f * s, 60.0f * std::sin( fAngle ) ), iTimestamp );
+            iTimestamp += 9000;
+        }
+
+        store.endStroke( id );
+        iTimestamp += 250000;
+    }
+
+    for ( uint32_t s = 3; s < kNumStrokes; s += 17 )
+    {
+        store.setErased( s, true );
+    }
+
+    store.setClearMark( 20 );
+}
+
+/// everything a mirror has to reproduce.  returns the largest position error,
+/// or a negative number if anything else differs.
+float compare( const StrokeStore& a, const StrokeStore& b )
+{
+    if ( a.strokeCount() != b.strokeCount() || a.clearMark() != b.clearMark() || a.pointCount() != b.pointCount() )
+    {
+        return -1.0f;
+    }
+
+    float                       fMaxError = 0.0f;
+    std::vector<Leap::Vector>   pointsA, pointsB;
+
+    for ( uint32_t s = 0; s < a.strokeCount(); s++ )
+    {
+        const StrokeStore::Stroke& strokeA = a.stroke( s );
+        const StrokeStore::Stroke& strokeB = b.stroke( s );
+
+        if ( strokeA.uiColorIndex != strokeB.uiColorIndex || strokeA.fWidth != strokeB.fWidth ||
+             strokeA.iStartTimestamp != strokeB.iStartTimestamp || strokeA.iEndTimestamp != strokeB.iEndTimestamp ||
+             strokeA.uiNumPoints != strokeB.uiNumPoints || strokeA.bOpen != strokeB.bOpen || strokeA.bErased != strokeB.bErased )
+        {
+            return -1.0f;
+        }
+
+        pointsA.clear();
+        pointsB.clear();
+        a.forEachPoint( s, [&]( const Leap::Vector& v ) { pointsA.push_back( v ); } );
+        b.forEachPoint( s, [&]( const Leap::Vector& v ) { pointsB.push_back( v ); } );
+
+        for ( size_t i = 0; i < pointsA.size(); i++ )
+        {
+            fMaxError = std::max( fMaxError, std::fabs( pointsA[i].x - pointsB[i].x ) );
+            fMaxError = std::max( fMaxError, std::fabs( pointsA[i].y - pointsB[i].y ) );
+            fMaxError = std::max( fMaxError, std::fabs( pointsA[i].z - pointsB[i].z ) );
+        }
+    }
+
+    return fMaxError;
+}
+
+/// paints input into a fresh store, one frame every uiPointsPerFrame points,
+/// the way StrokeBuilder journals it: the last point of an open stroke is
+/// moved ahead to a predicted tip in the store only, once the frame is
+/// published, and back before the next one is appended.
+int loopback( const StrokeStore& input, const std::string& strAddress, uint32_t uiPointsPerFrame )
+{
+    MirrorServer server;
+
+    if ( !server.start( strAddress ) )
+    {
+        fprintf( stderr, "can't listen at %s\n", strAddress.c_str() );
+        return 1;
+    }
+
+    MirrorClient    early, late;
+    StrokeStore     source, earlyCopy, lateCopy;
+    CanvasJournal   journal;
+
+    if ( !early.connect( strAddress ) )
+    {
+        fprintf( stderr, "can't connect to %s\n", strAddress.c_str() );
+        return 1;
+    }
+
+    // the server notices the client on its own thread, and the snapshot is
+    // taken by the next publish after that.
+    const Clock::time_point connectStart = Clock::now();
+
+    while ( early.messageCount() == 0 && Clock::now() - connectStart < std::chrono::seconds( 5 ) )
+    {
+        server.publish( journal.pending(), source );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        early.poll( earlyCopy );
+    }
+
+    uint64_t    uiJournalBytes  = 0;
+    uint64_t    uiPublishNs     = 0;
+    uint32_t    uiNumFrames     = 0;
+    uint32_t    uiPending       = 0;
+    bool        bLateConnected  = false;
+
+    auto frame = [&]()
+    {
+        uiJournalBytes += journal.pending().size();
+
+        const Clock::time_point start = Clock::now();
+        server.publish( journal.pending(), source );
+        uiPublishNs += static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - start ).count() );
+
+        journal.flush();
+        early.poll( earlyCopy );
+        late.poll( lateCopy );
+
+        uiNumFrames++;
+        uiPending = 0;
+    };
+
+    for ( uint32_t s = 0; s < input.strokeCount(); s++ )
+    {
+        const StrokeStore::Stroke&  stroke      = input.stroke( s );
+        const StrokeStore::StrokeId id          = source.beginStroke( stroke.uiColorIndex, stroke.fWidth, stroke.iStartTimestamp );
+        const uint32_t              uiNumPoints = stroke.uiNumPoints;
+        uint32_t                    uiPoint     = 0;
+        Leap::Vector                vTip;
+        int64_t                     iTipTimestamp   = 0;
+        bool                        bPredicted      = false;
+
+        journal.beginStroke( id, stroke.uiColorIndex, stroke.fWidth, stroke.iStartTimestamp );
+
+        input.forEachPoint( s, [&]( const Leap::Vector& vPoint )
+        {
+            const int64_t iTimestamp = stroke.iStartTimestamp +
+                                       (uiNumPoints > 1 ? (stroke.iEndTimestamp - stroke.iStartTimestamp) * uiPoint / (uiNumPoints - 1) : 0);
+
+            if ( bPredicted )
+            {
+                source.moveLastPoint( id, vTip, iTipTimestamp );
+                bPredicted = false;
+            }
+
+            source.appendPoint( id, vPoint, iTimestamp );
+            journal.appendPoint( id, vPoint, iTimestamp );
+            vTip            = vPoint;
+            iTipTimestamp   = iTimestamp;
+            uiPoint++;
+
+            if ( ++uiPending == uiPointsPerFrame )
+            {
+                frame();
+
+                // drawn until the next point, as StrokeBuilder::withRealTips
+                // keeps it out of snapshots.
+                source.moveLastPoint( id, vPoint + Leap::Vector( 0.4f, -0.3f, 0.2f ), iTimestamp );
+                bPredicted = true;
+            }
+        } );
+
+        if ( bPredicted )
+        {
+            // the tip settles where the stroke ended.
+            source.moveLastPoint( id, vTip, iTipTimestamp );
+        }
+
+        source.endStroke( id );
+        journal.endStroke( id );
+
+        if ( !bLateConnected && s >= input.strokeCount() / 2 )
+        {
+            bLateConnected = late.connect( strAddress );
+        }
+    }
+
+    for ( uint32_t s = 0; s < input.strokeCount(); s++ )
+    {
+        if ( input.stroke( s ).bErased )
+        {
+            source.setErased( s, true );
+            journal.setErased( s, true );
+        }
+
+        if ( s % 11 == 5 )
+        {
+            source.setColor( s, (input.stroke( s ).uiColorIndex + 1) % 7 );
+            journal.setColor( s, source.stroke( s ).uiColorIndex );
+        }
+    }
+
+    source.setClearMark( input.clearMark() );
+    journal.setClearMark( input.clearMark() );
+    frame();
+
+    // whatever is still on its way, and the late client's snapshot if it
+    // connected after the last stroke.
+    const Clock::time_point settleStart = Clock::now();
+    float                   fEarlyError = -1.0f;
+    float                   fLateError  = -1.0f;
+
+    while ( Clock::now() - settleStart < std::chrono::seconds( 5 ) )
+    {
+        frame();
+
+        fEarlyError = compare( source, earlyCopy );
+        fLateError  = compare( source, lateCopy );
+
+        if ( fEarlyError >= 0.0f && fLateError >= 0.0f )
+        {
+            break;
+        }
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    // half a micrometre of rounding, plus float spacing at leap distances.
+    const float kfTolerance = 0.5f / MirrorCodec::kStepsPerMm + 1e-4f;
+    const bool  bOk         = early.isConnected() && late.isConnected() && bLateConnected &&
+                              fEarlyError >= 0.0f && fEarlyError <= kfTolerance && fLateError >= 0.0f && fLateError <= kfTolerance;
+
+    printf( "{\"strokes\":%u,\"points\":%llu,\"frames\":%u,\"journal_bytes\":%llu,\"mirror_bytes\":%llu,\"early_bytes\":%llu,"
+            "\"late_bytes\":%llu,\"publish_ns_per_frame\":%llu,\"max_error_mm\":%.6f,\"ok\":%s}\n",
+            source.strokeCount(), static_cast<unsigned long long>( source.pointCount() ), uiNumFrames,
+            static_cast<unsigned long long>( uiJournalBytes ), static_cast<unsigned long long>( server.bytesSent() ),
+            static_cast<unsigned long long>( early.bytesReceived() ), static_cast<unsigned long long>( late.bytesReceived() ),
+            static_cast<unsigned long long>( uiNumFrames ? uiPublishNs / uiNumFrames : 0 ),
+            std::max( fEarlyError, fLateError ), bOk ? "true" : "false" );
+
+    return bOk ? 0 : 1;
+}
+
+int view( const std::string& strAddress )
+{
+    MirrorClient    client;
+    StrokeStore     copy;
+
+    if ( !client.connect( strAddress ) )
+    {
+        fprintf( stderr, "can't connect to %s\n", strAddress.c_str() );
+        return 1;
+    }
+
+    while ( client.isConnected() )
+    {
+        std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+        client.poll( copy );
+
+        printf( "{\"strokes\":%u,\"points\":%llu,\"open\":%u,\"messages\":%llu,\"bytes\":%llu}\n",
+                copy.strokeCount(), static_cast<unsigned long long>( copy.pointCount() ), copy.openStrokeCount(),
+                static_cast<unsigned long long>( client.messageCount() ), static_cast<unsigned long long>( client.bytesReceived() ) );
+        fflush( stdout );
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    bool        bLoopback           = false;
+    const char* szCanvas            = nullptr;
+    std::string strAddress;
+    uint32_t    uiPointsPerFrame    = 8;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( !strcmp( argv[i], "--loopback" ) )
+        {
+            bLoopback = true;
+        }
+        else if ( !strcmp( argv[i], "--address" ) && i + 1 < argc )
+        {
+            strAddress = argv[++i];
+        }
+        else if ( !strcmp( argv[i], "--points-per-frame" ) && i + 1 < argc )
+        {
+            uiPointsPerFrame = static_cast<uint32_t>( std::max( 1, atoi( argv[++i] ) ) );
+        }
+        else if ( argv[i][0] != '-' && bLoopback && !szCanvas )
+        {
+            szCanvas = argv[i];
+        }
+        else if ( argv[i][0] != '-' && !bLoopback && strAddress.empty() )
+        {
+            strAddress = argv[i];
+        }
+        else
+        {
+            strAddress.clear();
+            bLoopback = false;
+            break;
+        }
+    }
+
+    if ( bLoopback )
+    {
+        StrokeStore input;
+
+        if ( szCanvas && !CanvasDocument::read( szCanvas, input ) )
+        {
+            fprintf( stderr, "%s: can't read canvas %s\n", argv[0], szCanvas );
+            return 1;
+        }
+
+        if ( !szCanvas )
+        {
+            syntheticPainting( input );
+        }
+
+        return loopback( input, strAddress.empty() ? "47411" : strAddress, uiPointsPerFrame );
+    }
+
+    if ( strAddress.empty() )
+    {
+        fprintf( stderr, "usage: %s <address>\n       %s --loopback [canvas.lpcv] [--address 47411] [--points-per-frame 8]\n", argv[0], argv[0] );
+        return 1;
+    }
+
+    return view( strAddress );
+}
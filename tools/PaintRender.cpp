@@ -0,0 +1,581 @@
+/******************************************************************************\
+* LeapPaint3D offscreen renders.
+*
+* Draws a saved canvas (and whatever its journal adds) with StrokeRasterizer,
+* no window, GL or Leap device needed, as a single image or as a turntable:
+* the app's default camera orbited around its target in equal steps, strokes
+* in the app's palette colors.  Images are PNG or binary PPM by extension.
+* Each frame is encoded and written by a background job while the next one
+* renders.  One JSON object describing the run is written to stdout.
+*
+* Build (only the Leap SDK headers are needed, nothing is linked):
+*   c++ -O2 -std=c++11 -I.. -I<LeapSDK>/include PaintRender.cpp -o PaintRender -pthread
+*
+* Usage:
+*   PaintRender canvas.lpcv out.(png|ppm) [--size WxH] [--lines] [--frames N]
+*               [--orbit-degrees D] [--fov DEGREES] [--fit] [--threads N]
+*
+* With more than one frame the output name needs one printf integer
+* conversion, e.g. turntable_%04d.png, filled with the frame number.  --fit
+* aims at the painting's bounds instead of the app's origin.  --threads
+* counts this thread, the rest are JobSystem workers; the default is one per
+* core.
+\******************************************************************************/
+
+#include "../CanvasFile.h"
+#include "../StrokePalette.h"
+#include "../StrokeRaster.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define PAINTRENDER_POSIX 1
+#endif
+
+using namespace LeapPaint;
+
+namespace {
+
+long peakRssKb()
+{
+#if defined(PAINTRENDER_POSIX)
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/// true if the pattern holds exactly one integer conversion and no other.
+bool framePattern( const char* szPattern )
+{
+    uint32_t uiConversions = 0;
+
+    for ( const char* p = szPattern; *p; p++ )
+    {
+        if ( *p != '%' )
+        {
+            continue;
+        }
+
+        if ( p[1] == '%' )
+        {
+            p++;
+            continue;
+        }
+
+        p++;
+        p += strspn( p, "0-+ " );
+        p += strspn( p, "0123456789" );
+
+        if ( *p != 'd' && *p != 'i' )
+        {
+            return false;
+        }
+
+        uiConversions++;
+    }
+
+    return uiConversions == 1;
+}
+
+/// lsb first bit stream for deflate.
+class BitWriter
+{
+public:
+    explicit BitWriter( std::vector<uint8_t>& out ) : m_out(out), m_uiBits(0), m_uiNumBits(0) {}
+
+    void put( uint32_t uiValue, uint32_t uiNumBits )
+    {
+        m_uiBits |= static_cast<uint64_t>(uiValue) << m_uiNumBits;
+        m_uiNumBits += uiNumBits;
+
+        while ( m_uiNumBits >= 8 )
+        {
+            m_out.push_back( static_cast<uint8_t>(m_uiBits) );
+            m_uiBits >>= 8;
+            m_uiNumBits -= 8;
+        }
+    }
+
+    /// huffman codes go most significant bit first.
+    void putCode( uint32_t uiCode, uint32_t uiLength )
+    {
+        uint32_t uiReversed = 0;
+
+        for ( uint32_t i = 0; i < uiLength; i++ )
+        {
+            uiReversed |= ((uiCode >> i) & 1) << (uiLength - 1 - i);
+        }
+
+        put( uiReversed, uiLength );
+    }
+
+    void flush()
+    {
+        if ( m_uiNumBits )
+        {
+            m_out.push_back( static_cast<uint8_t>(m_uiBits) );
+        }
+
+        m_uiBits    = 0;
+        m_uiNumBits = 0;
+    }
+
+private:
+    std::vector<uint8_t>&   m_out;
+    uint64_t                m_uiBits;
+    uint32_t                m_uiNumBits;
+};
+
+/// zlib stream of one fixed huffman block.  only repeats of the previous
+/// byte or pixel are matched, which is what an image of strokes on black
+/// mostly is, and keeps encoding a single pass.
+void deflate( const std::vector<uint8_t>& in, std::vector<uint8_t>& out )
+{
+    static const uint16_t s_auiLengthBase[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t  s_auiLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                   3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+    out.push_back( 0x78 );
+    out.push_back( 0x01 );
+
+    BitWriter bits( out );
+
+    // final block, fixed codes.
+    bits.put( 1, 1 );
+    bits.put( 1, 2 );
+
+    const size_t uiSize = in.size();
+
+    for ( size_t i = 0; i < uiSize; )
+    {
+        // the longest run repeating from one or three bytes back.
+        uint32_t uiBestLength   = 0;
+        uint32_t uiBestDistance = 0;
+
+        for ( uint32_t uiDistance = 1; uiDistance <= 3; uiDistance += 2 )
+        {
+            if ( i < uiDistance )
+            {
+                break;
+            }
+
+            uint32_t uiLength = 0;
+
+            while ( uiLength < 258 && i + uiLength < uiSize && in[i + uiLength] == in[i + uiLength - uiDistance] )
+            {
+                uiLength++;
+            }
+
+            if ( uiLength > uiBestLength )
+            {
+                uiBestLength    = uiLength;
+                uiBestDistance  = uiDistance;
+            }
+        }
+
+        if ( uiBestLength >= 3 )
+        {
+            int c = 28;
+
+            while ( s_auiLengthBase[c] > uiBestLength )
+            {
+                c--;
+            }
+
+            const uint32_t uiSymbol = 257 + c;
+
+            if ( uiSymbol < 280 )
+            {
+                bits.putCode( uiSymbol - 256, 7 );
+            }
+            else
+            {
+                bits.putCode( 0xC0 + uiSymbol - 280, 8 );
+            }
+
+            bits.put( uiBestLength - s_auiLengthBase[c], s_auiLengthExtra[c] );
+            // distance codes 0 and 2 are distances 1 and 3, without extra bits.
+            bits.putCode( uiBestDistance - 1, 5 );
+
+            i += uiBestLength;
+        }
+        else
+        {
+            const uint32_t uiByte = in[i++];
+
+            if ( uiByte < 144 )
+            {
+                bits.putCode( 0x30 + uiByte, 8 );
+            }
+            else
+            {
+                bits.putCode( 0x190 + uiByte - 144, 9 );
+            }
+        }
+    }
+
+    // end of block.
+    bits.putCode( 0, 7 );
+    bits.flush();
+
+    uint32_t uiA = 1, uiB = 0;
+
+    for ( size_t i = 0; i < uiSize; i++ )
+    {
+        uiA = (uiA + in[i]) % 65521;
+        uiB = (uiB + uiA) % 65521;
+    }
+
+    const uint32_t uiAdler = (uiB << 16) | uiA;
+
+    for ( int s = 24; s >= 0; s -= 8 )
+    {
+        out.push_back( static_cast<uint8_t>(uiAdler >> s) );
+    }
+}
+
+struct CrcTable
+{
+    CrcTable()
+    {
+        for ( uint32_t n = 0; n < 256; n++ )
+        {
+            uint32_t c = n;
+
+            for ( int k = 0; k < 8; k++ )
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+
+            auiEntries[n] = c;
+        }
+    }
+
+    uint32_t auiEntries[256];
+};
+
+uint32_t crc32( const uint8_t* pData, size_t uiSize, uint32_t uiCrc = 0 )
+{
+    // built once, safely, whichever writer job gets here first.
+    static const CrcTable s_table;
+
+    uiCrc = ~uiCrc;
+
+    for ( size_t i = 0; i < uiSize; i++ )
+    {
+        uiCrc = s_table.auiEntries[(uiCrc ^ pData[i]) & 0xFF] ^ (uiCrc >> 8);
+    }
+
+    return ~uiCrc;
+}
+
+void putU32( std::vector<uint8_t>& out, uint32_t uiValue )
+{
+    for ( int s = 24; s >= 0; s -= 8 )
+    {
+        out.push_back( static_cast<uint8_t>(uiValue >> s) );
+    }
+}
+
+void pngChunk( std::vector<uint8_t>& out, const char* szType, const std::vector<uint8_t>& data )
+{
+    putU32( out, static_cast<uint32_t>(data.size()) );
+
+    const size_t uiStart = out.size();
+
+    out.insert( out.end(), szType, szType + 4 );
+    out.insert( out.end(), data.begin(), data.end() );
+    putU32( out, crc32( &out[uiStart], out.size() - uiStart ) );
+}
+
+/// one rendered frame waiting to be encoded and written.
+struct Frame
+{
+    std::vector<uint32_t>   pixels;
+    uint32_t                uiWidth;
+    uint32_t                uiHeight;
+    std::string             strPath;
+    bool                    bPng;
+    bool                    bWritten;
+    size_t                  uiBytes;
+};
+
+/// rgb rows of a frame, each after a PNG filter byte if asked.
+void rgbRows( const Frame& frame, bool bFilterBytes, std::vector<uint8_t>& out )
+{
+    out.clear();
+    out.reserve( static_cast<size_t>(frame.uiWidth * 3 + 1) * frame.uiHeight );
+
+    for ( uint32_t y = 0; y < frame.uiHeight; y++ )
+    {
+        if ( bFilterBytes )
+        {
+            out.push_back( 0 );
+        }
+
+        const uint32_t* pRow = &frame.pixels[static_cast<size_t>(y) * frame.uiWidth];
+
+        for ( uint32_t x = 0; x < frame.uiWidth; x++ )
+        {
+            out.push_back( static_cast<uint8_t>(pRow[x]) );
+            out.push_back( static_cast<uint8_t>(pRow[x] >> 8) );
+            out.push_back( static_cast<uint8_t>(pRow[x] >> 16) );
+        }
+    }
+}
+
+void writeFrame( Frame& frame )
+{
+    std::vector<uint8_t> rows, file;
+
+    rgbRows( frame, frame.bPng, rows );
+
+    if ( frame.bPng )
+    {
+        static const uint8_t s_aSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        std::vector<uint8_t> header, data;
+
+        putU32( header, frame.uiWidth );
+        putU32( header, frame.uiHeight );
+        // 8 bit rgb, deflate, no interlace.
+        header.push_back( 8 );
+        header.push_back( 2 );
+        header.push_back( 0 );
+        header.push_back( 0 );
+        header.push_back( 0 );
+
+        deflate( rows, data );
+
+        file.assign( s_aSignature, s_aSignature + 8 );
+        pngChunk( file, "IHDR", header );
+        pngChunk( file, "IDAT", data );
+        pngChunk( file, "IEND", std::vector<uint8_t>() );
+    }
+    else
+    {
+        char szHeader[64];
+        const int iLength = snprintf( szHeader, sizeof(szHeader), "P6\n%u %u\n255\n", frame.uiWidth, frame.uiHeight );
+
+        file.assign( szHeader, szHeader + iLength );
+        file.insert( file.end(), rows.begin(), rows.end() );
+    }
+
+    frame.bWritten  = false;
+    frame.uiBytes   = file.size();
+
+    if ( FILE* pFile = fopen( frame.strPath.c_str(), "wb" ) )
+    {
+        frame.bWritten = (fwrite( &file[0], 1, file.size(), pFile ) == file.size());
+        frame.bWritten = (fclose( pFile ) == 0) && frame.bWritten;
+    }
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    const char*                 szCanvas        = nullptr;
+    const char*                 szOutput        = nullptr;
+    uint32_t                    uiNumThreads    = 0;
+    uint32_t                    uiWidth         = 1024;
+    uint32_t                    uiHeight        = 768;
+    uint32_t                    uiNumFrames     = 1;
+    float                       fOrbitDegrees   = 360.0f;
+    bool                        bFit            = false;
+    bool                        bUsage          = false;
+    RasterCamera                camera;
+    StrokeRasterizer::Settings  settings;
+    Leap::Vector                avColors[kPaletteSize];
+
+    makePalette( avColors );
+    settings.pColors        = avColors;
+    settings.uiNumColors    = kPaletteSize;
+
+    for ( int i = 1; i < argc && !bUsage; i++ )
+    {
+        if ( !strcmp( argv[i], "--lines" ) )
+        {
+            settings.eStyle = StrokeRasterizer::kStyle_Lines;
+        }
+        else if ( !strcmp( argv[i], "--fit" ) )
+        {
+            bFit = true;
+        }
+        else if ( !strcmp( argv[i], "--size" ) && i + 1 < argc )
+        {
+            unsigned uiW = 0, uiH = 0;
+            bUsage = (sscanf( argv[++i], "%ux%u", &uiW, &uiH ) != 2 || !uiW || !uiH || uiW > 16384 || uiH > 16384);
+            uiWidth     = uiW;
+            uiHeight    = uiH;
+        }
+        else if ( !strcmp( argv[i], "--frames" ) && i + 1 < argc )
+        {
+            uiNumFrames = static_cast<uint32_t>( std::max( 1, atoi( argv[++i] ) ) );
+        }
+        else if ( !strcmp( argv[i], "--orbit-degrees" ) && i + 1 < argc )
+        {
+            fOrbitDegrees = static_cast<float>( atof( argv[++i] ) );
+        }
+        else if ( !strcmp( argv[i], "--fov" ) && i + 1 < argc )
+        {
+            camera.fFovDegrees = std::min( 170.0f, std::max( 1.0f, static_cast<float>( atof( argv[++i] ) ) ) );
+        }
+        else if ( !strcmp( argv[i], "--threads" ) && i + 1 < argc )
+        {
+            uiNumThreads = static_cast<uint32_t>( std::max( 1, atoi( argv[++i] ) ) );
+        }
+        else if ( argv[i][0] != '-' && !szCanvas )
+        {
+            szCanvas = argv[i];
+        }
+        else if ( argv[i][0] != '-' && !szOutput )
+        {
+            szOutput = argv[i];
+        }
+        else
+        {
+            bUsage = true;
+        }
+    }
+
+    const std::string   strOutput   = szOutput ? szOutput : "";
+    const size_t        uiDot       = strOutput.find_last_of( '.' );
+    const std::string   strExtension = (uiDot == std::string::npos) ? std::string() : strOutput.substr( uiDot + 1 );
+    const bool          bPng        = (strExtension == "png" || strExtension == "PNG");
+
+    if ( bUsage || !szCanvas || !szOutput || (!bPng && strExtension != "ppm" && strExtension != "PPM") ||
+         (uiNumFrames > 1 && !framePattern( szOutput )) )
+    {
+        fprintf( stderr, "usage: %s canvas.lpcv out.(png|ppm) [--size WxH] [--lines] [--frames N] [--orbit-degrees D]\n"
+                         "       [--fov DEGREES] [--fit] [--threads N]\n"
+                         "       several frames need a pattern such as out_%%04d.png\n", argv[0] );
+        return 1;
+    }
+
+    StrokeStore store;
+
+    if ( !CanvasDocument::read( szCanvas, store ) )
+    {
+        fprintf( stderr, "%s: can't read canvas %s\n", argv[0], szCanvas );
+        return 1;
+    }
+
+    std::unique_ptr<JobSystem> jobs;
+
+    if ( uiNumThreads != 1 )
+    {
+        jobs.reset( new JobSystem( uiNumThreads ? uiNumThreads - 1 : 0 ) );
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    StrokeRasterizer rasterizer;
+    rasterizer.capture( store, settings );
+
+    const double fCaptureSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    Leap::Vector vMin, vMax;
+
+    if ( bFit && rasterizer.bounds( vMin, vMax ) )
+    {
+        camera = camera.framing( vMin, vMax, uiWidth / static_cast<float>(uiHeight) );
+    }
+
+    // two frames in flight: one being written while the next renders.
+    Frame       aFrames[2];
+    JobGraph    writeA( kJobPriority_Background ), writeB( kJobPriority_Background );
+    JobGraph*   apWrites[2] = { &writeA, &writeB };
+    bool        abPending[2] = { false, false };
+    bool        bFailed = false;
+    size_t      uiBytes = 0;
+    double      fRenderSeconds = 0;
+
+    for ( uint32_t f = 0; f < uiNumFrames && !bFailed; f++ )
+    {
+        const std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        const float fRadians = fOrbitDegrees * (Leap::PI / 180.0f) * f / uiNumFrames;
+
+        rasterizer.render( camera.orbited( fRadians ), uiWidth, uiHeight, jobs.get() );
+
+        fRenderSeconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - frameStart ).count();
+
+        const uint32_t  uiSlot  = f % 2;
+        Frame&          frame   = aFrames[uiSlot];
+
+        if ( abPending[uiSlot] )
+        {
+            jobs->wait( *apWrites[uiSlot] );
+            bFailed = !frame.bWritten;
+            uiBytes += frame.uiBytes;
+        }
+
+        char szPath[4096];
+        snprintf( szPath, sizeof(szPath), szOutput, static_cast<int>(f) );
+
+        frame.uiWidth   = uiWidth;
+        frame.uiHeight  = uiHeight;
+        frame.strPath   = (uiNumFrames > 1) ? szPath : szOutput;
+        frame.bPng      = bPng;
+        frame.pixels.resize( static_cast<size_t>(uiWidth) * uiHeight );
+
+        for ( uint32_t y = 0; y < uiHeight; y++ )
+        {
+            memcpy( &frame.pixels[static_cast<size_t>(y) * uiWidth], rasterizer.image() + static_cast<size_t>(y) * rasterizer.stride(), uiWidth * sizeof(uint32_t) );
+        }
+
+        if ( jobs )
+        {
+            apWrites[uiSlot]->clear();
+            apWrites[uiSlot]->add( [&frame]() { writeFrame( frame ); } );
+            jobs->start( *apWrites[uiSlot] );
+            abPending[uiSlot] = true;
+        }
+        else
+        {
+            writeFrame( frame );
+            bFailed = !frame.bWritten;
+            uiBytes += frame.uiBytes;
+        }
+    }
+
+    for ( uint32_t s = 0; s < 2; s++ )
+    {
+        if ( abPending[s] )
+        {
+            jobs->wait( *apWrites[s] );
+            bFailed = bFailed || !aFrames[s].bWritten;
+            uiBytes += aFrames[s].uiBytes;
+        }
+    }
+
+    if ( bFailed )
+    {
+        fprintf( stderr, "%s: can't write %s\n", argv[0], szOutput );
+        return 1;
+    }
+
+    const double fSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    printf( "{\"output\":\"%s\",\"style\":\"%s\",\"frames\":%u,\"width\":%u,\"height\":%u,\"vertices\":%u,\"primitives\":%u,"
+            "\"capture_seconds\":%.3f,\"render_ms_per_frame\":%.2f,\"seconds\":%.3f,\"frames_per_second\":%.2f,\"bytes\":%llu,\"peak_rss_kb\":%ld}\n",
+            szOutput, settings.eStyle == StrokeRasterizer::kStyle_Tubes ? "tubes" : "lines", uiNumFrames, uiWidth, uiHeight,
+            rasterizer.vertexCount(), rasterizer.primitiveCount(), fCaptureSeconds, fRenderSeconds * 1000.0 / uiNumFrames,
+            fSeconds, uiNumFrames / std::max( fSeconds, 1e-9 ), static_cast<unsigned long long>(uiBytes), peakRssKb() );
+
+    return 0;
+}